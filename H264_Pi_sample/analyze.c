@@ -0,0 +1,294 @@
+/***************************************************************************
+*
+*   analyze.c
+*
+*   Per-frame bitstream analysis, kept with decode latency (see analyze.h).
+*
+****************************************************************************/
+
+#include "video_gl.h"
+#include "analyze.h"
+
+#define ANALYZE_ENV             "CTX_H264_ANALYZE"
+
+const char *analyze_class_names[ANALYZE_CLASSES] = {
+    "IDR",
+    "I",
+    "P",
+    "B",
+};
+
+static void reset_frame(H264_analysis *analysis)
+{
+    memset(&analysis->frame, 0, sizeof(session_frame_info));
+    analysis->frame.qp = -1;
+    analysis->passed = 0;
+}
+
+int analyze_open(H264_analysis *analysis, int context, H264_stats *stats)
+{
+    char *level = getenv(ANALYZE_ENV);
+
+    memset(analysis, 0, sizeof(H264_analysis));
+
+    if (level && atoi(level) <= 0) {
+        return -1;
+    }
+
+    /* Its own parameter sets, as the backend's aren't always parsed. */
+    analysis->sps = calloc(H264_MAX_SPS, sizeof(H264_sps));
+    analysis->pps = calloc(H264_MAX_PPS, sizeof(H264_pps));
+    if (!analysis->sps || !analysis->pps) {
+        free(analysis->sps);
+        free(analysis->pps);
+        return -1;
+    }
+
+    analysis->context = context;
+    analysis->log_frames = level && atoi(level) >= 2;
+    analysis->stats = stats;
+    reset_frame(analysis);
+
+    return 0;
+}
+
+void analyze_data(H264_analysis *analysis, const unsigned char *data, int len)
+{
+    int keep = min(len, ANALYZE_NAL_MAX - analysis->nal_len);
+
+    if (keep > 0) {
+        memcpy(analysis->nal + analysis->nal_len, data, keep);
+        analysis->nal_len += keep;
+    }
+    analysis->nal_bytes += len;
+}
+
+/* Returns the slice type, modulo 5, or -1 if the header is cut short. */
+static int parse_slice(H264_analysis *analysis)
+{
+    session_frame_info *frame = &analysis->frame;
+    H264_slice_header slice;
+    H264_bits bits;
+    int size, type;
+
+    size = h264_unescape(analysis->nal, analysis->nal_len, analysis->rbsp, ANALYZE_NAL_MAX);
+
+    /* The first slice gives the frame's QP and references. */
+    h264_bits_init(&bits, analysis->rbsp, size);
+    if (frame->slices == 0 && h264_parse_slice_header(&bits, analysis->sps, analysis->pps, &slice) == 0) {
+        const H264_pps *pps = &analysis->pps[slice.pps_id];
+
+        frame->qp = 26 + pps->pic_init_qp_minus26 + slice.slice_qp_delta;
+        frame->refs = slice.slice_type == H264_SLICE_I || slice.slice_type == H264_SLICE_SI ?
+                      0 : slice.num_ref_idx_l0_active_minus1 + 1;
+        if (pps->entropy_coding_mode) {
+            frame->flags |= SESSION_FRAME_CABAC;
+        }
+        return slice.slice_type;
+    }
+
+    /* Of the others only the type, which leads the header. */
+    h264_bits_init(&bits, analysis->rbsp + 1, size - 1);
+    h264_read_ue(&bits);
+    type = h264_read_ue(&bits) % 5;
+
+    return bits.error ? -1 : type;
+}
+
+void analyze_nal_end(H264_analysis *analysis, int passed)
+{
+    session_frame_info *frame = &analysis->frame;
+    H264_bits bits;
+    int type, slice_type, size;
+
+    if (analysis->nal_bytes == 0) {
+        return;
+    }
+
+    type = h264_nal_type(analysis->nal[0]);
+    frame->nals++;
+    frame->bytes += analysis->nal_bytes;
+
+    switch (type) {
+    case H264_NAL_SLICE:
+    case H264_NAL_SLICE_IDR:
+        slice_type = parse_slice(analysis);
+        if (slice_type >= 0) {
+            frame->slice_types |= 1 << slice_type;
+        }
+        frame->slices++;
+        frame->idr |= type == H264_NAL_SLICE_IDR;
+        frame->ref_idc = max(frame->ref_idc, h264_nal_ref_idc(analysis->nal[0]));
+        frame->max_slice_bytes = max(frame->max_slice_bytes, analysis->nal_bytes);
+        analysis->passed |= passed;
+        break;
+    case H264_NAL_SPS:
+    case H264_NAL_PPS:
+        frame->flags |= SESSION_FRAME_PARAMS;
+        size = h264_unescape(analysis->nal + 1, analysis->nal_len - 1, analysis->rbsp, ANALYZE_NAL_MAX);
+        h264_bits_init(&bits, analysis->rbsp, size);
+        if (type == H264_NAL_SPS) {
+            h264_parse_sps(&bits, analysis->sps);
+        } else {
+            h264_parse_pps(&bits, analysis->sps, analysis->pps);
+        }
+        break;
+    }
+
+    analysis->nal_len = 0;
+    analysis->nal_bytes = 0;
+}
+
+/* The class of a frame, or -1 for one without slices. */
+static int frame_class(const session_frame_info *info)
+{
+    if (info->slices == 0) {
+        return -1;
+    }
+    if (info->idr) {
+        return ANALYZE_IDR;
+    }
+    if (info->slice_types & (1 << H264_SLICE_B)) {
+        return ANALYZE_B;
+    }
+    if (info->slice_types & ((1 << H264_SLICE_P) | (1 << H264_SLICE_SP))) {
+        return ANALYZE_P;
+    }
+
+    return ANALYZE_I;
+}
+
+/* Fills in the latency of a pending frame, and records it. */
+static void describe(H264_analysis *analysis, analyze_pending *pending)
+{
+    session_frame_info *info = &pending->info;
+    unsigned long long end, decode_us = 0;
+    latency_frame stamps;
+    analyze_totals *totals;
+    int i, c = frame_class(info);
+
+    if (latency_get(&analysis->stats->latency, pending->timestamp, &stamps) == 0) {
+        for (i = LATENCY_FIRST_SUBMIT; i < LATENCY_POINTS && i < SESSION_LATENCY_POINTS; i++) {
+            if (stamps.stamps[i]) {
+                /* 0 is for points not reached. */
+                info->latency_us[i] = max(stamps.stamps[i] - pending->timestamp, 1ULL);
+            }
+        }
+
+        end = stamps.stamps[LATENCY_DECODED] ? stamps.stamps[LATENCY_DECODED] : stamps.stamps[LATENCY_CONSUMED];
+        if (end && stamps.stamps[LATENCY_FIRST_SUBMIT] && end >= stamps.stamps[LATENCY_FIRST_SUBMIT]) {
+            decode_us = max(end - stamps.stamps[LATENCY_FIRST_SUBMIT], 1ULL);
+        }
+    }
+
+    if (c >= 0) {
+        totals = &analysis->totals[c];
+        totals->frames++;
+        totals->bytes += info->bytes;
+        totals->max_bytes = max(totals->max_bytes, info->bytes);
+        totals->slices += info->slices;
+        totals->max_slices = max(totals->max_slices, info->slices);
+        if (decode_us) {
+            latency_histogram_add(&totals->decode, decode_us);
+        }
+    }
+
+    if (capture_enabled) {
+        capture_frame_info(analysis->context, info);
+    }
+
+    if (analysis->log_frames) {
+        DEBUG_TRACE("Frame %u: %s, %u bytes in %u NALs, %u slices (largest %u bytes), ref_idc %u, qp %d, "
+                    "%u refs%s%s, decode %.1fms\n", info->frame, c >= 0 ? analyze_class_names[c] : "no slices",
+                    info->bytes, info->nals, info->slices, info->max_slice_bytes, info->ref_idc, info->qp,
+                    info->refs, info->flags & SESSION_FRAME_CABAC ? ", CABAC" : "",
+                    info->flags & SESSION_FRAME_DROPPED ? ", dropped" : "", decode_us / 1000.0);
+    }
+
+    pending->timestamp = 0;
+}
+
+/* Whether frame "index" has reached the decoder's decode point, or never
+ * will.
+ */
+static int decoded(H264_analysis *analysis, unsigned int index)
+{
+    analyze_pending *pending = &analysis->pending[index % ANALYZE_PENDING];
+    latency_frame stamps;
+
+    if (!pending->info.slices || (pending->info.flags & SESSION_FRAME_DROPPED) ||
+        latency_get(&analysis->stats->latency, pending->timestamp, &stamps) != 0) {
+        return 1;
+    }
+
+    return stamps.stamps[analysis->stats->decode_point] != 0;
+}
+
+void analyze_frame_end(H264_analysis *analysis, unsigned long long timestamp)
+{
+    analyze_pending *pending;
+
+    /* The frame whose slot this takes leaves the latency ring at the next
+     * start_frame(), so is described now, decoded or not.
+     */
+    if (analysis->next - analysis->oldest == ANALYZE_PENDING) {
+        describe(analysis, &analysis->pending[analysis->oldest++ % ANALYZE_PENDING]);
+    }
+
+    pending = &analysis->pending[analysis->next % ANALYZE_PENDING];
+    analysis->frame.frame = analysis->next++;
+    if (analysis->frame.slices && !analysis->passed) {
+        analysis->frame.flags |= SESSION_FRAME_DROPPED;
+    }
+
+    pending->timestamp = timestamp;
+    pending->info = analysis->frame;
+    reset_frame(analysis);
+
+    /* In order, so that the capture lists frames as they came. */
+    while (analysis->next - analysis->oldest > ANALYZE_LAG && decoded(analysis, analysis->oldest)) {
+        describe(analysis, &analysis->pending[analysis->oldest++ % ANALYZE_PENDING]);
+    }
+}
+
+void analyze_query(H264_analysis *analysis, analyze_class frame_class, analyze_totals *totals)
+{
+    *totals = analysis->totals[frame_class];
+}
+
+void analyze_close(H264_analysis *analysis)
+{
+    latency_summary summary;
+    analyze_totals *totals;
+    char decode[64];
+    unsigned int i;
+
+    while (analysis->oldest != analysis->next) {
+        describe(analysis, &analysis->pending[analysis->oldest++ % ANALYZE_PENDING]);
+    }
+
+    for (i = 0; i < ANALYZE_CLASSES; i++) {
+        totals = &analysis->totals[i];
+        if (totals->frames == 0) {
+            continue;
+        }
+
+        latency_summarise(&totals->decode, &summary);
+        if (summary.count) {
+            snprintf(decode, sizeof(decode), "p50 %.1fms, p99 %.1fms, max %.1fms",
+                     summary.p50 / 1000.0, summary.p99 / 1000.0, summary.max / 1000.0);
+        } else {
+            /* None were decoded while their stamps were kept. */
+            snprintf(decode, sizeof(decode), "-");
+        }
+        DEBUG_TRACE("Frames %-3s %6u, %.1f KB (max %.1f), %.1f slices (max %u), decode %s\n",
+                    analyze_class_names[i], totals->frames, totals->bytes / 1024.0 / totals->frames,
+                    totals->max_bytes / 1024.0, (double)totals->slices / totals->frames, totals->max_slices, decode);
+    }
+
+    /* The figures stay, for metrics_close(). */
+    free(analysis->sps);
+    free(analysis->pps);
+    analysis->sps = NULL;
+    analysis->pps = NULL;
+}
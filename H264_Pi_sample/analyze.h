@@ -0,0 +1,124 @@
+/***************************************************************************
+*
+*   analyze.h
+*
+*   Bitstream analysis, to tell which of the ways a server encodes make
+*   frames slow to decode. The NAL and slice headers of each frame are
+*   parsed as decode_frame() passes them on: its size, slice count and
+*   types, nal_ref_idc, whether it is an IDR, its QP and references. Once
+*   it has been decoded, or it is about to leave the latency ring, or the
+*   context closes, this goes to the capture file as a SESSION_FRAME_INFO
+*   record (see session.h) with the frame's latency, and the frame's decode
+*   time into the figures of its class, which the metrics block carries and
+*   which are logged when the context closes.
+*
+*   The decode time is from the frame's first submission to when the
+*   picture came out of the decoder, or the decoder was done with the
+*   bitstream for backends that can't see the picture.
+*
+*   CTX_H264_ANALYZE=0 turns analysis off, 2 also logs every frame.
+*
+****************************************************************************/
+
+#ifndef _ANALYZE_H_
+#define _ANALYZE_H_
+
+#include "h264_parse.h"
+#include "latency.h"
+#include "session.h"
+
+/* A frame is described once this many more have ended and it has reached
+ * the backend's decode point, which leaves time for it to be shown. One
+ * that never does is described when its stamps are about to be dropped,
+ * ANALYZE_PENDING frames after it, so that a decoder far behind still
+ * has its decode times counted.
+ */
+#define ANALYZE_LAG             2
+#define ANALYZE_PENDING         (LATENCY_FRAMES - 1)
+
+/* Kept of each NAL: all of a parameter set, the header of a slice. */
+#define ANALYZE_NAL_MAX         1024
+
+/* Frames by the slices they have: IDR, then the one of B, P and I that
+ * comes first.
+ */
+typedef enum _analyze_class {
+    ANALYZE_IDR = 0,
+    ANALYZE_I,
+    ANALYZE_P,
+    ANALYZE_B,
+    ANALYZE_CLASSES
+} analyze_class;
+
+typedef struct _analyze_totals {
+    unsigned int        frames;
+    unsigned long long  bytes;
+    unsigned int        max_bytes;
+    unsigned int        slices;
+    unsigned int        max_slices;
+    latency_histogram   decode;         /* Frames with a decode time. */
+} analyze_totals;
+
+typedef struct _analyze_pending {
+    unsigned long long  timestamp;      /* Of latency.h, 0 for none. */
+    session_frame_info  info;
+} analyze_pending;
+
+struct _H264_stats;
+
+typedef struct _H264_analysis {
+    int                 context;
+    int                 log_frames;
+    struct _H264_stats *stats;          /* Of the context: its latency and decode point. */
+
+    /* The NAL being received. */
+    unsigned char       nal[ANALYZE_NAL_MAX];
+    int                 nal_len;
+    unsigned int        nal_bytes;
+    unsigned char       rbsp[ANALYZE_NAL_MAX];
+    H264_sps           *sps;
+    H264_pps           *pps;
+
+    /* The frame being received, and those waiting for their stamps. */
+    session_frame_info  frame;
+    int                 passed;         /* Any of its slices passed to the decoder. */
+    analyze_pending     pending[ANALYZE_PENDING];
+    unsigned int        next;           /* Frames ended. */
+    unsigned int        oldest;         /* The first of them not yet described. */
+
+    analyze_totals      totals[ANALYZE_CLASSES];
+} H264_analysis;
+
+extern const char *analyze_class_names[ANALYZE_CLASSES];
+
+/*  Function: analyze_open()
+ *
+ *  Starts analysing the frames of context "context", if CTX_H264_ANALYZE
+ *  allows, taking their stamps from the latency of "stats".
+ *
+ *  Returns:
+ *       0, or -1 if analysis is off or out of memory.
+ */
+int analyze_open(H264_analysis *analysis, int context, struct _H264_stats *stats);
+
+/* Adds "len" bytes of the NAL being received. */
+void analyze_data(H264_analysis *analysis, const unsigned char *data, int len);
+
+/* Ends the NAL being received; "passed" if it went to the decoder. */
+void analyze_nal_end(H264_analysis *analysis, int passed);
+
+/* Ends the frame with timestamp "timestamp", whose last NAL has been
+ * ended, and describes the earlier frames that are ready.
+ */
+void analyze_frame_end(H264_analysis *analysis, unsigned long long timestamp);
+
+/* Gets the figures of "frame_class" since the context opened. */
+void analyze_query(H264_analysis *analysis, analyze_class frame_class, analyze_totals *totals);
+
+/* Describes the frames still pending, logs the figures and frees the
+ * parameter sets; the figures can still be queried. Call before the
+ * latency it was given is destroyed.
+ */
+void analyze_close(H264_analysis *analysis);
+
+#endif /* _ANALYZE_H_ */
@@ -0,0 +1,660 @@
+/***************************************************************************
+*
+*   avcodec_backend.c
+*
+*   Software backend: libavcodec's H.264 decoder, threaded across every
+*   core, for boards whose hardware decoder can't be used. It is the last
+*   backend probed, so it only runs when no hardware one does.
+*
+*   Threads decode slices of a frame in parallel by default. Frame
+*   threading decodes several frames at once, which scales with any stream,
+*   but holds frames back until later ones arrive: the end of each update
+*   stays off screen until the next. It is only worth it for content that
+*   keeps moving, and is enabled by CTX_H264_SW_FRAME_THREADS=1.
+*
+*   How fast software decodes depends on the board, so the limits it
+*   advertises come from timing a synthetic stream when it is probed.
+*
+****************************************************************************/
+
+#include "video_gl.h"
+
+#ifdef HAVE_AVCODEC
+
+#include <unistd.h>
+#include <libavcodec/avcodec.h>
+
+#include "h264_parse.h"
+#include "h264_synth.h"
+#include "presenter.h"
+
+/* Decoded frames: the one on screen, one queued behind it, the latest
+ * decoded waiting for present() and the one being received.
+ */
+#define AVCODEC_SLOTS           4
+
+/* libavcodec's frame threading uses at most this many threads. */
+#define AVCODEC_MAX_THREADS     16
+
+/* The benchmark stream: frames timed, after the IDR, and the size. */
+#define AVCODEC_BENCH_FRAMES    16
+#define AVCODEC_BENCH_WIDTH     1920
+#define AVCODEC_BENCH_HEIGHT    1080
+
+/* Sizes advertised, largest first, and the frame rates. A size that can't
+ * be decoded at AVCODEC_MIN_FPS is no use to Receiver.
+ */
+#define AVCODEC_MIN_FPS         15
+#define AVCODEC_MAX_FPS         30
+
+#define AVCODEC_THREADS_ENV         "CTX_H264_SW_THREADS"
+#define AVCODEC_FRAME_THREADS_ENV   "CTX_H264_SW_FRAME_THREADS"
+
+static const struct {
+    unsigned int width;
+    unsigned int height;
+} avcodec_sizes[] = {
+    { 1920, 1080 },
+    { 1280, 720 },
+    { 640, 360 },
+};
+
+typedef struct _avcodec_slot {
+    AVFrame        *picture;
+    H264_frame      frame;
+    int             held;           /* By the presenter. */
+} avcodec_slot;
+
+typedef struct _AVH264_decoder {
+    AVCodecContext     *codec;
+    AVPacket           *packet;
+    AVFrame            *discard;        /* Frames with nowhere to go. */
+
+    /* Frame threading holds this many frames back: each comes out once
+     * the threads have all been given one after it.
+     */
+    int                 frame_delay;
+
+    /* The frame being received, in Annex-B format, with the padding
+     * libavcodec reads beyond the end.
+     */
+    unsigned char      *bitstream;
+    int                 fill;
+    int                 size;
+
+    unsigned long long  frame_count;    /* Sent. */
+    unsigned long long  received;
+    unsigned long long  frame_stamp;    /* Latency timestamp of the frame being received. */
+    unsigned long long  last_pts;       /* Of the last sent: its latency timestamp. */
+
+    /* Presentation, as in the V4L2 backend. */
+    avcodec_slot        slots[AVCODEC_SLOTS];
+    const H264_presenter *presenter;
+    void               *presenter_ctx;
+    unsigned int        width;          /* Of the context. */
+    unsigned int        height;
+    int                 ready;          /* Latest decoded, -1 if none. */
+    bool               *pushed;         /* Passed on once the pushed frame is decoded. */
+    unsigned long long  pushed_pts;
+    H264_dirty          damage;         /* Since a present() that left nothing to decode. */
+
+    H264_stats         *stats;
+} AVH264_decoder;
+
+/* Frame ids, unique across contexts. */
+static unsigned int frame_ids;
+
+/*  Opens libavcodec's H.264 decoder with a thread per core, or as many as
+ *  CTX_H264_SW_THREADS says. Without frame threading, no frame is held
+ *  back for reordering either: Receiver's streams have no B frames.
+ */
+static AVCodecContext *open_codec()
+{
+    const AVCodec *h264 = avcodec_find_decoder(AV_CODEC_ID_H264);
+    char *threads = getenv(AVCODEC_THREADS_ENV);
+    char *frame_threads = getenv(AVCODEC_FRAME_THREADS_ENV);
+    long count = threads ? atoi(threads) : sysconf(_SC_NPROCESSORS_ONLN);
+    AVCodecContext *codec;
+
+    if (!h264) {
+        return NULL;
+    }
+
+    codec = avcodec_alloc_context3(h264);
+    if (!codec) {
+        return NULL;
+    }
+
+    codec->thread_count = min(max(count, 1), AVCODEC_MAX_THREADS);
+    if (frame_threads && atoi(frame_threads)) {
+        codec->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+    } else {
+        codec->thread_type = FF_THREAD_SLICE;
+        codec->flags |= AV_CODEC_FLAG_LOW_DELAY;
+    }
+
+    if (avcodec_open2(codec, h264, NULL) < 0) {
+        avcodec_free_context(&codec);
+        return NULL;
+    }
+
+    return codec;
+}
+
+/*  Decodes a synthetic 1080p stream as fast as possible, threaded as
+ *  contexts will be. Only the P frames are timed: the IDR is raw samples,
+ *  unlike any real one. The stream has a single slice per frame, so slice
+ *  threading gains nothing from it, as with single slice streams from the
+ *  server.
+ *
+ *  Returns:
+ *       the macroblocks decoded per second, or 0 on failure.
+ */
+static double benchmark()
+{
+    AVCodecContext *codec = open_codec();
+    AVPacket *packet = av_packet_alloc();
+    AVFrame *picture = av_frame_alloc();
+    H264_synth synth;
+    unsigned char *buf = NULL;
+    struct timespec start, end;
+    double rate = 0, seconds;
+    int size, len, i, received = 0, ret = 0;
+
+    memset(&start, 0, sizeof(start));
+
+    if (!codec || !packet || !picture ||
+        h264_synth_init(&synth, AVCODEC_BENCH_WIDTH, AVCODEC_BENCH_HEIGHT, 1) != 0) {
+        goto done;
+    }
+
+    size = h264_synth_max_size(&synth);
+    buf = calloc(1, size + AV_INPUT_BUFFER_PADDING_SIZE);
+
+    for (i = 0; buf && i <= AVCODEC_BENCH_FRAMES + 1 && ret >= 0; i++) {
+        if (i == 1) {
+            clock_gettime(CLOCK_MONOTONIC, &start);
+        }
+
+        /* The frames all go in, then a flush brings the last ones out. */
+        if (i <= AVCODEC_BENCH_FRAMES) {
+            len = h264_synth_frame(&synth, buf, size);
+            if (len < 0) {
+                break;
+            }
+            packet->data = buf;
+            packet->size = len;
+            ret = avcodec_send_packet(codec, packet);
+        } else {
+            ret = avcodec_send_packet(codec, NULL);
+        }
+
+        while (ret >= 0) {
+            ret = avcodec_receive_frame(codec, picture);
+            if (ret >= 0) {
+                received++;
+                av_frame_unref(picture);
+            }
+        }
+        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
+            ret = 0;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    if (ret == 0 && received == AVCODEC_BENCH_FRAMES + 1 && seconds > 0) {
+        rate = (double)synth.mb_width * synth.mb_height * AVCODEC_BENCH_FRAMES / seconds;
+        DEBUG_TRACE("libavcodec with %d threads decodes %.0f macroblocks/s\n", codec->thread_count, rate);
+    } else {
+        DEBUG_TRACE("Benchmark stream failed to decode, %d frames out\n", received);
+    }
+
+    h264_synth_free(&synth);
+
+done:
+    free(buf);
+    av_frame_free(&picture);
+    av_packet_free(&packet);
+    avcodec_free_context(&codec);
+
+    return rate;
+}
+
+/***************************************************************************
+*   Frames.
+****************************************************************************/
+
+/* Called by the presenter once it no longer shows the frame. */
+static void release_frame(H264_frame *frame)
+{
+    AVH264_decoder *decoder = frame->owner;
+    avcodec_slot *slot = &decoder->slots[frame->index];
+
+    slot->held = 0;
+    av_frame_unref(slot->picture);
+}
+
+/* A slot to receive into. The latest decoded frame gives way if the
+ * presenter holds all the others.
+ */
+static avcodec_slot *free_slot(AVH264_decoder *decoder)
+{
+    int i;
+
+    for (i = 0; i < AVCODEC_SLOTS; i++) {
+        if (!decoder->slots[i].held && i != decoder->ready) {
+            av_frame_unref(decoder->slots[i].picture);
+            return &decoder->slots[i];
+        }
+    }
+
+    if (decoder->ready >= 0) {
+        i = decoder->ready;
+        decoder->ready = -1;
+        av_frame_unref(decoder->slots[i].picture);
+        return &decoder->slots[i];
+    }
+
+    return NULL;
+}
+
+/* Describes the picture in "slot" as a frame, mapped but without DMABUFs. */
+static void init_frame(AVH264_decoder *decoder, avcodec_slot *slot)
+{
+    AVFrame *picture = slot->picture;
+    H264_frame *frame = &slot->frame;
+    int p;
+
+    frame->id = ++frame_ids;
+    frame->fourcc = H264_FOURCC_YU12;
+    frame->width = min(decoder->width, (unsigned int)picture->width);
+    frame->height = min(decoder->height, (unsigned int)picture->height);
+    frame->color = (picture->colorspace == AVCOL_SPC_BT709 ? H264_COLOR_BT709 : 0) |
+                   (picture->color_range == AVCOL_RANGE_JPEG || picture->format == AV_PIX_FMT_YUVJ420P ?
+                    H264_COLOR_FULL_RANGE : 0);
+    frame->latency = &decoder->stats->latency;
+    frame->timestamp = picture->pts;
+    frame->num_planes = 3;
+    for (p = 0; p < 3; p++) {
+        frame->dmabuf[p] = -1;
+        frame->offsets[p] = 0;
+        frame->pitches[p] = picture->linesize[p];
+        frame->data[p] = picture->data[p];
+    }
+}
+
+/*  Takes every frame libavcodec has finished. The latest becomes ready;
+ *  those before it are dropped, as the V4L2 backend drops frames present()
+ *  doesn't get to.
+ *
+ *  Returns:
+ *       0, or -1 if a frame failed to decode.
+ */
+static int receive_frames(AVH264_decoder *decoder)
+{
+    avcodec_slot *slot;
+    AVFrame *picture;
+    int ret;
+
+    for (;;) {
+        slot = free_slot(decoder);
+        picture = slot ? slot->picture : decoder->discard;
+
+        ret = avcodec_receive_frame(decoder->codec, picture);
+        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
+            return 0;
+        }
+        if (ret < 0) {
+            DEBUG_TRACE("avcodec_receive_frame failed, ret=%d\n", ret);
+            return -1;
+        }
+
+        decoder->received++;
+
+        if (!slot) {
+            av_frame_unref(picture);
+            continue;
+        }
+
+        if (picture->format != AV_PIX_FMT_YUV420P && picture->format != AV_PIX_FMT_YUVJ420P) {
+            DEBUG_TRACE("Unsupported picture format %d\n", picture->format);
+            av_frame_unref(picture);
+            return -1;
+        }
+
+        /* Concealed errors leave frames showing garbage; recovery waits
+         * for the next IDR instead.
+         */
+        if (picture->decode_error_flags || (picture->flags & AV_FRAME_FLAG_CORRUPT)) {
+            DEBUG_TRACE("Decoding failed, flags=0x%x\n", picture->decode_error_flags);
+            av_frame_unref(picture);
+            return -1;
+        }
+
+        init_frame(decoder, slot);
+        if (decoder->stats->checksums) {
+            checksum_picture(decoder->stats->checksums, &slot->frame);
+        }
+        latency_stamp(&decoder->stats->latency, picture->pts, LATENCY_DECODED);
+        decoder->ready = slot - decoder->slots;
+        TRACE(TRACE_FRAME_DECODED, slot->frame.id, decoder->ready, 0);
+        USDT1(frame_decoded, picture->pts);
+    }
+}
+
+/***************************************************************************
+*   Backend interface.
+****************************************************************************/
+
+/*  Times decoding at full speed, then advertises the largest size that
+ *  keeps up with AVCODEC_MIN_FPS, allowing for H264_SYNTH_HEADROOM.
+ */
+static int avcodec_probe(struct H264_decoder *caps)
+{
+    double rate, fps = 0;
+    unsigned int i, mbs;
+
+    if (!avcodec_find_decoder(AV_CODEC_ID_H264)) {
+        return 0;
+    }
+
+    rate = benchmark() / H264_SYNTH_HEADROOM;
+
+    for (i = 0; i < ELEMENTS_IN_ARRAY(avcodec_sizes); i++) {
+        mbs = ((avcodec_sizes[i].width + 15) / 16) * ((avcodec_sizes[i].height + 15) / 16);
+        fps = rate / mbs;
+        if (fps >= AVCODEC_MIN_FPS) {
+            break;
+        }
+    }
+
+    if (i == ELEMENTS_IN_ARRAY(avcodec_sizes)) {
+        DEBUG_TRACE("Too slow for %ux%u@%d\n", avcodec_sizes[i - 1].width, avcodec_sizes[i - 1].height,
+                    AVCODEC_MIN_FPS);
+        return 0;
+    }
+
+    caps->width = avcodec_sizes[i].width;
+    caps->height = avcodec_sizes[i].height;
+    caps->max_fps = min((int)fps, AVCODEC_MAX_FPS);
+    caps->chroma_formats = H264_CHROMA_FORMAT_420;
+    caps->options = 0;
+
+    DEBUG_TRACE("libavcodec, advertising %ux%u@%d\n", caps->width, caps->height, caps->max_fps);
+
+    return 1;
+}
+
+static void avcodec_close(void *ctx)
+{
+    AVH264_decoder *decoder = ctx;
+    int i;
+
+    if (!decoder) {
+        return;
+    }
+
+    /* Frames come back to the slots before they go. */
+    if (decoder->presenter_ctx) {
+        decoder->presenter->close(decoder->presenter_ctx);
+    }
+
+    for (i = 0; i < AVCODEC_SLOTS; i++) {
+        av_frame_free(&decoder->slots[i].picture);
+    }
+    av_frame_free(&decoder->discard);
+    av_packet_free(&decoder->packet);
+    avcodec_free_context(&decoder->codec);
+    free(decoder->bitstream);
+    free(decoder);
+}
+
+static void *avcodec_open(int width, int height, unsigned int options, H264_stats *stats)
+{
+    AVH264_decoder *decoder = calloc(1, sizeof(AVH264_decoder));
+    int i;
+
+    if (!decoder) {
+        return NULL;
+    }
+
+    decoder->stats = stats;
+    decoder->width = width;
+    decoder->height = height;
+    decoder->ready = -1;
+
+    decoder->codec = open_codec();
+    decoder->packet = av_packet_alloc();
+    decoder->discard = av_frame_alloc();
+    for (i = 0; i < AVCODEC_SLOTS; i++) {
+        decoder->slots[i].picture = av_frame_alloc();
+        decoder->slots[i].frame.release = release_frame;
+        decoder->slots[i].frame.owner = decoder;
+        decoder->slots[i].frame.index = i;
+        if (!decoder->slots[i].picture) {
+            avcodec_close(decoder);
+            return NULL;
+        }
+    }
+
+    if (!decoder->codec || !decoder->packet || !decoder->discard) {
+        DEBUG_TRACE("Failed to open libavcodec's H.264 decoder\n");
+        avcodec_close(decoder);
+        return NULL;
+    }
+
+    if (decoder->codec->active_thread_type & FF_THREAD_FRAME) {
+        decoder->frame_delay = decoder->codec->thread_count - 1;
+    }
+
+    decoder->presenter_ctx = presenter_open(width, height, PRESENTER_FRAMES_MAPPED, &decoder->presenter);
+    if (!decoder->presenter_ctx) {
+        avcodec_close(decoder);
+        return NULL;
+    }
+
+    DEBUG_TRACE("Opened libavcodec decoder for %dx%d, %d threads\n", width, height, decoder->codec->thread_count);
+
+    return decoder;
+}
+
+static int avcodec_start_frame(void *ctx, SIGNED_RECT dirty_rects[], unsigned int num_rects)
+{
+    AVH264_decoder *decoder = ctx;
+
+    /* Decoding finishes in end_frame(), which reports any failure. */
+    decoder->frame_stamp = decoder->stats->latency.current;
+    decoder->fill = 0;
+    presenter_add_damage(&decoder->damage, dirty_rects, num_rects, decoder->width, decoder->height);
+
+    return 0;
+}
+
+static int append(AVH264_decoder *decoder, const unsigned char *data, int len)
+{
+    unsigned char *bitstream;
+    int size;
+
+    if (decoder->fill + len + AV_INPUT_BUFFER_PADDING_SIZE > decoder->size) {
+        size = max(decoder->size * 2, decoder->fill + len + AV_INPUT_BUFFER_PADDING_SIZE);
+        bitstream = realloc(decoder->bitstream, size);
+        if (!bitstream) {
+            return -1;
+        }
+        decoder->bitstream = bitstream;
+        decoder->size = size;
+    }
+
+    memcpy(decoder->bitstream + decoder->fill, data, len);
+    decoder->fill += len;
+
+    return 0;
+}
+
+/* NALs are gathered, with their start codes back, into one packet for the
+ * frame.
+ */
+static int avcodec_submit(void *ctx, const unsigned char *data, int len, unsigned int flags)
+{
+    AVH264_decoder *decoder = ctx;
+
+    if ((flags & BACKEND_NAL_START) && append(decoder, h264_start_code, H264_START_CODE_LEN) != 0) {
+        return -1;
+    }
+
+    return append(decoder, data, len);
+}
+
+static int avcodec_end_frame(void *ctx, int submitted)
+{
+    AVH264_decoder *decoder = ctx;
+    int ret;
+
+    if (!submitted || decoder->fill == 0) {
+        return 0;
+    }
+
+    memset(decoder->bitstream + decoder->fill, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+    decoder->packet->data = decoder->bitstream;
+    decoder->packet->size = decoder->fill;
+    /* The pts, which libavcodec gives back with the picture, is the frame's
+     * latency timestamp; pictures are matched to the push by it.
+     */
+    decoder->last_pts = max(decoder->frame_stamp, decoder->last_pts + 1);
+    decoder->packet->pts = decoder->last_pts;
+    decoder->frame_count++;
+    decoder->fill = 0;
+    TRACE(TRACE_BUFFER_SUBMIT, decoder->packet->size, 0, decoder->frame_count - decoder->received);
+    USDT3(buffer_submit, decoder->packet->size, 0, decoder->last_pts);
+    /* The whole frame goes in one packet, which is decoded as it is sent. */
+    latency_stamp(&decoder->stats->latency, decoder->last_pts, LATENCY_FIRST_SUBMIT);
+    latency_stamp(&decoder->stats->latency, decoder->last_pts, LATENCY_LAST_SUBMIT);
+
+    /* Frames are taken out as they are finished, which is what makes room
+     * for more to go in.
+     */
+    while ((ret = avcodec_send_packet(decoder->codec, decoder->packet)) == AVERROR(EAGAIN)) {
+        decoder->stats->input_stalls++;
+        if (receive_frames(decoder) != 0) {
+            return -1;
+        }
+    }
+
+    if (ret < 0) {
+        DEBUG_TRACE("avcodec_send_packet failed, ret=%d\n", ret);
+        return -1;
+    }
+
+    return receive_frames(decoder);
+}
+
+static int avcodec_queue_depth(void *ctx)
+{
+    AVH264_decoder *decoder = ctx;
+
+    return max((int)(decoder->frame_count - decoder->received) - decoder->frame_delay, 0);
+}
+
+/* Drops everything in the decoder, references included. Frames the
+ * presenter holds stay with it.
+ */
+static void avcodec_flush(void *ctx)
+{
+    AVH264_decoder *decoder = ctx;
+
+    avcodec_flush_buffers(decoder->codec);
+
+    if (decoder->ready >= 0) {
+        av_frame_unref(decoder->slots[decoder->ready].picture);
+        decoder->ready = -1;
+    }
+
+    decoder->fill = 0;
+    decoder->received = decoder->frame_count;
+    decoder->pushed = NULL;
+}
+
+static int avcodec_compose_with_fb(void *ctx, struct image_buf *fb, SIGNED_RECT interesting_rects[],
+                                   unsigned int num_rects)
+{
+    AVH264_decoder *decoder = ctx;
+
+    return decoder->presenter->compose_with_fb(decoder->presenter_ctx, fb, interesting_rects, num_rects);
+}
+
+static int avcodec_compose_with_rects(void *ctx, struct image_buf objects[], unsigned int num_objects, bool last)
+{
+    AVH264_decoder *decoder = ctx;
+
+    return decoder->presenter->compose_with_rects(decoder->presenter_ctx, objects, num_objects, last);
+}
+
+/*  Hands the latest decoded frame to the presenter. Frames are decoded by
+ *  the time end_frame() returns, except for those frame threading holds
+ *  back: the presenter then shows the last one out, even with "wait", and
+ *  "pushed" goes with the first frame from the push or later to be
+ *  presented. Damage is kept until a frame is presented with none of the
+ *  stream left to decode.
+ */
+static int avcodec_present(void *ctx, struct window_info windows[], unsigned int num_windows, bool wait,
+                           bool *pushed)
+{
+    AVH264_decoder *decoder = ctx;
+    avcodec_slot *slot = NULL;
+    bool *frame_pushed = NULL;
+    int ret;
+
+    if (pushed) {
+        *pushed = 0;
+        decoder->pushed = pushed;
+        decoder->pushed_pts = decoder->last_pts;
+    }
+
+    if (decoder->ready >= 0) {
+        slot = &decoder->slots[decoder->ready];
+        slot->held = 1;
+        decoder->ready = -1;
+
+        if (decoder->pushed && (unsigned long long)slot->picture->pts >= decoder->pushed_pts) {
+            frame_pushed = decoder->pushed;
+            decoder->pushed = NULL;
+        }
+    }
+
+    TRACE(TRACE_PRESENT_BEGIN, slot ? slot->frame.id : 0, 0, 0);
+    ret = decoder->presenter->present(decoder->presenter_ctx, slot ? &slot->frame : NULL, &decoder->damage,
+                                      windows, num_windows, wait, frame_pushed);
+    TRACE(TRACE_PRESENT_END, 0, 0, 0);
+    if (ret != 0) {
+        if (slot) {
+            slot->held = 0;
+            av_frame_unref(slot->picture);
+        }
+        return -1;
+    }
+
+    if (decoder->received == decoder->frame_count) {
+        decoder->damage.num_rects = 0;
+    }
+
+    return 0;
+}
+
+const H264_backend avcodec_backend = {
+    "avcodec",
+    avcodec_probe,
+    avcodec_open,
+    avcodec_start_frame,
+    avcodec_submit,
+    avcodec_end_frame,
+    avcodec_queue_depth,
+    avcodec_flush,
+    avcodec_compose_with_fb,
+    avcodec_compose_with_rects,
+    avcodec_present,
+    avcodec_close,
+};
+
+#endif /* HAVE_AVCODEC */
@@ -0,0 +1,113 @@
+/***************************************************************************
+*
+*   backend.h
+*
+*   Decoder backends. The v3_* entry points split the H.264 stream into
+*   NALs, handle error recovery and load shedding, and hand what is left to
+*   a backend that decodes and presents it. The backend is chosen when the
+*   plugin is initialised, from CTX_H264_BACKEND or by probing.
+*
+****************************************************************************/
+
+#ifndef _BACKEND_H_
+#define _BACKEND_H_
+
+#include "citrix.h"
+#include "H264_decode.h"
+#include "latency.h"
+
+/* Flags passed with NAL data to submit(). */
+#define BACKEND_NAL_START   0x01    /* Data begins with the NAL header byte. */
+#define BACKEND_NAL_END     0x02    /* The NAL is complete, "data" may be empty. */
+
+/* Per-context counters, kept by the front-end and shared with the backend,
+ * and published by metrics.h.
+ */
+typedef struct _H264_stats {
+    unsigned int    errors;             /* Decoder errors recovered from. */
+    unsigned int    resets;             /* Decoder hangs recovered from. */
+    unsigned int    shed_frames;        /* Non-reference frames dropped under load. */
+    unsigned int    dropped_frames;     /* Frames dropped waiting for an IDR. */
+    unsigned int    frames;             /* Frames received. */
+    unsigned long long bytes;           /* Bitstream passed to the backend. */
+    unsigned int    input_stalls;       /* Kept by the backend: waits for the decoder to take input. */
+    unsigned int    lossless_objects;   /* Lossless objects composed. */
+    unsigned long long overlay_bytes;   /* ARGB composed into the lossless layer. */
+
+    /* Stamped by the backend at the points of latency.h it can see, with
+     * the timestamp of "latency.current" at its start_frame().
+     */
+    H264_latency    latency;
+
+    /* The last point of decoding the backend stamps: LATENCY_DECODED,
+     * which the front-end sets before open(), or LATENCY_CONSUMED for a
+     * backend that doesn't see pictures.
+     */
+    latency_point   decode_point;
+
+    /* Set for decode-only contexts: the backend checksums each picture it
+     * decodes (checksum.h).
+     */
+    struct _H264_checksums *checksums;
+
+    /* Set for calibration contexts: a backend that shows pictures as it
+     * decodes them keeps doing so, but invisibly.
+     */
+    int             hidden;
+
+    /* Set while the bitstream is analysed (analyze.h), for the metrics. */
+    struct _H264_analysis *analysis;
+} H264_stats;
+
+typedef struct _H264_backend {
+    const char *name;
+
+    /* Checks that the backend can run here and sets the limits it can
+     * sustain in "caps". Returns 1 if it is usable, 0 if not.
+     */
+    int   (*probe)(struct H264_decoder *caps);
+
+    /* Returns a backend context, or NULL. */
+    void *(*open)(int width, int height, unsigned int options, H264_stats *stats);
+
+    /* Called before each frame. Returns -1 if the decoder failed since the
+     * last frame.
+     */
+    int   (*start_frame)(void *ctx, SIGNED_RECT dirty_rects[], unsigned int num_rects);
+
+    /* Takes NAL payload, without start codes. A NAL may arrive in several
+     * parts, the first flagged BACKEND_NAL_START and the last BACKEND_NAL_END.
+     * Returns -1 on failure.
+     */
+    int   (*submit)(void *ctx, const unsigned char *data, int len, unsigned int flags);
+
+    /* Ends the frame. "submitted" is set if any of it reached submit(), in
+     * which case a NAL still open ends with the frame. Returns -1 on failure.
+     */
+    int   (*end_frame)(void *ctx, int submitted);
+
+    /* Frames submitted but not yet decoded. */
+    int   (*queue_depth)(void *ctx);
+
+    /* Discards everything queued after a failure. Decoding resumes with
+     * the next IDR.
+     */
+    void  (*flush)(void *ctx);
+
+    int   (*compose_with_fb)(void *ctx, struct image_buf *fb, SIGNED_RECT interesting_rects[],
+                             unsigned int num_rects);
+    int   (*compose_with_rects)(void *ctx, struct image_buf objects[], unsigned int num_objects, bool last);
+    int   (*present)(void *ctx, struct window_info windows[], unsigned int num_windows, bool wait, bool *pushed);
+
+    void  (*close)(void *ctx);
+} H264_backend;
+
+extern const H264_backend omx_backend;
+#ifdef HAVE_V4L2
+extern const H264_backend v4l2_backend;
+#endif
+#ifdef HAVE_AVCODEC
+extern const H264_backend avcodec_backend;
+#endif
+
+#endif /* _BACKEND_H_ */
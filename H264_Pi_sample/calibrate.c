@@ -0,0 +1,415 @@
+/***************************************************************************
+*
+*   calibrate.c
+*
+*   Startup calibration. A synthetic stream is decoded through the chosen
+*   backend at each size it was probed to support, largest first, as fast
+*   as the backend takes it. The largest size that keeps up with
+*   CALIBRATE_MIN_FPS, allowing for H264_SYNTH_HEADROOM, is advertised.
+*   Calibration only ever lowers the probed limits, which are what the
+*   decoder is specified to do, to what this board manages. With OMX, the
+*   buffer depths are then picked at that size: the fewest buffers that
+*   decode about as fast as the most, as each buffer queued is latency and
+*   GPU memory.
+*
+*   The result is cached per board revision and GPU memory split, so it
+*   only runs once on each kind of board.
+*
+****************************************************************************/
+
+#include <unistd.h>
+
+#include "video_gl.h"
+#include "h264_synth.h"
+
+#define CALIBRATE_ENV           "CTX_H264_CALIBRATE"
+#define CALIBRATION_FILE_ENV    "CTX_H264_CALIBRATION_FILE"
+#define INPUT_BUFFERS_ENV       "CTX_H264_INPUT_BUFFERS"
+#define OUTPUT_BUFFERS_ENV      "CTX_H264_OUTPUT_BUFFERS"
+
+/* Lines of other versions in the cache are stale. */
+#define CALIBRATE_VERSION       2
+
+/* P frames timed, after the IDR. */
+#define CALIBRATE_FRAMES        30
+
+/* A size that can't be decoded at this rate is no use to Receiver. */
+#define CALIBRATE_MIN_FPS       15
+
+/* A depth decoding within this of the best rate is as good. */
+#define CALIBRATE_DEPTH_SLACK   0.95
+
+H264_buffer_depths buffer_depths;
+
+static const struct {
+    unsigned int width;
+    unsigned int height;
+} calibrate_sizes[] = {
+    { 1920, 1080 },
+    { 1280, 720 },
+    { 640, 360 },
+};
+
+/* Depths tried, fewest first. The firmware gives video_decode 20 input
+ * buffers of 80K.
+ */
+#define CALIBRATE_DEPTHS        4
+
+static const int input_depths[CALIBRATE_DEPTHS] = { 4, 8, 12, 20 };
+static const int output_depths[CALIBRATE_DEPTHS] = { 1, 2, 3, 4 };
+
+typedef struct _calibration {
+    unsigned int        width;
+    unsigned int        height;
+    int                 max_fps;
+    H264_buffer_depths  depths;
+} calibration;
+
+/* The IDR, then CALIBRATE_FRAMES P frames, one after the other. */
+typedef struct _calibration_stream {
+    unsigned char      *data;
+    int                 sizes[CALIBRATE_FRAMES + 1];
+} calibration_stream;
+
+/***************************************************************************
+*   Measuring.
+****************************************************************************/
+
+static double now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Returns 0, or -1 if out of memory. */
+static int make_stream(calibration_stream *cs, unsigned int width, unsigned int height)
+{
+    H264_synth synth;
+    unsigned char *frame, *data;
+    int size, len, total = 0, i;
+
+    memset(cs, 0, sizeof(calibration_stream));
+
+    if (h264_synth_init(&synth, width, height, 1) != 0) {
+        return -1;
+    }
+
+    size = h264_synth_max_size(&synth);
+    frame = malloc(size);
+
+    for (i = 0; frame && i <= CALIBRATE_FRAMES; i++) {
+        len = h264_synth_frame(&synth, frame, size);
+        data = len > 0 ? realloc(cs->data, total + len) : NULL;
+        if (!data) {
+            break;
+        }
+        memcpy(data + total, frame, len);
+        cs->data = data;
+        cs->sizes[i] = len;
+        total += len;
+    }
+
+    free(frame);
+    h264_synth_free(&synth);
+
+    if (i <= CALIBRATE_FRAMES) {
+        free(cs->data);
+        cs->data = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+/*  Decodes "cs" through a context of "backend", opened as v3_open_context()
+ *  opens one but hidden, feeding it as fast as it takes it. With OMX the
+ *  pictures still go down the tunnel to video_render, whose region is
+ *  transparent, so the rate and the output depths are those of the
+ *  tunnel that contexts display through, render back-pressure included.
+ *
+ *  Returns:
+ *       the P frames decoded per second, or 0 if decoding failed.
+ */
+static double measure(const H264_backend *backend, const calibration_stream *cs,
+                      unsigned int width, unsigned int height)
+{
+    H264_stream *stream = calloc(1, sizeof(H264_stream));
+    unsigned char *p = cs->data;
+    double start = 0, fps = 0;
+    int i;
+
+    if (!stream) {
+        return 0;
+    }
+
+    stream->backend = backend;
+    stream->nal = NAL_STATE_PASS;
+    stream->state = DECODER_STATE_RUNNING;
+    h264_scanner_reset(&stream->scanner);
+    latency_init(&stream->stats.latency);
+    stream->stats.hidden = 1;
+
+    stream->ctx = backend->open(width, height, 0, &stream->stats);
+    if (!stream->ctx) {
+        goto done;
+    }
+
+    for (i = 0; i <= CALIBRATE_FRAMES; i++) {
+        /* The IDR, all I_PCM, is nothing like a real one, so isn't timed. */
+        if (i == 1) {
+            if (drain_stream(stream) != 0) {
+                goto done;
+            }
+            start = now();
+        }
+
+        latency_start(&stream->stats.latency);
+        if (backend->start_frame(stream->ctx, NULL, 0) != 0 ||
+            decode_frame(stream, p, cs->sizes[i], 1) != 0) {
+            goto done;
+        }
+        p += cs->sizes[i];
+    }
+
+    /* start_frame() reports errors raised since the last frame. */
+    if (drain_stream(stream) == 0 && backend->start_frame(stream->ctx, NULL, 0) == 0) {
+        fps = CALIBRATE_FRAMES / (now() - start);
+    }
+
+done:
+    if (stream->ctx) {
+        backend->close(stream->ctx);
+    }
+    latency_destroy(&stream->stats.latency);
+    free(stream);
+
+    return fps;
+}
+
+/*  Tries each of "depths" in "*depth" and leaves the fewest that decode
+ *  within CALIBRATE_DEPTH_SLACK of the fastest there.
+ */
+static void pick_depth(const H264_backend *backend, const calibration_stream *cs, unsigned int width,
+                       unsigned int height, const int depths[CALIBRATE_DEPTHS], int *depth, const char *name)
+{
+    double fps[CALIBRATE_DEPTHS], best = 0;
+    int i;
+
+    for (i = 0; i < CALIBRATE_DEPTHS; i++) {
+        *depth = depths[i];
+        fps[i] = measure(backend, cs, width, height);
+        best = max(best, fps[i]);
+        DEBUG_TRACE("%d %s buffers: %.1f fps\n", depths[i], name, fps[i]);
+    }
+
+    *depth = 0;
+    for (i = 0; best > 0 && i < CALIBRATE_DEPTHS; i++) {
+        if (fps[i] >= best * CALIBRATE_DEPTH_SLACK) {
+            *depth = depths[i];
+            break;
+        }
+    }
+}
+
+/* Returns 0, or -1 if none of the sizes could be sustained. */
+static int run_calibration(const H264_backend *backend, const struct H264_decoder *caps, calibration *result)
+{
+    calibration_stream cs;
+    double fps = 0;
+    unsigned int i;
+
+    memset(result, 0, sizeof(calibration));
+    memset(&buffer_depths, 0, sizeof(buffer_depths));
+
+    for (i = 0; i < ELEMENTS_IN_ARRAY(calibrate_sizes); i++) {
+        if (calibrate_sizes[i].width > caps->width || calibrate_sizes[i].height > caps->height) {
+            continue;
+        }
+
+        if (make_stream(&cs, calibrate_sizes[i].width, calibrate_sizes[i].height) != 0) {
+            return -1;
+        }
+
+        fps = measure(backend, &cs, calibrate_sizes[i].width, calibrate_sizes[i].height) / H264_SYNTH_HEADROOM;
+        DEBUG_TRACE("Calibrating %s at %ux%u: %.1f fps\n", backend->name, calibrate_sizes[i].width,
+                    calibrate_sizes[i].height, fps);
+        if (fps >= CALIBRATE_MIN_FPS) {
+            break;
+        }
+
+        free(cs.data);
+    }
+
+    if (i == ELEMENTS_IN_ARRAY(calibrate_sizes)) {
+        DEBUG_TRACE("Calibration found no size decoded at %dfps\n", CALIBRATE_MIN_FPS);
+        return -1;
+    }
+
+    result->width = calibrate_sizes[i].width;
+    result->height = calibrate_sizes[i].height;
+    result->max_fps = min((int)fps, caps->max_fps);
+
+    /* Only the OMX backend takes buffer depths. */
+    if (backend == &omx_backend) {
+        pick_depth(backend, &cs, result->width, result->height, input_depths, &buffer_depths.input, "input");
+        pick_depth(backend, &cs, result->width, result->height, output_depths, &buffer_depths.output, "output");
+        result->depths = buffer_depths;
+    }
+
+    free(cs.data);
+
+    return 0;
+}
+
+/***************************************************************************
+*   The cache: a line per board, of the version, board revision, GPU
+*   memory, backend, then the result.
+****************************************************************************/
+
+static const char *cache_path(char *path, int size)
+{
+    char *file = getenv(CALIBRATION_FILE_ENV);
+    char *home = getenv("HOME");
+
+    if (file) {
+        return file;
+    }
+
+    if (!home) {
+        return NULL;
+    }
+
+    snprintf(path, size, "%s/.ctxh264_calibration", home);
+
+    return path;
+}
+
+/* Whether "line" is of the current version and for this board and backend. */
+static int cache_line_matches(const char *line, const board_info *board, const char *backend, calibration *result)
+{
+    unsigned int revision;
+    int version, gpu_mem_mb;
+    char name[32];
+    calibration entry;
+
+    if (sscanf(line, "%d %x %d %31s %u %u %d %d %d", &version, &revision, &gpu_mem_mb, name, &entry.width,
+               &entry.height, &entry.max_fps, &entry.depths.input, &entry.depths.output) != 9 ||
+        version != CALIBRATE_VERSION || revision != board->revision || gpu_mem_mb != board->gpu_mem_mb ||
+        strcmp(name, backend) != 0) {
+        return 0;
+    }
+
+    if (result) {
+        *result = entry;
+    }
+
+    return 1;
+}
+
+/* Returns 0, or -1 if the board has no entry. */
+static int read_cache(const char *path, const board_info *board, const char *backend, calibration *result)
+{
+    FILE *f = fopen(path, "r");
+    char line[256];
+    int found = 0;
+
+    if (!f) {
+        return -1;
+    }
+
+    while (!found && fgets(line, sizeof(line), f)) {
+        found = cache_line_matches(line, board, backend, result);
+    }
+
+    fclose(f);
+
+    return found ? 0 : -1;
+}
+
+/* Replaces the board's entry, keeping those of other boards. */
+static void write_cache(const char *path, const board_info *board, const char *backend, const calibration *result)
+{
+    char tmp[256], line[256];
+    FILE *in = fopen(path, "r");
+    FILE *out;
+
+    snprintf(tmp, sizeof(tmp), "%s.%d", path, getpid());
+    out = fopen(tmp, "w");
+    if (!out) {
+        DEBUG_TRACE("Couldn't write calibration to %s, errno=%d\n", path, errno);
+        if (in) {
+            fclose(in);
+        }
+        return;
+    }
+
+    while (in && fgets(line, sizeof(line), in)) {
+        if (!cache_line_matches(line, board, backend, NULL)) {
+            fputs(line, out);
+        }
+    }
+    if (in) {
+        fclose(in);
+    }
+
+    fprintf(out, "%d %x %d %s %u %u %d %d %d\n", CALIBRATE_VERSION, board->revision, board->gpu_mem_mb, backend,
+            result->width, result->height, result->max_fps, result->depths.input, result->depths.output);
+
+    if (fclose(out) != 0 || rename(tmp, path) != 0) {
+        DEBUG_TRACE("Couldn't write calibration to %s, errno=%d\n", path, errno);
+        unlink(tmp);
+    }
+}
+
+/***************************************************************************
+*   Entry point.
+****************************************************************************/
+
+void calibrate(const H264_backend *backend, struct H264_decoder *caps)
+{
+    char *mode = getenv(CALIBRATE_ENV);
+    char *input = getenv(INPUT_BUFFERS_ENV);
+    char *output = getenv(OUTPUT_BUFFERS_ENV);
+    char buf[256];
+    const char *path;
+    calibration result;
+    board_info board;
+    int found = 0;
+
+    memset(&buffer_depths, 0, sizeof(buffer_depths));
+
+    if (mode && atoi(mode) > 0) {
+        probe_board(&board);
+        path = cache_path(buf, sizeof(buf));
+
+        if (atoi(mode) == 1 && path && read_cache(path, &board, backend->name, &result) == 0) {
+            DEBUG_TRACE("Calibration for board revision 0x%x from %s\n", board.revision, path);
+            found = 1;
+        } else if (run_calibration(backend, caps, &result) == 0) {
+            found = 1;
+            if (path) {
+                write_cache(path, &board, backend->name, &result);
+            }
+        }
+
+        /* A cached result can't raise what the probe found either. */
+        if (found && result.width <= caps->width && result.height <= caps->height) {
+            caps->width = result.width;
+            caps->height = result.height;
+            caps->max_fps = min(result.max_fps, caps->max_fps);
+            buffer_depths = result.depths;
+            DEBUG_TRACE("Calibrated to %ux%u@%d, %d input and %d output buffers\n", caps->width, caps->height,
+                        caps->max_fps, buffer_depths.input, buffer_depths.output);
+        }
+    }
+
+    if (input) {
+        buffer_depths.input = atoi(input);
+    }
+    if (output) {
+        buffer_depths.output = atoi(output);
+    }
+}
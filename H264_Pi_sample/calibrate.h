@@ -0,0 +1,43 @@
+/***************************************************************************
+*
+*   calibrate.h
+*
+*   Startup calibration: the limits advertised and the decoder's buffer
+*   depths, measured on the board by decoding a synthetic stream through
+*   the backend, and cached per board revision.
+*
+*   CTX_H264_CALIBRATE=1 takes the cached result, or calibrates when there
+*   is none for the board; 2 calibrates again. The cache is
+*   CTX_H264_CALIBRATION_FILE, or ~/.ctxh264_calibration, one line per
+*   board, so boards of different kinds can share a home directory.
+*
+****************************************************************************/
+
+#ifndef _CALIBRATE_H_
+#define _CALIBRATE_H_
+
+/* Buffers the backend's decoder is given, 0 for its default. Only the OMX
+ * backend takes them: "input" is video_decode's input buffers, "output"
+ * the buffers of the tunnel to video_render. CTX_H264_INPUT_BUFFERS and
+ * CTX_H264_OUTPUT_BUFFERS override them.
+ */
+typedef struct _H264_buffer_depths {
+    int             input;
+    int             output;
+} H264_buffer_depths;
+
+extern H264_buffer_depths buffer_depths;
+
+struct H264_decoder;
+
+/*  Function: calibrate()
+ *
+ *  Sets the size and frame rate advertised in "caps", which "backend" was
+ *  probed to support, and "buffer_depths" to what was measured on this
+ *  board, if calibration is enabled. Limits are only ever lowered; the
+ *  probed ones are kept if it isn't enabled, or if the backend sustains
+ *  none of the sizes tried.
+ */
+void calibrate(const H264_backend *backend, struct H264_decoder *caps);
+
+#endif /* _CALIBRATE_H_ */
@@ -0,0 +1,448 @@
+/***************************************************************************
+*
+*   capture.c
+*
+*   Session capture: records every call made through the H264_decoder
+*   table to a session file (see session.h) for replay with ctxh264_host.
+*
+****************************************************************************/
+
+#include "video_gl.h"
+#include "session.h"
+
+/* Records are buffered and written out once per frame, so that a crash
+ * loses at most the frame in progress.
+ */
+#define CAPTURE_BUFFER_SIZE     (256 * 1024)
+
+typedef struct _OMXH264_capture {
+    pthread_mutex_t      lock;
+    FILE                *file;
+    uint64_t             offset;        /* Of the next record. */
+    uint64_t             start_ns;
+
+    /* IDR index, written when the capture ends. */
+    session_index_entry *index;
+    unsigned int         index_count;
+    unsigned int         index_size;
+
+    uint64_t             open_offset;
+    uint64_t             frame_offset;
+    uint64_t             frame_time;
+    unsigned int         frames;
+    int                  frame_indexed;
+
+    H264_nal_scanner     scanner;
+    int                  nal_header_next;
+} OMXH264_capture;
+
+int capture_enabled = 0;
+
+static OMXH264_capture capture = { PTHREAD_MUTEX_INITIALIZER };
+static const unsigned char capture_padding[8];
+
+static uint64_t capture_time(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec - capture.start_ns;
+}
+
+static void capture_write(const void *data, size_t len)
+{
+    if (!capture_enabled) {
+        /* Ended, or a previous write failed. */
+        return;
+    }
+
+    if (len && fwrite(data, 1, len, capture.file) != len) {
+        DEBUG_TRACE("Capture write failed: %s, capture stopped\n", strerror(errno));
+        capture_enabled = 0;
+    }
+}
+
+/* Starts a record of "size" payload bytes. The caller writes the payload
+ * and then calls end_record().
+ */
+static uint64_t begin_record(session_record_type type, uint32_t size, H264_context cxt, uint32_t arg)
+{
+    session_record rec;
+    uint64_t offset = capture.offset;
+
+    rec.type = type;
+    rec.size = size;
+    rec.time = capture_time();
+    rec.context = cxt;
+    rec.arg = arg;
+
+    capture_write(&rec, sizeof(rec));
+    capture.offset += sizeof(rec) + SESSION_ALIGN(size);
+
+    return offset;
+}
+
+static void end_record(uint32_t size)
+{
+    capture_write(capture_padding, SESSION_ALIGN(size) - size);
+}
+
+static void add_index_entry(void)
+{
+    session_index_entry *entry;
+
+    if (capture.index_count == capture.index_size) {
+        unsigned int size = capture.index_size ? capture.index_size * 2 : 256;
+
+        entry = realloc(capture.index, size * sizeof(session_index_entry));
+        if (!entry) {
+            return;
+        }
+        capture.index = entry;
+        capture.index_size = size;
+    }
+
+    entry = &capture.index[capture.index_count++];
+    entry->offset = capture.frame_offset;
+    entry->open_offset = capture.open_offset;
+    entry->time = capture.frame_time;
+    entry->frame = capture.frames - 1;
+    entry->reserved = 0;
+}
+
+/* Indexes the frame if this chunk carries the header of an IDR slice. A
+ * start code, or the header after it, may be split across chunks.
+ */
+static void scan_for_idr(const unsigned char *data, int len)
+{
+    int pos = 0, held, payload, found;
+
+    while (pos < len && !capture.frame_indexed) {
+        if (capture.nal_header_next) {
+            capture.nal_header_next = 0;
+            if (h264_nal_type(data[pos]) == H264_NAL_SLICE_IDR && capture.frames) {
+                add_index_entry();
+                capture.frame_indexed = 1;
+                break;
+            }
+        }
+
+        pos += h264_scan_nal(&capture.scanner, data + pos, len - pos, &held, &payload, &found);
+        if (found) {
+            capture.nal_header_next = 1;
+        }
+    }
+}
+
+void capture_init(void)
+{
+    char *path = getenv("CTX_H264_CAPTURE");
+    session_header header;
+    struct timespec ts;
+
+    if (!path || !*path || capture.file) {
+        return;
+    }
+
+    capture.file = fopen(path, "wb");
+    if (!capture.file) {
+        DEBUG_TRACE("Cannot open capture file %s: %s\n", path, strerror(errno));
+        return;
+    }
+    setvbuf(capture.file, NULL, _IOFBF, CAPTURE_BUFFER_SIZE);
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    capture.start_ns = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    memcpy(header.magic, SESSION_MAGIC, sizeof(header.magic));
+    header.version = SESSION_VERSION;
+    header.header_size = sizeof(header);
+    header.start_time = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+
+    capture_enabled = 1;
+    capture_write(&header, sizeof(header));
+    capture.offset = sizeof(header);
+
+    DEBUG_TRACE("Capturing session to %s\n", path);
+}
+
+void capture_end(void)
+{
+    session_footer footer;
+    uint32_t size;
+
+    if (!capture.file) {
+        return;
+    }
+
+    pthread_mutex_lock(&capture.lock);
+    if (capture_enabled) {
+        size = capture.index_count * sizeof(session_index_entry);
+
+        memcpy(footer.magic, SESSION_FOOTER_MAGIC, sizeof(footer.magic));
+        footer.index_offset = begin_record(SESSION_INDEX, size, 0, 0);
+        capture_write(capture.index, size);
+        end_record(size);
+        capture_write(&footer, sizeof(footer));
+    }
+
+    fclose(capture.file);
+    capture.file = NULL;
+    capture_enabled = 0;
+
+    free(capture.index);
+    capture.index = NULL;
+    capture.index_count = 0;
+    capture.index_size = 0;
+    pthread_mutex_unlock(&capture.lock);
+}
+
+void capture_open_context(H264_context cxt, int width, int height, void *codec_data, int len,
+                          unsigned int options)
+{
+    session_open open;
+    uint32_t size;
+
+    if (len < 0 || !codec_data) {
+        len = 0;
+    }
+
+    open.width = width;
+    open.height = height;
+    open.options = options;
+    open.codec_data_len = len;
+    size = sizeof(open) + len;
+
+    pthread_mutex_lock(&capture.lock);
+    capture.open_offset = begin_record(SESSION_OPEN_CONTEXT, size, cxt, 0);
+    capture_write(&open, sizeof(open));
+    capture_write(codec_data, len);
+    end_record(size);
+    pthread_mutex_unlock(&capture.lock);
+}
+
+void capture_start_frame(H264_context cxt, unsigned int encoded_size, SIGNED_RECT dirty_rects[],
+                         unsigned int num_rects)
+{
+    session_start_frame start;
+    uint32_t size;
+
+    if (!dirty_rects) {
+        num_rects = 0;
+    }
+
+    start.encoded_size = encoded_size;
+    start.num_rects = num_rects;
+    size = sizeof(start) + num_rects * sizeof(SIGNED_RECT);
+
+    pthread_mutex_lock(&capture.lock);
+    capture.frame_time = capture_time();
+    capture.frame_offset = begin_record(SESSION_START_FRAME, size, cxt, 0);
+    capture_write(&start, sizeof(start));
+    capture_write(dirty_rects, num_rects * sizeof(SIGNED_RECT));
+    end_record(size);
+
+    capture.frames++;
+    capture.frame_indexed = 0;
+    capture.nal_header_next = 0;
+    h264_scanner_reset(&capture.scanner);
+    pthread_mutex_unlock(&capture.lock);
+}
+
+void capture_decode_frame(H264_context cxt, void *H264_data, int len, bool last)
+{
+    if (len < 0 || !H264_data) {
+        len = 0;
+    }
+
+    pthread_mutex_lock(&capture.lock);
+    scan_for_idr(H264_data, len);
+    begin_record(SESSION_DECODE_FRAME, len, cxt, last);
+    capture_write(H264_data, len);
+    end_record(len);
+    pthread_mutex_unlock(&capture.lock);
+}
+
+static void image_to_session(session_image *out, const struct image_buf *image)
+{
+    out->pixel_format = image->pixel_format;
+    out->lossless_op = image->lossless_op;
+    out->reserved = 0;
+    out->stride = image->stride;
+    out->width = image->width;
+    out->height = image->height;
+    out->dst_x = image->dst_x;
+    out->dst_y = image->dst_y;
+    out->src_x = image->src_x;
+    out->src_y = image->src_y;
+    out->col = image->col;
+}
+
+static int image_has_pixels(const struct image_buf *image)
+{
+    return image->lossless_op == IMAGE_OP_DRAW_LOSSLESS || image->lossless_op == IMAGE_OP_SMALL_FRAME_BITMAP;
+}
+
+static void write_rows(const struct image_buf *image, int left, int top, int width, int height)
+{
+    static const unsigned char blank[256];
+    int y, done;
+
+    for (y = top; y < top + height; y++) {
+        if (image->bits) {
+            capture_write((const unsigned char *)image->bits + y * image->stride + left * 4, width * 4);
+            continue;
+        }
+
+        /* Keep the record layout even if Receiver passed no pixels. */
+        for (done = 0; done < width * 4; done += sizeof(blank)) {
+            capture_write(blank, width * 4 - done < (int)sizeof(blank) ? width * 4 - done : (int)sizeof(blank));
+        }
+    }
+}
+
+/* Only the interesting rects of the frame buffer are recorded, clipped to
+ * it. With no rects the whole frame buffer is, and "arg" is set so that
+ * replay passes no rects either.
+ */
+void capture_compose_with_fb(H264_context cxt, struct image_buf *fb, SIGNED_RECT interesting_rects[],
+                             unsigned int num_rects)
+{
+    session_compose_fb compose;
+    SIGNED_RECT whole, *rects;
+    uint32_t size, i;
+
+    if (!fb) {
+        return;
+    }
+
+    if (!interesting_rects || !num_rects) {
+        whole.left = 0;
+        whole.top = 0;
+        whole.right = fb->width;
+        whole.bottom = fb->height;
+        interesting_rects = &whole;
+        num_rects = 0;
+    }
+
+    rects = malloc((num_rects ? num_rects : 1) * sizeof(SIGNED_RECT));
+    if (!rects) {
+        return;
+    }
+
+    size = sizeof(compose);
+    for (i = 0; i < (num_rects ? num_rects : 1); i++) {
+        rects[i].left = interesting_rects[i].left < 0 ? 0 : interesting_rects[i].left;
+        rects[i].top = interesting_rects[i].top < 0 ? 0 : interesting_rects[i].top;
+        rects[i].right = interesting_rects[i].right > (INT32)fb->width ? (INT32)fb->width : interesting_rects[i].right;
+        rects[i].bottom = interesting_rects[i].bottom > (INT32)fb->height ? (INT32)fb->height :
+                          interesting_rects[i].bottom;
+        if (rects[i].right < rects[i].left) {
+            rects[i].right = rects[i].left;
+        }
+        if (rects[i].bottom < rects[i].top) {
+            rects[i].bottom = rects[i].top;
+        }
+        size += sizeof(SIGNED_RECT) + (rects[i].right - rects[i].left) * (rects[i].bottom - rects[i].top) * 4;
+    }
+
+    image_to_session(&compose.fb, fb);
+    compose.num_rects = num_rects ? num_rects : 1;
+    compose.reserved = 0;
+
+    pthread_mutex_lock(&capture.lock);
+    begin_record(SESSION_COMPOSE_WITH_FB, size, cxt, num_rects == 0);
+    capture_write(&compose, sizeof(compose));
+    capture_write(rects, compose.num_rects * sizeof(SIGNED_RECT));
+    for (i = 0; i < compose.num_rects; i++) {
+        write_rows(fb, rects[i].left, rects[i].top, rects[i].right - rects[i].left, rects[i].bottom - rects[i].top);
+    }
+    end_record(size);
+    pthread_mutex_unlock(&capture.lock);
+
+    free(rects);
+}
+
+void capture_compose_with_rects(H264_context cxt, struct image_buf objects[], unsigned int num_objects,
+                                bool last)
+{
+    session_image image;
+    uint32_t count = objects ? num_objects : 0;
+    uint32_t size = sizeof(count), i;
+
+    for (i = 0; i < count; i++) {
+        size += sizeof(session_image);
+        if (image_has_pixels(&objects[i])) {
+            size += objects[i].width * objects[i].height * 4;
+        }
+    }
+
+    pthread_mutex_lock(&capture.lock);
+    begin_record(SESSION_COMPOSE_WITH_RECTS, size, cxt, last);
+    capture_write(&count, sizeof(count));
+    for (i = 0; i < count; i++) {
+        image_to_session(&image, &objects[i]);
+        if (image_has_pixels(&objects[i])) {
+            /* The rows that follow are the source rectangle, packed. */
+            image.stride = objects[i].width * 4;
+            image.src_x = 0;
+            image.src_y = 0;
+        }
+        capture_write(&image, sizeof(image));
+        if (image_has_pixels(&objects[i])) {
+            write_rows(&objects[i], objects[i].src_x, objects[i].src_y, objects[i].width, objects[i].height);
+        }
+    }
+    end_record(size);
+    pthread_mutex_unlock(&capture.lock);
+}
+
+void capture_push_frame(H264_context cxt, struct window_info windows[], unsigned int num_windows, bool wait)
+{
+    session_window window;
+    uint32_t count = windows ? num_windows : 0;
+    uint32_t size = sizeof(count) + count * sizeof(session_window), i;
+
+    pthread_mutex_lock(&capture.lock);
+    begin_record(SESSION_PUSH_FRAME, size, cxt, wait);
+    capture_write(&count, sizeof(count));
+    for (i = 0; i < count; i++) {
+        window.id = windows[i].id;
+        window.left = windows[i].rect.left;
+        window.top = windows[i].rect.top;
+        window.right = windows[i].rect.right;
+        window.bottom = windows[i].rect.bottom;
+        window.target_x = windows[i].target_x;
+        window.target_y = windows[i].target_y;
+        window.flags = windows[i].flags;
+        capture_write(&window, sizeof(window));
+    }
+    end_record(size);
+
+    /* One write per frame. */
+    if (capture_enabled) {
+        fflush(capture.file);
+    }
+    pthread_mutex_unlock(&capture.lock);
+}
+
+void capture_close_context(H264_context cxt)
+{
+    pthread_mutex_lock(&capture.lock);
+    begin_record(SESSION_CLOSE_CONTEXT, 0, cxt, 0);
+    if (capture_enabled) {
+        fflush(capture.file);
+    }
+    pthread_mutex_unlock(&capture.lock);
+}
+
+void capture_frame_info(H264_context cxt, const session_frame_info *info)
+{
+    pthread_mutex_lock(&capture.lock);
+    begin_record(SESSION_FRAME_INFO, sizeof(session_frame_info), cxt, 0);
+    capture_write(info, sizeof(session_frame_info));
+    end_record(sizeof(session_frame_info));
+    pthread_mutex_unlock(&capture.lock);
+}
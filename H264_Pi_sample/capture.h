@@ -0,0 +1,45 @@
+/***************************************************************************
+*
+*   capture.h
+*
+*   Session capture: records every call made through the H264_decoder
+*   table to a session file (see session.h) for replay with ctxh264_host.
+*
+*   Capture is enabled by setting CTX_H264_CAPTURE to the file to write.
+*   Callers test capture_enabled before each capture_*() call, so a
+*   disabled capture costs one branch.
+*
+****************************************************************************/
+
+#ifndef _CAPTURE_H_
+#define _CAPTURE_H_
+
+#include "citrix.h"
+#include "H264_decode.h"
+
+extern int capture_enabled;
+
+/* Opens the capture file if CTX_H264_CAPTURE is set. */
+void capture_init(void);
+
+/* Writes the IDR index and closes the capture file. */
+void capture_end(void);
+
+void capture_open_context(H264_context cxt, int width, int height, void *codec_data, int len,
+                          unsigned int options);
+void capture_start_frame(H264_context cxt, unsigned int encoded_size, SIGNED_RECT dirty_rects[],
+                         unsigned int num_rects);
+void capture_decode_frame(H264_context cxt, void *H264_data, int len, bool last);
+void capture_compose_with_fb(H264_context cxt, struct image_buf *fb, SIGNED_RECT interesting_rects[],
+                             unsigned int num_rects);
+void capture_compose_with_rects(H264_context cxt, struct image_buf objects[], unsigned int num_objects,
+                                bool last);
+void capture_push_frame(H264_context cxt, struct window_info windows[], unsigned int num_windows, bool wait);
+void capture_close_context(H264_context cxt);
+
+struct _session_frame_info;
+
+/* Records what frame "info->frame" of the context was, from analyze.h. */
+void capture_frame_info(H264_context cxt, const struct _session_frame_info *info);
+
+#endif /* _CAPTURE_H_ */
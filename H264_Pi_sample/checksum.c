@@ -0,0 +1,222 @@
+/***************************************************************************
+*
+*   checksum.c
+*
+*   Checksums of decoded pictures and of the lossless layer, for
+*   decode-only contexts (see checksum.h).
+*
+*   The hash is FNV-1a taken a 64 bit word at a time, which runs at
+*   memory speed; any one word changed changes it. Pictures are hashed row
+*   by row over their visible samples only, so decoders with different
+*   strides or padding agree.
+*
+****************************************************************************/
+
+#include "video_gl.h"
+#include "presenter.h"
+
+#define DECODE_ONLY_ENV         "CTX_H264_DECODE_ONLY"
+#define CHECKSUM_FILE_ENV       "CTX_H264_CHECKSUM_FILE"
+
+#define CHECKSUM_BASIS          0xcbf29ce484222325ULL
+#define CHECKSUM_PRIME          0x100000001b3ULL
+
+static unsigned long long now_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int decode_only()
+{
+    char *value = getenv(DECODE_ONLY_ENV);
+
+    return value && atoi(value) > 0;
+}
+
+unsigned long long checksum_bytes(unsigned long long hash, const unsigned char *data, unsigned int len)
+{
+    unsigned long long word;
+
+    for (; len >= sizeof(word); data += sizeof(word), len -= sizeof(word)) {
+        memcpy(&word, data, sizeof(word));
+        hash = (hash ^ word) * CHECKSUM_PRIME;
+    }
+
+    for (; len > 0; data++, len--) {
+        hash = (hash ^ *data) * CHECKSUM_PRIME;
+    }
+
+    return hash;
+}
+
+/* Rows and bytes per row of plane "p" of the visible picture. Returns -1
+ * for formats not known.
+ */
+static int plane_size(const H264_frame *frame, int p, unsigned int *rows, unsigned int *bytes)
+{
+    unsigned int chroma_width = (frame->width + 1) / 2, chroma_height = (frame->height + 1) / 2;
+
+    if (p == 0) {
+        *rows = frame->height;
+        *bytes = frame->width;
+        return 0;
+    }
+
+    switch (frame->fourcc) {
+    case H264_FOURCC_NV12:
+        *rows = chroma_height;
+        *bytes = chroma_width * 2;
+        return p == 1 ? 0 : -1;
+    case H264_FOURCC_YU12:
+        *rows = chroma_height;
+        *bytes = chroma_width;
+        return p <= 2 ? 0 : -1;
+    }
+
+    return -1;
+}
+
+static unsigned long long picture_sum(const H264_frame *frame)
+{
+    unsigned long long hash = CHECKSUM_BASIS;
+    unsigned int rows, bytes, y;
+    int p;
+
+    for (p = 0; p < frame->num_planes; p++) {
+        if (!frame->data[p] || plane_size(frame, p, &rows, &bytes) != 0) {
+            return 0;
+        }
+
+        for (y = 0; y < rows; y++) {
+            hash = checksum_bytes(hash, frame->data[p] + y * frame->pitches[p], bytes);
+        }
+    }
+
+    return hash;
+}
+
+/* Appends "sum" to "*sums", growing it. Returns -1 if out of memory. */
+static int append_sum(unsigned long long **sums, unsigned int *count, unsigned int *size, unsigned long long sum)
+{
+    unsigned long long *grown;
+
+    if (*count == *size) {
+        grown = realloc(*sums, max(*size * 2, 256U) * sizeof(unsigned long long));
+        if (!grown) {
+            return -1;
+        }
+        *sums = grown;
+        *size = max(*size * 2, 256U);
+    }
+
+    (*sums)[(*count)++] = sum;
+
+    return 0;
+}
+
+int checksum_open(H264_checksums *checksums, int context, unsigned int width, unsigned int height)
+{
+    unsigned char *bits = calloc(1, width * height * 4);
+
+    memset(checksums, 0, sizeof(H264_checksums));
+
+    if (!bits) {
+        return -1;
+    }
+
+    checksums->context = context;
+    pthread_mutex_init(&checksums->lock, NULL);
+    overlay_init(&checksums->overlay, bits, width * 4, width, height);
+
+    /* The layer starts out transparent, which is checksummed like any. */
+    checksums->overlay.dirty.num_rects = 1;
+
+    return 0;
+}
+
+void checksum_picture(H264_checksums *checksums, const H264_frame *frame)
+{
+    unsigned long long sum = picture_sum(frame), ns = now_ns();
+
+    pthread_mutex_lock(&checksums->lock);
+    if (append_sum(&checksums->pictures, &checksums->num_pictures, &checksums->max_pictures, sum) == 0) {
+        if (checksums->num_pictures == 1) {
+            checksums->first_ns = ns;
+        }
+        checksums->last_ns = ns;
+    }
+    pthread_mutex_unlock(&checksums->lock);
+}
+
+void checksum_push(H264_checksums *checksums)
+{
+    H264_overlay *overlay = &checksums->overlay;
+    unsigned int y;
+
+    if (overlay->dirty.num_rects) {
+        checksums->overlay_sum = CHECKSUM_BASIS;
+        for (y = 0; y < overlay->height; y++) {
+            checksums->overlay_sum = checksum_bytes(checksums->overlay_sum, overlay->bits + y * overlay->stride,
+                                                    overlay->width * 4);
+        }
+        overlay_clear_dirty(overlay);
+    }
+
+    append_sum(&checksums->overlays, &checksums->num_overlays, &checksums->max_overlays, checksums->overlay_sum);
+}
+
+void checksum_close(H264_checksums *checksums)
+{
+    char *path = getenv(CHECKSUM_FILE_ENV);
+    unsigned long long pictures, overlays;
+    double seconds;
+    FILE *f = NULL;
+    unsigned int i;
+
+    pthread_mutex_lock(&checksums->lock);
+
+    pictures = checksum_bytes(CHECKSUM_BASIS, (unsigned char *)checksums->pictures,
+                              checksums->num_pictures * sizeof(unsigned long long));
+    overlays = checksum_bytes(CHECKSUM_BASIS, (unsigned char *)checksums->overlays,
+                              checksums->num_overlays * sizeof(unsigned long long));
+    seconds = (checksums->last_ns - checksums->first_ns) / 1e9;
+
+    DEBUG_TRACE("Context %d checksums: %u pictures %016llx, %u overlays %016llx\n", checksums->context,
+                checksums->num_pictures, pictures, checksums->num_overlays, overlays);
+
+    if (path) {
+        /* Appended to, for sessions of several contexts. */
+        f = fopen(path, "a");
+        if (!f) {
+            DEBUG_TRACE("Couldn't open %s, errno=%d\n", path, errno);
+        }
+    }
+
+    if (f) {
+        fprintf(f, "context %d %ux%u\n", checksums->context, checksums->overlay.width, checksums->overlay.height);
+        for (i = 0; i < checksums->num_pictures; i++) {
+            fprintf(f, "picture %u %016llx\n", i, checksums->pictures[i]);
+        }
+        for (i = 0; i < checksums->num_overlays; i++) {
+            fprintf(f, "overlay %u %016llx\n", i, checksums->overlays[i]);
+        }
+        fprintf(f, "digest %d pictures %u %016llx overlays %u %016llx\n", checksums->context,
+                checksums->num_pictures, pictures, checksums->num_overlays, overlays);
+        /* From the first picture to the last, so intervals between them. */
+        fprintf(f, "throughput %d %u pictures in %.3f s, %.1f fps\n", checksums->context, checksums->num_pictures,
+                seconds, seconds > 0 ? (checksums->num_pictures - 1) / seconds : 0);
+        fclose(f);
+    }
+
+    pthread_mutex_unlock(&checksums->lock);
+    pthread_mutex_destroy(&checksums->lock);
+
+    free(checksums->pictures);
+    free(checksums->overlays);
+    free(checksums->overlay.bits);
+    memset(checksums, 0, sizeof(H264_checksums));
+}
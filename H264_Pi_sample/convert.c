@@ -0,0 +1,169 @@
+/***************************************************************************
+*
+*   convert.c
+*
+*   Software composition of the decoded frame and the lossless layer (see
+*   convert.h).
+*
+****************************************************************************/
+
+#include "video_gl.h"
+#include "convert.h"
+
+#define OPAQUE  0xFF000000u
+
+/* Set to "c" to use the reference kernel whatever the CPU has. */
+#define CONVERT_KERNEL_ENV  "CTX_H264_CONVERT"
+
+/* Indexed by H264_COLOR_*. Limited range luma is scaled by 255/219 from
+ * 16, chroma by 255/224; full range luma is as is.
+ */
+static const convert_coefs coefs_table[4] = {
+    { 149, 1160, 102, 25, 52, 129 },    /* BT.601, limited range. */
+    { 149, 1160, 115, 14, 34, 135 },    /* BT.709, limited range. */
+    { 128, -32, 90, 22, 46, 113 },      /* BT.601, full range. */
+    { 128, -32, 101, 12, 30, 119 },     /* BT.709, full range. */
+};
+
+static convert_kernel kernel;
+
+const convert_coefs *convert_coefs_for(unsigned int color)
+{
+    return &coefs_table[color & (H264_COLOR_BT709 | H264_COLOR_FULL_RANGE)];
+}
+
+/***************************************************************************
+*   Reference kernel.
+****************************************************************************/
+
+static int saturate(int value)
+{
+    return value < -32768 ? -32768 : value > 32767 ? 32767 : value;
+}
+
+static unsigned int narrow(int value)
+{
+    value >>= 6;
+    return value < 0 ? 0 : value > 255 ? 255 : value;
+}
+
+/* "over" blended onto "under" by "alpha", rounded as division by 255. */
+static unsigned int blend(unsigned int over, unsigned int under, unsigned int alpha)
+{
+    unsigned int mix = over * alpha + under * (255 - alpha) + 128;
+
+    return (mix + (mix >> 8)) >> 8;
+}
+
+static void store(unsigned char *dst, unsigned int r, unsigned int g, unsigned int b, int order)
+{
+    dst[0] = order == CONVERT_BGRA ? b : r;
+    dst[1] = g;
+    dst[2] = order == CONVERT_BGRA ? r : b;
+    dst[3] = 0xff;
+}
+
+void convert_row_c(const convert_row *row, int x, int width, const convert_coefs *coefs, int order)
+{
+    unsigned int r, g, b, pixel, alpha;
+    int i, l, u, v;
+
+    for (i = x; i < x + width; i++) {
+        if (row->v) {
+            u = row->u[i / 2] - 128;
+            v = row->v[i / 2] - 128;
+        } else {
+            u = row->u[(i / 2) * 2] - 128;
+            v = row->u[(i / 2) * 2 + 1] - 128;
+        }
+
+        l = ((row->luma[i] * coefs->luma) >> 1) - coefs->bias;
+        r = narrow(saturate(l + coefs->vr * v));
+        g = narrow(saturate(l - (coefs->ug * u + coefs->vg * v)));
+        b = narrow(saturate(l + coefs->ub * u));
+
+        if (row->layer) {
+            pixel = row->layer[i];
+            alpha = pixel >> 24;
+            r = blend((pixel >> 16) & 0xff, r, alpha);
+            g = blend((pixel >> 8) & 0xff, g, alpha);
+            b = blend(pixel & 0xff, b, alpha);
+        }
+
+        store(row->dst + i * 4, r, g, b, order);
+    }
+}
+
+/* The layer over black, where there is no frame. */
+static void blank_row(const convert_row *row, int x, int width, int order)
+{
+    unsigned int pixel, alpha;
+    int i;
+
+    for (i = x; i < x + width; i++) {
+        pixel = row->layer[i];
+        alpha = pixel >> 24;
+        store(row->dst + i * 4, blend((pixel >> 16) & 0xff, 0, alpha), blend((pixel >> 8) & 0xff, 0, alpha),
+              blend(pixel & 0xff, 0, alpha), order);
+    }
+}
+
+/***************************************************************************
+*   Composition.
+****************************************************************************/
+
+static convert_kernel choose_kernel(void)
+{
+    char *name = getenv(CONVERT_KERNEL_ENV);
+
+    if (name && strcmp(name, "c") == 0) {
+        return convert_row_c;
+    }
+#ifdef HAVE_NEON
+    if (convert_neon_usable()) {
+        return convert_row_neon;
+    }
+#endif
+    return convert_row_c;
+}
+
+int convert_compose(unsigned char *dst, int stride, const H264_frame *frame, const H264_overlay *overlay,
+                    const SIGNED_RECT *rect, int order)
+{
+    const convert_coefs *coefs = NULL;
+    convert_row row;
+    int y, video_right, video_bottom;
+
+    if (frame && (!frame->data[0] || (frame->fourcc != H264_FOURCC_NV12 && frame->fourcc != H264_FOURCC_YU12))) {
+        DEBUG_TRACE("Can't convert frame %u, format 0x%x\n", frame->id, frame->fourcc);
+        return -1;
+    }
+
+    if (!kernel) {
+        kernel = choose_kernel();
+    }
+
+    video_right = frame ? min(rect->right, (INT32)frame->width) : rect->left;
+    video_bottom = frame ? min(rect->bottom, (INT32)frame->height) : rect->top;
+    if (frame) {
+        coefs = convert_coefs_for(frame->color);
+    }
+
+    memset(&row, 0, sizeof(row));
+    for (y = rect->top; y < rect->bottom; y++) {
+        row.dst = dst + y * stride;
+        row.layer = (const unsigned int *)(overlay->bits + y * overlay->stride);
+
+        if (y < video_bottom && rect->left < video_right) {
+            row.luma = frame->data[0] + y * frame->pitches[0];
+            row.u = frame->data[1] + (y / 2) * frame->pitches[1];
+            row.v = frame->fourcc == H264_FOURCC_YU12 ? frame->data[2] + (y / 2) * frame->pitches[2] : NULL;
+            kernel(&row, rect->left, video_right - rect->left, coefs, order);
+            blank_row(&row, video_right, rect->right - video_right, order);
+        } else {
+            blank_row(&row, rect->left, rect->right - rect->left, order);
+        }
+    }
+
+    return 0;
+}
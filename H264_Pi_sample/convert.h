@@ -0,0 +1,79 @@
+/***************************************************************************
+*
+*   convert.h
+*
+*   Software composition, for presenters without an overlay plane: the
+*   decoded frame converted from YUV to RGB with the lossless layer blended
+*   over it, a rectangle at a time.
+*
+****************************************************************************/
+
+#ifndef _CONVERT_H_
+#define _CONVERT_H_
+
+#include "presenter.h"
+#include "overlay.h"
+
+/* Output pixel orders, as bytes in memory. */
+#define CONVERT_BGRA    0       /* 32 bit ARGB words, as X11 and the lossless layer. */
+#define CONVERT_RGBA    1       /* As GL_RGBA. */
+
+/*  Function: convert_compose()
+ *
+ *  Writes "rect" of the composed context to "dst", in pixel order "order"
+ *  with "stride" bytes per row and the context's top left at its start:
+ *  "frame" converted as its "color" says, under "overlay" blended by its
+ *  alpha. Areas outside the frame, or all of "rect" if "frame" is NULL, are
+ *  black under the overlay. "rect" must lie within the overlay.
+ *
+ *  Returns:
+ *       0, or -1 if "frame" isn't mapped or is in a format not handled.
+ */
+int convert_compose(unsigned char *dst, int stride, const H264_frame *frame, const H264_overlay *overlay,
+                    const SIGNED_RECT *rect, int order);
+
+/***************************************************************************
+*   Row kernels, behind convert_compose(); exposed for convert_bench.
+****************************************************************************/
+
+/* Conversion in 16 bit fixed point, which the kernels must follow exactly:
+ *
+ *     l = ((Y * luma) >> 1) - bias     (bias includes +0.5 for rounding)
+ *     R = l + vr * V
+ *     G = l - (ug * U + vg * V)
+ *     B = l + ub * U                   (U and V less 128; each sum saturated
+ *                                       to 16 bits, then >> 6 and clamped)
+ *
+ * and a layer pixel of alpha A over it is (over * A + under * (255 - A)),
+ * divided by 255 rounding to nearest.
+ */
+typedef struct _convert_coefs {
+    short   luma;           /* 7 fractional bits. */
+    short   bias;
+    short   vr, ug, vg, ub; /* 6 fractional bits. */
+} convert_coefs;
+
+const convert_coefs *convert_coefs_for(unsigned int color);
+
+/* One row of the frame, the layer and the output, each at pixel 0. */
+typedef struct _convert_row {
+    const unsigned char *luma;
+    const unsigned char *u;
+    const unsigned char *v;         /* NULL for NV12, with U and V interleaved at "u". */
+    const unsigned int  *layer;     /* NULL to leave the output opaque. */
+    unsigned char       *dst;
+} convert_row;
+
+/* Converts "width" pixels of "row" from "x". */
+typedef void (*convert_kernel)(const convert_row *row, int x, int width, const convert_coefs *coefs, int order);
+
+/* The reference every other kernel is checked against. */
+void convert_row_c(const convert_row *row, int x, int width, const convert_coefs *coefs, int order);
+
+#ifdef HAVE_NEON
+/* NEON, 16 pixels at a time; returns 0 if the CPU doesn't have it. */
+int convert_neon_usable(void);
+void convert_row_neon(const convert_row *row, int x, int width, const convert_coefs *coefs, int order);
+#endif
+
+#endif /* _CONVERT_H_ */
@@ -0,0 +1,291 @@
+/***************************************************************************
+*
+*   convert_bench.c
+*
+*   Checks every conversion kernel against the reference, and the reference
+*   against floating point, then times each kernel on a frame with and
+*   without the lossless layer:
+*
+*       make convert_bench.bin
+*       ./convert_bench.bin [-w width] [-h height] [-t seconds]
+*
+****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "convert.h"
+
+typedef struct _bench_kernel {
+    const char     *name;
+    convert_kernel  row;
+} bench_kernel;
+
+typedef struct _bench_frame {
+    int             width;
+    int             height;
+    unsigned char  *luma;
+    unsigned char  *chroma;     /* NV12 UV, or U then V for YU12. */
+    unsigned int   *layer;
+    unsigned char  *dst;
+    unsigned char  *reference;
+} bench_frame;
+
+static bench_kernel kernels[4];
+static int num_kernels;
+
+/* convert.c traces failures; there are none worth seeing here. */
+void DEBUG_TRACE(const char *format, ...)
+{
+    (void)format;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* A layer mixing the alphas Receiver sends: transparent, opaque and,
+ * around text and cursors, everything between.
+ */
+static void fill_frame(bench_frame *frame)
+{
+    int i, size = frame->width * frame->height;
+
+    for (i = 0; i < size; i++) {
+        frame->luma[i] = rand();
+        frame->layer[i] = (unsigned int)rand() << 16 ^ rand();
+        if (i % 7 < 3) {
+            frame->layer[i] &= 0x00ffffff;
+        } else if (i % 7 < 5) {
+            frame->layer[i] |= 0xff000000;
+        }
+    }
+    for (i = 0; i < size / 2; i++) {
+        frame->chroma[i] = rand();
+    }
+}
+
+static int alloc_frame(bench_frame *frame, int width, int height)
+{
+    int size = width * height;
+
+    frame->width = width;
+    frame->height = height;
+    frame->luma = malloc(size);
+    frame->chroma = malloc(size / 2);
+    frame->layer = malloc(size * 4);
+    frame->dst = malloc(size * 4);
+    frame->reference = malloc(size * 4);
+
+    return frame->luma && frame->chroma && frame->layer && frame->dst && frame->reference ? 0 : -1;
+}
+
+static void set_row(convert_row *row, const bench_frame *frame, unsigned int fourcc, int blend, int y,
+                    unsigned char *dst)
+{
+    int chroma_stride = fourcc == H264_FOURCC_NV12 ? frame->width : frame->width / 2;
+
+    row->luma = frame->luma + y * frame->width;
+    row->u = frame->chroma + (y / 2) * chroma_stride;
+    row->v = fourcc == H264_FOURCC_NV12 ? NULL : frame->chroma + frame->width * frame->height / 4 + (y / 2) *
+             chroma_stride;
+    row->layer = blend ? frame->layer + y * frame->width : NULL;
+    row->dst = dst + y * frame->width * 4;
+}
+
+static void convert_frame(convert_kernel kernel, const bench_frame *frame, unsigned int fourcc, int blend,
+                          const convert_coefs *coefs, int order, int x, int width, unsigned char *dst)
+{
+    convert_row row;
+    int y;
+
+    for (y = 0; y < frame->height; y++) {
+        set_row(&row, frame, fourcc, blend, y, dst);
+        kernel(&row, x, width, coefs, order);
+    }
+}
+
+/***************************************************************************
+*   Validation.
+****************************************************************************/
+
+/* Largest difference of the reference from the conversion in floating
+ * point, over every Y, U and V.
+ */
+static int reference_error(unsigned int color)
+{
+    const convert_coefs *coefs = convert_coefs_for(color);
+    int full = (color & H264_COLOR_FULL_RANGE) != 0;
+    double kr = color & H264_COLOR_BT709 ? 0.2126 : 0.299, kb = color & H264_COLOR_BT709 ? 0.0722 : 0.114;
+    double luma_scale = full ? 1 : 255 / 219.0, chroma_scale = full ? 1 : 255 / 224.0;
+    double l, u, v, want[3];
+    unsigned char yuv[3], out[4];
+    convert_row row;
+    int y, uv, c, error, worst = 0;
+
+    memset(&row, 0, sizeof(row));
+    row.luma = yuv;
+    row.u = yuv + 1;
+    row.dst = out;
+
+    for (y = 0; y < 256; y++) {
+        for (uv = 0; uv < 65536; uv++) {
+            yuv[0] = y;
+            yuv[1] = uv & 0xff;
+            yuv[2] = uv >> 8;
+            convert_row_c(&row, 0, 1, coefs, CONVERT_RGBA);
+
+            l = (y - (full ? 0 : 16)) * luma_scale;
+            u = (yuv[1] - 128) * chroma_scale;
+            v = (yuv[2] - 128) * chroma_scale;
+            want[0] = l + 2 * (1 - kr) * v;
+            want[1] = l - (2 * kb * (1 - kb) * u + 2 * kr * (1 - kr) * v) / (1 - kr - kb);
+            want[2] = l + 2 * (1 - kb) * u;
+
+            for (c = 0; c < 3; c++) {
+                error = abs(out[c] - (int)(want[c] < 0 ? 0 : want[c] > 255 ? 255 : want[c] + 0.5));
+                worst = error > worst ? error : worst;
+            }
+        }
+    }
+
+    return worst;
+}
+
+/* Each kernel, on every variant and on rows starting and ending at odd
+ * pixels, must give the same bytes as the reference.
+ */
+static int validate(const bench_frame *frame)
+{
+    static const unsigned int fourccs[] = { H264_FOURCC_NV12, H264_FOURCC_YU12 };
+    static const int spans[][2] = { { 0, 0 }, { 1, 0 }, { 3, 17 }, { 2, 15 }, { 5, 1 } };
+    unsigned int color, f, s;
+    int k, blend, order, x, width, size = frame->width * frame->height * 4, failed = 0;
+
+    for (color = 0; color < 4; color++) {
+        printf("reference, color %u: max error %d\n", color, reference_error(color));
+    }
+
+    for (k = 1; k < num_kernels; k++) {
+        for (color = 0; color < 4; color++) {
+            for (f = 0; f < 2; f++) {
+                for (blend = 0; blend < 2; blend++) {
+                    for (order = CONVERT_BGRA; order <= CONVERT_RGBA; order++) {
+                        for (s = 0; s < sizeof(spans) / sizeof(spans[0]); s++) {
+                            x = spans[s][0];
+                            width = spans[s][1] ? spans[s][1] : frame->width - x;
+
+                            memset(frame->reference, 0, size);
+                            memset(frame->dst, 0, size);
+                            convert_frame(convert_row_c, frame, fourccs[f], blend, convert_coefs_for(color),
+                                          order, x, width, frame->reference);
+                            convert_frame(kernels[k].row, frame, fourccs[f], blend, convert_coefs_for(color),
+                                          order, x, width, frame->dst);
+
+                            if (memcmp(frame->reference, frame->dst, size) != 0) {
+                                printf("%s differs: color %u, %s, blend %d, order %d, x %d, width %d\n",
+                                       kernels[k].name, color, f ? "yu12" : "nv12", blend, order, x, width);
+                                failed = 1;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    return failed ? -1 : 0;
+}
+
+/***************************************************************************
+*   Timing.
+****************************************************************************/
+
+static void time_kernels(const bench_frame *frame, double seconds)
+{
+    static const unsigned int fourccs[] = { H264_FOURCC_NV12, H264_FOURCC_YU12 };
+    const convert_coefs *coefs = convert_coefs_for(0);
+    double start, elapsed;
+    unsigned int f;
+    int k, blend, passes;
+
+    for (k = 0; k < num_kernels; k++) {
+        for (f = 0; f < 2; f++) {
+            for (blend = 0; blend < 2; blend++) {
+                /* One pass to warm the caches and the branch predictors. */
+                convert_frame(kernels[k].row, frame, fourccs[f], blend, coefs, CONVERT_BGRA, 0, frame->width,
+                              frame->dst);
+
+                passes = 0;
+                start = now();
+                do {
+                    convert_frame(kernels[k].row, frame, fourccs[f], blend, coefs, CONVERT_BGRA, 0,
+                                  frame->width, frame->dst);
+                    passes++;
+                    elapsed = now() - start;
+                } while (elapsed < seconds);
+
+                printf("%-6s %s %-8s %8.1f Mpixel/s\n", kernels[k].name, f ? "yu12" : "nv12",
+                       blend ? "blend" : "no-blend", (double)frame->width * frame->height * passes / elapsed / 1e6);
+            }
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    bench_frame frame;
+    double seconds = 1;
+    int width = 1920, height = 1080, opt;
+
+    while ((opt = getopt(argc, argv, "w:h:t:")) != -1) {
+        switch (opt) {
+        case 'w':
+            width = atoi(optarg);
+            break;
+        case 'h':
+            height = atoi(optarg);
+            break;
+        case 't':
+            seconds = atof(optarg);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-w width] [-h height] [-t seconds per kernel]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    /* Whole macroblocks, wide enough for the odd spans checked. */
+    width = width < 32 ? 32 : width & ~15;
+    height = height < 2 ? 2 : height & ~1;
+    if (alloc_frame(&frame, width, height) != 0) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    fill_frame(&frame);
+
+    kernels[num_kernels].name = "c";
+    kernels[num_kernels++].row = convert_row_c;
+#ifdef HAVE_NEON
+    if (convert_neon_usable()) {
+        kernels[num_kernels].name = "neon";
+        kernels[num_kernels++].row = convert_row_neon;
+    }
+#endif
+
+    if (validate(&frame) != 0) {
+        return 1;
+    }
+    printf("%d kernels match the reference; %dx%d frame\n", num_kernels, width, height);
+
+    time_kernels(&frame, seconds);
+
+    return 0;
+}
@@ -0,0 +1,122 @@
+/***************************************************************************
+*
+*   convert_neon.c
+*
+*   The NEON row kernel for convert_compose(), bit exact with
+*   convert_row_c(). Built with HAVE_NEON=1.
+*
+****************************************************************************/
+
+#ifdef HAVE_NEON
+
+#include <arm_neon.h>
+#if defined(__arm__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+#include "convert.h"
+
+int convert_neon_usable(void)
+{
+#if defined(__arm__)
+    return (getauxval(AT_HWCAP) & HWCAP_NEON) != 0;
+#else
+    /* Always there on AArch64. */
+    return 1;
+#endif
+}
+
+/* Luma of 8 pixels, as l in convert.h. */
+static int16x8_t luma_term(uint8x8_t y, const convert_coefs *coefs)
+{
+    uint16x8_t scaled = vshrq_n_u16(vmull_u8(y, vdup_n_u8(coefs->luma)), 1);
+
+    return vsubq_s16(vreinterpretq_s16_u16(scaled), vdupq_n_s16(coefs->bias));
+}
+
+/* "over" blended onto "under" by "alpha": the exact division by 255 of
+ * convert_row_c(), as (t + ((t + 128) >> 8) + 128) >> 8.
+ */
+static uint8x16_t blend(uint8x16_t over, uint8x16_t under, uint8x16_t alpha)
+{
+    uint8x16_t inverse = vmvnq_u8(alpha);
+    uint16x8_t low = vmlal_u8(vmull_u8(vget_low_u8(over), vget_low_u8(alpha)), vget_low_u8(under),
+                              vget_low_u8(inverse));
+    uint16x8_t high = vmlal_u8(vmull_u8(vget_high_u8(over), vget_high_u8(alpha)), vget_high_u8(under),
+                               vget_high_u8(inverse));
+
+    return vcombine_u8(vraddhn_u16(low, vrshrq_n_u16(low, 8)), vraddhn_u16(high, vrshrq_n_u16(high, 8)));
+}
+
+/* 16 pixels from "x", which is even. */
+static void convert_16(const convert_row *row, int x, const convert_coefs *coefs, int order)
+{
+    uint8x16_t luma = vld1q_u8(row->luma + x);
+    uint8x8x2_t uv;
+    uint8x16_t r, g, b;
+    uint8x16x4_t out;
+    int16x8_t u, v, red, green, blue, low, high;
+    int16x8x2_t red2, green2, blue2;
+
+    if (row->v) {
+        uv.val[0] = vld1_u8(row->u + x / 2);
+        uv.val[1] = vld1_u8(row->v + x / 2);
+    } else {
+        uv = vld2_u8(row->u + x);
+    }
+    u = vreinterpretq_s16_u16(vsubl_u8(uv.val[0], vdup_n_u8(128)));
+    v = vreinterpretq_s16_u16(vsubl_u8(uv.val[1], vdup_n_u8(128)));
+
+    /* Chroma terms for 8 pixel pairs, doubled up to one per pixel. */
+    red = vmulq_n_s16(v, coefs->vr);
+    green = vmlaq_n_s16(vmulq_n_s16(u, coefs->ug), v, coefs->vg);
+    blue = vmulq_n_s16(u, coefs->ub);
+    red2 = vzipq_s16(red, red);
+    green2 = vzipq_s16(green, green);
+    blue2 = vzipq_s16(blue, blue);
+
+    low = luma_term(vget_low_u8(luma), coefs);
+    high = luma_term(vget_high_u8(luma), coefs);
+    r = vcombine_u8(vqshrun_n_s16(vqaddq_s16(low, red2.val[0]), 6), vqshrun_n_s16(vqaddq_s16(high, red2.val[1]), 6));
+    g = vcombine_u8(vqshrun_n_s16(vqsubq_s16(low, green2.val[0]), 6),
+                    vqshrun_n_s16(vqsubq_s16(high, green2.val[1]), 6));
+    b = vcombine_u8(vqshrun_n_s16(vqaddq_s16(low, blue2.val[0]), 6),
+                    vqshrun_n_s16(vqaddq_s16(high, blue2.val[1]), 6));
+
+    if (row->layer) {
+        /* Little endian ARGB words are B, G, R, A bytes. */
+        uint8x16x4_t layer = vld4q_u8((const unsigned char *)(row->layer + x));
+
+        r = blend(layer.val[2], r, layer.val[3]);
+        g = blend(layer.val[1], g, layer.val[3]);
+        b = blend(layer.val[0], b, layer.val[3]);
+    }
+
+    out.val[0] = order == CONVERT_BGRA ? b : r;
+    out.val[1] = g;
+    out.val[2] = order == CONVERT_BGRA ? r : b;
+    out.val[3] = vdupq_n_u8(0xff);
+    vst4q_u8(row->dst + x * 4, out);
+}
+
+void convert_row_neon(const convert_row *row, int x, int width, const convert_coefs *coefs, int order)
+{
+    int end = x + width;
+
+    /* Chroma pairs start on even pixels. */
+    if (x & 1 && width > 0) {
+        convert_row_c(row, x, 1, coefs, order);
+        x++;
+    }
+
+    for (; x + 16 <= end; x += 16) {
+        convert_16(row, x, coefs, order);
+    }
+
+    if (x < end) {
+        convert_row_c(row, x, end - x, coefs, order);
+    }
+}
+
+#endif /* HAVE_NEON */
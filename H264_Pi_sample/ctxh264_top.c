@@ -0,0 +1,274 @@
+/***************************************************************************
+*
+*   ctxh264_top.c
+*
+*   Shows the statistics every context of the plugin publishes (see
+*   metrics.h), refreshed like top:
+*
+*       make ctxh264_top.bin
+*       ./ctxh264_top.bin [-d seconds] [-n iterations] [-b]
+*
+*   -b prints one report after another rather than redrawing the screen.
+*
+****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "metrics.h"
+
+#define SHM_DIR         "/dev/shm"
+#define MAX_CONTEXTS    32
+
+/* Tries at a consistent copy before a block is given up on for this round. */
+#define READ_TRIES      1000
+
+/* What the rates are worked out from. */
+typedef struct _sample {
+    char            name[64];
+    uint64_t        updated;
+    uint64_t        frames;
+    uint64_t        displayed;
+    uint64_t        bytes;
+    int             seen;
+} sample;
+
+static sample samples[MAX_CONTEXTS];
+
+static const char *stage_names[LATENCY_STAGES] = {
+    "total", "first_submit", "last_submit", "consumed", "decoded", "displayed"
+};
+
+static const char *class_names[ANALYZE_CLASSES] = {
+    "IDR", "I", "P", "B"
+};
+
+/* Copies "size" bytes of the block at "shared" into "copy", retrying while
+ * the writer is in the middle of an update. Fields the writer's version
+ * doesn't have are left 0.
+ */
+static int read_block(const volatile metrics_block *shared, size_t size, metrics_block *copy)
+{
+    uint32_t sequence;
+    int i;
+
+    memset(copy, 0, sizeof(metrics_block));
+    size = size < sizeof(metrics_block) ? size : sizeof(metrics_block);
+
+    for (i = 0; i < READ_TRIES; i++) {
+        sequence = shared->sequence;
+        __sync_synchronize();
+        if (sequence & 1) {
+            usleep(10);
+            continue;
+        }
+
+        memcpy(copy, (const void *)shared, size);
+        __sync_synchronize();
+        if (shared->sequence == sequence) {
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+/* Reads the block in /dev/shm/"name". Returns -1 if it isn't one, or its
+ * process has gone without removing it.
+ */
+static int load_block(const char *name, metrics_block *copy)
+{
+    char path[300];
+    struct stat st;
+    void *shared;
+    int fd, ret;
+
+    snprintf(path, sizeof(path), SHM_DIR "/%s", name);
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)offsetof(metrics_block, frames)) {
+        close(fd);
+        return -1;
+    }
+
+    shared = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (shared == MAP_FAILED) {
+        return -1;
+    }
+
+    ret = read_block(shared, st.st_size, copy);
+    munmap(shared, st.st_size);
+
+    if (ret != 0 || memcmp(copy->magic, METRICS_MAGIC, sizeof(copy->magic)) != 0 || copy->closed ||
+        (kill(copy->pid, 0) != 0 && errno == ESRCH)) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/* The sample kept for "name", or a free one. */
+static sample *find_sample(const char *name)
+{
+    sample *free_sample = NULL;
+    int i;
+
+    for (i = 0; i < MAX_CONTEXTS; i++) {
+        if (samples[i].name[0] && strcmp(samples[i].name, name) == 0) {
+            return &samples[i];
+        }
+        if (!samples[i].name[0] && !free_sample) {
+            free_sample = &samples[i];
+        }
+    }
+
+    if (free_sample) {
+        memset(free_sample, 0, sizeof(sample));
+        snprintf(free_sample->name, sizeof(free_sample->name), "%s", name);
+    }
+
+    return free_sample;
+}
+
+static double rate(uint64_t now, uint64_t then, double seconds)
+{
+    return seconds > 0 && now >= then ? (now - then) / seconds : 0;
+}
+
+static void print_block(const char *name, const metrics_block *block)
+{
+    sample *last = find_sample(name);
+    double seconds = 0, fps = 0, shown = 0, mbits = 0;
+    int i;
+
+    if (last) {
+        if (last->updated && block->updated > last->updated) {
+            seconds = (block->updated - last->updated) / 1e9;
+            fps = rate(block->frames, last->frames, seconds);
+            shown = rate(block->displayed, last->displayed, seconds);
+            mbits = rate(block->bytes, last->bytes, seconds) * 8 / 1e6;
+        }
+        last->updated = block->updated;
+        last->frames = block->frames;
+        last->displayed = block->displayed;
+        last->bytes = block->bytes;
+        last->seen = 1;
+    }
+
+    printf("%6u %3u %-8.8s %4ux%-4u %5.1f %5.1f %6.2f %8llu %8llu %5u %6u %5u %5u %4u %4u %7u %9.1f%s\n",
+           block->pid, block->context, block->backend, block->width, block->height, fps, shown, mbits,
+           (unsigned long long)block->frames, (unsigned long long)block->decoded, block->queue_depth,
+           block->input_stalls, block->shed_frames, block->dropped_frames, block->errors, block->resets,
+           block->lossless_objects, block->overlay_bytes / 1e6, block->recovering ? " recovering" : "");
+
+    for (i = 0; i < LATENCY_STAGES; i++) {
+        const metrics_latency *latency = &block->latency[i];
+
+        if (latency->count) {
+            printf("           %-12s %8u frames  p50 %7.1fms  p99 %7.1fms  p99.9 %7.1fms  max %7.1fms\n",
+                   stage_names[i], latency->count, latency->p50 / 1000.0, latency->p99 / 1000.0,
+                   latency->p999 / 1000.0, latency->max / 1000.0);
+        }
+    }
+
+    /* Zeroed by read_block() for plugins older than version 2. */
+    for (i = 0; i < ANALYZE_CLASSES; i++) {
+        const metrics_frames *frames = &block->frame_classes[i];
+
+        if (frames->frames) {
+            printf("           %-3s frames %8u  %7.1fKB (max %7.1f)  %5.1f slices (max %3u)  decode p50 %7.1fms  "
+                   "p99 %7.1fms  max %7.1fms\n", class_names[i], frames->frames,
+                   frames->bytes / 1024.0 / frames->frames, frames->max_bytes / 1024.0,
+                   (double)frames->slices / frames->frames, frames->max_slices, frames->decode.p50 / 1000.0,
+                   frames->decode.p99 / 1000.0, frames->decode.max / 1000.0);
+        }
+    }
+}
+
+static void report(int batch)
+{
+    metrics_block block;
+    struct dirent *entry;
+    DIR *dir;
+    int i, found = 0;
+
+    if (!batch) {
+        printf("\033[H\033[2J");
+    }
+
+    for (i = 0; i < MAX_CONTEXTS; i++) {
+        samples[i].seen = 0;
+    }
+
+    printf("   PID CTX BACKEND  SIZE        FPS  SHOWN MBIT/S   FRAMES  DECODED QUEUE STALLS  SHED  DROP  ERR RSET OBJECTS OVERLAYMB\n");
+
+    dir = opendir(SHM_DIR);
+    while (dir && (entry = readdir(dir))) {
+        if (strncmp(entry->d_name, METRICS_PREFIX, strlen(METRICS_PREFIX)) == 0 &&
+            load_block(entry->d_name, &block) == 0) {
+            print_block(entry->d_name, &block);
+            found++;
+        }
+    }
+    if (dir) {
+        closedir(dir);
+    }
+
+    if (!found) {
+        printf("(no contexts)\n");
+    }
+    printf("\n");
+    fflush(stdout);
+
+    /* Forget contexts that have closed. */
+    for (i = 0; i < MAX_CONTEXTS; i++) {
+        if (!samples[i].seen) {
+            samples[i].name[0] = '\0';
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    double delay = 1;
+    int iterations = -1, batch = 0, opt;
+
+    while ((opt = getopt(argc, argv, "d:n:b")) != -1) {
+        switch (opt) {
+        case 'd':
+            delay = atof(optarg);
+            break;
+        case 'n':
+            iterations = atoi(optarg);
+            break;
+        case 'b':
+            batch = 1;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-d seconds] [-n iterations] [-b]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    while (iterations < 0 || iterations-- > 0) {
+        report(batch);
+        if (iterations != 0) {
+            usleep(delay * 1000000);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,980 @@
+/***************************************************************************
+*
+*   drm_presenter.c
+*
+*   DRM/KMS presenter. Decoded frames are scanned out of the decoder's
+*   DMABUFs on an overlay plane, with the lossless layer on an ARGB plane
+*   above it, both changed at once by atomic commits. Nothing is copied but
+*   the lossless rectangles that changed, and the out-fence of each commit
+*   says when it reached the screen. Runs on vkms, for testing without a
+*   display.
+*
+****************************************************************************/
+
+#include "video_gl.h"
+
+#ifdef HAVE_DRM
+
+#include <dirent.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#include <drm_fourcc.h>
+
+#include "presenter.h"
+#include "overlay.h"
+
+#define DRM_DEVICE_ENV      "CTX_H264_DRM_DEVICE"
+
+/* Framebuffers made for decoded frames, kept while the decoder reuses its
+ * buffers.
+ */
+#define DRM_FB_CACHE        32
+
+/* A flip not done after this long is given up on. */
+#define DRM_FLIP_TIMEOUT_MS 1000
+
+typedef enum _drm_prop {
+    PROP_FB_ID = 0,
+    PROP_CRTC_ID,
+    PROP_SRC_X,
+    PROP_SRC_Y,
+    PROP_SRC_W,
+    PROP_SRC_H,
+    PROP_CRTC_X,
+    PROP_CRTC_Y,
+    PROP_CRTC_W,
+    PROP_CRTC_H,
+    PROP_ZPOS,
+    PLANE_PROPS
+} drm_prop;
+
+static const char *plane_prop_names[PLANE_PROPS] = {
+    "FB_ID", "CRTC_ID", "SRC_X", "SRC_Y", "SRC_W", "SRC_H", "CRTC_X", "CRTC_Y", "CRTC_W", "CRTC_H", "zpos"
+};
+
+typedef struct _drm_plane {
+    uint32_t            id;
+    uint32_t            props[PLANE_PROPS];     /* 0 if absent. */
+    int                 zpos_mutable;
+    uint64_t            zpos;
+} drm_plane;
+
+/* A dumb buffer, mapped. */
+typedef struct _drm_dumb {
+    uint32_t            handle;
+    uint32_t            fb_id;
+    uint32_t            pitch;
+    uint64_t            size;
+    unsigned char      *map;
+} drm_dumb;
+
+typedef struct _drm_fb {
+    unsigned int        id;                     /* H264_frame id, 0 if free. */
+    uint32_t            fb_id;
+    uint32_t            handles[H264_FRAME_MAX_PLANES];
+    unsigned long       used;
+} drm_fb;
+
+typedef struct _DRM_presenter {
+    int                 fd;
+    int                 width;
+    int                 height;
+
+    uint32_t            connector_id;
+    uint32_t            crtc_id;
+    drmModeModeInfo     mode;
+    uint32_t            mode_blob;              /* Set until the first commit, if it modesets. */
+    drm_dumb            background;             /* Primary plane content when modesetting. */
+    uint32_t            primary_id;
+
+    uint32_t            connector_crtc_prop;
+    uint32_t            crtc_active_prop;
+    uint32_t            crtc_mode_prop;
+    uint32_t            crtc_fence_prop;
+
+    drm_plane           video;
+    drm_plane           lossless;
+
+    /* The lossless layer, double buffered. Compositing goes to the back
+     * buffer, which is first brought up to date with what changed in the
+     * front one.
+     */
+    drm_dumb            layer[2];
+    H264_overlay        overlay[2];
+    int                 front;
+    int                 composing;              /* The back buffer has changed. */
+
+    drm_fb              fbs[DRM_FB_CACHE];
+    unsigned long       fb_clock;
+
+    int                 active;                 /* The planes are in use. */
+    H264_frame         *shown;                  /* Scanned out. */
+    H264_frame         *queued;                 /* In the commit pending. */
+    int                 lossless_queued;        /* The commit pending flips the layer. */
+
+    /* The commit in flight is waited on by a thread, which sets "pushed"
+     * as soon as its fence signals.
+     */
+    pthread_t           waiter;
+    pthread_mutex_t     lock;
+    pthread_cond_t      cond;
+    int                 pending;
+    int                 fence;
+    H264_latency       *latency;                /* Of a frame the commit shows first, if any. */
+    unsigned long long  timestamp;
+    bool               *pushed;
+    int                 failed;
+    int                 quit;
+} DRM_presenter;
+
+/***************************************************************************
+*   Device and pipeline discovery.
+****************************************************************************/
+
+static uint32_t find_property(int fd, uint32_t object, uint32_t type, const char *name, uint64_t *value,
+                              int *immutable)
+{
+    drmModeObjectPropertiesPtr props = drmModeObjectGetProperties(fd, object, type);
+    drmModePropertyPtr prop;
+    uint32_t id = 0;
+    unsigned int i;
+
+    for (i = 0; props && !id && i < props->count_props; i++) {
+        prop = drmModeGetProperty(fd, props->props[i]);
+        if (prop && strcmp(prop->name, name) == 0) {
+            id = prop->prop_id;
+            if (value) {
+                *value = props->prop_values[i];
+            }
+            if (immutable) {
+                *immutable = (prop->flags & DRM_MODE_PROP_IMMUTABLE) != 0;
+            }
+        }
+        drmModeFreeProperty(prop);
+    }
+
+    drmModeFreeObjectProperties(props);
+
+    return id;
+}
+
+static int plane_has_format(drmModePlanePtr plane, uint32_t format)
+{
+    unsigned int i;
+
+    for (i = 0; i < plane->count_formats; i++) {
+        if (plane->formats[i] == format) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static void get_plane(int fd, uint32_t id, drm_plane *plane)
+{
+    int immutable = 1;
+    int i;
+
+    memset(plane, 0, sizeof(drm_plane));
+    plane->id = id;
+
+    for (i = 0; i < PLANE_PROPS; i++) {
+        plane->props[i] = find_property(fd, id, DRM_MODE_OBJECT_PLANE, plane_prop_names[i],
+                                        i == PROP_ZPOS ? &plane->zpos : NULL,
+                                        i == PROP_ZPOS ? &immutable : NULL);
+    }
+
+    plane->zpos_mutable = plane->props[PROP_ZPOS] && !immutable;
+}
+
+/*  Picks a connected connector and the CRTC driving it, or one that can.
+ *  The current mode is kept; an idle CRTC gets the connector's preferred
+ *  mode, set with the first commit.
+ */
+static int find_pipe(DRM_presenter *drm, int *crtc_index)
+{
+    drmModeResPtr res = drmModeGetResources(drm->fd);
+    drmModeConnectorPtr connector = NULL;
+    drmModeEncoderPtr encoder;
+    drmModeCrtcPtr crtc;
+    int i, j, found = 0;
+
+    if (!res) {
+        return -1;
+    }
+
+    for (i = 0; !found && i < res->count_connectors; i++) {
+        connector = drmModeGetConnector(drm->fd, res->connectors[i]);
+        if (!connector) {
+            continue;
+        }
+
+        for (j = 0; connector->connection == DRM_MODE_CONNECTED && !found && j < connector->count_encoders; j++) {
+            encoder = drmModeGetEncoder(drm->fd, connector->encoders[j]);
+            if (!encoder) {
+                continue;
+            }
+
+            for (*crtc_index = 0; !found && *crtc_index < res->count_crtcs; (*crtc_index)++) {
+                if (encoder->crtc_id ? res->crtcs[*crtc_index] == encoder->crtc_id :
+                                       (encoder->possible_crtcs & (1 << *crtc_index)) != 0) {
+                    found = 1;
+                    drm->crtc_id = res->crtcs[*crtc_index];
+                    drm->connector_id = connector->connector_id;
+                }
+            }
+            drmModeFreeEncoder(encoder);
+        }
+
+        if (found) {
+            (*crtc_index)--;
+
+            crtc = drmModeGetCrtc(drm->fd, drm->crtc_id);
+            if (crtc && crtc->mode_valid) {
+                drm->mode = crtc->mode;
+            } else if (connector->count_modes > 0) {
+                drm->mode = connector->modes[0];
+                for (j = 0; j < connector->count_modes; j++) {
+                    if (connector->modes[j].type & DRM_MODE_TYPE_PREFERRED) {
+                        drm->mode = connector->modes[j];
+                        break;
+                    }
+                }
+                if (drmModeCreatePropertyBlob(drm->fd, &drm->mode, sizeof(drm->mode), &drm->mode_blob) != 0) {
+                    found = 0;
+                }
+            } else {
+                found = 0;
+            }
+            drmModeFreeCrtc(crtc);
+        }
+
+        drmModeFreeConnector(connector);
+    }
+
+    drmModeFreeResources(res);
+
+    return found ? 0 : -1;
+}
+
+/*  The video goes on an overlay plane taking NV12, the lossless layer on
+ *  an ARGB one above it. The primary plane is only used for a black
+ *  background when the presenter sets the mode.
+ */
+static int find_planes(DRM_presenter *drm, int crtc_index)
+{
+    drmModePlaneResPtr res = drmModeGetPlaneResources(drm->fd);
+    drmModePlanePtr plane;
+    uint64_t type;
+    uint32_t id;
+    unsigned int i;
+
+    if (!res) {
+        return -1;
+    }
+
+    for (i = 0; i < res->count_planes; i++) {
+        plane = drmModeGetPlane(drm->fd, res->planes[i]);
+        if (!plane) {
+            continue;
+        }
+
+        id = plane->plane_id;
+        if ((plane->possible_crtcs & (1 << crtc_index)) &&
+            find_property(drm->fd, id, DRM_MODE_OBJECT_PLANE, "type", &type, NULL)) {
+            if (type == DRM_PLANE_TYPE_PRIMARY && !drm->primary_id) {
+                drm->primary_id = id;
+            } else if (type == DRM_PLANE_TYPE_OVERLAY && !drm->video.id &&
+                       plane_has_format(plane, DRM_FORMAT_NV12)) {
+                get_plane(drm->fd, id, &drm->video);
+            } else if (type == DRM_PLANE_TYPE_OVERLAY && !drm->lossless.id &&
+                       plane_has_format(plane, DRM_FORMAT_ARGB8888)) {
+                get_plane(drm->fd, id, &drm->lossless);
+            }
+        }
+
+        drmModeFreePlane(plane);
+    }
+
+    drmModeFreePlaneResources(res);
+
+    if (!drm->video.id || !drm->lossless.id) {
+        DEBUG_TRACE("No NV12 and ARGB overlay planes\n");
+        return -1;
+    }
+
+    /* Planes without zpos stack in the order they are listed. */
+    if (drm->video.zpos_mutable && drm->lossless.zpos_mutable) {
+        drm->lossless.zpos = max(drm->lossless.zpos, drm->video.zpos + 1);
+    } else if (drm->video.props[PROP_ZPOS] && drm->lossless.props[PROP_ZPOS] &&
+               drm->lossless.zpos <= drm->video.zpos) {
+        DEBUG_TRACE("ARGB plane is below the video plane\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+static int open_device(DRM_presenter *drm)
+{
+    char *name = getenv(DRM_DEVICE_ENV);
+    char path[300];
+    DIR *dir;
+    struct dirent *entry;
+
+    if (name) {
+        drm->fd = open(name, O_RDWR | O_CLOEXEC);
+        return drm->fd >= 0 ? 0 : -1;
+    }
+
+    dir = opendir("/dev/dri");
+    if (!dir) {
+        return -1;
+    }
+
+    /* The first card that does atomic modesetting and has a display. */
+    while (drm->fd < 0 && (entry = readdir(dir)) != NULL) {
+        if (strncmp(entry->d_name, "card", 4) != 0) {
+            continue;
+        }
+
+        snprintf(path, sizeof(path), "/dev/dri/%s", entry->d_name);
+        drm->fd = open(path, O_RDWR | O_CLOEXEC);
+        if (drm->fd < 0) {
+            continue;
+        }
+
+        if (drmSetClientCap(drm->fd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1) != 0 ||
+            drmSetClientCap(drm->fd, DRM_CLIENT_CAP_ATOMIC, 1) != 0) {
+            close(drm->fd);
+            drm->fd = -1;
+            continue;
+        }
+
+        DEBUG_TRACE("Using %s\n", path);
+    }
+
+    closedir(dir);
+
+    return drm->fd >= 0 ? 0 : -1;
+}
+
+/***************************************************************************
+*   Buffers.
+****************************************************************************/
+
+static void destroy_dumb(DRM_presenter *drm, drm_dumb *dumb)
+{
+    struct drm_mode_destroy_dumb destroy;
+
+    if (dumb->map) {
+        munmap(dumb->map, dumb->size);
+        dumb->map = NULL;
+    }
+    if (dumb->fb_id) {
+        drmModeRmFB(drm->fd, dumb->fb_id);
+        dumb->fb_id = 0;
+    }
+    if (dumb->handle) {
+        memset(&destroy, 0, sizeof(destroy));
+        destroy.handle = dumb->handle;
+        drmIoctl(drm->fd, DRM_IOCTL_MODE_DESTROY_DUMB, &destroy);
+        dumb->handle = 0;
+    }
+}
+
+/* A cleared, mapped dumb buffer, with a framebuffer of "format". */
+static int create_dumb(DRM_presenter *drm, drm_dumb *dumb, unsigned int width, unsigned int height,
+                       uint32_t format)
+{
+    struct drm_mode_create_dumb create;
+    struct drm_mode_map_dumb map;
+    uint32_t handles[4] = { 0 }, pitches[4] = { 0 }, offsets[4] = { 0 };
+    void *mem;
+
+    memset(&create, 0, sizeof(create));
+    create.width = width;
+    create.height = height;
+    create.bpp = 32;
+    if (drmIoctl(drm->fd, DRM_IOCTL_MODE_CREATE_DUMB, &create) != 0) {
+        DEBUG_TRACE("Failed to create a %ux%u dumb buffer, errno=%d\n", width, height, errno);
+        return -1;
+    }
+    dumb->handle = create.handle;
+    dumb->pitch = create.pitch;
+    dumb->size = create.size;
+
+    memset(&map, 0, sizeof(map));
+    map.handle = dumb->handle;
+    if (drmIoctl(drm->fd, DRM_IOCTL_MODE_MAP_DUMB, &map) != 0) {
+        destroy_dumb(drm, dumb);
+        return -1;
+    }
+
+    mem = mmap(NULL, dumb->size, PROT_READ | PROT_WRITE, MAP_SHARED, drm->fd, map.offset);
+    if (mem == MAP_FAILED) {
+        destroy_dumb(drm, dumb);
+        return -1;
+    }
+    dumb->map = mem;
+    memset(dumb->map, 0, dumb->size);
+
+    handles[0] = dumb->handle;
+    pitches[0] = dumb->pitch;
+    if (drmModeAddFB2(drm->fd, width, height, format, handles, pitches, offsets, &dumb->fb_id, 0) != 0) {
+        destroy_dumb(drm, dumb);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void free_fb(DRM_presenter *drm, drm_fb *fb)
+{
+    struct drm_gem_close gem_close;
+    unsigned int i, j;
+
+    if (fb->fb_id) {
+        drmModeRmFB(drm->fd, fb->fb_id);
+    }
+
+    /* Planes sharing a buffer share its handle. */
+    for (i = 0; i < H264_FRAME_MAX_PLANES; i++) {
+        for (j = 0; j < i && fb->handles[i] && fb->handles[j] != fb->handles[i]; j++) {
+        }
+        if (fb->handles[i] && j == i) {
+            memset(&gem_close, 0, sizeof(gem_close));
+            gem_close.handle = fb->handles[i];
+            drmIoctl(drm->fd, DRM_IOCTL_GEM_CLOSE, &gem_close);
+        }
+    }
+
+    memset(fb, 0, sizeof(drm_fb));
+}
+
+/*  The framebuffer scanning out "frame", made from its DMABUFs the first
+ *  time it is seen. Frames on screen or queued are never evicted.
+ *
+ *  Returns:
+ *       the framebuffer id, or 0 if the frame can't be imported.
+ */
+static uint32_t frame_fb(DRM_presenter *drm, H264_frame *frame)
+{
+    uint32_t handles[4] = { 0 }, pitches[4] = { 0 }, offsets[4] = { 0 };
+    drm_fb *fb, *victim = NULL;
+    int i;
+
+    for (i = 0; i < DRM_FB_CACHE; i++) {
+        fb = &drm->fbs[i];
+        if (fb->id == frame->id) {
+            fb->used = ++drm->fb_clock;
+            return fb->fb_id;
+        }
+
+        if ((drm->shown && fb->id == drm->shown->id) || (drm->queued && fb->id == drm->queued->id)) {
+            continue;
+        }
+        if (!victim || fb->used < victim->used) {
+            victim = fb;
+        }
+    }
+
+    if (victim->id) {
+        free_fb(drm, victim);
+    }
+
+    for (i = 0; i < frame->num_planes; i++) {
+        if (frame->dmabuf[i] < 0 || drmPrimeFDToHandle(drm->fd, frame->dmabuf[i], &handles[i]) != 0) {
+            DEBUG_TRACE("Failed to import frame %u plane %d, errno=%d\n", frame->id, i, errno);
+            memcpy(victim->handles, handles, sizeof(victim->handles));
+            free_fb(drm, victim);
+            return 0;
+        }
+        pitches[i] = frame->pitches[i];
+        offsets[i] = frame->offsets[i];
+    }
+    memcpy(victim->handles, handles, sizeof(victim->handles));
+
+    if (drmModeAddFB2(drm->fd, frame->width, frame->height, frame->fourcc, handles, pitches, offsets,
+                      &victim->fb_id, 0) != 0) {
+        DEBUG_TRACE("drmModeAddFB2 failed for frame %u, errno=%d\n", frame->id, errno);
+        free_fb(drm, victim);
+        return 0;
+    }
+
+    victim->id = frame->id;
+    victim->used = ++drm->fb_clock;
+
+    return victim->fb_id;
+}
+
+/***************************************************************************
+*   Commits.
+****************************************************************************/
+
+/* Waits for each commit's fence, and reports it done. */
+static void *flip_waiter(void *arg)
+{
+    DRM_presenter *drm = arg;
+    struct pollfd pfd;
+    int ret;
+
+    pthread_mutex_lock(&drm->lock);
+
+    while (!drm->quit) {
+        if (drm->fence < 0) {
+            pthread_cond_wait(&drm->cond, &drm->lock);
+            continue;
+        }
+
+        pfd.fd = drm->fence;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        pthread_mutex_unlock(&drm->lock);
+
+        do {
+            ret = poll(&pfd, 1, DRM_FLIP_TIMEOUT_MS);
+        } while (ret < 0 && errno == EINTR);
+
+        pthread_mutex_lock(&drm->lock);
+        if (ret <= 0) {
+            DEBUG_TRACE("Flip not done after %dms\n", DRM_FLIP_TIMEOUT_MS);
+            drm->failed = 1;
+        } else {
+            latency_stamp(drm->latency, drm->timestamp, LATENCY_DISPLAYED);
+        }
+        close(drm->fence);
+        drm->fence = -1;
+        drm->pending = 0;
+        if (drm->pushed) {
+            *drm->pushed = 1;
+            drm->pushed = NULL;
+            TRACE(TRACE_PUSHED, 0, 0, 0);
+        }
+        pthread_cond_broadcast(&drm->cond);
+    }
+
+    pthread_mutex_unlock(&drm->lock);
+
+    return NULL;
+}
+
+/*  Waits for the commit in flight, if any, then releases the frame it took
+ *  off the screen. Frames are only released here, on the caller's thread.
+ */
+static void finish_flip(DRM_presenter *drm)
+{
+    pthread_mutex_lock(&drm->lock);
+    while (drm->pending) {
+        pthread_cond_wait(&drm->cond, &drm->lock);
+    }
+    pthread_mutex_unlock(&drm->lock);
+
+    if (drm->queued) {
+        if (drm->shown && drm->shown != drm->queued) {
+            drm->shown->release(drm->shown);
+        }
+        drm->shown = drm->queued;
+        drm->queued = NULL;
+    }
+
+    if (drm->lossless_queued) {
+        drm->front ^= 1;
+        drm->lossless_queued = 0;
+    }
+}
+
+static void add_plane(drmModeAtomicReqPtr req, const drm_plane *plane, uint32_t crtc_id, uint32_t fb_id,
+                      const SIGNED_RECT *src, const SIGNED_RECT *dst)
+{
+    drmModeAtomicAddProperty(req, plane->id, plane->props[PROP_FB_ID], fb_id);
+    drmModeAtomicAddProperty(req, plane->id, plane->props[PROP_CRTC_ID], crtc_id);
+    drmModeAtomicAddProperty(req, plane->id, plane->props[PROP_SRC_X], (uint64_t)src->left << 16);
+    drmModeAtomicAddProperty(req, plane->id, plane->props[PROP_SRC_Y], (uint64_t)src->top << 16);
+    drmModeAtomicAddProperty(req, plane->id, plane->props[PROP_SRC_W], (uint64_t)(src->right - src->left) << 16);
+    drmModeAtomicAddProperty(req, plane->id, plane->props[PROP_SRC_H], (uint64_t)(src->bottom - src->top) << 16);
+    drmModeAtomicAddProperty(req, plane->id, plane->props[PROP_CRTC_X], dst->left);
+    drmModeAtomicAddProperty(req, plane->id, plane->props[PROP_CRTC_Y], dst->top);
+    drmModeAtomicAddProperty(req, plane->id, plane->props[PROP_CRTC_W], dst->right - dst->left);
+    drmModeAtomicAddProperty(req, plane->id, plane->props[PROP_CRTC_H], dst->bottom - dst->top);
+    if (plane->zpos_mutable) {
+        drmModeAtomicAddProperty(req, plane->id, plane->props[PROP_ZPOS], plane->zpos);
+    }
+}
+
+static void disable_plane(drmModeAtomicReqPtr req, const drm_plane *plane)
+{
+    drmModeAtomicAddProperty(req, plane->id, plane->props[PROP_FB_ID], 0);
+    drmModeAtomicAddProperty(req, plane->id, plane->props[PROP_CRTC_ID], 0);
+}
+
+/*  Where the context goes on screen: a window shows the part of the
+ *  context at its target offset, and without one the context goes at the
+ *  top left. Planes are not scaled, as not all can be. Seamless sessions
+ *  get their first window only, there being one plane each for the video
+ *  and the lossless layer. Returns 0 if nothing is visible.
+ */
+static int placement(const DRM_presenter *drm, struct window_info windows[], unsigned int num_windows,
+                     SIGNED_RECT *src, SIGNED_RECT *dst)
+{
+    int clip;
+
+    if (num_windows == 0) {
+        dst->left = 0;
+        dst->top = 0;
+        dst->right = drm->width;
+        dst->bottom = drm->height;
+        *src = *dst;
+    } else {
+        *dst = windows[0].rect;
+        src->left = windows[0].target_x;
+        src->top = windows[0].target_y;
+        src->right = src->left + (dst->right - dst->left);
+        src->bottom = src->top + (dst->bottom - dst->top);
+    }
+
+    /* Clip to the context and to the screen. */
+    clip = max(max(-src->left, -dst->left), 0);
+    src->left += clip;
+    dst->left += clip;
+    clip = max(max(-src->top, -dst->top), 0);
+    src->top += clip;
+    dst->top += clip;
+    clip = max(max(src->right - drm->width, dst->right - (int)drm->mode.hdisplay), 0);
+    src->right -= clip;
+    dst->right -= clip;
+    clip = max(max(src->bottom - drm->height, dst->bottom - (int)drm->mode.vdisplay), 0);
+    src->bottom -= clip;
+    dst->bottom -= clip;
+
+    return src->left < src->right && src->top < src->bottom;
+}
+
+/*  Commits the video plane showing "video" from "fb_id" and the lossless
+ *  plane showing layer "layer", both at "src" / "dst", with the mode if not
+ *  yet set. The out-fence goes to "*fence".
+ */
+static int commit(DRM_presenter *drm, const H264_frame *video, uint32_t fb_id, int layer, const SIGNED_RECT *src,
+                  const SIGNED_RECT *dst, unsigned int flags, int *fence)
+{
+    drmModeAtomicReqPtr req = drmModeAtomicAlloc();
+    SIGNED_RECT screen = { 0, 0, drm->mode.hdisplay, drm->mode.vdisplay };
+    SIGNED_RECT video_src = *src, video_dst = *dst;
+    int clip, ret;
+
+    if (!req) {
+        return -1;
+    }
+
+    if (drm->mode_blob) {
+        flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
+        drmModeAtomicAddProperty(req, drm->connector_id, drm->connector_crtc_prop, drm->crtc_id);
+        drmModeAtomicAddProperty(req, drm->crtc_id, drm->crtc_mode_prop, drm->mode_blob);
+        drmModeAtomicAddProperty(req, drm->crtc_id, drm->crtc_active_prop, 1);
+        if (drm->primary_id) {
+            drm_plane primary;
+
+            get_plane(drm->fd, drm->primary_id, &primary);
+            primary.zpos_mutable = 0;
+            add_plane(req, &primary, drm->crtc_id, drm->background.fb_id, &screen, &screen);
+        }
+    }
+
+    /* Decoded pictures can be smaller than the context. */
+    if (video) {
+        clip = max(video_src.right - (int)video->width, 0);
+        video_src.right -= clip;
+        video_dst.right -= clip;
+        clip = max(video_src.bottom - (int)video->height, 0);
+        video_src.bottom -= clip;
+        video_dst.bottom -= clip;
+    }
+    if (video && video_src.left < video_src.right && video_src.top < video_src.bottom) {
+        add_plane(req, &drm->video, drm->crtc_id, fb_id, &video_src, &video_dst);
+    } else if (video) {
+        disable_plane(req, &drm->video);
+    }
+    add_plane(req, &drm->lossless, drm->crtc_id, drm->layer[layer].fb_id, src, dst);
+
+    if (fence) {
+        *fence = -1;
+        drmModeAtomicAddProperty(req, drm->crtc_id, drm->crtc_fence_prop, (uint64_t)(uintptr_t)fence);
+    }
+
+    ret = drmModeAtomicCommit(drm->fd, req, flags, NULL);
+    drmModeAtomicFree(req);
+
+    if (ret != 0) {
+        DEBUG_TRACE("Atomic commit failed, errno=%d\n", errno);
+        return -1;
+    }
+
+    if (!(flags & DRM_MODE_ATOMIC_TEST_ONLY)) {
+        drm->active = 1;
+        if (drm->mode_blob) {
+            drmModeDestroyPropertyBlob(drm->fd, drm->mode_blob);
+            drm->mode_blob = 0;
+        }
+    }
+
+    return 0;
+}
+
+/* Makes the back buffer current before the first change of a frame. */
+static H264_overlay *back_layer(DRM_presenter *drm)
+{
+    H264_overlay *front, *back;
+
+    if (!drm->composing) {
+        /* Still scanned out until the commit in flight is done. */
+        finish_flip(drm);
+
+        front = &drm->overlay[drm->front];
+        back = &drm->overlay[drm->front ^ 1];
+        overlay_copy_dirty(back, front, &front->dirty);
+        overlay_clear_dirty(back);
+        drm->composing = 1;
+    }
+
+    return &drm->overlay[drm->front ^ 1];
+}
+
+/***************************************************************************
+*   Presenter interface.
+****************************************************************************/
+
+static void drm_close(void *ctx)
+{
+    DRM_presenter *drm = ctx;
+    int i;
+
+    if (!drm) {
+        return;
+    }
+
+    if (drm->waiter) {
+        finish_flip(drm);
+
+        pthread_mutex_lock(&drm->lock);
+        drm->quit = 1;
+        pthread_cond_broadcast(&drm->cond);
+        pthread_mutex_unlock(&drm->lock);
+        pthread_join(drm->waiter, NULL);
+    }
+
+    /* Take the planes down before their buffers go. */
+    if (drm->active) {
+        drmModeAtomicReqPtr req = drmModeAtomicAlloc();
+
+        if (req) {
+            disable_plane(req, &drm->video);
+            disable_plane(req, &drm->lossless);
+            drmModeAtomicCommit(drm->fd, req, 0, NULL);
+            drmModeAtomicFree(req);
+        }
+    }
+    if (drm->shown) {
+        drm->shown->release(drm->shown);
+    }
+
+    for (i = 0; i < DRM_FB_CACHE; i++) {
+        if (drm->fbs[i].id) {
+            free_fb(drm, &drm->fbs[i]);
+        }
+    }
+    destroy_dumb(drm, &drm->layer[0]);
+    destroy_dumb(drm, &drm->layer[1]);
+    destroy_dumb(drm, &drm->background);
+
+    if (drm->mode_blob) {
+        drmModeDestroyPropertyBlob(drm->fd, drm->mode_blob);
+    }
+
+    pthread_cond_destroy(&drm->cond);
+    pthread_mutex_destroy(&drm->lock);
+    close(drm->fd);
+    free(drm);
+}
+
+static void *drm_open(int width, int height, unsigned int frames)
+{
+    DRM_presenter *drm;
+    SIGNED_RECT src, dst;
+    int crtc_index, i;
+
+    /* Frames are scanned out where they were decoded. */
+    if (!(frames & PRESENTER_FRAMES_DMABUF)) {
+        return NULL;
+    }
+
+    drm = calloc(1, sizeof(DRM_presenter));
+    if (!drm) {
+        return NULL;
+    }
+
+    drm->fd = -1;
+    drm->fence = -1;
+    drm->width = width;
+    drm->height = height;
+    pthread_mutex_init(&drm->lock, NULL);
+    pthread_cond_init(&drm->cond, NULL);
+
+    if (open_device(drm) != 0) {
+        DEBUG_TRACE("No DRM device\n");
+        pthread_cond_destroy(&drm->cond);
+        pthread_mutex_destroy(&drm->lock);
+        free(drm);
+        return NULL;
+    }
+
+    if (drmSetClientCap(drm->fd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1) != 0 ||
+        drmSetClientCap(drm->fd, DRM_CLIENT_CAP_ATOMIC, 1) != 0 ||
+        find_pipe(drm, &crtc_index) != 0 || find_planes(drm, crtc_index) != 0) {
+        drm_close(drm);
+        return NULL;
+    }
+
+    drm->connector_crtc_prop = find_property(drm->fd, drm->connector_id, DRM_MODE_OBJECT_CONNECTOR, "CRTC_ID",
+                                             NULL, NULL);
+    drm->crtc_active_prop = find_property(drm->fd, drm->crtc_id, DRM_MODE_OBJECT_CRTC, "ACTIVE", NULL, NULL);
+    drm->crtc_mode_prop = find_property(drm->fd, drm->crtc_id, DRM_MODE_OBJECT_CRTC, "MODE_ID", NULL, NULL);
+    drm->crtc_fence_prop = find_property(drm->fd, drm->crtc_id, DRM_MODE_OBJECT_CRTC, "OUT_FENCE_PTR",
+                                         NULL, NULL);
+    if (!drm->crtc_fence_prop) {
+        DEBUG_TRACE("No out-fences\n");
+        drm_close(drm);
+        return NULL;
+    }
+
+    for (i = 0; i < 2; i++) {
+        if (create_dumb(drm, &drm->layer[i], width, height, DRM_FORMAT_ARGB8888) != 0) {
+            drm_close(drm);
+            return NULL;
+        }
+        overlay_init(&drm->overlay[i], drm->layer[i].map, drm->layer[i].pitch, width, height);
+    }
+
+    if (drm->mode_blob && drm->primary_id &&
+        create_dumb(drm, &drm->background, drm->mode.hdisplay, drm->mode.vdisplay, DRM_FORMAT_XRGB8888) != 0) {
+        drm_close(drm);
+        return NULL;
+    }
+
+    /* Fails if another client is the DRM master, e.g. an X server. */
+    if (!placement(drm, NULL, 0, &src, &dst) ||
+        commit(drm, NULL, 0, 0, &src, &dst, DRM_MODE_ATOMIC_TEST_ONLY, NULL) != 0) {
+        drm_close(drm);
+        return NULL;
+    }
+
+    if (pthread_create(&drm->waiter, NULL, flip_waiter, drm) != 0) {
+        drm->waiter = 0;
+        drm_close(drm);
+        return NULL;
+    }
+
+    DEBUG_TRACE("DRM presenter on CRTC %u, %ux%u, planes %u and %u\n", drm->crtc_id, drm->mode.hdisplay,
+                drm->mode.vdisplay, drm->video.id, drm->lossless.id);
+
+    return drm;
+}
+
+static int drm_compose_with_fb(void *ctx, struct image_buf *fb, SIGNED_RECT interesting_rects[],
+                               unsigned int num_rects)
+{
+    return overlay_compose_fb(back_layer(ctx), fb, interesting_rects, num_rects);
+}
+
+static int drm_compose_with_rects(void *ctx, struct image_buf objects[], unsigned int num_objects, bool last)
+{
+    return overlay_compose_rects(back_layer(ctx), objects, num_objects);
+}
+
+/*  Commits without blocking; the waiter sets "pushed" once the commit is
+ *  scanned out. Only one commit can be in flight, so a second present()
+ *  within a refresh waits for the first.
+ */
+static int drm_present(void *ctx, H264_frame *frame, const H264_dirty *damage, struct window_info windows[],
+                       unsigned int num_windows, bool wait, bool *pushed)
+{
+    DRM_presenter *drm = ctx;
+    SIGNED_RECT src, dst;
+    H264_frame *video;
+    uint32_t fb_id = 0;
+    int layer, fence, ret;
+
+    finish_flip(drm);
+
+    pthread_mutex_lock(&drm->lock);
+    ret = drm->failed ? -1 : 0;
+    drm->failed = 0;
+    pthread_mutex_unlock(&drm->lock);
+
+    if (pushed) {
+        *pushed = 1;
+    }
+
+    video = frame ? frame : drm->shown;
+    if (video) {
+        fb_id = frame_fb(drm, video);
+        if (!fb_id) {
+            return -1;
+        }
+    }
+    layer = drm->composing ? drm->front ^ 1 : drm->front;
+
+    if (!placement(drm, windows, num_windows, &src, &dst)) {
+        /* Off screen: there is nothing to wait for. */
+        if (frame) {
+            frame->release(frame);
+        }
+        return ret;
+    }
+
+    if (commit(drm, video, fb_id, layer, &src, &dst, DRM_MODE_ATOMIC_NONBLOCK, &fence) != 0) {
+        /* The frame isn't held; the back buffer stays the back buffer. */
+        return -1;
+    }
+
+    drm->queued = video;
+    drm->lossless_queued = drm->composing;
+    drm->composing = 0;
+
+    if (fence >= 0) {
+        pthread_mutex_lock(&drm->lock);
+        drm->pending = 1;
+        drm->fence = fence;
+        drm->latency = frame ? frame->latency : NULL;
+        drm->timestamp = frame ? frame->timestamp : 0;
+        drm->pushed = pushed;
+        if (pushed) {
+            *pushed = 0;
+        }
+        pthread_cond_broadcast(&drm->cond);
+        pthread_mutex_unlock(&drm->lock);
+    } else if (frame) {
+        /* Without a fence, committed is as near as it gets. */
+        latency_stamp(frame->latency, frame->timestamp, LATENCY_DISPLAYED);
+    }
+
+    if (wait) {
+        finish_flip(drm);
+    }
+
+    return ret;
+}
+
+const H264_presenter drm_presenter = {
+    "drm",
+    drm_open,
+    drm_compose_with_fb,
+    drm_compose_with_rects,
+    drm_present,
+    drm_close,
+};
+
+#endif /* HAVE_DRM */
@@ -0,0 +1,1063 @@
+/***************************************************************************
+*
+*   gles_presenter.c
+*
+*   OpenGL ES 2 presenter. Each present is one pass over the areas of the
+*   context that changed: the fragment shader samples the decoded frame,
+*   converting it from YUV, and blends the lossless layer over it, with the
+*   scissor keeping everything else as it was. Frames with DMABUFs are
+*   imported as external textures where EGL can; mapped frames, and the
+*   layer, are uploaded a dirty rectangle at a time. Draws to Receiver's
+*   window through EGL on X11, or off screen to a pbuffer, which runs on
+*   Mesa's llvmpipe for testing without a display or GPU.
+*
+****************************************************************************/
+
+#include "video_gl.h"
+
+#include <stdint.h>
+
+#include "presenter.h"
+#include "overlay.h"
+#include "convert.h"
+
+#define GLES_PBUFFER_ENV        "CTX_H264_GLES_PBUFFER"
+
+/* Textures made for DMABUF frames, kept while the decoder reuses its
+ * buffers.
+ */
+#define GLES_IMAGE_CACHE        32
+
+/* A draw not done after this long is given up on. */
+#define GLES_DRAW_TIMEOUT_MS    1000
+
+/* Texture units. */
+#define UNIT_LAYER              0
+#define UNIT_PLANES             1
+
+extern Display *GetICADisplay();
+
+/* How the frame is sampled, a program each. */
+typedef enum _gles_video {
+    VIDEO_NONE = 0,                             /* No frame yet: black. */
+    VIDEO_EXTERNAL,                             /* Imported, converted by the GPU's sampler. */
+    VIDEO_NV12,
+    VIDEO_YU12,
+    VIDEO_KINDS
+} gles_video;
+
+static const char *vertex_shader =
+    "attribute vec2 position;\n"
+    "uniform vec2 video_scale;\n"
+    "varying vec2 layer_coord;\n"
+    "varying vec2 video_coord;\n"
+    "void main() {\n"
+    "    layer_coord = vec2(position.x + 1.0, 1.0 - position.y) * 0.5;\n"
+    "    video_coord = layer_coord * video_scale;\n"
+    "    gl_Position = vec4(position, 0.0, 1.0);\n"
+    "}\n";
+
+/* The frame's colour encoding, with convert.c's coefficients: "luma" is
+ * the scale and offset, "chroma" the V to R, U and V to G and U to B
+ * factors. The layer is ARGB words, which are BGRA bytes; areas of the
+ * context outside the frame are black.
+ */
+static const char *fragment_common =
+    "#ifdef GL_FRAGMENT_PRECISION_HIGH\n"
+    "precision highp float;\n"
+    "#else\n"
+    "precision mediump float;\n"
+    "#endif\n"
+    "varying vec2 layer_coord;\n"
+    "varying vec2 video_coord;\n"
+    "uniform sampler2D layer;\n"
+    "uniform vec2 luma;\n"
+    "uniform vec4 chroma;\n"
+    "vec3 yuv(float y, vec2 uv) {\n"
+    "    y = luma.x * y - luma.y;\n"
+    "    uv -= 0.5020;\n"
+    "    return vec3(y + chroma.x * uv.y, y - chroma.y * uv.x - chroma.z * uv.y, y + chroma.w * uv.x);\n"
+    "}\n";
+
+static const char *fragment_video[VIDEO_KINDS] = {
+    "vec3 video() { return vec3(0.0); }\n",
+
+    "uniform samplerExternalOES plane0;\n"
+    "vec3 video() { return texture2D(plane0, video_coord).rgb; }\n",
+
+    "uniform sampler2D plane0;\n"
+    "uniform sampler2D plane1;\n"
+    "vec3 video() { return yuv(texture2D(plane0, video_coord).r, texture2D(plane1, video_coord).ra); }\n",
+
+    "uniform sampler2D plane0;\n"
+    "uniform sampler2D plane1;\n"
+    "uniform sampler2D plane2;\n"
+    "vec3 video() {\n"
+    "    return yuv(texture2D(plane0, video_coord).r,\n"
+    "               vec2(texture2D(plane1, video_coord).r, texture2D(plane2, video_coord).r));\n"
+    "}\n",
+};
+
+static const char *fragment_main =
+    "void main() {\n"
+    "    vec4 over = texture2D(layer, layer_coord).bgra;\n"
+    "    vec3 under = clamp(video(), 0.0, 1.0) * step(video_coord.x, 1.0) * step(video_coord.y, 1.0);\n"
+    "    gl_FragColor = vec4(mix(under, over.rgb, over.a), 1.0);\n"
+    "}\n";
+
+static const GLfloat quad[4 * 2] = {
+    -1.f, -1.f,
+     1.f, -1.f,
+    -1.f,  1.f,
+     1.f,  1.f
+};
+
+typedef struct _gles_image {
+    unsigned int        id;                     /* H264_frame id, 0 if free. */
+    EGLImageKHR         image;
+    GLuint              tex;
+    unsigned long       used;
+} gles_image;
+
+typedef struct _GLES_presenter {
+    int                 width;
+    int                 height;
+
+    Display            *disp;                   /* Ours, for EGL on X11; NULL drawing to a pbuffer. */
+    Window              own_window;             /* Shown in when Receiver gives no window. */
+    EGLDisplay          display;
+    EGLConfig           config;
+    EGLContext          context;
+    EGLSurface          surface;
+    Window              window;                 /* Of "surface", 0 for the pbuffer. */
+    int                 preserved;              /* "surface" keeps its content across swaps. */
+    int                 fresh;                  /* "surface" hasn't been drawn to. */
+
+    PFNEGLCREATEIMAGEKHRPROC                create_image;
+    PFNEGLDESTROYIMAGEKHRPROC               destroy_image;
+    PFNGLEGLIMAGETARGETTEXTURE2DOESPROC     image_target;
+    PFNEGLCREATESYNCKHRPROC                 create_sync;
+    PFNEGLCLIENTWAITSYNCKHRPROC             client_wait_sync;
+    PFNEGLDESTROYSYNCKHRPROC                destroy_sync;
+    int                 dmabuf;                 /* DMABUFs can be imported. */
+    int                 unpack_subimage;        /* Uploads can start mid row. */
+
+    GLuint              programs[VIDEO_KINDS];
+    GLint               video_scale[VIDEO_KINDS];
+    GLint               luma[VIDEO_KINDS];
+    GLint               chroma[VIDEO_KINDS];
+
+    /* The lossless layer, composed in memory and uploaded as it changes. */
+    unsigned char      *layer;
+    H264_overlay        overlay;
+    GLuint              layer_tex;
+
+    /* Mapped frames' planes, valid for the format and size given. */
+    GLuint              planes[H264_FRAME_MAX_PLANES];
+    unsigned int        plane_fourcc;
+    unsigned int        plane_width;
+    unsigned int        plane_height;
+
+    gles_image          images[GLES_IMAGE_CACHE];
+    unsigned long       image_clock;
+
+    gles_video          kind;                   /* How the frame drawn is sampled. */
+    unsigned int        color;                  /* and converted, H264_COLOR_*. */
+    GLuint              external;               /* Its texture, if imported. */
+    GLfloat             scale_x;                /* Context size over frame size. */
+    GLfloat             scale_y;
+
+    H264_frame         *shown;                  /* Imported and drawn from. */
+    H264_frame         *queued;                 /* Imported and drawn from by the draw pending. */
+    int                 replacing;              /* The draw pending takes "shown" off screen. */
+
+    /* The draw in flight is waited on by a thread, which sets "pushed" as
+     * soon as its fence signals.
+     */
+    pthread_t           waiter;
+    pthread_mutex_t     lock;
+    pthread_cond_t      cond;
+    int                 pending;
+    EGLSyncKHR          fence;
+    H264_latency       *latency;                /* Of a frame the draw shows first, if any. */
+    unsigned long long  timestamp;
+    bool               *pushed;
+    int                 failed;
+    int                 quit;
+} GLES_presenter;
+
+static int has_extension(const char *extensions, const char *name)
+{
+    size_t len = strlen(name);
+    const char *at = extensions;
+
+    while (at && (at = strstr(at, name)) != NULL) {
+        if ((at == extensions || at[-1] == ' ') && (at[len] == ' ' || at[len] == '\0')) {
+            return 1;
+        }
+        at += len;
+    }
+
+    return 0;
+}
+
+/***************************************************************************
+*   EGL setup.
+****************************************************************************/
+
+/* Mesa's surfaceless platform needs no display server. */
+static EGLDisplay offscreen_display(void)
+{
+#ifdef EGL_PLATFORM_SURFACELESS_MESA
+    PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+
+    if (get_platform_display &&
+        has_extension(eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS), "EGL_MESA_platform_surfaceless")) {
+        return get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+    }
+#endif
+
+    return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+}
+
+/*  Creates the context, current on a pbuffer of the context's size if
+ *  "pbuffer", or on no surface until present() is given a window.
+ */
+static int open_display(GLES_presenter *gles, Display *receiver, int pbuffer)
+{
+    EGLint config_attribs[] = {
+        EGL_RED_SIZE, 8,
+        EGL_GREEN_SIZE, 8,
+        EGL_BLUE_SIZE, 8,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
+        EGL_SURFACE_TYPE, pbuffer ? EGL_PBUFFER_BIT : EGL_WINDOW_BIT,
+        EGL_NONE
+    };
+    EGLint context_attribs[] = { EGL_CONTEXT_CLIENT_VERSION, 2, EGL_NONE };
+    EGLint pbuffer_attribs[] = { EGL_WIDTH, gles->width, EGL_HEIGHT, gles->height, EGL_NONE };
+    EGLint num_config;
+    const char *extensions;
+
+    if (pbuffer) {
+        gles->display = offscreen_display();
+    } else {
+        gles->disp = XOpenDisplay(DisplayString(receiver));
+        if (!gles->disp) {
+            return -1;
+        }
+        gles->display = eglGetDisplay((EGLNativeDisplayType)gles->disp);
+    }
+
+    if (gles->display == EGL_NO_DISPLAY || !eglInitialize(gles->display, NULL, NULL)) {
+        gles->display = EGL_NO_DISPLAY;
+        return -1;
+    }
+    extensions = eglQueryString(gles->display, EGL_EXTENSIONS);
+
+    if (!eglBindAPI(EGL_OPENGL_ES_API) ||
+        !eglChooseConfig(gles->display, config_attribs, &gles->config, 1, &num_config) || num_config < 1) {
+        DEBUG_TRACE("No EGL config for GLES2\n");
+        return -1;
+    }
+
+    gles->context = eglCreateContext(gles->display, gles->config, EGL_NO_CONTEXT, context_attribs);
+    if (gles->context == EGL_NO_CONTEXT) {
+        DEBUG_TRACE("Couldn't create EGL context, err=0x%x\n", eglGetError());
+        return -1;
+    }
+
+    if (pbuffer) {
+        gles->surface = eglCreatePbufferSurface(gles->display, gles->config, pbuffer_attribs);
+        if (gles->surface == EGL_NO_SURFACE) {
+            DEBUG_TRACE("Couldn't create EGL pbuffer, err=0x%x\n", eglGetError());
+            return -1;
+        }
+        gles->preserved = 1;
+        gles->fresh = 1;
+    } else if (!has_extension(extensions, "EGL_KHR_surfaceless_context")) {
+        /* Textures and programs are made before there is a window. */
+        DEBUG_TRACE("No EGL_KHR_surfaceless_context\n");
+        return -1;
+    }
+
+    if (!eglMakeCurrent(gles->display, gles->surface, gles->surface, gles->context)) {
+        DEBUG_TRACE("Couldn't bind EGL context, err=0x%x\n", eglGetError());
+        return -1;
+    }
+
+    if (has_extension(extensions, "EGL_KHR_fence_sync")) {
+        gles->create_sync = (PFNEGLCREATESYNCKHRPROC)eglGetProcAddress("eglCreateSyncKHR");
+        gles->client_wait_sync = (PFNEGLCLIENTWAITSYNCKHRPROC)eglGetProcAddress("eglClientWaitSyncKHR");
+        gles->destroy_sync = (PFNEGLDESTROYSYNCKHRPROC)eglGetProcAddress("eglDestroySyncKHR");
+    }
+    if (!gles->create_sync || !gles->client_wait_sync || !gles->destroy_sync) {
+        gles->create_sync = NULL;
+    }
+
+#ifdef EGL_LINUX_DMA_BUF_EXT
+    if (has_extension(extensions, "EGL_EXT_image_dma_buf_import") &&
+        has_extension((const char *)glGetString(GL_EXTENSIONS), "GL_OES_EGL_image_external")) {
+        gles->create_image = (PFNEGLCREATEIMAGEKHRPROC)eglGetProcAddress("eglCreateImageKHR");
+        gles->destroy_image = (PFNEGLDESTROYIMAGEKHRPROC)eglGetProcAddress("eglDestroyImageKHR");
+        gles->image_target = (PFNGLEGLIMAGETARGETTEXTURE2DOESPROC)eglGetProcAddress("glEGLImageTargetTexture2DOES");
+        gles->dmabuf = gles->create_image && gles->destroy_image && gles->image_target;
+    }
+#endif
+    gles->unpack_subimage = has_extension((const char *)glGetString(GL_EXTENSIONS), "GL_EXT_unpack_subimage");
+
+    return 0;
+}
+
+/* Makes "window" the surface drawn to, creating our own if it is 0. */
+static int use_window(GLES_presenter *gles, Window window)
+{
+    if (!window) {
+        if (!gles->own_window) {
+            gles->own_window = XCreateSimpleWindow(gles->disp, DefaultRootWindow(gles->disp), 0, 0, gles->width,
+                                                   gles->height, 0, 0, 0);
+            XStoreName(gles->disp, gles->own_window, "H.264");
+            XMapWindow(gles->disp, gles->own_window);
+            XFlush(gles->disp);
+        }
+        window = gles->own_window;
+    }
+
+    if (gles->surface != EGL_NO_SURFACE && window == gles->window) {
+        return 0;
+    }
+
+    if (gles->surface != EGL_NO_SURFACE) {
+        eglMakeCurrent(gles->display, EGL_NO_SURFACE, EGL_NO_SURFACE, gles->context);
+        eglDestroySurface(gles->display, gles->surface);
+    }
+
+    gles->window = window;
+    gles->surface = eglCreateWindowSurface(gles->display, gles->config, (EGLNativeWindowType)(uintptr_t)window,
+                                           NULL);
+    if (gles->surface == EGL_NO_SURFACE) {
+        DEBUG_TRACE("Couldn't create EGL surface for window 0x%lx, err=0x%x\n", window, eglGetError());
+        gles->window = 0;
+        eglMakeCurrent(gles->display, EGL_NO_SURFACE, EGL_NO_SURFACE, gles->context);
+        return -1;
+    }
+
+    if (!eglMakeCurrent(gles->display, gles->surface, gles->surface, gles->context)) {
+        return -1;
+    }
+
+    /* Without preserved swaps every present redraws all of the context.
+     * Swaps don't wait for the vertical blank, which would hold up
+     * Receiver; the fence says when the GPU is done.
+     */
+    gles->preserved = eglSurfaceAttrib(gles->display, gles->surface, EGL_SWAP_BEHAVIOR, EGL_BUFFER_PRESERVED);
+    gles->fresh = 1;
+    eglSwapInterval(gles->display, 0);
+
+    DEBUG_TRACE("GLES drawing to window 0x%lx, %spreserved\n", window, gles->preserved ? "" : "not ");
+
+    return 0;
+}
+
+/***************************************************************************
+*   Programs and textures.
+****************************************************************************/
+
+static GLuint compile_shader(GLenum type, const char **sources, int count)
+{
+    GLuint shader = glCreateShader(type);
+    GLint status;
+    char log[512];
+
+    glShaderSource(shader, count, sources, NULL);
+    glCompileShader(shader);
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+    if (!status) {
+        glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+        DEBUG_TRACE("Shader failed to compile: %s\n", log);
+        glDeleteShader(shader);
+        return 0;
+    }
+
+    return shader;
+}
+
+static GLuint build_program(GLES_presenter *gles, gles_video kind)
+{
+    const char *sources[] = {
+        kind == VIDEO_EXTERNAL ? "#extension GL_OES_EGL_image_external : require\n" : "",
+        fragment_common,
+        fragment_video[kind],
+        fragment_main
+    };
+    GLuint program, vertex, fragment;
+    char name[8];
+    GLint status;
+    int i;
+
+    vertex = compile_shader(GL_VERTEX_SHADER, &vertex_shader, 1);
+    fragment = compile_shader(GL_FRAGMENT_SHADER, sources, ELEMENTS_IN_ARRAY(sources));
+    if (!vertex || !fragment) {
+        glDeleteShader(vertex);
+        glDeleteShader(fragment);
+        return 0;
+    }
+
+    program = glCreateProgram();
+    glAttachShader(program, vertex);
+    glAttachShader(program, fragment);
+    glBindAttribLocation(program, 0, "position");
+    glLinkProgram(program);
+    glDeleteShader(vertex);
+    glDeleteShader(fragment);
+
+    glGetProgramiv(program, GL_LINK_STATUS, &status);
+    if (!status) {
+        DEBUG_TRACE("Program %d failed to link\n", kind);
+        glDeleteProgram(program);
+        return 0;
+    }
+
+    glUseProgram(program);
+    glUniform1i(glGetUniformLocation(program, "layer"), UNIT_LAYER);
+    for (i = 0; i < H264_FRAME_MAX_PLANES; i++) {
+        sprintf(name, "plane%d", i);
+        glUniform1i(glGetUniformLocation(program, name), UNIT_PLANES + i);
+    }
+    gles->video_scale[kind] = glGetUniformLocation(program, "video_scale");
+    gles->luma[kind] = glGetUniformLocation(program, "luma");
+    gles->chroma[kind] = glGetUniformLocation(program, "chroma");
+
+    return program;
+}
+
+static GLuint create_texture(GLenum target)
+{
+    GLuint tex;
+
+    glGenTextures(1, &tex);
+    glBindTexture(target, tex);
+    glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    return tex;
+}
+
+/*  Uploads "rect" of the bound texture, "width" texels wide, from "data"
+ *  with "pitch" bytes per row. Without GL_EXT_unpack_subimage whole rows
+ *  are uploaded.
+ */
+static void upload_rect(const GLES_presenter *gles, GLenum format, int bpp, const unsigned char *data, int pitch,
+                        int width, const SIGNED_RECT *rect)
+{
+    int y;
+
+    if (gles->unpack_subimage) {
+        glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, pitch / bpp);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, rect->left, rect->top, rect->right - rect->left, rect->bottom - rect->top,
+                        format, GL_UNSIGNED_BYTE, data + rect->top * pitch + rect->left * bpp);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, 0);
+    } else if (pitch == width * bpp) {
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, rect->top, width, rect->bottom - rect->top, format, GL_UNSIGNED_BYTE,
+                        data + rect->top * pitch);
+    } else {
+        for (y = rect->top; y < rect->bottom; y++) {
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, y, width, 1, format, GL_UNSIGNED_BYTE, data + y * pitch);
+        }
+    }
+}
+
+/*  Uploads the parts of mapped "frame" in "damage", or all of it if the
+ *  planes held another format or size. Chroma is subsampled by two both
+ *  ways, in one plane for NV12 and two for YU12.
+ */
+static void upload_frame(GLES_presenter *gles, const H264_frame *frame, const H264_dirty *damage)
+{
+    H264_dirty all = { { { 0, 0, frame->width, frame->height } }, 1 };
+    int nv12 = frame->fourcc == H264_FOURCC_NV12;
+    int chroma_width = (frame->width + 1) / 2, chroma_height = (frame->height + 1) / 2;
+    SIGNED_RECT rect, chroma;
+    unsigned int i;
+    int p;
+
+    if (frame->fourcc != gles->plane_fourcc || frame->width != gles->plane_width ||
+        frame->height != gles->plane_height) {
+        glBindTexture(GL_TEXTURE_2D, gles->planes[0]);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, frame->width, frame->height, 0, GL_LUMINANCE,
+                     GL_UNSIGNED_BYTE, NULL);
+        for (p = 1; p < (nv12 ? 2 : 3); p++) {
+            glBindTexture(GL_TEXTURE_2D, gles->planes[p]);
+            glTexImage2D(GL_TEXTURE_2D, 0, nv12 ? GL_LUMINANCE_ALPHA : GL_LUMINANCE, chroma_width, chroma_height,
+                         0, nv12 ? GL_LUMINANCE_ALPHA : GL_LUMINANCE, GL_UNSIGNED_BYTE, NULL);
+        }
+        gles->plane_fourcc = frame->fourcc;
+        gles->plane_width = frame->width;
+        gles->plane_height = frame->height;
+        damage = &all;
+    }
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    for (i = 0; i < damage->num_rects; i++) {
+        rect = damage->rects[i];
+        rect.right = min(rect.right, (INT32)frame->width);
+        rect.bottom = min(rect.bottom, (INT32)frame->height);
+        if (rect.left >= rect.right || rect.top >= rect.bottom) {
+            continue;
+        }
+        chroma.left = rect.left / 2;
+        chroma.top = rect.top / 2;
+        chroma.right = (rect.right + 1) / 2;
+        chroma.bottom = (rect.bottom + 1) / 2;
+
+        glBindTexture(GL_TEXTURE_2D, gles->planes[0]);
+        upload_rect(gles, GL_LUMINANCE, 1, frame->data[0], frame->pitches[0], frame->width, &rect);
+        if (nv12) {
+            glBindTexture(GL_TEXTURE_2D, gles->planes[1]);
+            upload_rect(gles, GL_LUMINANCE_ALPHA, 2, frame->data[1], frame->pitches[1], chroma_width, &chroma);
+        } else {
+            for (p = 1; p < 3; p++) {
+                glBindTexture(GL_TEXTURE_2D, gles->planes[p]);
+                upload_rect(gles, GL_LUMINANCE, 1, frame->data[p], frame->pitches[p], chroma_width, &chroma);
+            }
+        }
+    }
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+static void free_image(GLES_presenter *gles, gles_image *image)
+{
+    if (image->tex) {
+        glDeleteTextures(1, &image->tex);
+    }
+    if (image->image != EGL_NO_IMAGE_KHR) {
+        gles->destroy_image(gles->display, image->image);
+    }
+
+    memset(image, 0, sizeof(gles_image));
+}
+
+/*  The external texture sampling "frame", imported from its DMABUFs the
+ *  first time it is seen. Frames drawn from or queued are never evicted.
+ *
+ *  Returns:
+ *       the texture, or 0 if the frame can't be imported.
+ */
+static GLuint frame_texture(GLES_presenter *gles, H264_frame *frame)
+{
+#ifdef EGL_LINUX_DMA_BUF_EXT
+    static const EGLint plane_attribs[H264_FRAME_MAX_PLANES][3] = {
+        { EGL_DMA_BUF_PLANE0_FD_EXT, EGL_DMA_BUF_PLANE0_OFFSET_EXT, EGL_DMA_BUF_PLANE0_PITCH_EXT },
+        { EGL_DMA_BUF_PLANE1_FD_EXT, EGL_DMA_BUF_PLANE1_OFFSET_EXT, EGL_DMA_BUF_PLANE1_PITCH_EXT },
+        { EGL_DMA_BUF_PLANE2_FD_EXT, EGL_DMA_BUF_PLANE2_OFFSET_EXT, EGL_DMA_BUF_PLANE2_PITCH_EXT },
+    };
+    EGLint attribs[6 + H264_FRAME_MAX_PLANES * 6 + 5];
+    gles_image *image, *victim = NULL;
+    int i, n = 0;
+
+    for (i = 0; i < GLES_IMAGE_CACHE; i++) {
+        image = &gles->images[i];
+        if (image->id == frame->id) {
+            image->used = ++gles->image_clock;
+            return image->tex;
+        }
+
+        if ((gles->shown && image->id == gles->shown->id) || (gles->queued && image->id == gles->queued->id)) {
+            continue;
+        }
+        if (!victim || image->used < victim->used) {
+            victim = image;
+        }
+    }
+
+    if (victim->id) {
+        free_image(gles, victim);
+    }
+
+    attribs[n++] = EGL_WIDTH;
+    attribs[n++] = frame->width;
+    attribs[n++] = EGL_HEIGHT;
+    attribs[n++] = frame->height;
+    attribs[n++] = EGL_LINUX_DRM_FOURCC_EXT;
+    attribs[n++] = frame->fourcc;
+    for (i = 0; i < frame->num_planes; i++) {
+        if (frame->dmabuf[i] < 0) {
+            return 0;
+        }
+        attribs[n++] = plane_attribs[i][0];
+        attribs[n++] = frame->dmabuf[i];
+        attribs[n++] = plane_attribs[i][1];
+        attribs[n++] = frame->offsets[i];
+        attribs[n++] = plane_attribs[i][2];
+        attribs[n++] = frame->pitches[i];
+    }
+    attribs[n++] = EGL_YUV_COLOR_SPACE_HINT_EXT;
+    attribs[n++] = frame->color & H264_COLOR_BT709 ? EGL_ITU_REC709_EXT : EGL_ITU_REC601_EXT;
+    attribs[n++] = EGL_SAMPLE_RANGE_HINT_EXT;
+    attribs[n++] = frame->color & H264_COLOR_FULL_RANGE ? EGL_YUV_FULL_RANGE_EXT : EGL_YUV_NARROW_RANGE_EXT;
+    attribs[n++] = EGL_NONE;
+
+    victim->image = gles->create_image(gles->display, EGL_NO_CONTEXT, EGL_LINUX_DMA_BUF_EXT, NULL, attribs);
+    if (victim->image == EGL_NO_IMAGE_KHR) {
+        DEBUG_TRACE("Failed to import frame %u, err=0x%x\n", frame->id, eglGetError());
+        return 0;
+    }
+
+    victim->tex = create_texture(GL_TEXTURE_EXTERNAL_OES);
+    gles->image_target(GL_TEXTURE_EXTERNAL_OES, victim->image);
+    victim->id = frame->id;
+    victim->used = ++gles->image_clock;
+
+    return victim->tex;
+#else
+    return 0;
+#endif
+}
+
+/*  Makes "frame" the one drawn: imported if it has DMABUFs and EGL can,
+ *  otherwise uploaded where "damage" says it changed.
+ */
+static int load_frame(GLES_presenter *gles, H264_frame *frame, const H264_dirty *damage)
+{
+    if (frame->fourcc != H264_FOURCC_NV12 && frame->fourcc != H264_FOURCC_YU12) {
+        DEBUG_TRACE("Can't draw frame %u, format 0x%x\n", frame->id, frame->fourcc);
+        return -1;
+    }
+
+    gles->scale_x = (GLfloat)gles->width / frame->width;
+    gles->scale_y = (GLfloat)gles->height / frame->height;
+    gles->color = frame->color;
+
+    if (gles->dmabuf && frame->dmabuf[0] >= 0) {
+        gles->external = frame_texture(gles, frame);
+        if (gles->external) {
+            gles->kind = VIDEO_EXTERNAL;
+            /* The planes no longer hold the frame drawn. */
+            gles->plane_fourcc = 0;
+            return 0;
+        }
+    }
+
+    if (!frame->data[0]) {
+        return -1;
+    }
+
+    upload_frame(gles, frame, damage);
+    gles->kind = frame->fourcc == H264_FOURCC_NV12 ? VIDEO_NV12 : VIDEO_YU12;
+
+    return 0;
+}
+
+/***************************************************************************
+*   Drawing.
+****************************************************************************/
+
+/* Waits for each draw's fence, and reports it done. */
+static void *draw_waiter(void *arg)
+{
+    GLES_presenter *gles = arg;
+    EGLSyncKHR fence;
+    EGLint status;
+
+    pthread_mutex_lock(&gles->lock);
+
+    while (!gles->quit) {
+        if (gles->fence == EGL_NO_SYNC_KHR) {
+            pthread_cond_wait(&gles->cond, &gles->lock);
+            continue;
+        }
+
+        fence = gles->fence;
+        pthread_mutex_unlock(&gles->lock);
+
+        status = gles->client_wait_sync(gles->display, fence, 0, (EGLTimeKHR)GLES_DRAW_TIMEOUT_MS * 1000000);
+        gles->destroy_sync(gles->display, fence);
+
+        pthread_mutex_lock(&gles->lock);
+        if (status != EGL_CONDITION_SATISFIED_KHR) {
+            DEBUG_TRACE("Draw not done after %dms\n", GLES_DRAW_TIMEOUT_MS);
+            gles->failed = 1;
+        } else {
+            latency_stamp(gles->latency, gles->timestamp, LATENCY_DISPLAYED);
+        }
+        gles->fence = EGL_NO_SYNC_KHR;
+        gles->pending = 0;
+        if (gles->pushed) {
+            *gles->pushed = 1;
+            gles->pushed = NULL;
+            TRACE(TRACE_PUSHED, 0, 0, 0);
+        }
+        pthread_cond_broadcast(&gles->cond);
+    }
+
+    pthread_mutex_unlock(&gles->lock);
+
+    return NULL;
+}
+
+/*  Waits for the draw in flight, if any, then releases the frame it took
+ *  off the screen. Returns -1 if the draw failed.
+ */
+static int finish_draw(GLES_presenter *gles)
+{
+    int ret;
+
+    pthread_mutex_lock(&gles->lock);
+    while (gles->pending) {
+        pthread_cond_wait(&gles->cond, &gles->lock);
+    }
+    ret = gles->failed ? -1 : 0;
+    gles->failed = 0;
+    pthread_mutex_unlock(&gles->lock);
+
+    if (gles->replacing) {
+        if (gles->shown && gles->shown != gles->queued) {
+            gles->shown->release(gles->shown);
+        }
+        gles->shown = gles->queued;
+        gles->queued = NULL;
+        gles->replacing = 0;
+    }
+
+    return ret;
+}
+
+/*  Draws "rects" of the context, with the part at ("x", "y") at the top
+ *  left of the surface, "surface_height" tall. GL counts rows up from the
+ *  bottom.
+ */
+static void draw(GLES_presenter *gles, const H264_dirty *rects, int x, int y, int surface_height)
+{
+    const convert_coefs *coefs = convert_coefs_for(gles->color);
+    unsigned int i;
+    int p;
+
+    glUseProgram(gles->programs[gles->kind]);
+    glUniform2f(gles->video_scale[gles->kind], gles->scale_x, gles->scale_y);
+    /* Normalised: "bias" is in 1/64ths of a code, with 1/2 for rounding. */
+    glUniform2f(gles->luma[gles->kind], coefs->luma / 128.f, (coefs->bias + 32) / (64.f * 255.f));
+    glUniform4f(gles->chroma[gles->kind], coefs->vr / 64.f, coefs->ug / 64.f, coefs->vg / 64.f, coefs->ub / 64.f);
+
+    glActiveTexture(GL_TEXTURE0 + UNIT_LAYER);
+    glBindTexture(GL_TEXTURE_2D, gles->layer_tex);
+    if (gles->kind == VIDEO_EXTERNAL) {
+        glActiveTexture(GL_TEXTURE0 + UNIT_PLANES);
+        glBindTexture(GL_TEXTURE_EXTERNAL_OES, gles->external);
+    } else {
+        for (p = 0; p < H264_FRAME_MAX_PLANES; p++) {
+            glActiveTexture(GL_TEXTURE0 + UNIT_PLANES + p);
+            glBindTexture(GL_TEXTURE_2D, gles->planes[p]);
+        }
+    }
+    glActiveTexture(GL_TEXTURE0);
+
+    glViewport(-x, surface_height + y - gles->height, gles->width, gles->height);
+    glEnable(GL_SCISSOR_TEST);
+    for (i = 0; i < rects->num_rects; i++) {
+        glScissor(rects->rects[i].left - x, surface_height - (rects->rects[i].bottom - y),
+                  rects->rects[i].right - rects->rects[i].left, rects->rects[i].bottom - rects->rects[i].top);
+        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    }
+    glDisable(GL_SCISSOR_TEST);
+}
+
+/***************************************************************************
+*   Presenter interface.
+****************************************************************************/
+
+static void gles_close(void *ctx)
+{
+    GLES_presenter *gles = ctx;
+    int i;
+
+    if (!gles) {
+        return;
+    }
+
+    if (gles->waiter) {
+        finish_draw(gles);
+
+        pthread_mutex_lock(&gles->lock);
+        gles->quit = 1;
+        pthread_cond_broadcast(&gles->cond);
+        pthread_mutex_unlock(&gles->lock);
+        pthread_join(gles->waiter, NULL);
+    }
+
+    if (gles->shown) {
+        gles->shown->release(gles->shown);
+    }
+
+    if (gles->context != EGL_NO_CONTEXT &&
+        eglMakeCurrent(gles->display, gles->surface, gles->surface, gles->context)) {
+        for (i = 0; i < GLES_IMAGE_CACHE; i++) {
+            if (gles->images[i].id) {
+                free_image(gles, &gles->images[i]);
+            }
+        }
+        for (i = 0; i < VIDEO_KINDS; i++) {
+            if (gles->programs[i]) {
+                glDeleteProgram(gles->programs[i]);
+            }
+        }
+        glDeleteTextures(H264_FRAME_MAX_PLANES, gles->planes);
+        glDeleteTextures(1, &gles->layer_tex);
+    }
+
+    if (gles->display != EGL_NO_DISPLAY) {
+        eglMakeCurrent(gles->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        if (gles->surface != EGL_NO_SURFACE) {
+            eglDestroySurface(gles->display, gles->surface);
+        }
+        if (gles->context != EGL_NO_CONTEXT) {
+            eglDestroyContext(gles->display, gles->context);
+        }
+        eglTerminate(gles->display);
+    }
+
+    if (gles->own_window) {
+        XDestroyWindow(gles->disp, gles->own_window);
+    }
+    if (gles->disp) {
+        XCloseDisplay(gles->disp);
+    }
+
+    pthread_cond_destroy(&gles->cond);
+    pthread_mutex_destroy(&gles->lock);
+    free(gles->layer);
+    free(gles);
+}
+
+static void *gles_open(int width, int height, unsigned int frames)
+{
+    Display *receiver = GetICADisplay();
+    char *pbuffer = getenv(GLES_PBUFFER_ENV);
+    GLES_presenter *gles;
+    int i;
+
+    if (pbuffer && atoi(pbuffer) == 0) {
+        pbuffer = NULL;
+    }
+    if (!pbuffer && !receiver) {
+        return NULL;
+    }
+
+    gles = calloc(1, sizeof(GLES_presenter));
+    if (!gles) {
+        return NULL;
+    }
+
+    gles->width = width;
+    gles->height = height;
+    gles->display = EGL_NO_DISPLAY;
+    gles->context = EGL_NO_CONTEXT;
+    gles->surface = EGL_NO_SURFACE;
+    gles->fence = EGL_NO_SYNC_KHR;
+    pthread_mutex_init(&gles->lock, NULL);
+    pthread_cond_init(&gles->cond, NULL);
+
+    if (open_display(gles, receiver, pbuffer != NULL) != 0) {
+        DEBUG_TRACE("No EGL display for GLES2\n");
+        gles_close(gles);
+        return NULL;
+    }
+
+    /* Frames are either imported or uploaded. */
+    if (!(frames & PRESENTER_FRAMES_MAPPED) && !((frames & PRESENTER_FRAMES_DMABUF) && gles->dmabuf)) {
+        gles_close(gles);
+        return NULL;
+    }
+
+    for (i = 0; i < VIDEO_KINDS; i++) {
+        if (i == VIDEO_EXTERNAL && !gles->dmabuf) {
+            continue;
+        }
+        gles->programs[i] = build_program(gles, i);
+        if (!gles->programs[i]) {
+            gles_close(gles);
+            return NULL;
+        }
+    }
+
+    gles->layer = calloc(width * height, 4);
+    if (!gles->layer) {
+        gles_close(gles);
+        return NULL;
+    }
+    overlay_init(&gles->overlay, gles->layer, width * 4, width, height);
+
+    gles->layer_tex = create_texture(GL_TEXTURE_2D);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, gles->layer);
+    for (i = 0; i < H264_FRAME_MAX_PLANES; i++) {
+        gles->planes[i] = create_texture(GL_TEXTURE_2D);
+    }
+
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, quad);
+    glEnableVertexAttribArray(0);
+
+    if (glGetError() != GL_NO_ERROR) {
+        DEBUG_TRACE("GLES setup failed\n");
+        gles_close(gles);
+        return NULL;
+    }
+
+    if (gles->create_sync && pthread_create(&gles->waiter, NULL, draw_waiter, gles) != 0) {
+        gles->waiter = 0;
+        gles_close(gles);
+        return NULL;
+    }
+
+    DEBUG_TRACE("GLES presenter on %s, %s%s\n", (const char *)glGetString(GL_RENDERER),
+                pbuffer ? "pbuffer" : "X11", gles->dmabuf ? ", DMABUF import" : "");
+
+    /* Current again on whichever thread presents. */
+    eglMakeCurrent(gles->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+
+    return gles;
+}
+
+/* The layer is only read by present(), so it's composed in place. */
+static int gles_compose_with_fb(void *ctx, struct image_buf *fb, SIGNED_RECT interesting_rects[],
+                                unsigned int num_rects)
+{
+    GLES_presenter *gles = ctx;
+
+    return overlay_compose_fb(&gles->overlay, fb, interesting_rects, num_rects);
+}
+
+static int gles_compose_with_rects(void *ctx, struct image_buf objects[], unsigned int num_objects, bool last)
+{
+    GLES_presenter *gles = ctx;
+
+    return overlay_compose_rects(&gles->overlay, objects, num_objects);
+}
+
+/*  Draws without waiting for the GPU; the waiter sets "pushed" once the
+ *  draw's fence signals, or it is set here after glFinish() if EGL has no
+ *  fences. Only one draw is in flight, so a present() waits for the last.
+ */
+static int gles_present(void *ctx, H264_frame *frame, const H264_dirty *damage, struct window_info windows[],
+                        unsigned int num_windows, bool wait, bool *pushed)
+{
+    GLES_presenter *gles = ctx;
+    H264_dirty all = { { { 0, 0, gles->width, gles->height } }, 1 }, rects;
+    EGLint surface_height = gles->height;
+    EGLSyncKHR fence;
+    int x = 0, y = 0, ret;
+    unsigned int i;
+
+    ret = finish_draw(gles);
+
+    if (pushed) {
+        *pushed = 1;
+    }
+
+    /* A pbuffer holds the whole context; seamless sessions get their
+     * first window only, as with drm.
+     */
+    if (!gles->disp) {
+        if (!eglMakeCurrent(gles->display, gles->surface, gles->surface, gles->context)) {
+            return -1;
+        }
+    } else {
+        if (use_window(gles, num_windows ? windows[0].id : 0) != 0 ||
+            !eglMakeCurrent(gles->display, gles->surface, gles->surface, gles->context)) {
+            return -1;
+        }
+        eglQuerySurface(gles->display, gles->surface, EGL_HEIGHT, &surface_height);
+        if (num_windows) {
+            x = windows[0].target_x;
+            y = windows[0].target_y;
+        }
+    }
+
+    if (frame && load_frame(gles, frame, damage) != 0) {
+        return -1;
+    }
+
+    memset(&rects, 0, sizeof(rects));
+    for (i = 0; damage && i < damage->num_rects; i++) {
+        overlay_add_dirty(&rects, &damage->rects[i], gles->width, gles->height);
+    }
+
+    if (gles->overlay.dirty.num_rects) {
+        glBindTexture(GL_TEXTURE_2D, gles->layer_tex);
+        for (i = 0; i < gles->overlay.dirty.num_rects; i++) {
+            const SIGNED_RECT *rect = &gles->overlay.dirty.rects[i];
+
+            USDT2(overlay_upload, rect->right - rect->left, rect->bottom - rect->top);
+            upload_rect(gles, GL_RGBA, 4, gles->layer, gles->overlay.stride, gles->width, rect);
+            overlay_add_dirty(&rects, rect, gles->width, gles->height);
+        }
+        overlay_clear_dirty(&gles->overlay);
+    }
+
+    if (!gles->preserved || gles->fresh) {
+        rects = all;
+    }
+    gles->fresh = 0;
+
+    if (frame) {
+        gles->queued = gles->kind == VIDEO_EXTERNAL ? frame : NULL;
+        gles->replacing = 1;
+    }
+
+    if (rects.num_rects == 0) {
+        /* Nothing changed: there is nothing to wait for. */
+        finish_draw(gles);
+        if (frame) {
+            latency_stamp(frame->latency, frame->timestamp, LATENCY_DISPLAYED);
+        }
+    } else {
+        draw(gles, &rects, x, y, surface_height);
+        if (gles->window) {
+            eglSwapBuffers(gles->display, gles->surface);
+        }
+
+        fence = gles->create_sync ? gles->create_sync(gles->display, EGL_SYNC_FENCE_KHR, NULL) : EGL_NO_SYNC_KHR;
+        if (fence == EGL_NO_SYNC_KHR) {
+            glFinish();
+            finish_draw(gles);
+            if (frame) {
+                latency_stamp(frame->latency, frame->timestamp, LATENCY_DISPLAYED);
+            }
+        } else {
+            glFlush();
+
+            pthread_mutex_lock(&gles->lock);
+            gles->pending = 1;
+            gles->fence = fence;
+            gles->latency = frame ? frame->latency : NULL;
+            gles->timestamp = frame ? frame->timestamp : 0;
+            gles->pushed = pushed;
+            if (pushed) {
+                *pushed = 0;
+            }
+            pthread_cond_broadcast(&gles->cond);
+            pthread_mutex_unlock(&gles->lock);
+        }
+    }
+
+    /* Uploaded frames aren't needed once drawn. */
+    if (frame && gles->kind != VIDEO_EXTERNAL) {
+        frame->release(frame);
+    }
+
+    if (wait) {
+        ret = min(ret, finish_draw(gles));
+    }
+
+    return ret;
+}
+
+const H264_presenter gles_presenter = {
+    "gles",
+    gles_open,
+    gles_compose_with_fb,
+    gles_compose_with_rects,
+    gles_present,
+    gles_close,
+};
@@ -0,0 +1,723 @@
+/***************************************************************************
+*
+*   h264_parse.c
+*
+*   H.264 bitstream helpers: Annex-B start code scanning, and parsing of
+*   the parameter sets and slice headers stateless decoders need.
+*
+****************************************************************************/
+
+#include <string.h>
+#include "h264_parse.h"
+
+/* Runs of 3 or more zero bytes never occur inside a NAL, so there is no
+ * need to remember more than this across chunks.
+ */
+#define MAX_HELD_ZEROS 3
+
+const unsigned char h264_start_code[H264_START_CODE_LEN] = { 0, 0, 0, 1 };
+
+void h264_scanner_reset(H264_nal_scanner *scanner)
+{
+    scanner->zeros = 0;
+}
+
+/* Number of zero bytes immediately before data[end]. */
+static int zero_run(const unsigned char *data, int end)
+{
+    int run = 0;
+
+    while (run < end && data[end - run - 1] == 0) {
+        run++;
+    }
+
+    return run;
+}
+
+int h264_scan_nal(H264_nal_scanner *scanner, const unsigned char *data, int len,
+                  int *held, int *payload, int *found)
+{
+    const unsigned char *one;
+    int pos = 0, run;
+
+    /* A start code ends in 0x01, which is rare enough in slice data that
+     * searching for it and looking back is cheaper than examining every
+     * byte.
+     */
+    while ((one = memchr(data + pos, 1, len - pos))) {
+        int end = one - data;
+
+        run = zero_run(data, end);
+
+        if (run == end) {
+            /* Only zeros before the 0x01 in this chunk. */
+            if (run + scanner->zeros >= 2) {
+                /* The held zeros were trailing bytes of the previous NAL. */
+                *held = 0;
+                *payload = 0;
+                *found = 1;
+                scanner->zeros = 0;
+                return end + 1;
+            }
+        } else if (run >= 2) {
+            *held = scanner->zeros;
+            *payload = end - run;
+            *found = 1;
+            scanner->zeros = 0;
+            return end + 1;
+        }
+
+        pos = end + 1;
+    }
+
+    /* No start code. Hold back trailing zeros, they may begin one. */
+    run = zero_run(data, len);
+    *found = 0;
+
+    if (run == len) {
+        *held = 0;
+        *payload = 0;
+        scanner->zeros += len;
+        if (scanner->zeros > MAX_HELD_ZEROS) {
+            scanner->zeros = MAX_HELD_ZEROS;
+        }
+    } else {
+        *held = scanner->zeros;
+        *payload = len - run;
+        scanner->zeros = run > MAX_HELD_ZEROS ? MAX_HELD_ZEROS : run;
+    }
+
+    return len;
+}
+
+/***************************************************************************
+*   RBSP bit reading.
+****************************************************************************/
+
+int h264_unescape(const unsigned char *src, int len, unsigned char *dst, int max)
+{
+    int i, out = 0, zeros = 0;
+
+    for (i = 0; i < len && out < max; i++) {
+        if (zeros >= 2 && src[i] == 3) {
+            /* Emulation prevention byte, drop it. */
+            zeros = 0;
+            continue;
+        }
+
+        zeros = src[i] == 0 ? zeros + 1 : 0;
+        dst[out++] = src[i];
+    }
+
+    return out;
+}
+
+void h264_bits_init(H264_bits *bits, const unsigned char *data, int len)
+{
+    bits->data = data;
+    bits->size = len * 8;
+    bits->pos = 0;
+    bits->error = 0;
+}
+
+unsigned int h264_read_bits(H264_bits *bits, int n)
+{
+    unsigned int value = 0;
+
+    if (bits->pos + n > bits->size) {
+        bits->error = 1;
+        bits->pos = bits->size;
+        return 0;
+    }
+
+    while (n--) {
+        value = (value << 1) | ((bits->data[bits->pos >> 3] >> (7 - (bits->pos & 7))) & 1);
+        bits->pos++;
+    }
+
+    return value;
+}
+
+unsigned int h264_read_ue(H264_bits *bits)
+{
+    int zeros = 0;
+
+    while (!bits->error && h264_read_bits(bits, 1) == 0) {
+        if (++zeros > 31) {
+            bits->error = 1;
+            return 0;
+        }
+    }
+
+    return ((1u << zeros) - 1) + h264_read_bits(bits, zeros);
+}
+
+int h264_read_se(H264_bits *bits)
+{
+    unsigned int code = h264_read_ue(bits);
+
+    return code & 1 ? (int)((code + 1) >> 1) : -(int)(code >> 1);
+}
+
+/* more_rbsp_data(): anything before the stop bit ending the RBSP. */
+static int more_rbsp_data(const H264_bits *bits)
+{
+    int last = bits->size - 1;
+
+    /* Skip cabac_zero_words and trailing zero bits to the stop bit. */
+    while (last >= 0 && !((bits->data[last >> 3] >> (7 - (last & 7))) & 1)) {
+        last--;
+    }
+
+    return bits->pos < last;
+}
+
+/***************************************************************************
+*   Scaling lists.
+****************************************************************************/
+
+const unsigned char h264_zigzag_4x4[16] = {
+    0,  1,  4,  8,  5,  2,  3,  6,  9, 12, 13, 10,  7, 11, 14, 15
+};
+
+const unsigned char h264_zigzag_8x8[64] = {
+     0,  1,  8, 16,  9,  2,  3, 10, 17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63
+};
+
+/* Default scaling lists (table 7-3 and 7-4), in zig-zag order. */
+static const unsigned char default_4x4[2][16] = {
+    {  6, 13, 13, 20, 20, 20, 28, 28, 28, 28, 32, 32, 32, 37, 37, 42 },
+    { 10, 14, 14, 20, 20, 20, 24, 24, 24, 24, 27, 27, 27, 30, 30, 34 }
+};
+
+static const unsigned char default_8x8[2][64] = {
+    {  6, 10, 10, 13, 11, 13, 16, 16, 16, 16, 18, 18, 18, 18, 18, 23,
+      23, 23, 23, 23, 23, 25, 25, 25, 25, 25, 25, 25, 27, 27, 27, 27,
+      27, 27, 27, 27, 29, 29, 29, 29, 29, 29, 29, 31, 31, 31, 31, 31,
+      31, 33, 33, 33, 33, 33, 36, 36, 36, 36, 38, 38, 38, 40, 40, 42 },
+    {  9, 13, 13, 15, 13, 15, 17, 17, 17, 17, 19, 19, 19, 19, 19, 21,
+      21, 21, 21, 21, 21, 22, 22, 22, 22, 22, 22, 22, 24, 24, 24, 24,
+      24, 24, 24, 24, 25, 25, 25, 25, 25, 25, 25, 27, 27, 27, 27, 27,
+      27, 28, 28, 28, 28, 28, 30, 30, 30, 30, 32, 32, 32, 33, 33, 35 }
+};
+
+/* scaling_list() (7.3.2.1.1.1). Returns 1 if the default list is to be
+ * used instead.
+ */
+static int parse_scaling_list(H264_bits *bits, unsigned char *list, int size)
+{
+    int j, last = 8, next = 8;
+
+    for (j = 0; j < size; j++) {
+        if (next != 0) {
+            next = (last + h264_read_se(bits) + 256) % 256;
+            if (j == 0 && next == 0) {
+                return 1;
+            }
+        }
+        list[j] = next == 0 ? last : next;
+        last = list[j];
+    }
+
+    return 0;
+}
+
+/*  Parses the scaling lists of an SPS or PPS, applying the fall-back rules
+ *  of table 7-2. "fallback" holds the lists rule B falls back to, or is
+ *  NULL for rule A.
+ */
+static void parse_scaling(H264_bits *bits, H264_scaling *scaling, int num_8x8, const H264_scaling *fallback)
+{
+    int i;
+
+    for (i = 0; i < 6; i++) {
+        if (h264_read_bits(bits, 1)) {
+            if (parse_scaling_list(bits, scaling->list_4x4[i], 16)) {
+                memcpy(scaling->list_4x4[i], default_4x4[i / 3], 16);
+            }
+        } else if (i == 0 || i == 3) {
+            memcpy(scaling->list_4x4[i], fallback ? fallback->list_4x4[i] : default_4x4[i / 3], 16);
+        } else {
+            memcpy(scaling->list_4x4[i], scaling->list_4x4[i - 1], 16);
+        }
+    }
+
+    for (i = 0; i < 6; i++) {
+        if (i < num_8x8 && h264_read_bits(bits, 1)) {
+            if (parse_scaling_list(bits, scaling->list_8x8[i], 64)) {
+                memcpy(scaling->list_8x8[i], default_8x8[i & 1], 64);
+            }
+        } else if (i < 2) {
+            memcpy(scaling->list_8x8[i], fallback ? fallback->list_8x8[i] : default_8x8[i & 1], 64);
+        } else {
+            memcpy(scaling->list_8x8[i], scaling->list_8x8[i - 2], 64);
+        }
+    }
+}
+
+/***************************************************************************
+*   Parameter sets.
+****************************************************************************/
+
+/* The start of vui_parameters() (E.1.1), up to the colour description. A
+ * truncated VUI leaves the defaults.
+ */
+static void parse_video_signal_type(H264_bits *bits, H264_sps *sps)
+{
+    unsigned char full_range = 0, matrix = H264_MATRIX_UNSPECIFIED;
+
+    if (h264_read_bits(bits, 1)) {                  /* aspect_ratio_info_present_flag. */
+        if (h264_read_bits(bits, 8) == 255) {       /* aspect_ratio_idc: Extended_SAR. */
+            h264_read_bits(bits, 16);
+            h264_read_bits(bits, 16);
+        }
+    }
+    if (h264_read_bits(bits, 1)) {                  /* overscan_info_present_flag. */
+        h264_read_bits(bits, 1);
+    }
+    if (h264_read_bits(bits, 1)) {                  /* video_signal_type_present_flag. */
+        h264_read_bits(bits, 3);                    /* video_format. */
+        full_range = h264_read_bits(bits, 1);
+        if (h264_read_bits(bits, 1)) {              /* colour_description_present_flag. */
+            h264_read_bits(bits, 8);                /* colour_primaries. */
+            h264_read_bits(bits, 8);                /* transfer_characteristics. */
+            matrix = h264_read_bits(bits, 8);
+        }
+    }
+
+    if (!bits->error) {
+        sps->video_full_range = full_range;
+        sps->matrix_coefficients = matrix;
+    }
+}
+
+int h264_parse_sps(H264_bits *bits, H264_sps sps_table[H264_MAX_SPS])
+{
+    H264_sps sps;
+    unsigned int value;
+    int i;
+
+    memset(&sps, 0, sizeof(sps));
+
+    sps.profile_idc = h264_read_bits(bits, 8);
+    sps.constraint_flags = h264_read_bits(bits, 8);
+    sps.level_idc = h264_read_bits(bits, 8);
+
+    value = h264_read_ue(bits);
+    if (value >= H264_MAX_SPS) {
+        return -1;
+    }
+    sps.id = value;
+    sps.chroma_format_idc = 1;
+
+    switch (sps.profile_idc) {
+    case 100: case 110: case 122: case 244: case 44:
+    case 83:  case 86:  case 118: case 128: case 138:
+    case 139: case 134: case 135:
+        sps.chroma_format_idc = h264_read_ue(bits);
+        if (sps.chroma_format_idc > 3) {
+            return -1;
+        }
+        if (sps.chroma_format_idc == 3) {
+            sps.separate_colour_plane = h264_read_bits(bits, 1);
+        }
+        sps.bit_depth_luma_minus8 = h264_read_ue(bits);
+        sps.bit_depth_chroma_minus8 = h264_read_ue(bits);
+        sps.qpprime_y_zero_transform_bypass = h264_read_bits(bits, 1);
+        sps.scaling_matrix_present = h264_read_bits(bits, 1);
+        if (sps.scaling_matrix_present) {
+            parse_scaling(bits, &sps.scaling, sps.chroma_format_idc == 3 ? 6 : 2, NULL);
+        }
+        break;
+    }
+
+    if (!sps.scaling_matrix_present) {
+        memset(&sps.scaling, 16, sizeof(sps.scaling));
+    }
+
+    value = h264_read_ue(bits);
+    if (value > 12) {
+        return -1;
+    }
+    sps.log2_max_frame_num_minus4 = value;
+
+    sps.pic_order_cnt_type = h264_read_ue(bits);
+    if (sps.pic_order_cnt_type == 0) {
+        value = h264_read_ue(bits);
+        if (value > 12) {
+            return -1;
+        }
+        sps.log2_max_poc_lsb_minus4 = value;
+    } else if (sps.pic_order_cnt_type == 1) {
+        sps.delta_pic_order_always_zero = h264_read_bits(bits, 1);
+        sps.offset_for_non_ref_pic = h264_read_se(bits);
+        sps.offset_for_top_to_bottom_field = h264_read_se(bits);
+        value = h264_read_ue(bits);
+        if (value > 255) {
+            return -1;
+        }
+        sps.num_ref_frames_in_poc_cycle = value;
+        for (i = 0; i < sps.num_ref_frames_in_poc_cycle; i++) {
+            sps.offset_for_ref_frame[i] = h264_read_se(bits);
+        }
+    } else if (sps.pic_order_cnt_type != 2) {
+        return -1;
+    }
+
+    value = h264_read_ue(bits);
+    if (value > 16) {
+        return -1;
+    }
+    sps.max_num_ref_frames = value;
+    sps.gaps_in_frame_num_allowed = h264_read_bits(bits, 1);
+    sps.pic_width_in_mbs_minus1 = h264_read_ue(bits);
+    sps.pic_height_in_map_units_minus1 = h264_read_ue(bits);
+    sps.frame_mbs_only = h264_read_bits(bits, 1);
+    if (!sps.frame_mbs_only) {
+        sps.mb_adaptive_frame_field = h264_read_bits(bits, 1);
+    }
+    sps.direct_8x8_inference = h264_read_bits(bits, 1);
+
+    if (bits->error) {
+        return -1;
+    }
+
+    /* Cropping is of no interest to the decoder; of the VUI, only how the
+     * samples convert to RGB is kept.
+     */
+    sps.matrix_coefficients = H264_MATRIX_UNSPECIFIED;
+    if (h264_read_bits(bits, 1)) {
+        for (i = 0; i < 4; i++) {
+            h264_read_ue(bits);
+        }
+    }
+    if (h264_read_bits(bits, 1)) {
+        parse_video_signal_type(bits, &sps);
+    }
+
+    sps.valid = 1;
+    sps_table[sps.id] = sps;
+
+    return sps.id;
+}
+
+int h264_parse_pps(H264_bits *bits, const H264_sps sps_table[H264_MAX_SPS],
+                   H264_pps pps_table[H264_MAX_PPS])
+{
+    const H264_sps *sps;
+    H264_pps pps;
+    unsigned int value;
+
+    memset(&pps, 0, sizeof(pps));
+
+    value = h264_read_ue(bits);
+    if (value >= H264_MAX_PPS) {
+        return -1;
+    }
+    pps.id = value;
+
+    value = h264_read_ue(bits);
+    if (value >= H264_MAX_SPS || !sps_table[value].valid) {
+        return -1;
+    }
+    pps.sps_id = value;
+    sps = &sps_table[value];
+
+    pps.entropy_coding_mode = h264_read_bits(bits, 1);
+    pps.bottom_field_pic_order_in_frame_present = h264_read_bits(bits, 1);
+
+    if (h264_read_ue(bits) != 0) {
+        /* Slice groups (FMO) are Baseline only and not supported. */
+        return -1;
+    }
+
+    value = h264_read_ue(bits);
+    if (value >= H264_MAX_REFS) {
+        return -1;
+    }
+    pps.num_ref_idx_l0_default_active_minus1 = value;
+    value = h264_read_ue(bits);
+    if (value >= H264_MAX_REFS) {
+        return -1;
+    }
+    pps.num_ref_idx_l1_default_active_minus1 = value;
+
+    pps.weighted_pred = h264_read_bits(bits, 1);
+    pps.weighted_bipred_idc = h264_read_bits(bits, 2);
+    pps.pic_init_qp_minus26 = h264_read_se(bits);
+    pps.pic_init_qs_minus26 = h264_read_se(bits);
+    pps.chroma_qp_index_offset = h264_read_se(bits);
+    pps.deblocking_filter_control_present = h264_read_bits(bits, 1);
+    pps.constrained_intra_pred = h264_read_bits(bits, 1);
+    pps.redundant_pic_cnt_present = h264_read_bits(bits, 1);
+    pps.second_chroma_qp_index_offset = pps.chroma_qp_index_offset;
+
+    if (!bits->error && more_rbsp_data(bits)) {
+        pps.transform_8x8_mode = h264_read_bits(bits, 1);
+        pps.scaling_matrix_present = h264_read_bits(bits, 1);
+        if (pps.scaling_matrix_present) {
+            parse_scaling(bits, &pps.scaling,
+                          pps.transform_8x8_mode * (sps->chroma_format_idc == 3 ? 6 : 2),
+                          sps->scaling_matrix_present ? &sps->scaling : NULL);
+        }
+        pps.second_chroma_qp_index_offset = h264_read_se(bits);
+    }
+
+    if (!pps.scaling_matrix_present) {
+        pps.scaling = sps->scaling;
+    }
+
+    if (bits->error) {
+        return -1;
+    }
+
+    pps.valid = 1;
+    pps_table[pps.id] = pps;
+
+    return pps.id;
+}
+
+/***************************************************************************
+*   Slice headers.
+****************************************************************************/
+
+static int parse_ref_pic_list_modification(H264_bits *bits)
+{
+    unsigned int idc;
+    int count = 0;
+
+    if (!h264_read_bits(bits, 1)) {
+        return 0;
+    }
+
+    while (!bits->error && (idc = h264_read_ue(bits)) != 3) {
+        if (idc > 5 || ++count > H264_MAX_REFS + 1) {
+            return -1;
+        }
+        h264_read_ue(bits);     /* abs_diff_pic_num_minus1, long_term_pic_num or abs_diff_view_idx_minus1 */
+    }
+
+    return 0;
+}
+
+static void parse_weights(H264_bits *bits, H264_weights *weights, int num_refs,
+                          int chroma, int luma_denom, int chroma_denom)
+{
+    int i, j;
+
+    for (i = 0; i < num_refs; i++) {
+        weights->luma_weight[i] = 1 << luma_denom;
+        weights->luma_offset[i] = 0;
+        if (h264_read_bits(bits, 1)) {
+            weights->luma_weight[i] = h264_read_se(bits);
+            weights->luma_offset[i] = h264_read_se(bits);
+        }
+
+        for (j = 0; j < 2; j++) {
+            weights->chroma_weight[i][j] = 1 << chroma_denom;
+            weights->chroma_offset[i][j] = 0;
+        }
+        if (chroma && h264_read_bits(bits, 1)) {
+            for (j = 0; j < 2; j++) {
+                weights->chroma_weight[i][j] = h264_read_se(bits);
+                weights->chroma_offset[i][j] = h264_read_se(bits);
+            }
+        }
+    }
+}
+
+static int parse_dec_ref_pic_marking(H264_bits *bits, H264_slice_header *slice)
+{
+    if (slice->nal_unit_type == H264_NAL_SLICE_IDR) {
+        slice->no_output_of_prior_pics = h264_read_bits(bits, 1);
+        slice->long_term_reference = h264_read_bits(bits, 1);
+        return 0;
+    }
+
+    slice->adaptive_ref_pic_marking = h264_read_bits(bits, 1);
+    if (!slice->adaptive_ref_pic_marking) {
+        return 0;
+    }
+
+    while (!bits->error) {
+        H264_mmco *mmco;
+        unsigned int op = h264_read_ue(bits);
+
+        if (op == 0) {
+            return 0;
+        }
+        if (op > 6 || slice->num_mmco == H264_MAX_MMCO) {
+            return -1;
+        }
+
+        mmco = &slice->mmco[slice->num_mmco++];
+        memset(mmco, 0, sizeof(H264_mmco));
+        mmco->op = op;
+
+        if (op == 1 || op == 3) {
+            mmco->difference_of_pic_nums_minus1 = h264_read_ue(bits);
+        }
+        if (op == 2) {
+            mmco->long_term_pic_num = h264_read_ue(bits);
+        }
+        if (op == 3 || op == 6) {
+            mmco->long_term_frame_idx = h264_read_ue(bits);
+        }
+        if (op == 4) {
+            mmco->max_long_term_frame_idx_plus1 = h264_read_ue(bits);
+        }
+    }
+
+    return -1;
+}
+
+int h264_parse_slice_header(H264_bits *bits, const H264_sps sps_table[H264_MAX_SPS],
+                            const H264_pps pps_table[H264_MAX_PPS], H264_slice_header *slice)
+{
+    const H264_sps *sps;
+    const H264_pps *pps;
+    unsigned int value;
+    int chroma, start;
+
+    memset(slice, 0, sizeof(H264_slice_header));
+
+    value = h264_read_bits(bits, 8);
+    slice->nal_ref_idc = h264_nal_ref_idc(value);
+    slice->nal_unit_type = h264_nal_type(value);
+
+    slice->first_mb_in_slice = h264_read_ue(bits);
+    value = h264_read_ue(bits);
+    if (value > 9) {
+        return -1;
+    }
+    slice->slice_type = value % 5;
+
+    value = h264_read_ue(bits);
+    if (value >= H264_MAX_PPS || !pps_table[value].valid || !sps_table[pps_table[value].sps_id].valid) {
+        return -1;
+    }
+    slice->pps_id = value;
+    pps = &pps_table[value];
+    sps = &sps_table[pps->sps_id];
+    chroma = sps->separate_colour_plane ? 0 : sps->chroma_format_idc;
+
+    if (sps->separate_colour_plane) {
+        slice->colour_plane_id = h264_read_bits(bits, 2);
+    }
+
+    slice->frame_num = h264_read_bits(bits, sps->log2_max_frame_num_minus4 + 4);
+
+    if (!sps->frame_mbs_only) {
+        slice->field_pic = h264_read_bits(bits, 1);
+        if (slice->field_pic) {
+            slice->bottom_field = h264_read_bits(bits, 1);
+        }
+    }
+
+    if (slice->nal_unit_type == H264_NAL_SLICE_IDR) {
+        slice->idr_pic_id = h264_read_ue(bits);
+    }
+
+    start = bits->pos;
+    if (sps->pic_order_cnt_type == 0) {
+        slice->pic_order_cnt_lsb = h264_read_bits(bits, sps->log2_max_poc_lsb_minus4 + 4);
+        if (pps->bottom_field_pic_order_in_frame_present && !slice->field_pic) {
+            slice->delta_pic_order_cnt_bottom = h264_read_se(bits);
+        }
+    }
+    if (sps->pic_order_cnt_type == 1 && !sps->delta_pic_order_always_zero) {
+        slice->delta_pic_order_cnt[0] = h264_read_se(bits);
+        if (pps->bottom_field_pic_order_in_frame_present && !slice->field_pic) {
+            slice->delta_pic_order_cnt[1] = h264_read_se(bits);
+        }
+    }
+    slice->pic_order_cnt_bit_size = bits->pos - start;
+
+    if (pps->redundant_pic_cnt_present) {
+        slice->redundant_pic_cnt = h264_read_ue(bits);
+    }
+
+    if (slice->slice_type == H264_SLICE_B) {
+        slice->direct_spatial_mv_pred = h264_read_bits(bits, 1);
+    }
+
+    slice->num_ref_idx_l0_active_minus1 = pps->num_ref_idx_l0_default_active_minus1;
+    slice->num_ref_idx_l1_active_minus1 = pps->num_ref_idx_l1_default_active_minus1;
+
+    if (slice->slice_type == H264_SLICE_P || slice->slice_type == H264_SLICE_SP ||
+        slice->slice_type == H264_SLICE_B) {
+        slice->num_ref_idx_active_override = h264_read_bits(bits, 1);
+        if (slice->num_ref_idx_active_override) {
+            value = h264_read_ue(bits);
+            if (value >= H264_MAX_REFS) {
+                return -1;
+            }
+            slice->num_ref_idx_l0_active_minus1 = value;
+            if (slice->slice_type == H264_SLICE_B) {
+                value = h264_read_ue(bits);
+                if (value >= H264_MAX_REFS) {
+                    return -1;
+                }
+                slice->num_ref_idx_l1_active_minus1 = value;
+            }
+        }
+    }
+
+    if (slice->slice_type != H264_SLICE_I && slice->slice_type != H264_SLICE_SI) {
+        if (parse_ref_pic_list_modification(bits) != 0) {
+            return -1;
+        }
+        if (slice->slice_type == H264_SLICE_B && parse_ref_pic_list_modification(bits) != 0) {
+            return -1;
+        }
+    }
+
+    if ((pps->weighted_pred && (slice->slice_type == H264_SLICE_P || slice->slice_type == H264_SLICE_SP)) ||
+        (pps->weighted_bipred_idc == 1 && slice->slice_type == H264_SLICE_B)) {
+        slice->luma_log2_weight_denom = h264_read_ue(bits);
+        if (chroma) {
+            slice->chroma_log2_weight_denom = h264_read_ue(bits);
+        }
+        if (slice->luma_log2_weight_denom > 7 || slice->chroma_log2_weight_denom > 7) {
+            return -1;
+        }
+        parse_weights(bits, &slice->weights[0], slice->num_ref_idx_l0_active_minus1 + 1, chroma,
+                      slice->luma_log2_weight_denom, slice->chroma_log2_weight_denom);
+        if (slice->slice_type == H264_SLICE_B) {
+            parse_weights(bits, &slice->weights[1], slice->num_ref_idx_l1_active_minus1 + 1, chroma,
+                          slice->luma_log2_weight_denom, slice->chroma_log2_weight_denom);
+        }
+    }
+
+    start = bits->pos;
+    if (slice->nal_ref_idc && parse_dec_ref_pic_marking(bits, slice) != 0) {
+        return -1;
+    }
+    slice->dec_ref_pic_marking_bit_size = bits->pos - start;
+
+    if (pps->entropy_coding_mode && slice->slice_type != H264_SLICE_I && slice->slice_type != H264_SLICE_SI) {
+        slice->cabac_init_idc = h264_read_ue(bits);
+    }
+    slice->slice_qp_delta = h264_read_se(bits);
+    if (slice->slice_type == H264_SLICE_SP || slice->slice_type == H264_SLICE_SI) {
+        if (slice->slice_type == H264_SLICE_SP) {
+            slice->sp_for_switch = h264_read_bits(bits, 1);
+        }
+        slice->slice_qs_delta = h264_read_se(bits);
+    }
+    if (pps->deblocking_filter_control_present) {
+        slice->disable_deblocking_filter_idc = h264_read_ue(bits);
+        if (slice->disable_deblocking_filter_idc != 1) {
+            slice->slice_alpha_c0_offset_div2 = h264_read_se(bits);
+            slice->slice_beta_offset_div2 = h264_read_se(bits);
+        }
+    }
+
+    /* The header byte isn't part of the slice header proper. */
+    slice->header_bit_size = bits->pos - 8;
+
+    return bits->error ? -1 : 0;
+}
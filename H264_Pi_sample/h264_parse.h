@@ -0,0 +1,246 @@
+/***************************************************************************
+*
+*   h264_parse.h
+*
+*   H.264 bitstream helpers: Annex-B start code scanning, and parsing of
+*   the parameter sets and slice headers stateless decoders need.
+*
+****************************************************************************/
+
+#ifndef _H264_PARSE_H_
+#define _H264_PARSE_H_
+
+/* NAL unit types (ITU-T H.264 table 7-1) the plugin cares about. */
+#define H264_NAL_SLICE      1
+#define H264_NAL_SLICE_IDR  5
+#define H264_NAL_SEI        6
+#define H264_NAL_SPS        7
+#define H264_NAL_PPS        8
+#define H264_NAL_AUD        9
+
+#define h264_nal_type(header)     ((header) & 0x1f)
+#define h264_nal_ref_idc(header)  (((header) >> 5) & 0x03)
+
+/* Annex-B start code emitted in front of every NAL submitted to a decoder. */
+#define H264_START_CODE_LEN 4
+extern const unsigned char h264_start_code[H264_START_CODE_LEN];
+
+/* Scanner state carried across the chunks of a frame. A start code may be
+ * split between two chunks, so trailing zero bytes are held back until it
+ * is known whether they belong to the payload or to the next start code.
+ */
+typedef struct _H264_nal_scanner {
+    int zeros;          /* Zero bytes held back from the previous chunk. */
+} H264_nal_scanner;
+
+void h264_scanner_reset(H264_nal_scanner *scanner);
+
+/*  Function: h264_scan_nal()
+ *
+ *  Scans "data" up to and including the next Annex-B start code.
+ *
+ *  On return, the first "*payload" bytes of "data" belong to the current
+ *  NAL and must be preceded by "*held" zero bytes held back by a previous
+ *  call. If "*found" is set the scan stopped at a start code and a new NAL
+ *  begins after the consumed bytes.
+ *
+ *  Returns:
+ *       the number of bytes consumed.
+ */
+int h264_scan_nal(H264_nal_scanner *scanner, const unsigned char *data, int len,
+                  int *held, int *payload, int *found);
+
+/***************************************************************************
+*   Parameter sets and slice headers (ITU-T H.264 7.3). Only what a
+*   stateless decoder has to be told is kept, and the colour encoding of the
+*   VUI; the rest of the VUI and SEI are skipped.
+****************************************************************************/
+
+#define H264_MAX_SPS            32
+#define H264_MAX_PPS            256
+#define H264_MAX_REFS           32
+#define H264_MAX_MMCO           66
+
+/* slice_type, modulo 5. */
+#define H264_SLICE_P    0
+#define H264_SLICE_B    1
+#define H264_SLICE_I    2
+#define H264_SLICE_SP   3
+#define H264_SLICE_SI   4
+
+/* matrix_coefficients values (table E-5) that matter here. */
+#define H264_MATRIX_BT709           1
+#define H264_MATRIX_UNSPECIFIED     2
+
+/* Bit reader over an RBSP, i.e. a NAL with emulation prevention removed.
+ * Reading past the end sets "error" and returns zeros.
+ */
+typedef struct _H264_bits {
+    const unsigned char *data;
+    int                  size;      /* In bits. */
+    int                  pos;
+    int                  error;
+} H264_bits;
+
+/*  Function: h264_unescape()
+ *
+ *  Copies at most "max" bytes of NAL "src" to "dst", removing emulation
+ *  prevention bytes.
+ *
+ *  Returns:
+ *       the number of bytes written.
+ */
+int h264_unescape(const unsigned char *src, int len, unsigned char *dst, int max);
+
+void h264_bits_init(H264_bits *bits, const unsigned char *data, int len);
+unsigned int h264_read_bits(H264_bits *bits, int n);
+unsigned int h264_read_ue(H264_bits *bits);
+int h264_read_se(H264_bits *bits);
+
+/* Scaling lists as coded, in zig-zag order. Lists not present are filled
+ * in by the fall-back rules of 7.4.2.1.1 and 7.4.2.2.
+ */
+typedef struct _H264_scaling {
+    unsigned char   list_4x4[6][16];
+    unsigned char   list_8x8[6][64];
+} H264_scaling;
+
+typedef struct _H264_sps {
+    int             valid;
+    unsigned char   profile_idc;
+    unsigned char   constraint_flags;
+    unsigned char   level_idc;
+    unsigned char   id;
+    unsigned char   chroma_format_idc;
+    unsigned char   separate_colour_plane;
+    unsigned char   bit_depth_luma_minus8;
+    unsigned char   bit_depth_chroma_minus8;
+    unsigned char   qpprime_y_zero_transform_bypass;
+    unsigned char   scaling_matrix_present;
+    unsigned char   log2_max_frame_num_minus4;
+    unsigned char   pic_order_cnt_type;
+    unsigned char   log2_max_poc_lsb_minus4;
+    unsigned char   delta_pic_order_always_zero;
+    int             offset_for_non_ref_pic;
+    int             offset_for_top_to_bottom_field;
+    unsigned char   num_ref_frames_in_poc_cycle;
+    int             offset_for_ref_frame[255];
+    unsigned char   max_num_ref_frames;
+    unsigned char   gaps_in_frame_num_allowed;
+    unsigned short  pic_width_in_mbs_minus1;
+    unsigned short  pic_height_in_map_units_minus1;
+    unsigned char   frame_mbs_only;
+    unsigned char   mb_adaptive_frame_field;
+    unsigned char   direct_8x8_inference;
+    unsigned char   video_full_range;
+    unsigned char   matrix_coefficients;
+    H264_scaling    scaling;
+} H264_sps;
+
+typedef struct _H264_pps {
+    int             valid;
+    unsigned char   id;
+    unsigned char   sps_id;
+    unsigned char   entropy_coding_mode;
+    unsigned char   bottom_field_pic_order_in_frame_present;
+    unsigned char   num_ref_idx_l0_default_active_minus1;
+    unsigned char   num_ref_idx_l1_default_active_minus1;
+    unsigned char   weighted_pred;
+    unsigned char   weighted_bipred_idc;
+    signed char     pic_init_qp_minus26;
+    signed char     pic_init_qs_minus26;
+    signed char     chroma_qp_index_offset;
+    signed char     second_chroma_qp_index_offset;
+    unsigned char   deblocking_filter_control_present;
+    unsigned char   constrained_intra_pred;
+    unsigned char   redundant_pic_cnt_present;
+    unsigned char   transform_8x8_mode;
+    unsigned char   scaling_matrix_present;
+    H264_scaling    scaling;    /* Valid whether present or inherited. */
+} H264_pps;
+
+typedef struct _H264_mmco {
+    unsigned char   op;
+    unsigned int    difference_of_pic_nums_minus1;
+    unsigned int    long_term_pic_num;
+    unsigned int    long_term_frame_idx;
+    unsigned int    max_long_term_frame_idx_plus1;
+} H264_mmco;
+
+typedef struct _H264_weights {
+    short   luma_weight[H264_MAX_REFS];
+    short   luma_offset[H264_MAX_REFS];
+    short   chroma_weight[H264_MAX_REFS][2];
+    short   chroma_offset[H264_MAX_REFS][2];
+} H264_weights;
+
+typedef struct _H264_slice_header {
+    unsigned char   nal_ref_idc;
+    unsigned char   nal_unit_type;
+    unsigned int    first_mb_in_slice;
+    unsigned char   slice_type;         /* Modulo 5. */
+    unsigned char   pps_id;
+    unsigned char   colour_plane_id;
+    unsigned short  frame_num;
+    unsigned char   field_pic;
+    unsigned char   bottom_field;
+    unsigned short  idr_pic_id;
+    unsigned short  pic_order_cnt_lsb;
+    int             delta_pic_order_cnt_bottom;
+    int             delta_pic_order_cnt[2];
+    unsigned char   redundant_pic_cnt;
+    unsigned char   direct_spatial_mv_pred;
+    unsigned char   num_ref_idx_active_override;
+    unsigned char   num_ref_idx_l0_active_minus1;
+    unsigned char   num_ref_idx_l1_active_minus1;
+
+    unsigned char   luma_log2_weight_denom;
+    unsigned char   chroma_log2_weight_denom;
+    H264_weights    weights[2];
+
+    unsigned char   no_output_of_prior_pics;
+    unsigned char   long_term_reference;
+    unsigned char   adaptive_ref_pic_marking;
+    unsigned char   num_mmco;
+    H264_mmco       mmco[H264_MAX_MMCO];
+
+    int             cabac_init_idc;
+    int             slice_qp_delta;
+    unsigned char   sp_for_switch;
+    int             slice_qs_delta;
+    unsigned char   disable_deblocking_filter_idc;
+    signed char     slice_alpha_c0_offset_div2;
+    signed char     slice_beta_offset_div2;
+
+    /* Sizes in RBSP bits, which some decoders need to skip these parts. */
+    int             header_bit_size;
+    int             pic_order_cnt_bit_size;
+    int             dec_ref_pic_marking_bit_size;
+} H264_slice_header;
+
+/* Parse the RBSP of an SPS or PPS NAL, header byte excluded, into the
+ * table entry for its id. A PPS needs the SPS it refers to. Return the id,
+ * or -1 for a malformed or unsupported parameter set.
+ */
+int h264_parse_sps(H264_bits *bits, H264_sps sps_table[H264_MAX_SPS]);
+int h264_parse_pps(H264_bits *bits, const H264_sps sps_table[H264_MAX_SPS],
+                   H264_pps pps_table[H264_MAX_PPS]);
+
+/*  Function: h264_parse_slice_header()
+ *
+ *  Parses the slice header of a slice NAL whose RBSP, header byte
+ *  included, is in "bits". Slice data is left unread.
+ *
+ *  Returns:
+ *       0:     success.
+ *
+ *       -1:    malformed header, or it refers to a missing parameter set.
+ */
+int h264_parse_slice_header(H264_bits *bits, const H264_sps sps_table[H264_MAX_SPS],
+                            const H264_pps pps_table[H264_MAX_PPS], H264_slice_header *slice);
+
+/* Zig-zag scans, mapping coded position to raster position. */
+extern const unsigned char h264_zigzag_4x4[16];
+extern const unsigned char h264_zigzag_8x8[64];
+
+#endif /* _H264_PARSE_H_ */
@@ -0,0 +1,498 @@
+/***************************************************************************
+*
+*   h264_synth.c
+*
+*   Synthetic H.264 streams for benchmarking decoders (see h264_synth.h).
+*   Baseline profile, CAVLC, slices of whole macroblock rows and one
+*   reference frame.
+*
+****************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "h264_parse.h"
+#include "h264_synth.h"
+
+/* Motion vectors are chosen within this many quarter pels either way. */
+#define SYNTH_MV_RANGE      64
+
+/* slice_type values meaning every slice of the picture has that type. */
+#define SYNTH_SLICE_P_ALL   5
+#define SYNTH_SLICE_I_ALL   7
+
+#define SYNTH_MB_I_PCM      25
+#define SYNTH_MB_P_L0_16x16 0
+
+/* Writes an RBSP straight to Annex-B, adding emulation prevention. */
+typedef struct _synth_writer {
+    unsigned char  *buf;
+    int             size;
+    int             len;
+    int             zeros;          /* Zero bytes just written. */
+    unsigned int    cache;
+    int             bits;           /* In "cache". */
+    int             overflow;
+} synth_writer;
+
+static void put_byte(synth_writer *w, unsigned char byte)
+{
+    if (w->len + 2 > w->size) {
+        w->overflow = 1;
+        return;
+    }
+
+    if (w->zeros >= 2 && byte <= 3) {
+        w->buf[w->len++] = 3;
+        w->zeros = 0;
+    }
+
+    w->buf[w->len++] = byte;
+    w->zeros = byte == 0 ? w->zeros + 1 : 0;
+}
+
+static void put_bits(synth_writer *w, unsigned int value, int n)
+{
+    while (n--) {
+        w->cache = (w->cache << 1) | ((value >> n) & 1);
+        if (++w->bits == 8) {
+            put_byte(w, w->cache);
+            w->cache = 0;
+            w->bits = 0;
+        }
+    }
+}
+
+static void put_ue(synth_writer *w, unsigned int value)
+{
+    int n = 0;
+
+    while ((value + 1) >> (n + 1)) {
+        n++;
+    }
+
+    put_bits(w, 0, n);
+    put_bits(w, value + 1, n + 1);
+}
+
+static void put_se(synth_writer *w, int value)
+{
+    put_ue(w, value > 0 ? 2 * value - 1 : -2 * value);
+}
+
+static void put_align_zero(synth_writer *w)
+{
+    if (w->bits) {
+        put_bits(w, 0, 8 - w->bits);
+    }
+}
+
+static void put_trailing_bits(synth_writer *w)
+{
+    put_bits(w, 1, 1);
+    put_align_zero(w);
+}
+
+static void start_nal(synth_writer *w, unsigned char header)
+{
+    if (w->len + H264_START_CODE_LEN + 1 > w->size) {
+        w->overflow = 1;
+        return;
+    }
+
+    memcpy(w->buf + w->len, h264_start_code, H264_START_CODE_LEN);
+    w->len += H264_START_CODE_LEN;
+    w->zeros = 0;
+    put_byte(w, header);
+}
+
+static int median(int a, int b, int c)
+{
+    return a > b ? (b > c ? b : a > c ? c : a) : (a > c ? a : b > c ? c : b);
+}
+
+static unsigned int synth_rand(H264_synth *synth)
+{
+    synth->seed = synth->seed * 1103515245 + 12345;
+    return synth->seed >> 16;
+}
+
+/* Levels from table A-1: the smallest that allows the frame size and
+ * macroblock rate is given in the SPS.
+ */
+static const struct {
+    int             level_idc;
+    unsigned int    mbs_per_second;
+    unsigned int    frame_mbs;
+} synth_levels[] = {
+    { 30, 40500, 1620 },
+    { 31, 108000, 3600 },
+    { 32, 216000, 5120 },
+    { 40, 245760, 8192 },
+    { 42, 522240, 8704 },
+    { 50, 589824, 22080 },
+    { 51, 983040, 36864 },
+    { 52, 2073600, 36864 },
+};
+
+static int synth_level(const H264_synth *synth)
+{
+    unsigned int mbs = synth->mb_width * synth->mb_height;
+    int i;
+
+    for (i = 0; i < (int)(sizeof(synth_levels) / sizeof(synth_levels[0])) - 1; i++) {
+        if (mbs <= synth_levels[i].frame_mbs && mbs * synth->fps <= synth_levels[i].mbs_per_second) {
+            break;
+        }
+    }
+
+    return synth_levels[i].level_idc;
+}
+
+/* The first macroblock row of slice "slice". */
+static int slice_top(const H264_synth *synth, int slice)
+{
+    return slice * synth->mb_height / synth->slices;
+}
+
+/***************************************************************************
+*   Parameter sets and slices.
+****************************************************************************/
+
+/* Timing, and no reordering, so that a decoder outputs each frame as soon
+ * as it is decoded.
+ */
+static void write_vui(H264_synth *synth, synth_writer *w)
+{
+    put_bits(w, 0, 1);                      /* aspect_ratio_info_present_flag. */
+    put_bits(w, 0, 1);                      /* overscan_info_present_flag. */
+    put_bits(w, 0, 1);                      /* video_signal_type_present_flag. */
+    put_bits(w, 0, 1);                      /* chroma_loc_info_present_flag. */
+    put_bits(w, 1, 1);                      /* timing_info_present_flag. */
+    put_bits(w, 1, 32);                     /* num_units_in_tick. */
+    put_bits(w, synth->fps * 2, 32);        /* time_scale: a frame is two ticks. */
+    put_bits(w, 1, 1);                      /* fixed_frame_rate_flag. */
+    put_bits(w, 0, 1);                      /* nal_hrd_parameters_present_flag. */
+    put_bits(w, 0, 1);                      /* vcl_hrd_parameters_present_flag. */
+    put_bits(w, 0, 1);                      /* pic_struct_present_flag. */
+    put_bits(w, 1, 1);                      /* bitstream_restriction_flag. */
+    put_bits(w, 1, 1);                      /* motion_vectors_over_pic_boundaries_flag. */
+    put_ue(w, 0);                           /* max_bytes_per_pic_denom. */
+    put_ue(w, 0);                           /* max_bits_per_mb_denom. */
+    put_ue(w, 16);                          /* log2_max_mv_length_horizontal. */
+    put_ue(w, 16);                          /* log2_max_mv_length_vertical. */
+    put_ue(w, 0);                           /* max_num_reorder_frames. */
+    put_ue(w, 1);                           /* max_dec_frame_buffering. */
+}
+
+static void write_sps(H264_synth *synth, synth_writer *w)
+{
+    int crop_right = (synth->mb_width * 16 - synth->width) / 2;
+    int crop_bottom = (synth->mb_height * 16 - synth->height) / 2;
+
+    start_nal(w, 0x67);
+    put_bits(w, 66, 8);                     /* profile_idc: baseline. */
+    put_bits(w, 0xc0, 8);                   /* constraint_set0/1_flag. */
+    put_bits(w, synth_level(synth), 8);     /* level_idc. */
+    put_ue(w, 0);                           /* seq_parameter_set_id. */
+    put_ue(w, 0);                           /* log2_max_frame_num_minus4. */
+    put_ue(w, 2);                           /* pic_order_cnt_type. */
+    put_ue(w, 1);                           /* max_num_ref_frames. */
+    put_bits(w, 0, 1);                      /* gaps_in_frame_num_value_allowed_flag. */
+    put_ue(w, synth->mb_width - 1);
+    put_ue(w, synth->mb_height - 1);
+    put_bits(w, 1, 1);                      /* frame_mbs_only_flag. */
+    put_bits(w, 1, 1);                      /* direct_8x8_inference_flag. */
+    put_bits(w, crop_right || crop_bottom, 1);
+    if (crop_right || crop_bottom) {
+        put_ue(w, 0);
+        put_ue(w, crop_right);
+        put_ue(w, 0);
+        put_ue(w, crop_bottom);
+    }
+    put_bits(w, synth->fps != 0, 1);        /* vui_parameters_present_flag. */
+    if (synth->fps) {
+        write_vui(synth, w);
+    }
+    put_trailing_bits(w);
+}
+
+static void write_pps(synth_writer *w)
+{
+    start_nal(w, 0x68);
+    put_ue(w, 0);                           /* pic_parameter_set_id. */
+    put_ue(w, 0);                           /* seq_parameter_set_id. */
+    put_bits(w, 0, 1);                      /* entropy_coding_mode_flag: CAVLC. */
+    put_bits(w, 0, 1);                      /* bottom_field_pic_order_in_frame_present_flag. */
+    put_ue(w, 0);                           /* num_slice_groups_minus1. */
+    put_ue(w, 0);                           /* num_ref_idx_l0_default_active_minus1. */
+    put_ue(w, 0);                           /* num_ref_idx_l1_default_active_minus1. */
+    put_bits(w, 0, 1);                      /* weighted_pred_flag. */
+    put_bits(w, 0, 2);                      /* weighted_bipred_idc. */
+    put_se(w, 0);                           /* pic_init_qp_minus26. */
+    put_se(w, 0);                           /* pic_init_qs_minus26. */
+    put_se(w, 0);                           /* chroma_qp_index_offset. */
+    put_bits(w, 0, 1);                      /* deblocking_filter_control_present_flag. */
+    put_bits(w, 0, 1);                      /* constrained_intra_pred_flag. */
+    put_bits(w, 0, 1);                      /* redundant_pic_cnt_present_flag. */
+    put_trailing_bits(w);
+}
+
+/* Of the access unit being written, as synth->idr and synth->ref say. */
+static void write_slice_header(H264_synth *synth, synth_writer *w, int first_mb, int slice_type,
+                               unsigned int frame_num)
+{
+    start_nal(w, synth->idr ? 0x65 : synth->ref ? 0x41 : 0x01);
+    put_ue(w, first_mb);                    /* first_mb_in_slice. */
+    put_ue(w, slice_type);
+    put_ue(w, 0);                           /* pic_parameter_set_id. */
+    put_bits(w, frame_num, 4);              /* frame_num. */
+    if (synth->idr) {
+        put_ue(w, synth->idr_pic_id);
+    } else {
+        put_bits(w, 0, 1);                  /* num_ref_idx_active_override_flag. */
+        put_bits(w, 0, 1);                  /* ref_pic_list_modification_flag_l0. */
+    }
+    if (synth->idr) {
+        put_bits(w, 0, 1);                  /* no_output_of_prior_pics_flag. */
+        put_bits(w, 0, 1);                  /* long_term_reference_flag. */
+    } else if (synth->ref) {
+        put_bits(w, 0, 1);                  /* adaptive_ref_pic_marking_mode_flag. */
+    }
+    put_se(w, 0);                           /* slice_qp_delta. */
+}
+
+/* A textured picture, so that motion compensation has something to do. */
+static void write_idr(H264_synth *synth, synth_writer *w)
+{
+    int slice, mb, end, i, x, y;
+
+    for (slice = 0; slice < synth->slices && !w->overflow; slice++) {
+        mb = slice_top(synth, slice) * synth->mb_width;
+        end = slice_top(synth, slice + 1) * synth->mb_width;
+
+        write_slice_header(synth, w, mb, SYNTH_SLICE_I_ALL, 0);
+
+        for (; mb < end && !w->overflow; mb++) {
+            put_ue(w, SYNTH_MB_I_PCM);
+            put_align_zero(w);
+
+            /* Samples are never 0, which older decoders reject. */
+            for (i = 0; i < 256; i++) {
+                x = (mb % synth->mb_width) * 16 + i % 16;
+                y = (mb / synth->mb_width) * 16 + i / 16;
+                put_byte(w, 1 + (x * 3 + y * 5 + synth_rand(synth) % 32) % 254);
+            }
+            for (i = 0; i < 128; i++) {
+                put_byte(w, 1 + (i * 7 + mb + synth_rand(synth) % 16) % 254);
+            }
+        }
+
+        put_trailing_bits(w);
+    }
+}
+
+/*  The motion vector predicted for the 16x16 macroblock at (x, y), from
+ *  its neighbours A (left), B (above) and C (above right, or D above left
+ *  if C is outside the picture), as in 8.4.1.3. Rows above "top" are in
+ *  another slice, so not available. Every macroblock uses reference 0, so
+ *  only availability matters.
+ */
+static int predict_mv(const H264_synth *synth, int x, int y, int top, int component)
+{
+    int a = x > 0, b = y > top, c = y > top && x + 1 < synth->mb_width;
+    int mv_a = 0, mv_b = 0, mv_c = 0;
+    int cx = c ? x + 1 : x - 1;
+
+    if (!c) {
+        c = y > top && x > 0;
+    }
+
+    if (a) {
+        mv_a = synth->mvs[(y * synth->mb_width + x - 1) * 2 + component];
+    }
+    if (b) {
+        mv_b = synth->mvs[((y - 1) * synth->mb_width + x) * 2 + component];
+    }
+    if (c) {
+        mv_c = synth->mvs[((y - 1) * synth->mb_width + cx) * 2 + component];
+    }
+
+    if (a && !b && !c) {
+        return mv_a;
+    }
+    if (a + b + c == 1) {
+        return a ? mv_a : b ? mv_b : mv_c;
+    }
+
+    return median(mv_a, mv_b, mv_c);
+}
+
+/* The motion vector a P_Skip macroblock at (x, y) moves with, as in
+ * 8.4.1.1: none at the left or top of the slice or next to one that
+ * doesn't move, the predicted one otherwise.
+ */
+static void skip_mv(H264_synth *synth, int x, int y, int top)
+{
+    short *mv = &synth->mvs[(y * synth->mb_width + x) * 2];
+    short *left = mv - 2, *above = mv - synth->mb_width * 2;
+
+    if (x == 0 || y == top || (left[0] == 0 && left[1] == 0) || (above[0] == 0 && above[1] == 0)) {
+        mv[0] = mv[1] = 0;
+        return;
+    }
+
+    mv[0] = predict_mv(synth, x, y, top, 0);
+    mv[1] = predict_mv(synth, x, y, top, 1);
+}
+
+static int is_active(const H264_synth *synth, int x, int y)
+{
+    return x >= synth->active_x && x < synth->active_x + synth->active_width &&
+           y >= synth->active_y && y < synth->active_y + synth->active_height;
+}
+
+static void write_p(H264_synth *synth, synth_writer *w, unsigned int frame_num)
+{
+    int slice, top, bottom, x, y, c, mv, skip_run;
+
+    for (slice = 0; slice < synth->slices && !w->overflow; slice++) {
+        top = slice_top(synth, slice);
+        bottom = slice_top(synth, slice + 1);
+
+        write_slice_header(synth, w, top * synth->mb_width, SYNTH_SLICE_P_ALL, frame_num);
+
+        skip_run = 0;
+        for (y = top; y < bottom && !w->overflow; y++) {
+            for (x = 0; x < synth->mb_width; x++) {
+                if (!is_active(synth, x, y)) {
+                    skip_mv(synth, x, y, top);
+                    skip_run++;
+                    continue;
+                }
+
+                put_ue(w, skip_run);        /* mb_skip_run. */
+                skip_run = 0;
+                put_ue(w, SYNTH_MB_P_L0_16x16);
+                for (c = 0; c < 2; c++) {
+                    mv = (int)(synth_rand(synth) % (2 * SYNTH_MV_RANGE + 1)) - SYNTH_MV_RANGE;
+                    put_se(w, mv - predict_mv(synth, x, y, top, c));
+                    synth->mvs[(y * synth->mb_width + x) * 2 + c] = mv;
+                }
+                put_ue(w, 0);               /* coded_block_pattern: none. */
+            }
+        }
+        if (skip_run) {
+            put_ue(w, skip_run);
+        }
+
+        put_trailing_bits(w);
+    }
+}
+
+/***************************************************************************
+*   Interface.
+****************************************************************************/
+
+int h264_synth_init(H264_synth *synth, int width, int height, unsigned int seed)
+{
+    memset(synth, 0, sizeof(H264_synth));
+    synth->width = width;
+    synth->height = height;
+    synth->mb_width = (width + 15) / 16;
+    synth->mb_height = (height + 15) / 16;
+    synth->slices = 1;
+    synth->active_width = synth->mb_width;
+    synth->active_height = synth->mb_height;
+    synth->seed = seed;
+
+    synth->mvs = calloc(synth->mb_width * synth->mb_height * 2, sizeof(short));
+
+    return synth->mvs ? 0 : -1;
+}
+
+void h264_synth_free(H264_synth *synth)
+{
+    free(synth->mvs);
+    synth->mvs = NULL;
+}
+
+/* An I_PCM macroblock takes 384 bytes and a few bits; nothing else comes
+ * close. The parameter sets and slice headers take a few more.
+ */
+int h264_synth_max_size(const H264_synth *synth)
+{
+    return synth->mb_width * synth->mb_height * 386 + synth->mb_height * 16 + 256;
+}
+
+void h264_synth_set_active(H264_synth *synth, int x, int y, int width, int height)
+{
+    int right = x + width < synth->width ? x + width : synth->width;
+    int bottom = y + height < synth->height ? y + height : synth->height;
+
+    x = x > 0 ? x : 0;
+    y = y > 0 ? y : 0;
+
+    synth->active_x = x / 16;
+    synth->active_y = y / 16;
+    synth->active_width = right > x ? (right + 15) / 16 - synth->active_x : 0;
+    synth->active_height = bottom > y ? (bottom + 15) / 16 - synth->active_y : 0;
+}
+
+int h264_synth_frame(H264_synth *synth, unsigned char *buf, int size)
+{
+    H264_synth saved = *synth;
+    unsigned int frame_num;
+    synth_writer w;
+
+    memset(&w, 0, sizeof(w));
+    w.buf = buf;
+    w.size = size;
+
+    if (synth->slices < 1 || synth->slices > synth->mb_height) {
+        synth->slices = synth->slices < 1 ? 1 : synth->mb_height;
+    }
+
+    /* With pic_order_cnt_type 2, no two frames in a row may be non-reference. */
+    synth->idr = synth->frame == 0 || (synth->gop && synth->gop_frame + 1 >= synth->gop);
+    synth->gop_frame = synth->idr ? 0 : synth->gop_frame + 1;
+    synth->ref = synth->idr || !synth->non_ref || (synth->gop_frame & 1);
+    frame_num = synth->idr ? 0 : (synth->frame_num + 1) & 15;
+
+    if (synth->idr) {
+        write_sps(synth, &w);
+        write_pps(&w);
+        write_idr(synth, &w);
+    } else {
+        write_p(synth, &w, frame_num);
+    }
+
+    if (w.overflow) {
+        *synth = saved;
+        return -1;
+    }
+
+    if (synth->ref) {
+        synth->frame_num = frame_num;
+    }
+    if (synth->idr) {
+        synth->idr_pic_id ^= 1;
+    }
+    synth->frame++;
+
+    return w.len;
+}
+
+int h264_synth_parameter_sets(H264_synth *synth, unsigned char *buf, int size)
+{
+    synth_writer w;
+
+    memset(&w, 0, sizeof(w));
+    w.buf = buf;
+    w.size = size;
+
+    write_sps(synth, &w);
+    write_pps(&w);
+
+    return w.overflow ? -1 : w.len;
+}
@@ -0,0 +1,88 @@
+/***************************************************************************
+*
+*   h264_synth.h
+*
+*   Synthetic H.264 streams, written without an encoder: an IDR of I_PCM
+*   macroblocks followed by P frames whose macroblocks are all predicted
+*   from the previous frame with their own motion vector, and no residual.
+*   Decoding them exercises motion compensation and deblocking on every
+*   macroblock, which makes them a fair load for benchmarking a decoder.
+*
+*   The shape of the stream can be changed after h264_synth_init(), before
+*   the first frame: slices per frame, IDR period, frame rate, frames that
+*   aren't references, and a region outside which the macroblocks of P
+*   frames are skipped, as they are around a changing window of a desktop.
+*
+****************************************************************************/
+
+#ifndef _H264_SYNTH_H_
+#define _H264_SYNTH_H_
+
+/* Real content decodes slower than these streams, having residual: busy
+ * video at 25Mbit/s for 1080p took about three times as long in
+ * libavcodec. A rate measured with them is divided by this before it is
+ * advertised. No hardware decoder has been measured apart, so they get
+ * the same allowance.
+ */
+#define H264_SYNTH_HEADROOM     3
+
+typedef struct _H264_synth {
+    int             width;
+    int             height;
+    int             mb_width;
+    int             mb_height;
+
+    int             slices;         /* Per frame, each a band of macroblock rows. 1 by default. */
+    unsigned int    gop;            /* Frames from an IDR to the next, 0 for only the first. */
+    int             non_ref;        /* Every other P frame has nal_ref_idc 0. */
+    unsigned int    fps;            /* Given in the VUI, and picks the level, if set. */
+
+    /* Macroblocks coded in P frames; the rest are skipped. The whole
+     * picture by default.
+     */
+    int             active_x, active_y, active_width, active_height;
+
+    unsigned int    frame;          /* Access units written so far. */
+    unsigned int    seed;
+    short          *mvs;            /* Of the frame being written, x then y per macroblock. */
+    int             idr;            /* Whether the last access unit was an IDR. */
+    int             ref;            /* And a reference. */
+    unsigned int    gop_frame;      /* Of the last access unit, from its IDR. */
+    unsigned int    frame_num;      /* Of the last reference. */
+    unsigned int    idr_pic_id;
+} H264_synth;
+
+/* Returns 0, or -1 if out of memory. */
+int h264_synth_init(H264_synth *synth, int width, int height, unsigned int seed);
+void h264_synth_free(H264_synth *synth);
+
+/* The largest access unit h264_synth_frame() writes. */
+int h264_synth_max_size(const H264_synth *synth);
+
+/* Marks the macroblocks covering the "width" x "height" pixels at (x, y)
+ * as the ones P frames code, clipped to the picture.
+ */
+void h264_synth_set_active(H264_synth *synth, int x, int y, int width, int height);
+
+/*  Function: h264_synth_frame()
+ *
+ *  Writes the next access unit to "buf", in Annex-B format. An IDR is
+ *  preceded by the SPS and the PPS; the first access unit and every
+ *  "gop"th after it are IDRs, and the rest are P frames.
+ *
+ *  Returns:
+ *       the number of bytes written, or -1 if "size" is too small.
+ */
+int h264_synth_frame(H264_synth *synth, unsigned char *buf, int size);
+
+/*  Function: h264_synth_parameter_sets()
+ *
+ *  Writes the SPS and the PPS to "buf" in Annex-B format, as the codec
+ *  data of the stream.
+ *
+ *  Returns:
+ *       the number of bytes written, or -1 if "size" is too small.
+ */
+int h264_synth_parameter_sets(H264_synth *synth, unsigned char *buf, int size);
+
+#endif /* _H264_SYNTH_H_ */
@@ -0,0 +1,296 @@
+/***************************************************************************
+*
+*   hud.c
+*
+*   On-screen statistics (see hud.h).
+*
+****************************************************************************/
+
+#include "video_gl.h"
+#include "hud.h"
+
+#define HUD_COLUMNS         26
+#define HUD_LINES           6
+#define HUD_SCALE           2
+#define HUD_BORDER          4
+
+/* A 5x7 glyph in a 6x9 cell. */
+#define GLYPH_WIDTH         6
+#define GLYPH_HEIGHT        9
+
+#define HUD_WIDTH           (HUD_COLUMNS * GLYPH_WIDTH * HUD_SCALE + 2 * HUD_BORDER)
+#define HUD_HEIGHT          (HUD_LINES * GLYPH_HEIGHT * HUD_SCALE + 2 * HUD_BORDER)
+
+#define HUD_BACKGROUND      0xa0000000
+#define HUD_TEXT            0xffffffff
+
+#define HUD_PERIOD_MS       1000
+
+/* ' ' to 'Z', a column per byte from the left, the top row in bit 0. */
+static const unsigned char font[][5] = {
+    { 0x00, 0x00, 0x00, 0x00, 0x00 },   /* ' ' */
+    { 0x00, 0x00, 0x5f, 0x00, 0x00 },   /* '!' */
+    { 0x00, 0x07, 0x00, 0x07, 0x00 },   /* '"' */
+    { 0x14, 0x7f, 0x14, 0x7f, 0x14 },   /* '#' */
+    { 0x24, 0x2a, 0x7f, 0x2a, 0x12 },   /* '$' */
+    { 0x23, 0x13, 0x08, 0x64, 0x62 },   /* '%' */
+    { 0x36, 0x49, 0x56, 0x20, 0x50 },   /* '&' */
+    { 0x00, 0x05, 0x03, 0x00, 0x00 },   /* ''' */
+    { 0x00, 0x1c, 0x22, 0x41, 0x00 },   /* '(' */
+    { 0x00, 0x41, 0x22, 0x1c, 0x00 },   /* ')' */
+    { 0x2a, 0x1c, 0x7f, 0x1c, 0x2a },   /* '*' */
+    { 0x08, 0x08, 0x3e, 0x08, 0x08 },   /* '+' */
+    { 0x00, 0x50, 0x30, 0x00, 0x00 },   /* ',' */
+    { 0x08, 0x08, 0x08, 0x08, 0x08 },   /* '-' */
+    { 0x00, 0x60, 0x60, 0x00, 0x00 },   /* '.' */
+    { 0x20, 0x10, 0x08, 0x04, 0x02 },   /* '/' */
+    { 0x3e, 0x51, 0x49, 0x45, 0x3e },   /* '0' */
+    { 0x00, 0x42, 0x7f, 0x40, 0x00 },   /* '1' */
+    { 0x42, 0x61, 0x51, 0x49, 0x46 },   /* '2' */
+    { 0x21, 0x41, 0x45, 0x4b, 0x31 },   /* '3' */
+    { 0x18, 0x14, 0x12, 0x7f, 0x10 },   /* '4' */
+    { 0x27, 0x45, 0x45, 0x45, 0x39 },   /* '5' */
+    { 0x3c, 0x4a, 0x49, 0x49, 0x30 },   /* '6' */
+    { 0x01, 0x71, 0x09, 0x05, 0x03 },   /* '7' */
+    { 0x36, 0x49, 0x49, 0x49, 0x36 },   /* '8' */
+    { 0x06, 0x49, 0x49, 0x29, 0x1e },   /* '9' */
+    { 0x00, 0x36, 0x36, 0x00, 0x00 },   /* ':' */
+    { 0x00, 0x56, 0x36, 0x00, 0x00 },   /* ';' */
+    { 0x08, 0x14, 0x22, 0x41, 0x00 },   /* '<' */
+    { 0x14, 0x14, 0x14, 0x14, 0x14 },   /* '=' */
+    { 0x00, 0x41, 0x22, 0x14, 0x08 },   /* '>' */
+    { 0x02, 0x01, 0x51, 0x09, 0x06 },   /* '?' */
+    { 0x32, 0x49, 0x79, 0x41, 0x3e },   /* '@' */
+    { 0x7e, 0x11, 0x11, 0x11, 0x7e },   /* 'A' */
+    { 0x7f, 0x49, 0x49, 0x49, 0x36 },   /* 'B' */
+    { 0x3e, 0x41, 0x41, 0x41, 0x22 },   /* 'C' */
+    { 0x7f, 0x41, 0x41, 0x22, 0x1c },   /* 'D' */
+    { 0x7f, 0x49, 0x49, 0x49, 0x41 },   /* 'E' */
+    { 0x7f, 0x09, 0x09, 0x09, 0x01 },   /* 'F' */
+    { 0x3e, 0x41, 0x49, 0x49, 0x7a },   /* 'G' */
+    { 0x7f, 0x08, 0x08, 0x08, 0x7f },   /* 'H' */
+    { 0x00, 0x41, 0x7f, 0x41, 0x00 },   /* 'I' */
+    { 0x20, 0x40, 0x41, 0x3f, 0x01 },   /* 'J' */
+    { 0x7f, 0x08, 0x14, 0x22, 0x41 },   /* 'K' */
+    { 0x7f, 0x40, 0x40, 0x40, 0x40 },   /* 'L' */
+    { 0x7f, 0x02, 0x0c, 0x02, 0x7f },   /* 'M' */
+    { 0x7f, 0x04, 0x08, 0x10, 0x7f },   /* 'N' */
+    { 0x3e, 0x41, 0x41, 0x41, 0x3e },   /* 'O' */
+    { 0x7f, 0x09, 0x09, 0x09, 0x06 },   /* 'P' */
+    { 0x3e, 0x41, 0x51, 0x21, 0x5e },   /* 'Q' */
+    { 0x7f, 0x09, 0x19, 0x29, 0x46 },   /* 'R' */
+    { 0x46, 0x49, 0x49, 0x49, 0x31 },   /* 'S' */
+    { 0x01, 0x01, 0x7f, 0x01, 0x01 },   /* 'T' */
+    { 0x3f, 0x40, 0x40, 0x40, 0x3f },   /* 'U' */
+    { 0x1f, 0x20, 0x40, 0x20, 0x1f },   /* 'V' */
+    { 0x3f, 0x40, 0x38, 0x40, 0x3f },   /* 'W' */
+    { 0x63, 0x14, 0x08, 0x14, 0x63 },   /* 'X' */
+    { 0x07, 0x08, 0x70, 0x08, 0x07 },   /* 'Y' */
+    { 0x61, 0x51, 0x49, 0x45, 0x43 },   /* 'Z' */
+};
+
+static unsigned long long now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+/***************************************************************************
+*   Drawing.
+****************************************************************************/
+
+static void draw_char(unsigned int *pixels, int x, int y, char c)
+{
+    const unsigned char *glyph;
+    int column, row, i, j;
+
+    if (c >= 'a' && c <= 'z') {
+        c -= 'a' - 'A';
+    }
+    if (c < ' ' || c > 'Z') {
+        c = '?';
+    }
+    glyph = font[c - ' '];
+
+    for (column = 0; column < 5; column++) {
+        for (row = 0; row < 7; row++) {
+            if (!(glyph[column] & (1 << row))) {
+                continue;
+            }
+            for (j = 0; j < HUD_SCALE; j++) {
+                for (i = 0; i < HUD_SCALE; i++) {
+                    pixels[(y + row * HUD_SCALE + j) * HUD_WIDTH + x + column * HUD_SCALE + i] = HUD_TEXT;
+                }
+            }
+        }
+    }
+}
+
+static void draw_line(unsigned int *pixels, int line, const char *text)
+{
+    int i;
+
+    for (i = 0; i < HUD_COLUMNS && text[i]; i++) {
+        draw_char(pixels, HUD_BORDER + i * GLYPH_WIDTH * HUD_SCALE,
+                  HUD_BORDER + line * GLYPH_HEIGHT * HUD_SCALE, text[i]);
+    }
+}
+
+/* "label p50 ... p99 ..." of a stage, in ms, or a dash if no frame has
+ * been through it.
+ */
+static void format_stage(char *text, int size, const char *label, H264_latency *latency, latency_stage stage)
+{
+    latency_summary summary;
+
+    if (latency_query(latency, stage, &summary) != 0) {
+        snprintf(text, size, "%-7s -", label);
+        return;
+    }
+
+    snprintf(text, size, "%-7s P50%5.1f P99%5.1f", label, summary.p50 / 1000.0, summary.p99 / 1000.0);
+}
+
+/* Draws the HUD into the resource not on screen and swaps it in. */
+static void render(H264_hud *hud, char lines[HUD_LINES][HUD_COLUMNS + 1])
+{
+    DISPMANX_UPDATE_HANDLE_T update;
+    DISPMANX_RESOURCE_HANDLE_T resource = hud->resources[!hud->shown];
+    VC_RECT_T rect;
+    int i;
+
+    for (i = 0; i < HUD_WIDTH * HUD_HEIGHT; i++) {
+        hud->pixels[i] = HUD_BACKGROUND;
+    }
+    for (i = 0; i < HUD_LINES; i++) {
+        draw_line(hud->pixels, i, lines[i]);
+    }
+
+    vc_dispmanx_rect_set(&rect, 0, 0, HUD_WIDTH, HUD_HEIGHT);
+    vc_dispmanx_resource_write_data(resource, VC_IMAGE_ARGB8888, HUD_WIDTH * 4, hud->pixels, &rect);
+
+    /* Not waited for, the decoding thread draws it. */
+    update = vc_dispmanx_update_start(0);
+    vc_dispmanx_element_change_source(update, hud->element, resource);
+    vc_dispmanx_update_submit(update, NULL, NULL);
+
+    hud->shown = !hud->shown;
+}
+
+/***************************************************************************
+*   HUD.
+****************************************************************************/
+
+int hud_open(H264_hud *hud, const char *backend, int width, int height)
+{
+    static VC_DISPMANX_ALPHA_T alpha = { DISPMANX_FLAGS_ALPHA_FROM_SOURCE, 255, 0 };
+    char *enabled = getenv("CTX_H264_HUD");
+    char lines[HUD_LINES][HUD_COLUMNS + 1];
+    DISPMANX_UPDATE_HANDLE_T update;
+    VC_RECT_T src_rect, dst_rect;
+    uint32_t image;
+
+    memset(hud, 0, sizeof(H264_hud));
+
+    if (!enabled || atoi(enabled) == 0) {
+        return -1;
+    }
+
+    hud->display = vc_dispmanx_display_open(0);
+    hud->pixels = malloc(HUD_WIDTH * HUD_HEIGHT * 4);
+    hud->resources[0] = vc_dispmanx_resource_create(VC_IMAGE_ARGB8888, HUD_WIDTH, HUD_HEIGHT, &image);
+    hud->resources[1] = vc_dispmanx_resource_create(VC_IMAGE_ARGB8888, HUD_WIDTH, HUD_HEIGHT, &image);
+
+    if (hud->display != DISPMANX_NO_HANDLE && hud->pixels && hud->resources[0] != DISPMANX_NO_HANDLE &&
+        hud->resources[1] != DISPMANX_NO_HANDLE) {
+        update = vc_dispmanx_update_start(0);
+        vc_dispmanx_rect_set(&src_rect, 0, 0, HUD_WIDTH << 16, HUD_HEIGHT << 16);
+        vc_dispmanx_rect_set(&dst_rect, 16, 16, HUD_WIDTH, HUD_HEIGHT);
+        hud->element = vc_dispmanx_element_add(update, hud->display, HUD_LAYER, &dst_rect, hud->resources[0],
+                                               &src_rect, DISPMANX_PROTECTION_NONE, &alpha, NULL, VC_IMAGE_ROT0);
+        vc_dispmanx_update_submit_sync(update);
+    }
+
+    if (hud->element == DISPMANX_NO_HANDLE) {
+        DEBUG_TRACE("Couldn't put the HUD up\n");
+        hud_close(hud);
+        return -1;
+    }
+
+    snprintf(hud->title, sizeof(hud->title), "%s %dX%d", backend, width, height);
+    hud->rendered = now_ms();
+
+    memset(lines, 0, sizeof(lines));
+    snprintf(lines[0], sizeof(lines[0]), "%s", hud->title);
+    render(hud, lines);
+
+    return 0;
+}
+
+void hud_update(H264_hud *hud, H264_stats *stats, int queue_depth)
+{
+    char lines[HUD_LINES][HUD_COLUMNS + 1];
+    latency_summary shown, decoded;
+    unsigned long long now;
+    double seconds;
+    latency_stage decode;
+
+    if (hud->element == DISPMANX_NO_HANDLE || (now = now_ms()) - hud->rendered < HUD_PERIOD_MS) {
+        return;
+    }
+
+    seconds = (now - hud->rendered) / 1000.0;
+    latency_query(&stats->latency, LATENCY_TO_DISPLAYED, &shown);
+
+    /* With OMX the picture can't be seen leaving the decoder; the
+     * bitstream being consumed is the nearest there is.
+     */
+    decode = LATENCY_TO_DECODED;
+    if (latency_query(&stats->latency, LATENCY_TO_DECODED, &decoded) != 0) {
+        decode = LATENCY_TO_CONSUMED;
+    }
+
+    memset(lines, 0, sizeof(lines));
+    snprintf(lines[0], sizeof(lines[0]), "%s", hud->title);
+    snprintf(lines[1], sizeof(lines[1]), "FPS %4.1f SHOWN %4.1f", (stats->frames - hud->frames) / seconds,
+             (shown.count - hud->displayed) / seconds);
+    format_stage(lines[2], sizeof(lines[2]), "DECODE", &stats->latency, decode);
+    format_stage(lines[3], sizeof(lines[3]), "PRESENT", &stats->latency, LATENCY_TO_DISPLAYED);
+    format_stage(lines[4], sizeof(lines[4]), "TOTAL", &stats->latency, LATENCY_TOTAL);
+    snprintf(lines[5], sizeof(lines[5]), "QUEUE %d SHED %u DROP %u", queue_depth, stats->shed_frames,
+             stats->dropped_frames);
+
+    render(hud, lines);
+
+    hud->rendered = now;
+    hud->frames = stats->frames;
+    hud->displayed = shown.count;
+}
+
+void hud_close(H264_hud *hud)
+{
+    DISPMANX_UPDATE_HANDLE_T update;
+    int i;
+
+    if (hud->element != DISPMANX_NO_HANDLE) {
+        update = vc_dispmanx_update_start(0);
+        vc_dispmanx_element_remove(update, hud->element);
+        vc_dispmanx_update_submit_sync(update);
+    }
+
+    for (i = 0; i < 2; i++) {
+        if (hud->resources[i] != DISPMANX_NO_HANDLE) {
+            vc_dispmanx_resource_delete(hud->resources[i]);
+        }
+    }
+
+    if (hud->display != DISPMANX_NO_HANDLE) {
+        vc_dispmanx_display_close(hud->display);
+    }
+
+    free(hud->pixels);
+    memset(hud, 0, sizeof(H264_hud));
+}
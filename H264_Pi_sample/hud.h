@@ -0,0 +1,54 @@
+/***************************************************************************
+*
+*   hud.h
+*
+*   On-screen statistics: a small ARGB dispmanx element on layer 2000,
+*   over the video, as the old watermark was. It shows the frame rates,
+*   decode and present latency, queue depth and drops, and is redrawn
+*   once a second with a built-in 5x7 font.
+*
+*   CTX_H264_HUD=1 turns it on.
+*
+****************************************************************************/
+
+#ifndef _HUD_H_
+#define _HUD_H_
+
+#include "bcm_host.h"
+
+#define HUD_LAYER           2000
+
+typedef struct _H264_hud {
+    DISPMANX_DISPLAY_HANDLE_T  display;
+    DISPMANX_ELEMENT_HANDLE_T  element;
+
+    /* Drawn into the one not on screen, which is then swapped in. */
+    DISPMANX_RESOURCE_HANDLE_T resources[2];
+    int                        shown;
+    unsigned int              *pixels;
+
+    char                       title[27];   /* A line of the HUD. */
+    unsigned long long         rendered;    /* In ms. */
+    unsigned long long         frames;      /* As of the last render. */
+    unsigned int               displayed;
+} H264_hud;
+
+struct _H264_stats;
+
+/*  Function: hud_open()
+ *
+ *  Puts the HUD up, if CTX_H264_HUD is set.
+ *
+ *  Returns:
+ *       0, or -1 if there is no HUD.
+ */
+int hud_open(H264_hud *hud, const char *backend, int width, int height);
+
+/* Redraws the HUD if a second has passed since it last was. Does nothing
+ * without a HUD.
+ */
+void hud_update(H264_hud *hud, struct _H264_stats *stats, int queue_depth);
+
+void hud_close(H264_hud *hud);
+
+#endif /* _HUD_H_ */
@@ -0,0 +1,242 @@
+/***************************************************************************
+*
+*   latency.c
+*
+*   Per-stage frame latency histograms (see latency.h).
+*
+****************************************************************************/
+
+#include "video_gl.h"
+#include "latency.h"
+
+#define LATENCY_LOG_SECONDS     10
+
+const char *latency_stage_names[LATENCY_STAGES] = {
+    "total",
+    "first_submit",
+    "last_submit",
+    "consumed",
+    "decoded",
+    "displayed",
+};
+
+static unsigned long long now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+/***************************************************************************
+*   Histograms.
+****************************************************************************/
+
+/* Values below 2 << LATENCY_SUB_BITS have a bucket each; above, each power
+ * of 2 is split into 1 << LATENCY_SUB_BITS buckets.
+ */
+static unsigned int bucket_index(unsigned int us)
+{
+    int shift;
+
+    if (us < 2U << LATENCY_SUB_BITS) {
+        return us;
+    }
+
+    shift = 31 - __builtin_clz(us) - LATENCY_SUB_BITS;
+
+    return (shift << LATENCY_SUB_BITS) + (us >> shift);
+}
+
+/* The largest value that goes in bucket "index". */
+static unsigned int bucket_top(unsigned int index)
+{
+    int shift;
+
+    if (index < 2U << LATENCY_SUB_BITS) {
+        return index;
+    }
+
+    shift = (index >> LATENCY_SUB_BITS) - 1;
+
+    return (((index & ((1U << LATENCY_SUB_BITS) - 1)) + (1U << LATENCY_SUB_BITS) + 1) << shift) - 1;
+}
+
+void latency_histogram_add(latency_histogram *histogram, unsigned long long elapsed)
+{
+    unsigned int us = min(elapsed, LATENCY_MAX_US);
+
+    if (histogram->count == 0 || us < histogram->min) {
+        histogram->min = us;
+    }
+    histogram->max = max(histogram->max, us);
+    histogram->sum += us;
+    histogram->count++;
+    histogram->buckets[bucket_index(us)]++;
+}
+
+/* The value "fraction" of the samples are at or below, to within a bucket. */
+static unsigned int histogram_percentile(const latency_histogram *histogram, double fraction)
+{
+    unsigned int target = (unsigned int)(fraction * histogram->count + 0.999999), seen = 0, i;
+
+    target = max(target, 1U);
+
+    for (i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += histogram->buckets[i];
+        if (seen >= target) {
+            return min(bucket_top(i), histogram->max);
+        }
+    }
+
+    return histogram->max;
+}
+
+int latency_summarise(const latency_histogram *histogram, latency_summary *summary)
+{
+    memset(summary, 0, sizeof(latency_summary));
+
+    if (histogram->count == 0) {
+        return -1;
+    }
+
+    summary->count = histogram->count;
+    summary->min = histogram->min;
+    summary->max = histogram->max;
+    summary->mean = histogram->sum / histogram->count;
+    summary->p50 = histogram_percentile(histogram, 0.5);
+    summary->p99 = histogram_percentile(histogram, 0.99);
+    summary->p999 = histogram_percentile(histogram, 0.999);
+
+    return 0;
+}
+
+/***************************************************************************
+*   Frames.
+****************************************************************************/
+
+void latency_init(H264_latency *latency)
+{
+    char *log = getenv("CTX_H264_LATENCY_LOG");
+
+    memset(latency, 0, sizeof(H264_latency));
+    pthread_mutex_init(&latency->lock, NULL);
+    latency->log_us = (log ? atoi(log) : LATENCY_LOG_SECONDS) * 1000000U;
+    latency->logged = now_us();
+}
+
+void latency_destroy(H264_latency *latency)
+{
+    pthread_mutex_destroy(&latency->lock);
+}
+
+unsigned long long latency_start(H264_latency *latency)
+{
+    unsigned long long now = now_us();
+    latency_frame *frame;
+
+    pthread_mutex_lock(&latency->lock);
+
+    /* Timestamps identify frames, so no two may be the same. */
+    now = max(now, latency->current + 1);
+
+    frame = &latency->frames[latency->next++ % LATENCY_FRAMES];
+    memset(frame, 0, sizeof(latency_frame));
+    frame->stamps[LATENCY_START] = now;
+    latency->current = now;
+
+    pthread_mutex_unlock(&latency->lock);
+
+    return now;
+}
+
+void latency_stamp(H264_latency *latency, unsigned long long frame, latency_point point)
+{
+    unsigned long long now = now_us();
+    latency_frame *f = NULL;
+    int i, prev;
+
+    if (!latency || frame == 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&latency->lock);
+
+    for (i = 0; i < LATENCY_FRAMES && !f; i++) {
+        if (latency->frames[i].stamps[LATENCY_START] == frame) {
+            f = &latency->frames[i];
+        }
+    }
+
+    if (f && !f->stamps[point]) {
+        f->stamps[point] = now;
+
+        for (prev = point - 1; prev > LATENCY_START && !f->stamps[prev]; prev--) {
+        }
+        USDT3(latency, point, frame, now - f->stamps[prev]);
+        latency_histogram_add(&latency->total[point], now - f->stamps[prev]);
+        latency_histogram_add(&latency->window[point], now - f->stamps[prev]);
+
+        if (point == LATENCY_DISPLAYED) {
+            latency_histogram_add(&latency->total[LATENCY_TOTAL], now - frame);
+            latency_histogram_add(&latency->window[LATENCY_TOTAL], now - frame);
+        }
+    }
+
+    pthread_mutex_unlock(&latency->lock);
+}
+
+int latency_get(H264_latency *latency, unsigned long long frame, latency_frame *copy)
+{
+    int i, ret = -1;
+
+    pthread_mutex_lock(&latency->lock);
+    for (i = 0; i < LATENCY_FRAMES && ret != 0; i++) {
+        if (frame != 0 && latency->frames[i].stamps[LATENCY_START] == frame) {
+            *copy = latency->frames[i];
+            ret = 0;
+        }
+    }
+    pthread_mutex_unlock(&latency->lock);
+
+    return ret;
+}
+
+int latency_query(H264_latency *latency, latency_stage stage, latency_summary *summary)
+{
+    int ret;
+
+    pthread_mutex_lock(&latency->lock);
+    ret = latency_summarise(&latency->total[stage], summary);
+    pthread_mutex_unlock(&latency->lock);
+
+    return ret;
+}
+
+void latency_log(H264_latency *latency, int final)
+{
+    latency_histogram histograms[LATENCY_STAGES];
+    latency_summary summary;
+    unsigned long long now = now_us();
+    int i;
+
+    if (!final && (latency->log_us == 0 || now - latency->logged < latency->log_us)) {
+        return;
+    }
+
+    /* Formatted outside the lock, which the stamping threads take. */
+    pthread_mutex_lock(&latency->lock);
+    memcpy(histograms, final ? latency->total : latency->window, sizeof(histograms));
+    memset(latency->window, 0, sizeof(latency->window));
+    latency->logged = now;
+    pthread_mutex_unlock(&latency->lock);
+
+    for (i = 0; i < LATENCY_STAGES; i++) {
+        if (latency_summarise(&histograms[i], &summary) == 0) {
+            DEBUG_TRACE("Latency %s %-12s %6u frames, p50 %.1fms, p99 %.1fms, p99.9 %.1fms, max %.1fms\n",
+                        final ? "(context)" : "(window)", latency_stage_names[i], summary.count,
+                        summary.p50 / 1000.0, summary.p99 / 1000.0, summary.p999 / 1000.0, summary.max / 1000.0);
+        }
+    }
+}
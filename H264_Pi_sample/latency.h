@@ -0,0 +1,139 @@
+/***************************************************************************
+*
+*   latency.h
+*
+*   Per-stage frame latency. Each frame is stamped at start_frame() and its
+*   timestamp goes through the decoder with it (nTimeStamp for OMX, buffer
+*   timestamps for V4L2, pts for libavcodec), so the backend and presenter
+*   can stamp the points it reaches. The time between successive points is
+*   added to a log-linear histogram per stage, of fixed size, from which
+*   percentiles are read at any time.
+*
+*   CTX_H264_LATENCY_LOG sets how often, in seconds, the percentiles since
+*   the last log are logged (10 by default, 0 never); those of the whole
+*   context are logged when it closes.
+*
+****************************************************************************/
+
+#ifndef _LATENCY_H_
+#define _LATENCY_H_
+
+#include <pthread.h>
+
+/* Points a frame goes through. A backend stamps those it can see. */
+typedef enum _latency_point {
+    LATENCY_START = 0,          /* start_frame(). */
+    LATENCY_FIRST_SUBMIT,       /* First of the frame handed to the decoder. */
+    LATENCY_LAST_SUBMIT,        /* The end of it handed over. */
+    LATENCY_CONSUMED,           /* The decoder is done with the bitstream. */
+    LATENCY_DECODED,            /* The picture is out of the decoder. */
+    LATENCY_DISPLAYED,          /* On screen. */
+    LATENCY_POINTS
+} latency_point;
+
+/* Stage n ends at point n and starts at the last point before it that
+ * was stamped; LATENCY_TOTAL is from start_frame() to the screen.
+ */
+typedef enum _latency_stage {
+    LATENCY_TOTAL = 0,
+    LATENCY_TO_FIRST_SUBMIT = LATENCY_FIRST_SUBMIT,
+    LATENCY_TO_LAST_SUBMIT,
+    LATENCY_TO_CONSUMED,
+    LATENCY_TO_DECODED,
+    LATENCY_TO_DISPLAYED,
+    LATENCY_STAGES
+} latency_stage;
+
+/* Buckets of 1/16 of each power of 2, up to LATENCY_MAX_US. */
+#define LATENCY_SUB_BITS        4
+#define LATENCY_MAX_US          ((1U << 26) - 1)
+#define LATENCY_BUCKETS         ((26 - LATENCY_SUB_BITS + 1) << LATENCY_SUB_BITS)
+
+/* Frames whose points are still being stamped. */
+#define LATENCY_FRAMES          32
+
+typedef struct _latency_histogram {
+    unsigned int        count;
+    unsigned int        min;            /* In us. */
+    unsigned int        max;
+    unsigned long long  sum;
+    unsigned int        buckets[LATENCY_BUCKETS];
+} latency_histogram;
+
+typedef struct _latency_summary {
+    unsigned int        count;
+    unsigned int        min;            /* In us. */
+    unsigned int        max;
+    unsigned int        mean;
+    unsigned int        p50;
+    unsigned int        p99;
+    unsigned int        p999;
+} latency_summary;
+
+/* A frame's stamps, in us of CLOCK_MONOTONIC, 0 where not yet reached. */
+typedef struct _latency_frame {
+    unsigned long long  stamps[LATENCY_POINTS];
+} latency_frame;
+
+typedef struct _H264_latency {
+    pthread_mutex_t     lock;
+    latency_frame       frames[LATENCY_FRAMES];
+    unsigned int        next;
+    unsigned long long  current;        /* Timestamp of the frame being received. */
+
+    latency_histogram   total[LATENCY_STAGES];      /* Since the context opened. */
+    latency_histogram   window[LATENCY_STAGES];     /* Since the last log. */
+    unsigned long long  logged;
+    unsigned int        log_us;
+} H264_latency;
+
+extern const char *latency_stage_names[LATENCY_STAGES];
+
+void latency_init(H264_latency *latency);
+void latency_destroy(H264_latency *latency);
+
+/*  Function: latency_start()
+ *
+ *  Stamps the start of a new frame, which becomes the current one.
+ *
+ *  Returns:
+ *       the frame's timestamp, in us, unique and never 0.
+ */
+unsigned long long latency_start(H264_latency *latency);
+
+/* Stamps "point" of the frame with timestamp "frame", unless it has
+ * already been or the frame is too old to be tracked. Does nothing if
+ * "latency" is NULL.
+ */
+void latency_stamp(H264_latency *latency, unsigned long long frame, latency_point point);
+
+/*  Function: latency_get()
+ *
+ *  Copies the stamps of the frame with timestamp "frame".
+ *
+ *  Returns:
+ *       0, or -1 if the frame is no longer tracked.
+ */
+int latency_get(H264_latency *latency, unsigned long long frame, latency_frame *copy);
+
+/*  Function: latency_query()
+ *
+ *  Gets the percentiles of "stage" since the context opened.
+ *
+ *  Returns:
+ *       0, or -1 if no frame has been through the stage.
+ */
+int latency_query(H264_latency *latency, latency_stage stage, latency_summary *summary);
+
+/* Histograms of other figures, kept by their owners. The caller locks. */
+void latency_histogram_add(latency_histogram *histogram, unsigned long long elapsed);
+
+/* Returns 0, or -1 if "histogram" is empty. */
+int latency_summarise(const latency_histogram *histogram, latency_summary *summary);
+
+/* Logs the stages since the last log once CTX_H264_LATENCY_LOG seconds
+ * have passed, or those of the whole context if "final" is set.
+ */
+void latency_log(H264_latency *latency, int final);
+
+#endif /* _LATENCY_H_ */
@@ -0,0 +1,191 @@
+/***************************************************************************
+*
+*   metrics.c
+*
+*   Live statistics in shared memory (see metrics.h).
+*
+****************************************************************************/
+
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "video_gl.h"
+#include "metrics.h"
+
+static unsigned long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int metrics_open(H264_metrics *metrics, unsigned int context, const char *backend, int width, int height)
+{
+    char *enabled = getenv("CTX_H264_METRICS");
+    metrics_block *block;
+    int fd;
+
+    memset(metrics, 0, sizeof(H264_metrics));
+
+    if (enabled && atoi(enabled) == 0) {
+        return -1;
+    }
+
+    snprintf(metrics->name, sizeof(metrics->name), "/" METRICS_PREFIX "%d.%u", (int)getpid(), context);
+
+    fd = shm_open(metrics->name, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        DEBUG_TRACE("Couldn't create %s, errno=%d\n", metrics->name, errno);
+        return -1;
+    }
+
+    block = MAP_FAILED;
+    if (ftruncate(fd, sizeof(metrics_block)) == 0) {
+        block = mmap(NULL, sizeof(metrics_block), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+
+    if (block == MAP_FAILED) {
+        DEBUG_TRACE("Couldn't map %s, errno=%d\n", metrics->name, errno);
+        shm_unlink(metrics->name);
+        return -1;
+    }
+
+    /* The file is new and zeroed; readers ignore it until the magic is in. */
+    block->version = METRICS_VERSION;
+    block->size = sizeof(metrics_block);
+    block->pid = getpid();
+    block->context = context;
+    snprintf(block->backend, sizeof(block->backend), "%s", backend);
+    block->width = width;
+    block->height = height;
+    block->opened = block->updated = now_ns();
+    __sync_synchronize();
+    memcpy(block->magic, METRICS_MAGIC, sizeof(block->magic));
+
+    metrics->block = block;
+
+    return 0;
+}
+
+static void summarise(metrics_latency *out, H264_latency *latency, latency_stage stage)
+{
+    latency_summary summary;
+
+    latency_query(latency, stage, &summary);
+
+    out->count = summary.count;
+    out->p50 = summary.p50;
+    out->p99 = summary.p99;
+    out->p999 = summary.p999;
+    out->max = summary.max;
+}
+
+static void summarise_frames(metrics_frames *out, H264_analysis *analysis, analyze_class frame_class)
+{
+    latency_summary summary;
+    analyze_totals totals;
+
+    analyze_query(analysis, frame_class, &totals);
+    latency_summarise(&totals.decode, &summary);
+
+    out->frames = totals.frames;
+    out->max_bytes = totals.max_bytes;
+    out->bytes = totals.bytes;
+    out->slices = totals.slices;
+    out->max_slices = totals.max_slices;
+    out->decode.count = summary.count;
+    out->decode.p50 = summary.p50;
+    out->decode.p99 = summary.p99;
+    out->decode.p999 = summary.p999;
+    out->decode.max = summary.max;
+}
+
+static void publish(metrics_block *block, H264_stats *stats, int queue_depth, int recovering,
+                    const metrics_latency *latency, const metrics_frames *frames)
+{
+    block->sequence++;
+    __sync_synchronize();
+
+    block->updated = now_ns();
+    block->frames = stats->frames;
+    block->bytes = stats->bytes;
+    block->queue_depth = queue_depth;
+    block->recovering = recovering;
+    block->input_stalls = stats->input_stalls;
+    block->shed_frames = stats->shed_frames;
+    block->dropped_frames = stats->dropped_frames;
+    block->errors = stats->errors;
+    block->resets = stats->resets;
+    block->lossless_objects = stats->lossless_objects;
+    block->overlay_bytes = stats->overlay_bytes;
+    if (latency) {
+        memcpy(block->latency, latency, sizeof(block->latency));
+        block->decoded = latency[LATENCY_TO_DECODED].count;
+        block->displayed = latency[LATENCY_TO_DISPLAYED].count;
+    }
+    if (frames) {
+        memcpy(block->frame_classes, frames, sizeof(block->frame_classes));
+    }
+
+    __sync_synchronize();
+    block->sequence++;
+}
+
+void metrics_update(H264_metrics *metrics, H264_stats *stats, int queue_depth, int recovering)
+{
+    metrics_latency latency[LATENCY_STAGES];
+    metrics_frames frames[ANALYZE_CLASSES];
+    unsigned long long now_ms;
+    int i;
+
+    if (!metrics->block) {
+        return;
+    }
+
+    /* The summaries walk the histograms under their lock, so aren't taken
+     * every frame. They are taken before the block is opened for writing,
+     * to keep that short.
+     */
+    now_ms = now_ns() / 1000000;
+    if (now_ms - metrics->summarised < METRICS_SUMMARY_MS) {
+        publish(metrics->block, stats, queue_depth, recovering, NULL, NULL);
+        return;
+    }
+    metrics->summarised = now_ms;
+
+    memset(latency, 0, sizeof(latency));
+    for (i = 0; i < LATENCY_STAGES; i++) {
+        summarise(&latency[i], &stats->latency, i);
+    }
+
+    memset(frames, 0, sizeof(frames));
+    for (i = 0; stats->analysis && i < ANALYZE_CLASSES; i++) {
+        summarise_frames(&frames[i], stats->analysis, i);
+    }
+
+    publish(metrics->block, stats, queue_depth, recovering, latency, frames);
+}
+
+void metrics_close(H264_metrics *metrics, H264_stats *stats)
+{
+    if (!metrics->block) {
+        return;
+    }
+
+    metrics->summarised = 0;
+    metrics_update(metrics, stats, 0, 0);
+
+    /* A reader that has it open sees it close; new ones don't find it. */
+    metrics->block->sequence++;
+    __sync_synchronize();
+    metrics->block->closed = 1;
+    __sync_synchronize();
+    metrics->block->sequence++;
+
+    shm_unlink(metrics->name);
+    munmap(metrics->block, sizeof(metrics_block));
+    metrics->block = NULL;
+}
@@ -0,0 +1,121 @@
+/***************************************************************************
+*
+*   metrics.h
+*
+*   Live statistics in POSIX shared memory. Each context publishes a
+*   metrics_block at /dev/shm/ctxh264.<pid>.<context>, which any process
+*   can map and read without locks, as ctxh264_top.bin does. The counters
+*   are updated every frame and the latency summaries every
+*   METRICS_SUMMARY_MS. The block is unlinked when the context closes.
+*
+*   The writer brackets every update with increments of "sequence", so it
+*   is odd while the block is being written. A reader copies the block and
+*   keeps the copy if "sequence" was even and hadn't changed by the end.
+*
+*   CTX_H264_METRICS=0 stops the blocks being published.
+*
+****************************************************************************/
+
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+#include <stdint.h>
+
+#include "latency.h"
+#include "analyze.h"
+
+#define METRICS_MAGIC           "CTXH264M"
+#define METRICS_VERSION         2
+
+/* The shared memory objects are named METRICS_PREFIX<pid>.<context>. */
+#define METRICS_PREFIX          "ctxh264."
+
+#define METRICS_SUMMARY_MS      500
+
+/* A stage of latency.h: percentiles in us since the context opened. */
+typedef struct _metrics_latency {
+    uint32_t    count;
+    uint32_t    p50;
+    uint32_t    p99;
+    uint32_t    p999;
+    uint32_t    max;
+    uint32_t    reserved;
+} metrics_latency;
+
+/* Frames of a class of analyze.h, since the context opened. "decode" is
+ * of those whose decode time was seen.
+ */
+typedef struct _metrics_frames {
+    uint32_t    frames;
+    uint32_t    max_bytes;
+    uint64_t    bytes;
+    uint32_t    slices;
+    uint32_t    max_slices;
+    metrics_latency decode;
+} metrics_frames;
+
+/* Fields are only appended; readers check "version" and use "size" to
+ * tell which are there.
+ */
+typedef struct _metrics_block {
+    char            magic[8];
+    uint32_t        version;
+    uint32_t        size;           /* Of the block as written. */
+    volatile uint32_t sequence;     /* Odd while being written. */
+    uint32_t        pid;
+    uint32_t        context;
+    uint32_t        closed;         /* Set as the context closes. */
+    char            backend[16];
+    uint32_t        width;
+    uint32_t        height;
+    uint64_t        opened;         /* CLOCK_MONOTONIC, in ns. */
+    uint64_t        updated;
+
+    uint64_t        frames;         /* Frames received. */
+    uint64_t        bytes;          /* Bitstream bytes passed to the decoder. */
+    uint64_t        decoded;        /* Frames out of the decoder, where the backend sees them. */
+    uint64_t        displayed;      /* Frames on screen, where the presenter sees them. */
+    uint32_t        queue_depth;
+    uint32_t        recovering;     /* Waiting for an IDR. */
+    uint32_t        input_stalls;   /* Waits for the decoder to take input. */
+    uint32_t        shed_frames;
+    uint32_t        dropped_frames; /* Dropped waiting for an IDR. */
+    uint32_t        errors;
+    uint32_t        resets;
+    uint32_t        lossless_objects;
+    uint64_t        overlay_bytes;  /* ARGB composed into the lossless layer. */
+
+    metrics_latency latency[LATENCY_STAGES];
+
+    /* Version 2. */
+    metrics_frames  frame_classes[ANALYZE_CLASSES];
+} metrics_block;
+
+/* A context's block, as the plugin keeps it. */
+typedef struct _H264_metrics {
+    metrics_block  *block;
+    char            name[64];
+    unsigned long long summarised;  /* When the latency summaries were last updated, in ms. */
+} H264_metrics;
+
+struct _H264_stats;
+
+/*  Function: metrics_open()
+ *
+ *  Creates the block of context "context". Failing to is not an error:
+ *  the context runs without one.
+ *
+ *  Returns:
+ *       0, or -1 if there is no block.
+ */
+int metrics_open(H264_metrics *metrics, unsigned int context, const char *backend, int width, int height);
+
+/* Publishes "stats" and the decoder's queue depth. Does nothing without a
+ * block.
+ */
+void metrics_update(H264_metrics *metrics, struct _H264_stats *stats, int queue_depth, int recovering);
+
+/* Publishes the final figures and unlinks the block. */
+void metrics_close(H264_metrics *metrics, struct _H264_stats *stats);
+
+#endif /* _METRICS_H_ */
@@ -0,0 +1,614 @@
+/***************************************************************************
+*
+*   micro_bench.c
+*
+*   Times the plugin's CPU-side kernels on their own, with the code the
+*   plugin runs: start code scanning and SPS parsing, decode_frame() into
+*   input buffers as the OMX backend fills them, lossless object
+*   composition (cursors, byte-swapped frame buffers, text and deletes),
+*   dirty rect coalescing and the presenters' hand-off to their waiter
+*   threads.
+*
+*       make micro_bench.bin
+*       ./micro_bench.bin [-t seconds] [-r repetitions] [-W seconds]
+*                         [-b name] [-j]
+*
+*   Each benchmark is run for the warmup time, then "repetitions" times for
+*   "seconds" in all. ns/op and bytes/s are given for the median
+*   repetition, with the spread; -j prints JSON, with the machine, for
+*   comparing boards and builds.
+*
+****************************************************************************/
+
+#include <math.h>
+#include <unistd.h>
+#include <sys/utsname.h>
+
+#include "video_gl.h"
+#include "overlay.h"
+#include "presenter.h"
+#include "h264_synth.h"
+
+#define BENCH_MAX_REPS      100
+
+/* Of the stand-in VideoCore, which is what the firmware allocates. */
+#define BENCH_INPUT_BUFFER  81920
+
+#define BENCH_WIDTH         1920
+#define BENCH_HEIGHT        1080
+#define BENCH_SLICES        4
+#define BENCH_RECTS         64
+
+/* Exported by Receiver, as ctxh264_host.bin does. */
+BOOL TwiModeEnableFlag = FALSE;
+
+Display *GetICADisplay()
+{
+    return NULL;
+}
+
+typedef struct _bench_options {
+    double          seconds;
+    double          warmup;
+    int             reps;
+    const char     *only;
+    int             json;
+} bench_options;
+
+typedef struct _bench_result {
+    unsigned long long ops;         /* Per repetition. */
+    double          ns[BENCH_MAX_REPS];
+} bench_result;
+
+/* What the kernels work on, made once. */
+typedef struct _bench_data {
+    unsigned char  *frame;          /* A P frame of BENCH_SLICES slices. */
+    int             frame_size;
+    unsigned char  *sps;            /* Its SPS, without the start code. */
+    int             sps_size;
+
+    H264_stream     stream;
+    unsigned char  *input;          /* An input buffer, as decode_frame() fills it. */
+    int             filled;
+
+    H264_overlay    overlay;
+    struct image_buf fb;
+    struct image_buf cursor;
+    struct image_buf text[16];
+    struct image_buf deletes[16];
+    SIGNED_RECT     rects[BENCH_RECTS];
+
+    pthread_t       waiter;
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    int             pending;
+    int             quit;
+} bench_data;
+
+typedef struct _bench {
+    const char     *name;
+    const char     *what;           /* An op. */
+    unsigned long long bytes;       /* Per op, set up by the run's first call; 0 if not a rate. */
+    void          (*run)(bench_data *data, struct _bench *bench);
+} bench;
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/***************************************************************************
+*   Benchmarks. Each runs one op.
+****************************************************************************/
+
+static void bench_annexb_scan(bench_data *data, bench *b)
+{
+    H264_nal_scanner scanner;
+    unsigned char *p = data->frame;
+    int size = data->frame_size, held, payload, found;
+
+    h264_scanner_reset(&scanner);
+    while (size > 0) {
+        int consumed = h264_scan_nal(&scanner, p, size, &held, &payload, &found);
+
+        p += consumed;
+        size -= consumed;
+    }
+
+    b->bytes = data->frame_size;
+}
+
+static void bench_sps_parse(bench_data *data, bench *b)
+{
+    static H264_sps sps_table[H264_MAX_SPS];
+    unsigned char rbsp[256];
+    H264_bits bits;
+    int len;
+
+    len = h264_unescape(data->sps + 1, data->sps_size - 1, rbsp, sizeof(rbsp));
+    h264_bits_init(&bits, rbsp, len);
+    h264_parse_sps(&bits, sps_table);
+
+    b->bytes = data->sps_size;
+}
+
+static void bench_decode_frame(bench_data *data, bench *b)
+{
+    decode_frame(&data->stream, data->frame, data->frame_size, 1);
+
+    b->bytes = data->frame_size;
+}
+
+/* A 32x32 BGRA bitmap, as cursors come. */
+static void bench_cursor(bench_data *data, bench *b)
+{
+    overlay_clear_dirty(&data->overlay);
+    overlay_compose_rects(&data->overlay, &data->cursor, 1);
+
+    b->bytes = data->cursor.width * data->cursor.height * 4;
+}
+
+/* A 256x256 rect of a BGRA frame buffer, each pixel byte-swapped. */
+static void bench_swizzle(bench_data *data, bench *b)
+{
+    SIGNED_RECT rect = { 512, 256, 768, 512 };
+
+    data->fb.pixel_format = PIXEL_FORMAT_BGRA;
+    overlay_clear_dirty(&data->overlay);
+    overlay_compose_fb(&data->overlay, &data->fb, &rect, 1);
+
+    b->bytes = 256 * 256 * 4;
+}
+
+/* The same from an ARGB frame buffer, which is copied as it is. */
+static void bench_argb_copy(bench_data *data, bench *b)
+{
+    SIGNED_RECT rect = { 512, 256, 768, 512 };
+
+    data->fb.pixel_format = PIXEL_FORMAT_ARGB;
+    overlay_clear_dirty(&data->overlay);
+    overlay_compose_fb(&data->overlay, &data->fb, &rect, 1);
+
+    b->bytes = 256 * 256 * 4;
+}
+
+/* 16 lines of text, made opaque as they are copied. */
+static void bench_text_draw(bench_data *data, bench *b)
+{
+    overlay_clear_dirty(&data->overlay);
+    overlay_compose_rects(&data->overlay, data->text, ELEMENTS_IN_ARRAY(data->text));
+
+    b->bytes = ELEMENTS_IN_ARRAY(data->text) * data->text[0].width * data->text[0].height * 4;
+}
+
+/* And deleted, leaving the area transparent. */
+static void bench_text_delete(bench_data *data, bench *b)
+{
+    overlay_clear_dirty(&data->overlay);
+    overlay_compose_rects(&data->overlay, data->deletes, ELEMENTS_IN_ARRAY(data->deletes));
+
+    b->bytes = ELEMENTS_IN_ARRAY(data->deletes) * data->deletes[0].width * data->deletes[0].height * 4;
+}
+
+/* A frame's worth of dirty rects, some inside others, more than are kept. */
+static void bench_rect_coalesce(bench_data *data, bench *b)
+{
+    H264_dirty damage;
+
+    damage.num_rects = 0;
+    presenter_add_damage(&damage, data->rects, BENCH_RECTS, BENCH_WIDTH, BENCH_HEIGHT);
+}
+
+/* The waiter side of the hand-off, as the presenters' waiters do it. */
+static void *handoff_waiter(void *arg)
+{
+    bench_data *data = arg;
+
+    pthread_mutex_lock(&data->lock);
+    while (!data->quit) {
+        if (!data->pending) {
+            pthread_cond_wait(&data->cond, &data->lock);
+            continue;
+        }
+        data->pending = 0;
+        pthread_cond_broadcast(&data->cond);
+    }
+    pthread_mutex_unlock(&data->lock);
+
+    return NULL;
+}
+
+/* Hands an item to the waiter thread and waits for it to be taken. */
+static void bench_queue_handoff(bench_data *data, bench *b)
+{
+    pthread_mutex_lock(&data->lock);
+    data->pending = 1;
+    pthread_cond_broadcast(&data->cond);
+    while (data->pending) {
+        pthread_cond_wait(&data->cond, &data->lock);
+    }
+    pthread_mutex_unlock(&data->lock);
+}
+
+static bench benches[] = {
+    { "annexb_scan",    "1080p P frame",        0, bench_annexb_scan },
+    { "sps_parse",      "SPS",                  0, bench_sps_parse },
+    { "decode_frame",   "1080p P frame",        0, bench_decode_frame },
+    { "cursor",         "32x32 BGRA bitmap",    0, bench_cursor },
+    { "swizzle",        "256x256 BGRA rect",    0, bench_swizzle },
+    { "argb_copy",      "256x256 ARGB rect",    0, bench_argb_copy },
+    { "text_draw",      "16 256x16 objects",    0, bench_text_draw },
+    { "text_delete",    "16 256x16 deletes",    0, bench_text_delete },
+    { "rect_coalesce",  "64 dirty rects",       0, bench_rect_coalesce },
+    { "queue_handoff",  "hand-off",             0, bench_queue_handoff },
+};
+
+/***************************************************************************
+*   Set up.
+****************************************************************************/
+
+/* The stand-in for the OMX backend: NALs are copied into input buffers,
+ * each sent off once full or at the end of a NAL.
+ */
+static int bench_submit(void *ctx, const unsigned char *data, int len, unsigned int flags)
+{
+    bench_data *bench = ctx;
+    int chunk;
+
+    if (flags & BACKEND_NAL_START) {
+        bench_submit(ctx, h264_start_code, H264_START_CODE_LEN, 0);
+    }
+
+    while (len > 0) {
+        if (bench->filled == BENCH_INPUT_BUFFER) {
+            bench->filled = 0;
+        }
+        chunk = min(len, BENCH_INPUT_BUFFER - bench->filled);
+        memcpy(bench->input + bench->filled, data, chunk);
+        bench->filled += chunk;
+        data += chunk;
+        len -= chunk;
+    }
+
+    if (flags & BACKEND_NAL_END) {
+        bench->filled = 0;
+    }
+
+    return 0;
+}
+
+static int bench_end_frame(void *ctx, int submitted)
+{
+    ((bench_data *)ctx)->filled = 0;
+
+    return 0;
+}
+
+static int bench_queue_depth(void *ctx)
+{
+    return 0;
+}
+
+static const H264_backend bench_backend = {
+    "bench",
+    NULL,
+    NULL,
+    NULL,
+    bench_submit,
+    bench_end_frame,
+    bench_queue_depth,
+};
+
+static void set_image(struct image_buf *image, unsigned char op, unsigned char format, void *bits,
+                      unsigned int width, unsigned int height, int x, int y)
+{
+    memset(image, 0, sizeof(struct image_buf));
+    image->cb_size = sizeof(struct image_buf);
+    image->bits = bits;
+    image->pixel_format = format;
+    image->lossless_op = op;
+    image->stride = width * 4;
+    image->width = width;
+    image->height = height;
+    image->dst_x = x;
+    image->dst_y = y;
+}
+
+static int setup(bench_data *data)
+{
+    H264_synth synth;
+    unsigned int *pixels;
+    int i, size;
+
+    memset(data, 0, sizeof(bench_data));
+    srand(1);
+
+    /* The second frame from the generator is a P frame. */
+    if (h264_synth_init(&synth, BENCH_WIDTH, BENCH_HEIGHT, 1) != 0) {
+        return -1;
+    }
+    synth.slices = BENCH_SLICES;
+    synth.fps = 60;
+    size = h264_synth_max_size(&synth);
+    data->frame = malloc(size);
+    data->sps = malloc(256);
+    if (!data->frame || !data->sps) {
+        return -1;
+    }
+    data->sps_size = h264_synth_parameter_sets(&synth, data->sps, 256);
+    h264_synth_frame(&synth, data->frame, size);
+    data->frame_size = h264_synth_frame(&synth, data->frame, size);
+    h264_synth_free(&synth);
+
+    /* Up to the PPS's start code. */
+    memmove(data->sps, data->sps + H264_START_CODE_LEN, data->sps_size - H264_START_CODE_LEN);
+    for (i = 1; i + H264_START_CODE_LEN < data->sps_size; i++) {
+        if (memcmp(data->sps + i, h264_start_code, H264_START_CODE_LEN) == 0) {
+            break;
+        }
+    }
+    data->sps_size = i;
+
+    data->stream.backend = &bench_backend;
+    data->stream.ctx = data;
+    data->stream.nal = NAL_STATE_PASS;
+    data->stream.state = DECODER_STATE_RUNNING;
+    h264_scanner_reset(&data->stream.scanner);
+    data->input = malloc(BENCH_INPUT_BUFFER);
+
+    /* The layer, and a frame buffer of the same size to copy from. */
+    size = BENCH_WIDTH * BENCH_HEIGHT * 4;
+    pixels = malloc(size);
+    data->overlay.bits = malloc(size);
+    if (!data->input || !pixels || !data->overlay.bits) {
+        return -1;
+    }
+    for (i = 0; i < BENCH_WIDTH * BENCH_HEIGHT; i++) {
+        pixels[i] = (unsigned int)rand() << 16 ^ rand();
+    }
+    overlay_init(&data->overlay, data->overlay.bits, BENCH_WIDTH * 4, BENCH_WIDTH, BENCH_HEIGHT);
+    set_image(&data->fb, 0, PIXEL_FORMAT_ARGB, pixels, BENCH_WIDTH, BENCH_HEIGHT, 0, 0);
+
+    set_image(&data->cursor, IMAGE_OP_SMALL_FRAME_BITMAP, PIXEL_FORMAT_BGRA, pixels, 32, 32, 900, 500);
+    for (i = 0; i < (int)ELEMENTS_IN_ARRAY(data->text); i++) {
+        set_image(&data->text[i], IMAGE_OP_DRAW_LOSSLESS, PIXEL_FORMAT_ARGB, pixels, 256, 16, 100, 100 + i * 16);
+        set_image(&data->deletes[i], IMAGE_OP_DELETE_LOSSLESS, PIXEL_FORMAT_ARGB, NULL, 256, 16, 100, 100 + i * 16);
+    }
+
+    for (i = 0; i < BENCH_RECTS; i++) {
+        data->rects[i].left = rand() % BENCH_WIDTH;
+        data->rects[i].top = rand() % BENCH_HEIGHT;
+        data->rects[i].right = data->rects[i].left + 8 + rand() % 256;
+        data->rects[i].bottom = data->rects[i].top + 8 + rand() % 64;
+    }
+
+    pthread_mutex_init(&data->lock, NULL);
+    pthread_cond_init(&data->cond, NULL);
+    if (pthread_create(&data->waiter, NULL, handoff_waiter, data) != 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+static void teardown(bench_data *data)
+{
+    pthread_mutex_lock(&data->lock);
+    data->quit = 1;
+    pthread_cond_broadcast(&data->cond);
+    pthread_mutex_unlock(&data->lock);
+    pthread_join(data->waiter, NULL);
+}
+
+/***************************************************************************
+*   Timing.
+****************************************************************************/
+
+static unsigned long long run_for(bench_data *data, bench *b, unsigned long long ops)
+{
+    unsigned long long i;
+
+    for (i = 0; i < ops; i++) {
+        b->run(data, b);
+    }
+
+    return ops;
+}
+
+/*  Warms up, then sizes the repetitions so that together they take about
+ *  "seconds", and times each.
+ */
+static void measure(bench_data *data, bench *b, const bench_options *opt, bench_result *result)
+{
+    unsigned long long ops = 1;
+    double start, elapsed;
+    int rep;
+
+    start = now();
+    do {
+        run_for(data, b, ops);
+        elapsed = now() - start;
+        ops *= 2;
+    } while (elapsed < opt->warmup);
+
+    /* Time a batch, growing it until it is long enough to size from. */
+    for (ops = 1;; ops *= 2) {
+        start = now();
+        run_for(data, b, ops);
+        elapsed = now() - start;
+        if (elapsed > 0.01) {
+            break;
+        }
+    }
+
+    result->ops = max(1ULL, (unsigned long long)(ops * opt->seconds / opt->reps / elapsed));
+    for (rep = 0; rep < opt->reps; rep++) {
+        start = now();
+        run_for(data, b, result->ops);
+        result->ns[rep] = (now() - start) * 1e9 / result->ops;
+    }
+}
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+typedef struct _bench_summary {
+    double          min;
+    double          median;
+    double          mean;
+    double          stddev;
+} bench_summary;
+
+static void summarise(bench_result *result, int reps, bench_summary *summary)
+{
+    double sum = 0, squares = 0;
+    int i;
+
+    qsort(result->ns, reps, sizeof(double), compare_double);
+    for (i = 0; i < reps; i++) {
+        sum += result->ns[i];
+    }
+    summary->mean = sum / reps;
+    for (i = 0; i < reps; i++) {
+        squares += (result->ns[i] - summary->mean) * (result->ns[i] - summary->mean);
+    }
+
+    summary->min = result->ns[0];
+    summary->median = reps % 2 ? result->ns[reps / 2] : (result->ns[reps / 2 - 1] + result->ns[reps / 2]) / 2;
+    summary->stddev = reps > 1 ? sqrt(squares / (reps - 1)) : 0;
+}
+
+/* The board, from the device tree, or the machine. */
+static void machine_name(char *name, int size)
+{
+    struct utsname uts;
+    FILE *file = fopen("/proc/device-tree/model", "r");
+    int len = 0;
+
+    if (file) {
+        len = fread(name, 1, size - 1, file);
+        fclose(file);
+    }
+    name[len] = '\0';
+
+    if (!len && uname(&uts) == 0) {
+        snprintf(name, size, "%s %s", uts.sysname, uts.machine);
+    }
+}
+
+static void print_json_string(const char *s)
+{
+    putchar('"');
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') {
+            putchar('\\');
+        }
+        if ((unsigned char)*s >= ' ') {
+            putchar(*s);
+        }
+    }
+    putchar('"');
+}
+
+int main(int argc, char **argv)
+{
+    bench_options opt = { 1, 0.2, 10, NULL, 0 };
+    bench_result result;
+    bench_summary summary;
+    bench_data data;
+    char machine[128];
+    unsigned int i;
+    int first = 1, c;
+
+    while ((c = getopt(argc, argv, "t:r:W:b:j")) != -1) {
+        switch (c) {
+        case 't':
+            opt.seconds = atof(optarg);
+            break;
+        case 'r':
+            opt.reps = atoi(optarg);
+            break;
+        case 'W':
+            opt.warmup = atof(optarg);
+            break;
+        case 'b':
+            opt.only = optarg;
+            break;
+        case 'j':
+            opt.json = 1;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-t seconds] [-r repetitions] [-W warmup seconds] [-b name] [-j]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    opt.reps = min(max(opt.reps, 1), BENCH_MAX_REPS);
+
+    /* The kernels trace nothing worth seeing here. */
+    trace_level = TRACE_LEVEL_OFF;
+
+    if (setup(&data) != 0) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    machine_name(machine, sizeof(machine));
+    if (opt.json) {
+        printf("{\"machine\": ");
+        print_json_string(machine);
+        printf(", \"neon\": %d, \"repetitions\": %d, \"benchmarks\": [",
+#ifdef HAVE_NEON
+               1,
+#else
+               0,
+#endif
+               opt.reps);
+    } else {
+        printf("%s, %d repetitions\n", machine, opt.reps);
+        printf("%-14s %-20s %12s %12s %9s %12s\n", "benchmark", "op", "median ns", "min ns", "stddev", "MB/s");
+    }
+
+    for (i = 0; i < ELEMENTS_IN_ARRAY(benches); i++) {
+        bench *b = &benches[i];
+
+        if (opt.only && strcmp(opt.only, b->name) != 0) {
+            continue;
+        }
+
+        measure(&data, b, &opt, &result);
+        summarise(&result, opt.reps, &summary);
+
+        if (opt.json) {
+            printf("%s\n  {\"name\": \"%s\", \"op\": \"%s\", \"ops\": %llu, \"bytes_per_op\": %llu, "
+                   "\"ns_per_op\": {\"median\": %.1f, \"min\": %.1f, \"mean\": %.1f, \"stddev\": %.1f}, "
+                   "\"bytes_per_s\": %.0f}", first ? "" : ",", b->name, b->what, result.ops, b->bytes,
+                   summary.median, summary.min, summary.mean, summary.stddev,
+                   b->bytes ? b->bytes * 1e9 / summary.median : 0);
+        } else {
+            printf("%-14s %-20s %12.1f %12.1f %8.1f%% ", b->name, b->what, summary.median, summary.min,
+                   summary.mean ? summary.stddev * 100 / summary.mean : 0);
+            if (b->bytes) {
+                printf("%12.1f\n", b->bytes * 1e3 / summary.median);
+            } else {
+                printf("%12s\n", "-");
+            }
+        }
+        first = 0;
+    }
+
+    if (opt.json) {
+        printf("\n]}\n");
+    }
+
+    teardown(&data);
+
+    return 0;
+}
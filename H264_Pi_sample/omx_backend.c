@@ -0,0 +1,870 @@
+/***************************************************************************
+*
+*   omx_backend.c
+*
+*   OpenMAX IL backend: video_decode tunnelled to video_render on the
+*   legacy VideoCore firmware stack.
+*
+*   Author: Muhammad Dawood (muhammad.dawood@citrix.com)
+*   Copyright 2013-2014 Citrix Systems, Inc.  All Rights Reserved.
+*
+****************************************************************************/
+
+#include "video_gl.h"
+
+pthread_cond_t fill_buffer_done_cond = PTHREAD_COND_INITIALIZER;
+pthread_mutex_t fill_buffer_done_mutex = PTHREAD_MUTEX_INITIALIZER;
+int fill_buffer_done_val = 0;
+
+/* Sets the buffers of a port, before they are allocated. A count the
+ * component refuses leaves its default.
+ */
+static void set_buffer_count(OMX_HANDLETYPE handle, int port, int count)
+{
+    OMX_PARAM_PORTDEFINITIONTYPE portdef;
+
+    memset(&portdef, 0, sizeof(portdef));
+    portdef.nSize = sizeof(OMX_PARAM_PORTDEFINITIONTYPE);
+    portdef.nVersion.nVersion = OMX_VERSION;
+    portdef.nPortIndex = port;
+
+    if (count <= 0 || OMX_GetParameter(handle, OMX_IndexParamPortDefinition, &portdef) != OMX_ErrorNone) {
+        return;
+    }
+
+    portdef.nBufferCountActual = count;
+    if (OMX_SetParameter(handle, OMX_IndexParamPortDefinition, &portdef) != OMX_ErrorNone) {
+        DEBUG_TRACE("Port %d refused %d buffers\n", port, count);
+    }
+}
+
+/* Gives video_decode's output port buffers of its own, in decode-only
+ * contexts, and hands them all to the decoder. They come back filled with
+ * I420 pictures to fill_buffer_done().
+ */
+static int enable_readback(OMXH264_decoder *decoder, const OMX_PARAM_PORTDEFINITIONTYPE *portdef)
+{
+    comp_details *comp = decoder->image_decode;
+    const OMX_VIDEO_PORTDEFINITIONTYPE *video = &portdef->format.video;
+    H264_frame *picture = &decoder->picture;
+    OMX_BUFFERHEADERTYPE *buf;
+
+    if (decoder->readback) {
+        /* Changed again: the buffers go, for ones of the new size. */
+        decoder->readback = 0;
+        ilclient_disable_port_buffers(comp->component, comp->out_port, NULL, NULL, NULL);
+    }
+
+    memset(picture, 0, sizeof(H264_frame));
+    picture->fourcc = H264_FOURCC_YU12;
+    picture->width = min((unsigned int)decoder->width, video->nFrameWidth);
+    picture->height = min((unsigned int)decoder->height, video->nFrameHeight);
+    picture->num_planes = 3;
+    picture->pitches[0] = video->nStride;
+    picture->pitches[1] = picture->pitches[2] = video->nStride / 2;
+    picture->offsets[1] = video->nStride * video->nSliceHeight;
+    picture->offsets[2] = picture->offsets[1] + picture->pitches[1] * (video->nSliceHeight / 2);
+
+    if (ilclient_enable_port_buffers(comp->component, comp->out_port, NULL, NULL, NULL) != 0) {
+        DEBUG_TRACE("Couldn't enable output buffers\n");
+        return -1;
+    }
+
+    decoder->readback = 1;
+    while ((buf = ilclient_get_output_buffer(comp->component, comp->out_port, 0)) != NULL) {
+        OMX_FillThisBuffer(comp->handle, buf);
+    }
+
+    decoder->renderer_init = 1;
+
+    return 0;
+}
+
+int port_settings_changed(OMXH264_decoder *decoder, int again)
+{
+    OMX_PARAM_PORTDEFINITIONTYPE portdef;
+
+    portdef.nSize = sizeof(OMX_PARAM_PORTDEFINITIONTYPE);
+    portdef.nVersion.nVersion = OMX_VERSION;
+    portdef.nPortIndex = decoder->image_decode->out_port;
+    OMX_GetParameter(decoder->image_decode->handle, OMX_IndexParamPortDefinition, &portdef);
+
+    DEBUG_TRACE("Got port settings width=%d, height=%d, again=%d\n", decoder->width, decoder->height, again);
+    USDT2(port_settings, decoder->width, decoder->height);
+
+    if (decoder->stats->checksums) {
+        return enable_readback(decoder, &portdef);
+    }
+
+    if (decoder->video_render) {
+        DEBUG_TRACE("video_render port settings changed\n");
+        /* We're using video_render rendering. */
+
+        ilclient_change_component_state(decoder->video_render->component, OMX_StateIdle);
+
+        /* The tunnel takes the decoder's count, if it is the larger. */
+        set_buffer_count(decoder->image_decode->handle, decoder->image_decode->out_port, buffer_depths.output);
+
+        if (ilclient_setup_tunnel(decoder->tunnel, 0, 0) != 0) {
+            DEBUG_TRACE("Failed to setup tunnel\n");
+            return -1;
+        }
+
+        ilclient_change_component_state(decoder->video_render->component, OMX_StateExecuting);
+
+    }
+
+    decoder->renderer_init = 1;
+
+    DEBUG_TRACE("Port settings changed done\n");
+
+    return 0;
+}
+
+comp_details *init_component(OMXH264_decoder *decoder, char *name, unsigned int extra_flags, int type)
+{
+    comp_details *comp = malloc(sizeof(comp_details));
+
+    if (!comp) {
+        return NULL;
+    }
+
+    if (ilclient_create_component(decoder->client, &(comp->component), name, extra_flags) != 0) {
+        DEBUG_TRACE("Couldn't create component %s\n", name);
+        free(comp);
+        return NULL;
+    }
+
+    comp->handle = ILC_GET_HANDLE(comp->component);
+
+    if (strcmp(name, "video_render") == 0) {
+        /* TODO: fix. */
+        comp->in_port = 90;
+        comp->out_port = NULL;
+    } else {
+        OMX_PORT_PARAM_TYPE port;
+        port.nSize = sizeof(OMX_PORT_PARAM_TYPE);
+        port.nVersion.nVersion = OMX_VERSION;
+
+        OMX_GetParameter(comp->handle, type, &port);
+
+        comp->in_port = port.nStartPortNumber;
+        comp->out_port = port.nStartPortNumber + 1;
+    }
+
+    DEBUG_TRACE("Component %s, in_port=%d, out_port=%d\n", name, comp->in_port, comp->out_port);
+
+    return comp;
+}
+
+void decoder_error_callback(void *data, COMPONENT_T *comp, OMX_U32 error)
+{
+    OMXH264_decoder *decoder = (OMXH264_decoder *)data;
+
+    if (error == (OMX_U32)OMX_ErrorSameState) {
+        /* Harmless, raised by redundant state changes. */
+        return;
+    }
+
+    /* Picked up by the decoding thread on its next call. */
+    decoder->error_event = error;
+}
+
+/* Checksums the pictures read back and hands the buffers straight back. */
+static void read_back(OMXH264_decoder *decoder)
+{
+    comp_details *comp = decoder->image_decode;
+    H264_frame *picture = &decoder->picture;
+    OMX_BUFFERHEADERTYPE *buf;
+    unsigned long long stamp;
+    int p;
+
+    while (decoder->readback && (buf = ilclient_get_output_buffer(comp->component, comp->out_port, 0)) != NULL) {
+        if (buf->nFilledLen > 0) {
+            for (p = 0; p < picture->num_planes; p++) {
+                picture->data[p] = buf->pBuffer + buf->nOffset + picture->offsets[p];
+            }
+            checksum_picture(decoder->stats->checksums, picture);
+
+            stamp = buf->nTimeStamp.nLowPart | (unsigned long long)buf->nTimeStamp.nHighPart << 32;
+            latency_stamp(&decoder->stats->latency, stamp, LATENCY_DECODED);
+            TRACE(TRACE_FRAME_DECODED, 0, 0, 0);
+            USDT1(frame_decoded, stamp);
+        }
+
+        buf->nFilledLen = 0;
+        OMX_FillThisBuffer(comp->handle, buf);
+    }
+}
+
+void fill_buffer_done(void* data, COMPONENT_T* comp)
+{
+    OMXH264_decoder *decoder = (OMXH264_decoder *)data;
+
+    if (decoder->readback) {
+        read_back(decoder);
+    }
+
+    /* Signal complete event. */
+    pthread_mutex_lock(&fill_buffer_done_mutex);
+    fill_buffer_done_val = 1;
+    pthread_cond_signal(&fill_buffer_done_cond);
+    pthread_mutex_unlock(&fill_buffer_done_mutex);
+}
+
+static unsigned long get_time_ms()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000UL + ts.tv_nsec / 1000000;
+}
+
+void empty_buffer_done(void *data, COMPONENT_T *comp)
+{
+    OMXH264_decoder *decoder = (OMXH264_decoder *)data;
+
+    pthread_mutex_lock(&decoder->input_lock);
+    if (decoder->in_flight > 0) {
+        decoder->in_flight--;
+    }
+    decoder->returned++;
+    decoder->progress_ms = get_time_ms();
+    TRACE(TRACE_BUFFER_DONE, decoder->in_flight, 0, 0);
+    USDT1(buffer_done, decoder->in_flight);
+
+    /* Frames whose last buffer is back have been consumed. */
+    while (decoder->frame_ends_count &&
+           (int)(decoder->frame_ends[decoder->frame_ends_head] - decoder->returned) <= 0) {
+        latency_stamp(&decoder->stats->latency, decoder->frame_stamps[decoder->frame_ends_head], LATENCY_CONSUMED);
+        decoder->frame_ends_head = (decoder->frame_ends_head + 1) % MAX_QUEUED_FRAMES;
+        decoder->frame_ends_count--;
+    }
+
+    pthread_cond_broadcast(&decoder->input_cond);
+    pthread_mutex_unlock(&decoder->input_lock);
+}
+
+/* Number of frames the decoder has yet to consume. */
+static int queued_frames(OMXH264_decoder *decoder)
+{
+    int depth;
+
+    pthread_mutex_lock(&decoder->input_lock);
+    depth = decoder->frame_ends_count;
+    pthread_mutex_unlock(&decoder->input_lock);
+
+    return depth;
+}
+
+static void destroy_components(OMXH264_decoder *decoder)
+{
+    COMPONENT_T *components[3] = {0};
+
+    if (!decoder->image_decode) {
+        return;
+    }
+
+    components[0] = decoder->image_decode->component;
+
+    if (decoder->video_render) {
+        components[1] = decoder->video_render->component;
+    }
+
+    ilclient_disable_tunnel(decoder->tunnel);
+    ilclient_teardown_tunnels(decoder->tunnel);
+
+    decoder->readback = 0;
+
+    DEBUG_TRACE("Disabling port buffers\n");
+    ilclient_disable_port_buffers(components[0], decoder->image_decode->in_port, NULL, NULL, NULL);
+    ilclient_disable_port_buffers(components[0], decoder->image_decode->out_port, NULL, NULL, NULL);
+
+    ilclient_state_transition(components, OMX_StateIdle);
+
+    /* Destroy components. */
+    ilclient_cleanup_components(components);
+
+    free(decoder->image_decode);
+    free(decoder->video_render);
+    decoder->image_decode = NULL;
+    decoder->video_render = NULL;
+    decoder->in_buf = NULL;
+}
+
+/* Makes video_render's region transparent, so that it composes nothing
+ * on screen but takes pictures from the tunnel as when it is shown.
+ */
+static int hide_render(OMXH264_decoder *decoder)
+{
+    OMX_CONFIG_DISPLAYREGIONTYPE region;
+
+    memset(&region, 0, sizeof(region));
+    region.nSize = sizeof(OMX_CONFIG_DISPLAYREGIONTYPE);
+    region.nVersion.nVersion = OMX_VERSION;
+    region.nPortIndex = decoder->video_render->in_port;
+    region.set = OMX_DISPLAY_SET_NOASPECT | OMX_DISPLAY_SET_ALPHA;
+    region.noaspect = OMX_TRUE;
+    region.alpha = 0;
+
+    if (OMX_SetConfig(decoder->video_render->handle, OMX_IndexConfigDisplayRegion, &region) != OMX_ErrorNone) {
+        DEBUG_TRACE("Couldn't hide video_render\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Creates and connects the OMX components. Used when a context is opened,
+ * and by the watchdog to rebuild a hung decoder in place.
+ */
+static BOOL create_components(OMXH264_decoder *decoder)
+{
+    unsigned int flags = ILCLIENT_DISABLE_ALL_PORTS | ILCLIENT_ENABLE_INPUT_BUFFERS;
+
+    /* Decode-only contexts have no renderer, and read pictures back. */
+    if (decoder->stats->checksums) {
+        flags |= ILCLIENT_ENABLE_OUTPUT_BUFFERS;
+    }
+
+    decoder->image_decode = init_component(decoder, "video_decode", flags, OMX_IndexParamVideoInit);
+    if (!decoder->image_decode) {
+        return FALSE;
+    }
+
+    memset(decoder->tunnel, 0, sizeof(decoder->tunnel));
+
+    if (!decoder->stats->checksums) {
+        decoder->video_render = init_component(decoder,
+                                               "video_render",
+                                               ILCLIENT_DISABLE_ALL_PORTS | ILCLIENT_ENABLE_OUTPUT_BUFFERS,
+                                               OMX_IndexParamImageInit);
+        if (!decoder->video_render || (decoder->stats->hidden && hide_render(decoder) != 0)) {
+            destroy_components(decoder);
+            return FALSE;
+        }
+
+        set_tunnel(decoder->tunnel, decoder->image_decode->component, decoder->image_decode->out_port, decoder->video_render->component, decoder->video_render->in_port);
+    }
+
+    ilclient_change_component_state(decoder->image_decode->component, OMX_StateIdle);
+
+    /* Set port format. */
+    OMX_VIDEO_PARAM_PORTFORMATTYPE format = {0};
+    format.nSize = sizeof(format);
+    format.nVersion.nVersion = OMX_VERSION;
+    format.nPortIndex = decoder->image_decode->in_port;
+    format.eCompressionFormat = OMX_VIDEO_CodingAVC;
+    OMX_SetParameter(decoder->image_decode->handle, OMX_IndexParamVideoPortFormat, &format);
+
+    set_buffer_count(decoder->image_decode->handle, decoder->image_decode->in_port, buffer_depths.input);
+
+    if (ilclient_enable_port_buffers(decoder->image_decode->component, decoder->image_decode->in_port, NULL, NULL, NULL) != 0) {
+        DEBUG_TRACE("Couldn't enable input buffers\n");
+        destroy_components(decoder);
+        return FALSE;
+    }
+
+    ilclient_change_component_state(decoder->image_decode->component, OMX_StateExecuting);
+
+    decoder->renderer_init = 0;
+    decoder->in_buf = NULL;
+    decoder->port_settings_done = 0;
+    decoder->port_settings_pending = 0;
+    decoder->in_flight = 0;
+    decoder->returned = 0;
+    decoder->submitted = 0;
+    decoder->frame_ends_head = 0;
+    decoder->frame_ends_count = 0;
+    decoder->progress_ms = get_time_ms();
+
+    return TRUE;
+}
+
+static void close_decoder(OMXH264_decoder *decoder)
+{
+    destroy_components(decoder);
+
+    if (decoder->client) {
+        ilclient_destroy(decoder->client);
+    }
+
+    OMX_Deinit();
+
+    pthread_mutex_destroy(&decoder->input_lock);
+    pthread_cond_destroy(&decoder->input_cond);
+
+    free(decoder);
+}
+
+static void *setup_decoder(int width, int height, unsigned int options, H264_stats *stats)
+{
+    OMXH264_decoder *decoder = malloc(sizeof(OMXH264_decoder));
+
+    if (!decoder) {
+        DEBUG_TRACE("Couldn't allocate decoder structure.\n");
+        return NULL;
+    }
+
+    /* Initialize variables. */
+    memset(decoder, 0, sizeof(OMXH264_decoder));
+    decoder->width = width;
+    decoder->height = height;
+    decoder->stats = stats;
+    decoder->error_event = OMX_ErrorNone;
+
+    /* Pictures go down the tunnel unseen, unless they are read back. */
+    if (!stats->checksums) {
+        stats->decode_point = LATENCY_CONSUMED;
+    }
+    pthread_mutex_init(&decoder->input_lock, NULL);
+    pthread_cond_init(&decoder->input_cond, NULL);
+
+    OMX_Init();
+
+    decoder->client = ilclient_init();
+    if (!decoder->client) {
+        goto error;
+    }
+
+    ilclient_set_fill_buffer_done_callback(decoder->client, fill_buffer_done, decoder);
+    ilclient_set_empty_buffer_done_callback(decoder->client, empty_buffer_done, decoder);
+    ilclient_set_error_callback(decoder->client, decoder_error_callback, decoder);
+
+    if (!create_components(decoder)) {
+        goto error;
+    }
+
+    return decoder;
+
+error:
+    DEBUG_TRACE("Error setting up decoder.\n");
+    close_decoder(decoder);
+    return NULL;
+}
+
+/* Rebuilds a hung decoder without closing the context. Decoding resumes
+ * from the next IDR, as the reference frames are lost with the components.
+ */
+static void watchdog_reset(OMXH264_decoder *decoder)
+{
+    decoder->stats->resets++;
+
+    DEBUG_TRACE("Decoder hung for %lums with %d buffers outstanding, rebuilding (%u)\n",
+                get_time_ms() - decoder->progress_ms, decoder->in_flight, decoder->stats->resets);
+
+    /* A flush often unsticks the firmware enough for a clean teardown. */
+    OMX_SendCommand(decoder->image_decode->handle, OMX_CommandFlush, decoder->image_decode->in_port, NULL);
+    ilclient_wait_for_event(decoder->image_decode->component, OMX_EventCmdComplete, OMX_CommandFlush, 0,
+                            decoder->image_decode->in_port, 0, ILCLIENT_PORT_FLUSH, TIMEOUT_MS);
+    if (decoder->renderer_init) {
+        ilclient_flush_tunnels(decoder->tunnel, 0);
+    }
+
+    destroy_components(decoder);
+    if (!create_components(decoder)) {
+        DEBUG_TRACE("Couldn't rebuild decoder, retrying with the next frame\n");
+    }
+
+    decoder->error_event = OMX_ErrorNone;
+}
+
+/* Called between frames: catches a decoder that stopped making progress
+ * while the Receiver isn't blocked on it, and retries a failed rebuild.
+ */
+static int watchdog_check(OMXH264_decoder *decoder)
+{
+    int hung;
+
+    if (!decoder->image_decode) {
+        if (!create_components(decoder)) {
+            return -1;
+        }
+        return 0;
+    }
+
+    pthread_mutex_lock(&decoder->input_lock);
+    hung = decoder->in_flight > 0 && get_time_ms() - decoder->progress_ms >= TIMEOUT_MS;
+    pthread_mutex_unlock(&decoder->input_lock);
+
+    if (hung) {
+        watchdog_reset(decoder);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Waits for an input buffer to come back, "seen" being the count sampled
+ * before the last attempt to get one. Returns -1 if none comes back within
+ * TIMEOUT_MS of the last one.
+ */
+static int wait_for_progress(OMXH264_decoder *decoder, unsigned int seen)
+{
+    int ret = 0;
+
+    pthread_mutex_lock(&decoder->input_lock);
+    while (decoder->returned == seen) {
+        long remaining = (long)(decoder->progress_ms + TIMEOUT_MS - get_time_ms());
+        struct timespec deadline;
+
+        if (remaining <= 0) {
+            ret = -1;
+            break;
+        }
+
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += remaining / 1000;
+        deadline.tv_nsec += (remaining % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+
+        pthread_cond_timedwait(&decoder->input_cond, &decoder->input_lock, &deadline);
+    }
+    pthread_mutex_unlock(&decoder->input_lock);
+
+    return ret;
+}
+
+/* Checks for an error reported asynchronously by the decoder. */
+static int check_decoder_error(OMXH264_decoder *decoder)
+{
+    OMX_U32 error = decoder->error_event;
+
+    if (error == OMX_ErrorNone) {
+        return 0;
+    }
+
+    decoder->error_event = OMX_ErrorNone;
+
+    DEBUG_TRACE("Decoder reported error 0x%x\n", error);
+
+    return -1;
+}
+
+/* Hands the input buffer being filled to the decoder, stamped with the
+ * frame's latency timestamp, which the decoder passes on to its output.
+ */
+static int submit_input_buffer(OMXH264_decoder *decoder, unsigned int flags)
+{
+    OMX_BUFFERHEADERTYPE *buf = decoder->in_buf;
+    int ret;
+
+    buf->nFlags |= flags;
+    buf->nTimeStamp.nLowPart = (OMX_U32)decoder->frame_stamp;
+    buf->nTimeStamp.nHighPart = (OMX_U32)(decoder->frame_stamp >> 32);
+
+    /* Make sure we grab a buffer next time we come in. */
+    decoder->in_buf = 0;
+
+    pthread_mutex_lock(&decoder->input_lock);
+    if (decoder->in_flight++ == 0) {
+        /* The watchdog measures from the oldest outstanding buffer. */
+        decoder->progress_ms = get_time_ms();
+    }
+    decoder->submitted++;
+    if ((flags & OMX_BUFFERFLAG_ENDOFFRAME) && decoder->frame_ends_count < MAX_QUEUED_FRAMES) {
+        int tail = (decoder->frame_ends_head + decoder->frame_ends_count) % MAX_QUEUED_FRAMES;
+
+        decoder->frame_ends[tail] = decoder->submitted;
+        decoder->frame_stamps[tail] = decoder->frame_stamp;
+        decoder->frame_ends_count++;
+    }
+    pthread_mutex_unlock(&decoder->input_lock);
+
+    if (!decoder->frame_started) {
+        latency_stamp(&decoder->stats->latency, decoder->frame_stamp, LATENCY_FIRST_SUBMIT);
+        decoder->frame_started = 1;
+    }
+    if (flags & OMX_BUFFERFLAG_ENDOFFRAME) {
+        latency_stamp(&decoder->stats->latency, decoder->frame_stamp, LATENCY_LAST_SUBMIT);
+    }
+
+    TRACE(TRACE_BUFFER_SUBMIT, buf->nFilledLen, buf->nFlags, decoder->in_flight);
+    USDT3(buffer_submit, buf->nFilledLen, buf->nFlags, decoder->frame_stamp);
+    ret = OMX_EmptyThisBuffer(decoder->image_decode->handle, buf);
+    if (ret != OMX_ErrorNone) {
+        DEBUG_TRACE("Couldn't empty buffer, len=%d, flags=0x%x, ret=0x%x\n", buf->nFilledLen, buf->nFlags, ret);
+        pthread_mutex_lock(&decoder->input_lock);
+        decoder->in_flight--;
+        decoder->submitted--;
+        if (flags & OMX_BUFFERFLAG_ENDOFFRAME && decoder->frame_ends_count) {
+            decoder->frame_ends_count--;
+        }
+        pthread_mutex_unlock(&decoder->input_lock);
+
+        /* The decoder didn't take it, so it's still ours. */
+        decoder->in_buf = buf;
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Makes sure there is an input buffer to fill. */
+static int grab_input_buffer(OMXH264_decoder *decoder)
+{
+    OMX_BUFFERHEADERTYPE *buf;
+    int stalled;
+
+    if (decoder->in_buf) {
+        return 0;
+    }
+
+    if (!decoder->image_decode) {
+        /* A rebuild failed, nothing to submit to. */
+        return -1;
+    }
+
+    /* Don't block indefinitely: if the decoder stops returning buffers, the
+     * watchdog rebuilds it.
+     */
+    for (stalled = 0;; stalled = 1) {
+        unsigned int seen;
+
+        pthread_mutex_lock(&decoder->input_lock);
+        seen = decoder->returned;
+        pthread_mutex_unlock(&decoder->input_lock);
+
+        buf = ilclient_get_input_buffer(decoder->image_decode->component, decoder->image_decode->in_port, 0);
+        if (buf) {
+            break;
+        }
+
+        if (!stalled) {
+            decoder->stats->input_stalls++;
+        }
+        if (wait_for_progress(decoder, seen) != 0) {
+            watchdog_reset(decoder);
+            return -1;
+        }
+    }
+
+    USDT2(buffer_acquire, buf, stalled);
+    buf->nFilledLen = 0;
+    buf->nOffset = 0;
+    buf->nFlags = 0;
+    decoder->in_buf = buf;
+
+    return 0;
+}
+
+/* Appends data to the NAL being assembled. A NAL larger than an input
+ * buffer is split, with only the last part marked as the end of the NAL.
+ */
+static int append_input_data(OMXH264_decoder *decoder, const unsigned char *data, int size)
+{
+    while (size > 0) {
+        OMX_BUFFERHEADERTYPE *buf = decoder->in_buf;
+
+        if (buf && buf->nFilledLen == buf->nAllocLen) {
+            /* More to come, but the buffer is full. */
+            if (submit_input_buffer(decoder, 0) != 0) {
+                return -1;
+            }
+        }
+
+        if (grab_input_buffer(decoder) != 0) {
+            return -1;
+        }
+        buf = decoder->in_buf;
+
+        int buf_left = buf->nAllocLen - buf->nFilledLen;
+        int size_to_fill = size > buf_left ? buf_left : size;
+
+        memcpy(buf->pBuffer + buf->nFilledLen, data, size_to_fill);
+        buf->nFilledLen += size_to_fill;
+
+        data += size_to_fill;
+        size -= size_to_fill;
+    }
+
+    return 0;
+}
+
+/***************************************************************************
+*   Backend interface.
+****************************************************************************/
+
+static int omx_probe(struct H264_decoder *caps)
+{
+    board_info board;
+
+    probe_board(&board);
+
+    return probe_caps(&board, caps);
+}
+
+static int omx_start_frame(void *ctx, SIGNED_RECT dirty_rects[], unsigned int num_rects)
+{
+    OMXH264_decoder *decoder = ctx;
+
+    decoder->frame_stamp = decoder->stats->latency.current;
+    decoder->frame_started = 0;
+
+    /* Report errors raised since the last frame. */
+    if (watchdog_check(decoder) != 0 || check_decoder_error(decoder) != 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Each NAL is submitted as soon as it is complete, so that the decoder can
+ * start on the first slices of a frame while the rest is still being
+ * received.
+ */
+static int omx_submit(void *ctx, const unsigned char *data, int len, unsigned int flags)
+{
+    OMXH264_decoder *decoder = ctx;
+
+    if (check_decoder_error(decoder) != 0) {
+        return -1;
+    }
+
+    if ((flags & BACKEND_NAL_START) && append_input_data(decoder, h264_start_code, H264_START_CODE_LEN) != 0) {
+        return -1;
+    }
+
+    if (append_input_data(decoder, data, len) != 0) {
+        return -1;
+    }
+
+    if ((flags & BACKEND_NAL_END) && decoder->in_buf && decoder->in_buf->nFilledLen > 0) {
+        return submit_input_buffer(decoder, OMX_BUFFERFLAG_ENDOFNAL);
+    }
+
+    return 0;
+}
+
+static int omx_end_frame(void *ctx, int submitted)
+{
+    OMXH264_decoder *decoder = ctx;
+    int ret = 0;
+
+    if (submitted) {
+        /* Nothing may be pending, but the decoder still needs the end of frame. */
+        if (grab_input_buffer(decoder) != 0 ||
+            submit_input_buffer(decoder, OMX_BUFFERFLAG_ENDOFNAL | OMX_BUFFERFLAG_ENDOFFRAME) != 0) {
+            ret = -1;
+        }
+    } else if (decoder->in_buf) {
+        decoder->in_buf->nFilledLen = 0;
+    }
+
+    if (!decoder->image_decode) {
+        return -1;
+    }
+
+    if (decoder->port_settings_done == 0) {
+        /* Wait for p_s_c event. */
+        if (!decoder->port_settings_pending && submitted &&
+            0 == ilclient_wait_for_event(decoder->image_decode->component, OMX_EventPortSettingsChanged, decoder->image_decode->out_port, 0, 0, 1,
+                                               ILCLIENT_EVENT_ERROR | ILCLIENT_PARAMETER_CHANGED, 100)) {
+            DEBUG_TRACE("Got port settings changed event.\n");
+            decoder->port_settings_pending = 1;
+        }
+
+        if (decoder->port_settings_pending) {
+            if (port_settings_changed(decoder, 0) == 0) {
+                decoder->port_settings_pending = 0;
+                decoder->port_settings_done = 1;
+            } else {
+                /* Retried with the next frame. */
+                DEBUG_TRACE("Port settings failed\n");
+                ret = -1;
+            }
+        }
+    } else {
+        if (0 == ilclient_remove_event(decoder->image_decode->component, OMX_EventPortSettingsChanged, decoder->image_decode->out_port, 0, 0, 1)) {
+            /* Port settings changed again. */
+            DEBUG_TRACE("Got port settings changed event, again!\n");
+            if (port_settings_changed(decoder, 1) != 0) {
+                DEBUG_TRACE("Port settings failed\n");
+                ret = -1;
+            }
+        }
+    }
+
+    if (check_decoder_error(decoder) != 0) {
+        ret = -1;
+    }
+
+    return ret;
+}
+
+static int omx_queue_depth(void *ctx)
+{
+    return queued_frames(ctx);
+}
+
+/* Discards everything queued in the decoder, so that no corrupted frames
+ * are shown.
+ */
+static void omx_flush(void *ctx)
+{
+    OMXH264_decoder *decoder = ctx;
+
+    if (decoder->in_buf) {
+        /* Keep the buffer, but forget what was put in it. */
+        decoder->in_buf->nFilledLen = 0;
+        decoder->in_buf->nFlags = 0;
+    }
+
+    if (!decoder->image_decode || (!decoder->in_flight && !decoder->renderer_init)) {
+        /* Nothing queued, e.g. just rebuilt by the watchdog. */
+        return;
+    }
+
+    OMX_SendCommand(decoder->image_decode->handle, OMX_CommandFlush, decoder->image_decode->in_port, NULL);
+    ilclient_wait_for_event(decoder->image_decode->component, OMX_EventCmdComplete, OMX_CommandFlush, 0,
+                            decoder->image_decode->in_port, 0, ILCLIENT_PORT_FLUSH, TIMEOUT_MS);
+
+    if (decoder->renderer_init) {
+        ilclient_flush_tunnels(decoder->tunnel, 0);
+    }
+}
+
+static int omx_compose_with_fb(void *ctx, struct image_buf *fb, SIGNED_RECT interesting_rects[],
+                               unsigned int num_rects)
+{
+    return 0;
+}
+
+static int omx_compose_with_rects(void *ctx, struct image_buf objects[], unsigned int num_objects, bool last)
+{
+    return 0;
+}
+
+/* video_render displays frames as they are decoded. */
+static int omx_present(void *ctx, struct window_info windows[], unsigned int num_windows, bool wait, bool *pushed)
+{
+    if (pushed) {
+        *pushed = 1;
+    }
+
+    return 0;
+}
+
+static void omx_close(void *ctx)
+{
+    close_decoder(ctx);
+}
+
+const H264_backend omx_backend = {
+    "omx",
+    omx_probe,
+    setup_decoder,
+    omx_start_frame,
+    omx_submit,
+    omx_end_frame,
+    omx_queue_depth,
+    omx_flush,
+    omx_compose_with_fb,
+    omx_compose_with_rects,
+    omx_present,
+    omx_close,
+};
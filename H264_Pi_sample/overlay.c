@@ -0,0 +1,226 @@
+/***************************************************************************
+*
+*   overlay.c
+*
+*   The lossless layer: Receiver's frame buffer and lossless objects
+*   composed into an ARGB surface, with the rectangles changed tracked so
+*   that presenters only move what they must.
+*
+****************************************************************************/
+
+#include "video_gl.h"
+#include "overlay.h"
+
+#define OPAQUE  0xFF000000u
+
+/* Clips "rect" to "width" x "height". Returns 0 if nothing is left. */
+static int clip_rect(SIGNED_RECT *rect, unsigned int width, unsigned int height)
+{
+    rect->left = max(rect->left, 0);
+    rect->top = max(rect->top, 0);
+    rect->right = min(rect->right, (INT32)width);
+    rect->bottom = min(rect->bottom, (INT32)height);
+
+    return rect->left < rect->right && rect->top < rect->bottom;
+}
+
+/* Receiver's ARGB is 0xAARRGGBB in native order, BGRA the same bytes
+ * reversed.
+ */
+static unsigned int load_pixel(const unsigned char *p, unsigned char format)
+{
+    unsigned int pixel = *(const unsigned int *)p;
+
+    return format == PIXEL_FORMAT_BGRA ? __builtin_bswap32(pixel) : pixel;
+}
+
+/*  Copies a "width" x "height" block of "format" pixels at "src" to
+ *  (x, y) in the overlay, clipped to it. Alpha is ORed with "alpha".
+ */
+static void copy_block(H264_overlay *overlay, int x, int y, const unsigned char *src, int src_stride,
+                       unsigned int width, unsigned int height, unsigned char format, unsigned int alpha)
+{
+    SIGNED_RECT rect = { x, y, x + (INT32)width, y + (INT32)height };
+    unsigned int *dst;
+    int row, col;
+
+    if (!clip_rect(&rect, overlay->width, overlay->height)) {
+        return;
+    }
+
+    src += (rect.top - y) * src_stride + (rect.left - x) * 4;
+
+    for (row = rect.top; row < rect.bottom; row++, src += src_stride) {
+        dst = (unsigned int *)(overlay->bits + row * overlay->stride) + rect.left;
+
+        if (format == PIXEL_FORMAT_ARGB && alpha == 0) {
+            memcpy(dst, src, (rect.right - rect.left) * 4);
+            continue;
+        }
+
+        for (col = 0; col < rect.right - rect.left; col++) {
+            dst[col] = load_pixel(src + col * 4, format) | alpha;
+        }
+    }
+
+    overlay_add_dirty(&overlay->dirty, &rect, overlay->width, overlay->height);
+}
+
+static void fill_block(H264_overlay *overlay, int x, int y, unsigned int width, unsigned int height,
+                       unsigned int pixel)
+{
+    SIGNED_RECT rect = { x, y, x + (INT32)width, y + (INT32)height };
+    unsigned int *dst;
+    int row, col;
+
+    if (!clip_rect(&rect, overlay->width, overlay->height)) {
+        return;
+    }
+
+    for (row = rect.top; row < rect.bottom; row++) {
+        dst = (unsigned int *)(overlay->bits + row * overlay->stride) + rect.left;
+        for (col = 0; col < rect.right - rect.left; col++) {
+            dst[col] = pixel;
+        }
+    }
+
+    overlay_add_dirty(&overlay->dirty, &rect, overlay->width, overlay->height);
+}
+
+void overlay_init(H264_overlay *overlay, unsigned char *bits, int stride, unsigned int width, unsigned int height)
+{
+    overlay->bits = bits;
+    overlay->stride = stride;
+    overlay->width = width;
+    overlay->height = height;
+    overlay->dirty.num_rects = 0;
+}
+
+/* Once full, the list collapses into its bounding box. Receiver's updates
+ * are mostly a few small rectangles, so that is rare.
+ */
+void overlay_add_dirty(H264_dirty *dirty, const SIGNED_RECT *rect, unsigned int width, unsigned int height)
+{
+    SIGNED_RECT clipped = *rect, *bound;
+    unsigned int i;
+
+    if (!clip_rect(&clipped, width, height)) {
+        return;
+    }
+
+    for (i = 0; i < dirty->num_rects; i++) {
+        bound = &dirty->rects[i];
+        if (clipped.left >= bound->left && clipped.top >= bound->top &&
+            clipped.right <= bound->right && clipped.bottom <= bound->bottom) {
+            return;
+        }
+    }
+
+    if (dirty->num_rects == OVERLAY_MAX_DIRTY) {
+        bound = &dirty->rects[0];
+        for (i = 1; i < dirty->num_rects; i++) {
+            bound->left = min(bound->left, dirty->rects[i].left);
+            bound->top = min(bound->top, dirty->rects[i].top);
+            bound->right = max(bound->right, dirty->rects[i].right);
+            bound->bottom = max(bound->bottom, dirty->rects[i].bottom);
+        }
+        dirty->num_rects = 1;
+    }
+
+    dirty->rects[dirty->num_rects++] = clipped;
+}
+
+void overlay_clear_dirty(H264_overlay *overlay)
+{
+    overlay->dirty.num_rects = 0;
+}
+
+void overlay_copy_dirty(H264_overlay *overlay, const H264_overlay *src, const H264_dirty *dirty)
+{
+    const SIGNED_RECT *rect;
+    unsigned int i;
+    int row;
+
+    for (i = 0; i < dirty->num_rects; i++) {
+        rect = &dirty->rects[i];
+        for (row = rect->top; row < rect->bottom; row++) {
+            memcpy(overlay->bits + row * overlay->stride + rect->left * 4,
+                   src->bits + row * src->stride + rect->left * 4, (rect->right - rect->left) * 4);
+        }
+    }
+}
+
+int overlay_compose_fb(H264_overlay *overlay, const struct image_buf *fb, const SIGNED_RECT interesting_rects[],
+                       unsigned int num_rects)
+{
+    SIGNED_RECT rect;
+    unsigned int i;
+
+    if (fb->pixel_format != PIXEL_FORMAT_ARGB && fb->pixel_format != PIXEL_FORMAT_BGRA) {
+        DEBUG_TRACE("Unknown frame buffer format %u\n", fb->pixel_format);
+        return -1;
+    }
+
+    for (i = 0; i < max(num_rects, 1); i++) {
+        if (num_rects) {
+            rect = interesting_rects[i];
+        } else {
+            rect.left = 0;
+            rect.top = 0;
+            rect.right = fb->width;
+            rect.bottom = fb->height;
+        }
+
+        if (!clip_rect(&rect, fb->width, fb->height)) {
+            continue;
+        }
+
+        copy_block(overlay, rect.left, rect.top,
+                   (const unsigned char *)fb->bits + rect.top * fb->stride + rect.left * 4, fb->stride,
+                   rect.right - rect.left, rect.bottom - rect.top, fb->pixel_format, 0);
+    }
+
+    return 0;
+}
+
+/* Text and bitmaps are opaque whatever alpha Receiver gives them; deleting
+ * makes the area transparent again.
+ */
+int overlay_compose_rects(H264_overlay *overlay, const struct image_buf objects[], unsigned int num_objects)
+{
+    const struct image_buf *object;
+    const unsigned char *bits;
+    unsigned int i;
+
+    for (i = 0; i < num_objects; i++) {
+        object = &objects[i];
+
+        switch (object->lossless_op) {
+        case IMAGE_OP_DRAW_LOSSLESS:
+        case IMAGE_OP_SMALL_FRAME_BITMAP:
+            if (object->pixel_format != PIXEL_FORMAT_ARGB && object->pixel_format != PIXEL_FORMAT_BGRA) {
+                DEBUG_TRACE("Unknown lossless object format %u\n", object->pixel_format);
+                return -1;
+            }
+            bits = (const unsigned char *)object->bits + object->src_y * object->stride + object->src_x * 4;
+            copy_block(overlay, object->dst_x, object->dst_y, bits, object->stride, object->width,
+                       object->height, object->pixel_format, OPAQUE);
+            break;
+
+        case IMAGE_OP_DELETE_LOSSLESS:
+            fill_block(overlay, object->dst_x, object->dst_y, object->width, object->height, 0);
+            break;
+
+        case IMAGE_OP_SMALL_FRAME_SOLID_FILL:
+            fill_block(overlay, object->dst_x, object->dst_y, object->width, object->height,
+                       object->col | OPAQUE);
+            break;
+
+        default:
+            DEBUG_TRACE("Unknown lossless operation %u\n", object->lossless_op);
+            return -1;
+        }
+    }
+
+    return 0;
+}
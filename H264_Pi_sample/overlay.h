@@ -0,0 +1,54 @@
+/***************************************************************************
+*
+*   overlay.h
+*
+*   The lossless layer: an ARGB surface over the decoded frame, kept up
+*   to date from compose_with_fb() and compose_with_rects(). Pixels with
+*   alpha 0 let the frame show through.
+*
+****************************************************************************/
+
+#ifndef _OVERLAY_H_
+#define _OVERLAY_H_
+
+#include "citrix.h"
+#include "H264_decode.h"
+
+/* Dirty rectangles kept per frame before they are merged into one. */
+#define OVERLAY_MAX_DIRTY   32
+
+typedef struct _H264_dirty {
+    SIGNED_RECT     rects[OVERLAY_MAX_DIRTY];
+    unsigned int    num_rects;
+} H264_dirty;
+
+/* The surface is the caller's memory, 32 bit ARGB (0xAARRGGBB). */
+typedef struct _H264_overlay {
+    unsigned char  *bits;
+    int             stride;
+    unsigned int    width;
+    unsigned int    height;
+    H264_dirty      dirty;      /* Changed since overlay_clear_dirty(). */
+} H264_overlay;
+
+void overlay_init(H264_overlay *overlay, unsigned char *bits, int stride, unsigned int width, unsigned int height);
+
+/* Adds "rect", clipped to the surface, to "dirty". */
+void overlay_add_dirty(H264_dirty *dirty, const SIGNED_RECT *rect, unsigned int width, unsigned int height);
+
+void overlay_clear_dirty(H264_overlay *overlay);
+
+/* Copies the parts of "src" listed in "dirty" into "overlay", which has
+ * the same size. Used to bring a back buffer up to date.
+ */
+void overlay_copy_dirty(H264_overlay *overlay, const H264_overlay *src, const H264_dirty *dirty);
+
+/* Copy the interesting rectangles of Receiver's frame buffer, or all of it
+ * if there are none, and apply lossless objects. Both return -1 for an
+ * unknown pixel format or operation.
+ */
+int overlay_compose_fb(H264_overlay *overlay, const struct image_buf *fb, const SIGNED_RECT interesting_rects[],
+                       unsigned int num_rects);
+int overlay_compose_rects(H264_overlay *overlay, const struct image_buf objects[], unsigned int num_objects);
+
+#endif /* _OVERLAY_H_ */
@@ -0,0 +1,118 @@
+/***************************************************************************
+*
+*   presenter.c
+*
+*   Presenter selection, and the null presenter.
+*
+****************************************************************************/
+
+#include "video_gl.h"
+#include "presenter.h"
+
+/* In order of preference. */
+static const H264_presenter *presenters[] = {
+#ifdef HAVE_DRM
+    &drm_presenter,
+#endif
+    &gles_presenter,
+    &x11_presenter,
+    &null_presenter,
+};
+
+void *presenter_open(int width, int height, unsigned int frames, const H264_presenter **presenter)
+{
+    char *name = getenv("CTX_H264_PRESENTER");
+    unsigned int i;
+    void *ctx;
+
+    /* Decode-only contexts show nothing. */
+    if (decode_only()) {
+        name = "null";
+    }
+
+    for (i = 0; i < ELEMENTS_IN_ARRAY(presenters); i++) {
+        if (name && strcmp(name, presenters[i]->name) != 0) {
+            continue;
+        }
+
+        ctx = presenters[i]->open(width, height, frames);
+        if (ctx) {
+            DEBUG_TRACE("Using %s presenter\n", presenters[i]->name);
+            *presenter = presenters[i];
+            return ctx;
+        }
+
+        DEBUG_TRACE("%s presenter unavailable\n", presenters[i]->name);
+    }
+
+    /* A named presenter that can't run still leaves something to present
+     * with.
+     */
+    *presenter = &null_presenter;
+    return null_presenter.open(width, height, frames);
+}
+
+void presenter_add_damage(H264_dirty *damage, const SIGNED_RECT rects[], unsigned int num_rects,
+                          unsigned int width, unsigned int height)
+{
+    SIGNED_RECT all = { 0, 0, (INT32)width, (INT32)height };
+    unsigned int i;
+
+    if (num_rects == 0) {
+        overlay_add_dirty(damage, &all, width, height);
+    }
+
+    for (i = 0; i < num_rects; i++) {
+        overlay_add_dirty(damage, &rects[i], width, height);
+    }
+}
+
+/***************************************************************************
+*   Null presenter: frames are released as soon as they are presented,
+*   for decoding without a display.
+****************************************************************************/
+
+static int null_context;
+
+static void *null_open(int width, int height, unsigned int frames)
+{
+    return &null_context;
+}
+
+static int null_compose_with_fb(void *ctx, struct image_buf *fb, SIGNED_RECT interesting_rects[],
+                                unsigned int num_rects)
+{
+    return 0;
+}
+
+static int null_compose_with_rects(void *ctx, struct image_buf objects[], unsigned int num_objects, bool last)
+{
+    return 0;
+}
+
+static int null_present(void *ctx, H264_frame *frame, const H264_dirty *damage, struct window_info windows[],
+                        unsigned int num_windows, bool wait, bool *pushed)
+{
+    if (frame) {
+        frame->release(frame);
+    }
+
+    if (pushed) {
+        *pushed = 1;
+    }
+
+    return 0;
+}
+
+static void null_close(void *ctx)
+{
+}
+
+const H264_presenter null_presenter = {
+    "null",
+    null_open,
+    null_compose_with_fb,
+    null_compose_with_rects,
+    null_present,
+    null_close,
+};
@@ -0,0 +1,111 @@
+/***************************************************************************
+*
+*   presenter.h
+*
+*   Presenters, for backends that decode to memory rather than to the
+*   screen. A presenter composes the lossless layer Receiver supplies over
+*   the decoded frames and puts both on screen. It is chosen when the
+*   backend opens a context, from CTX_H264_PRESENTER or by trying each in
+*   turn.
+*
+****************************************************************************/
+
+#ifndef _PRESENTER_H_
+#define _PRESENTER_H_
+
+#include "citrix.h"
+#include "H264_decode.h"
+#include "overlay.h"
+#include "latency.h"
+
+#define H264_FRAME_MAX_PLANES   3
+
+/* Frame formats, the same codes in V4L2 and DRM. */
+#define H264_FOURCC_NV12        0x3231564e
+#define H264_FOURCC_YU12        0x32315559
+
+/* How a frame's samples convert to RGB; 0 is BT.601, limited range. */
+#define H264_COLOR_BT709        0x01
+#define H264_COLOR_FULL_RANGE   0x02
+
+/* What a backend's frames are made of, passed to presenter_open(). */
+#define PRESENTER_FRAMES_DMABUF 0x01    /* Every plane has a DMABUF. */
+#define PRESENTER_FRAMES_MAPPED 0x02    /* Every plane is mapped. */
+
+/* A decoded picture. A presenter given one holds it, and may scan out of
+ * it, until it calls release(); backends must not reuse it before that.
+ */
+typedef struct _H264_frame {
+    unsigned int    id;                 /* Unique for the buffer's lifetime. */
+    unsigned int    fourcc;             /* e.g. NV12, same code in V4L2 and DRM. */
+    unsigned int    width;              /* Visible size. */
+    unsigned int    height;
+    unsigned int    color;              /* H264_COLOR_*. */
+    int             num_planes;
+    int             dmabuf[H264_FRAME_MAX_PLANES];  /* -1 if only mapped. */
+    unsigned int    offsets[H264_FRAME_MAX_PLANES];
+    unsigned int    pitches[H264_FRAME_MAX_PLANES];
+    unsigned char  *data[H264_FRAME_MAX_PLANES];    /* Plane start, offset applied; NULL if not mapped. */
+
+    /* The presenter stamps LATENCY_DISPLAYED with these once the frame is
+     * on screen; "latency" is NULL if the frame isn't measured.
+     */
+    H264_latency   *latency;
+    unsigned long long timestamp;
+
+    void          (*release)(struct _H264_frame *frame);
+    void           *owner;
+    int             index;
+} H264_frame;
+
+typedef struct _H264_presenter {
+    const char *name;
+
+    /* Returns a presenter context for frames of "width" x "height", made
+     * of "frames" (PRESENTER_FRAMES_*), or NULL if this presenter can't
+     * run here or can't show such frames.
+     */
+    void *(*open)(int width, int height, unsigned int frames);
+
+    int   (*compose_with_fb)(void *ctx, struct image_buf *fb, SIGNED_RECT interesting_rects[],
+                             unsigned int num_rects);
+    int   (*compose_with_rects)(void *ctx, struct image_buf objects[], unsigned int num_objects, bool last);
+
+    /* Shows "frame" under the lossless layer, or the last frame shown if it
+     * is NULL. "damage" holds the areas of the context changed since the
+     * last present(), from Receiver's dirty rectangles. Follows push_frame()
+     * for "wait" and "pushed", which may be set later from another thread.
+     * Returns -1 on failure, in which case "frame" is not held.
+     */
+    int   (*present)(void *ctx, H264_frame *frame, const H264_dirty *damage, struct window_info windows[],
+                     unsigned int num_windows, bool wait, bool *pushed);
+
+    /* Releases every frame held. */
+    void  (*close)(void *ctx);
+} H264_presenter;
+
+#ifdef HAVE_DRM
+extern const H264_presenter drm_presenter;
+#endif
+extern const H264_presenter gles_presenter;
+extern const H264_presenter x11_presenter;
+extern const H264_presenter null_presenter;
+
+/*  Function: presenter_open()
+ *
+ *  Opens the presenter named by CTX_H264_PRESENTER, or the first one that
+ *  can run here and show "frames" (PRESENTER_FRAMES_*). The null
+ *  presenter, which shows nothing, always can.
+ *
+ *  Returns:
+ *       the presenter context, with the presenter in "*presenter".
+ */
+void *presenter_open(int width, int height, unsigned int frames, const H264_presenter **presenter);
+
+/* Adds the dirty rectangles given to start_frame() to "damage", which is
+ * the whole "width" x "height" context if there are none.
+ */
+void presenter_add_damage(H264_dirty *damage, const SIGNED_RECT rects[], unsigned int num_rects,
+                          unsigned int width, unsigned int height);
+
+#endif /* _PRESENTER_H_ */
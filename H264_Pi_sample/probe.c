@@ -0,0 +1,141 @@
+/***************************************************************************
+*
+*   probe.c
+*
+*   Runtime probing of the board and its VideoCore, used to advertise
+*   decoder limits the hardware can actually meet.
+*
+****************************************************************************/
+
+#include "video_gl.h"
+
+/* GPU memory below which 1080p decoding (frame store, references and the
+ * renderer's copies) no longer fits, and below which nothing useful does.
+ */
+#define GPU_MEM_1080P_MB    64
+#define GPU_MEM_720P_MB     32
+
+static const char *soc_names[] = {
+    "unknown", "BCM2835", "BCM2836", "BCM2837", "BCM2711", "BCM2712"
+};
+
+static void read_model(board_info *info)
+{
+    FILE *f = fopen("/proc/device-tree/model", "r");
+
+    info->model[0] = 0;
+
+    if (f) {
+        if (!fgets(info->model, sizeof(info->model), f)) {
+            info->model[0] = 0;
+        }
+        fclose(f);
+    }
+}
+
+/* Board revision and core count from /proc/cpuinfo. */
+static void read_cpuinfo(board_info *info)
+{
+    FILE *f = fopen("/proc/cpuinfo", "r");
+    char line[256];
+
+    if (!f) {
+        return;
+    }
+
+    while (fgets(line, sizeof(line), f)) {
+        if (strncmp(line, "processor", 9) == 0) {
+            info->cores++;
+        } else if (strncmp(line, "Revision", 8) == 0) {
+            char *colon = strchr(line, ':');
+
+            if (colon) {
+                info->revision = strtoul(colon + 1, NULL, 16);
+            }
+        }
+    }
+
+    fclose(f);
+
+    if (info->revision & (1 << 23)) {
+        /* New style revision code, processor in bits 12-15. */
+        switch ((info->revision >> 12) & 0xf) {
+        case 0: info->soc = SOC_BCM2835; break;
+        case 1: info->soc = SOC_BCM2836; break;
+        case 2: info->soc = SOC_BCM2837; break;
+        case 3: info->soc = SOC_BCM2711; break;
+        case 4: info->soc = SOC_BCM2712; break;
+        }
+    } else if (info->revision) {
+        /* Old style codes were only used on the Pi 1. */
+        info->soc = SOC_BCM2835;
+    }
+}
+
+static void read_videocore(board_info *info)
+{
+    char response[128];
+    int value;
+
+    if (vc_gencmd(response, sizeof(response), "get_mem gpu") == 0 &&
+        vc_gencmd_number_property(response, "gpu", &value)) {
+        info->gpu_mem_mb = value;
+    }
+
+    /* H.264 needs no licence, but the firmware can still have it disabled. */
+    info->h264_enabled = 1;
+    if (vc_gencmd(response, sizeof(response), "codec_enabled H264") == 0 &&
+        strstr(response, "disabled")) {
+        info->h264_enabled = 0;
+    }
+}
+
+void probe_board(board_info *info)
+{
+    memset(info, 0, sizeof(board_info));
+
+    read_model(info);
+    read_cpuinfo(info);
+    read_videocore(info);
+
+    if (info->soc == SOC_BCM2712) {
+        /* The Pi 5 has no H.264 decode block at all. */
+        info->h264_enabled = 0;
+    }
+
+    DEBUG_TRACE("Board \"%s\", revision 0x%x, %s, %d cores, gpu_mem=%dM, H.264 %s\n",
+                info->model, info->revision, soc_names[info->soc], info->cores,
+                info->gpu_mem_mb, info->h264_enabled ? "enabled" : "disabled");
+}
+
+int probe_caps(const board_info *info, struct H264_decoder *caps)
+{
+    if (!info->h264_enabled) {
+        return 0;
+    }
+
+    if (info->gpu_mem_mb && info->gpu_mem_mb < GPU_MEM_720P_MB) {
+        DEBUG_TRACE("Only %dM of GPU memory, not enough to decode\n", info->gpu_mem_mb);
+        return 0;
+    }
+
+    /* VideoCore IV decodes 1080p30, VideoCore VI 1080p60. */
+    caps->width = 1920;
+    caps->height = 1080;
+    caps->max_fps = info->soc == SOC_BCM2711 ? 60 : 30;
+
+    if (info->gpu_mem_mb && info->gpu_mem_mb < GPU_MEM_1080P_MB) {
+        caps->width = 1280;
+        caps->height = 720;
+    }
+
+    /* The hardware only decodes 4:2:0. */
+    caps->chroma_formats = H264_CHROMA_FORMAT_420;
+
+    /* The lossless overlay isn't composed, so don't ask for it. */
+    caps->options = 0;
+
+    DEBUG_TRACE("Advertising %ux%u@%d\n", caps->width, caps->height, caps->max_fps);
+
+    return 1;
+}
@@ -0,0 +1,50 @@
+/***************************************************************************
+*
+*   probe.h
+*
+*   Runtime probing of the board and its VideoCore, used to advertise
+*   decoder limits the hardware can actually meet.
+*
+****************************************************************************/
+
+#ifndef _PROBE_H_
+#define _PROBE_H_
+
+/* SoC, from the processor field of the board revision code. */
+typedef enum _board_soc {
+    SOC_UNKNOWN = 0,
+    SOC_BCM2835,        /* Pi 1, Zero. */
+    SOC_BCM2836,        /* Pi 2. */
+    SOC_BCM2837,        /* Pi 3, Zero 2. */
+    SOC_BCM2711,        /* Pi 4. */
+    SOC_BCM2712         /* Pi 5, no H.264 hardware. */
+} board_soc;
+
+typedef struct _board_info {
+    char            model[64];
+    unsigned int    revision;
+    board_soc       soc;
+    int             cores;
+    int             gpu_mem_mb;     /* 0 if unknown. */
+    int             h264_enabled;
+} board_info;
+
+struct H264_decoder;
+
+/* Fills "info" from /proc and the VideoCore gencmd service. */
+void probe_board(board_info *info);
+
+/*  Function: probe_caps()
+ *
+ *  Sets the limits advertised in "caps" (width, height, max_fps,
+ *  chroma_formats, options) to what the hardware decoder of the probed
+ *  board can sustain.
+ *
+ *  Returns:
+ *       1:     the hardware decoder is usable.
+ *
+ *       0:     no usable hardware decoder.
+ */
+int probe_caps(const board_info *info, struct H264_decoder *caps);
+
+#endif /* _PROBE_H_ */
@@ -0,0 +1,142 @@
+/***************************************************************************
+*
+*   session.h
+*
+*   On-disk format of recorded plugin sessions: every call made through the
+*   H264_decoder table, with its arguments and data, so that a session can
+*   be replayed outside Receiver.
+*
+*   A file is a session_header followed by records. Each record is a
+*   session_record followed by "size" bytes of payload, padded to 8 bytes
+*   so the file can be used in place when memory mapped. A file that was
+*   closed cleanly ends with a SESSION_INDEX record listing the frames that
+*   start with an IDR, followed by a session_footer pointing at it.
+*
+****************************************************************************/
+
+#ifndef _SESSION_H_
+#define _SESSION_H_
+
+#include <stdint.h>
+
+#define SESSION_MAGIC           "CTXH264S"
+#define SESSION_FOOTER_MAGIC    "CTXH264I"
+#define SESSION_VERSION         1
+
+#define SESSION_ALIGN(size)     (((size) + 7) & ~7)
+
+typedef struct _session_header {
+    char        magic[8];
+    uint32_t    version;
+    uint32_t    header_size;
+    uint64_t    start_time;     /* Wall clock time of the first record (ns since the epoch). */
+} session_header;
+
+typedef enum _session_record_type {
+    SESSION_OPEN_CONTEXT = 1,   /* session_open, codec data. */
+    SESSION_START_FRAME,        /* session_start_frame, SIGNED_RECTs. */
+    SESSION_DECODE_FRAME,       /* H.264 data, "arg" is the "last" flag. */
+    SESSION_COMPOSE_WITH_FB,    /* session_compose_fb, SIGNED_RECTs, pixels of each rect. "arg"
+                                 * is set if the call had no rects and one covering the frame
+                                 * buffer was recorded. */
+    SESSION_COMPOSE_WITH_RECTS, /* uint32_t count, then per object a session_image and its pixels.
+                                 * "arg" is the "last" flag. */
+    SESSION_PUSH_FRAME,         /* uint32_t count, session_windows. "arg" is the "wait" flag. */
+    SESSION_CLOSE_CONTEXT,      /* No payload. */
+    SESSION_INDEX,              /* session_index_entry array. */
+    SESSION_FRAME_INFO          /* session_frame_info, written by the plugin some frames after the
+                                 * frame it describes; not a call, so not replayed. */
+} session_record_type;
+
+typedef struct _session_record {
+    uint32_t    type;
+    uint32_t    size;           /* Payload bytes, before padding. */
+    uint64_t    time;           /* Since the start of the session (ns). */
+    uint32_t    context;
+    uint32_t    arg;
+} session_record;
+
+typedef struct _session_open {
+    int32_t     width;
+    int32_t     height;
+    uint32_t    options;
+    uint32_t    codec_data_len;
+} session_open;
+
+typedef struct _session_start_frame {
+    uint32_t    encoded_size;
+    uint32_t    num_rects;
+} session_start_frame;
+
+/* A struct image_buf without its pointers. Pixels follow, "height" rows of
+ * "width" 32-bit pixels, unless the operation carries none. The rows of a
+ * compose_with_rects() object are its source rectangle, so it is recorded
+ * with a stride of "width" pixels and a source of (0, 0).
+ */
+typedef struct _session_image {
+    uint8_t     pixel_format;
+    uint8_t     lossless_op;
+    uint16_t    reserved;
+    int32_t     stride;
+    uint32_t    width;
+    uint32_t    height;
+    int32_t     dst_x, dst_y;
+    int32_t     src_x, src_y;
+    uint32_t    col;
+} session_image;
+
+/* Only the interesting rects of the frame buffer are recorded. */
+typedef struct _session_compose_fb {
+    session_image fb;
+    uint32_t    num_rects;
+    uint32_t    reserved;
+} session_compose_fb;
+
+typedef struct _session_window {
+    uint32_t    id;
+    int32_t     left, top, right, bottom;
+    int32_t     target_x;
+    int32_t     target_y;
+    uint32_t    flags;
+} session_window;
+
+typedef struct _session_index_entry {
+    uint64_t    offset;         /* SESSION_START_FRAME record of the frame. */
+    uint64_t    open_offset;    /* SESSION_OPEN_CONTEXT record it belongs to. */
+    uint64_t    time;
+    uint32_t    frame;
+    uint32_t    reserved;
+} session_index_entry;
+
+/* What a frame was sent as, from its NAL and slice headers, and when it
+ * reached each of the points of latency.h, which there are
+ * SESSION_LATENCY_POINTS of.
+ */
+#define SESSION_LATENCY_POINTS  6
+
+#define SESSION_FRAME_DROPPED   0x01    /* Shed, or dropped waiting for an IDR. */
+#define SESSION_FRAME_CABAC     0x02
+#define SESSION_FRAME_PARAMS    0x04    /* Carried an SPS or PPS. */
+
+typedef struct _session_frame_info {
+    uint32_t    frame;          /* Of the context, from 0. */
+    uint32_t    bytes;          /* Of its NALs, start codes excluded. */
+    uint32_t    max_slice_bytes;
+    uint16_t    nals;
+    uint16_t    slices;
+    uint8_t     slice_types;    /* 1 << slice_type % 5 for each type among the slices. */
+    uint8_t     idr;
+    uint8_t     ref_idc;        /* Highest nal_ref_idc of the slices. */
+    uint8_t     flags;
+    int8_t      qp;             /* Of the first slice, -1 if unknown. */
+    uint8_t     refs;           /* num_ref_idx_l0_active of the first slice. */
+    uint16_t    reserved;
+    uint32_t    latency_us[SESSION_LATENCY_POINTS];    /* After start_frame(), 0 if not reached. */
+} session_frame_info;
+
+typedef struct _session_footer {
+    char        magic[8];
+    uint64_t    index_offset;   /* SESSION_INDEX record. */
+} session_footer;
+
+#endif /* _SESSION_H_ */
@@ -0,0 +1,390 @@
+/***************************************************************************
+*
+*   synth_session.c
+*
+*   Writes a synthetic session (see session.h) for ctxh264_host.bin to
+*   replay: a stream from h264_synth.h with the codec data, the dirty rect
+*   of every frame and a lossless overlay of text lines being drawn and
+*   deleted, as Receiver would send them for a desktop, at any size and
+*   rate. Or, with -R, only the Annex-B stream.
+*
+*       make synth_session.bin
+*       ./synth_session.bin [-w width] [-h height] [-f fps] [-n frames]
+*                           [-s slices] [-g gop] [-N] [-a x,y,w,h]
+*                           [-o objects] [-R] output
+*
+*   -N makes every other P frame a non-reference one, -a limits the
+*   macroblocks P frames code (and the dirty rect) to a region, and -o sets
+*   the text lines drawn per frame.
+*
+****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "citrix.h"
+#include "H264_decode.h"
+#include "session.h"
+#include "h264_synth.h"
+
+#define NS_PER_SEC          1000000000ULL
+
+/* A text line of the overlay, and the caret after it. */
+#define TEXT_WIDTH          256
+#define TEXT_HEIGHT         16
+#define CARET_WIDTH         2
+
+typedef struct _synth_options {
+    int             width;
+    int             height;
+    unsigned int    fps;
+    unsigned int    frames;
+    int             slices;
+    unsigned int    gop;
+    int             non_ref;
+    int             active[4];      /* x, y, width, height. */
+    unsigned int    objects;
+    int             raw;
+    const char     *output;
+} synth_options;
+
+typedef struct _session_out {
+    FILE           *file;
+    uint64_t        offset;
+    session_index_entry *index;
+    uint32_t        index_count;
+} session_out;
+
+static void out_write(session_out *out, const void *data, size_t size)
+{
+    if (size && fwrite(data, 1, size, out->file) != size) {
+        perror("fwrite");
+        exit(1);
+    }
+    out->offset += size;
+}
+
+/* Writes the record header; "size" bytes of payload follow, then
+ * end_record().
+ */
+static void begin_record(session_out *out, uint32_t type, uint32_t size, uint64_t time, uint32_t arg)
+{
+    session_record rec;
+
+    memset(&rec, 0, sizeof(rec));
+    rec.type = type;
+    rec.size = size;
+    rec.time = time;
+    rec.context = 1;
+    rec.arg = arg;
+
+    out_write(out, &rec, sizeof(rec));
+}
+
+/* Pads the payload, so that the next record starts on 8 bytes. */
+static void end_record(session_out *out)
+{
+    static const unsigned char pad[8];
+
+    out_write(out, pad, SESSION_ALIGN(out->offset) - out->offset);
+}
+
+/* The same text line for every object; only where it goes changes. */
+static uint32_t *make_text(void)
+{
+    uint32_t *pixels = malloc(TEXT_WIDTH * TEXT_HEIGHT * 4);
+    int x, y;
+
+    if (!pixels) {
+        return NULL;
+    }
+
+    for (y = 0; y < TEXT_HEIGHT; y++) {
+        for (x = 0; x < TEXT_WIDTH; x++) {
+            int glyph = y >= 3 && y < 13 && x % 8 < 6 && ((x / 8 * 7 + y) % 5 < 3);
+
+            pixels[y * TEXT_WIDTH + x] = glyph ? 0xff101010 : 0xfff0f0f0;
+        }
+    }
+
+    return pixels;
+}
+
+static void set_image(session_image *image, uint8_t op, int x, int y, int width, int height)
+{
+    memset(image, 0, sizeof(session_image));
+    image->pixel_format = PIXEL_FORMAT_ARGB;
+    image->lossless_op = op;
+    image->stride = width * 4;
+    image->width = width;
+    image->height = height;
+    image->dst_x = x;
+    image->dst_y = y;
+}
+
+/* Where text line "line" of the active region goes. */
+static void text_position(const synth_options *opt, unsigned int line, int *x, int *y)
+{
+    int columns = opt->active[2] / TEXT_WIDTH, rows = opt->active[3] / TEXT_HEIGHT;
+
+    columns = columns > 0 ? columns : 1;
+    rows = rows > 0 ? rows : 1;
+    line %= columns * rows;
+
+    *x = opt->active[0] + (line % columns) * TEXT_WIDTH;
+    *y = opt->active[1] + (line / columns) * TEXT_HEIGHT;
+}
+
+/* The text lines of frame "frame" are drawn, the ones of the frame before
+ * deleted, and the caret moved after the last.
+ */
+static void write_overlay(session_out *out, const synth_options *opt, unsigned int frame, uint64_t time,
+                          const uint32_t *text)
+{
+    unsigned int deleted = frame ? opt->objects : 0, i;
+    uint32_t count = opt->objects + deleted + 1;
+    uint32_t size = sizeof(count) + count * sizeof(session_image) + opt->objects * TEXT_WIDTH * TEXT_HEIGHT * 4;
+    session_image image;
+    int x, y;
+
+    begin_record(out, SESSION_COMPOSE_WITH_RECTS, size, time, 1);
+    out_write(out, &count, sizeof(count));
+
+    for (i = 0; i < deleted; i++) {
+        text_position(opt, (frame - 1) * opt->objects + i, &x, &y);
+        set_image(&image, IMAGE_OP_DELETE_LOSSLESS, x, y, TEXT_WIDTH, TEXT_HEIGHT);
+        out_write(out, &image, sizeof(image));
+    }
+
+    for (i = 0; i < opt->objects; i++) {
+        text_position(opt, frame * opt->objects + i, &x, &y);
+        set_image(&image, IMAGE_OP_DRAW_LOSSLESS, x, y, TEXT_WIDTH, TEXT_HEIGHT);
+        out_write(out, &image, sizeof(image));
+        out_write(out, text, TEXT_WIDTH * TEXT_HEIGHT * 4);
+    }
+
+    text_position(opt, (frame + 1) * opt->objects, &x, &y);
+    set_image(&image, IMAGE_OP_SMALL_FRAME_SOLID_FILL, x, y, CARET_WIDTH, TEXT_HEIGHT);
+    image.col = 0x101010;
+    out_write(out, &image, sizeof(image));
+    end_record(out);
+}
+
+static void write_frame(session_out *out, const synth_options *opt, H264_synth *synth, unsigned int frame,
+                        const unsigned char *au, int len, const uint32_t *text)
+{
+    uint64_t time = (uint64_t)frame * NS_PER_SEC / opt->fps;
+    session_start_frame start;
+    SIGNED_RECT dirty;
+    uint32_t windows = 0;
+
+    /* An IDR repaints everything; a P frame only what its macroblocks
+     * cover.
+     */
+    if (synth->idr) {
+        dirty.left = dirty.top = 0;
+        dirty.right = opt->width;
+        dirty.bottom = opt->height;
+    } else {
+        dirty.left = synth->active_x * 16;
+        dirty.top = synth->active_y * 16;
+        dirty.right = (synth->active_x + synth->active_width) * 16;
+        dirty.bottom = (synth->active_y + synth->active_height) * 16;
+        dirty.right = dirty.right < opt->width ? dirty.right : opt->width;
+        dirty.bottom = dirty.bottom < opt->height ? dirty.bottom : opt->height;
+    }
+
+    if (synth->idr) {
+        out->index = realloc(out->index, (out->index_count + 1) * sizeof(session_index_entry));
+        if (!out->index) {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+        memset(&out->index[out->index_count], 0, sizeof(session_index_entry));
+        out->index[out->index_count].offset = out->offset;
+        out->index[out->index_count].open_offset = sizeof(session_header);
+        out->index[out->index_count].time = time;
+        out->index[out->index_count].frame = frame;
+        out->index_count++;
+    }
+
+    start.encoded_size = len;
+    start.num_rects = 1;
+    begin_record(out, SESSION_START_FRAME, sizeof(start) + sizeof(dirty), time, 0);
+    out_write(out, &start, sizeof(start));
+    out_write(out, &dirty, sizeof(dirty));
+    end_record(out);
+
+    begin_record(out, SESSION_DECODE_FRAME, len, time, 1);
+    out_write(out, au, len);
+    end_record(out);
+
+    if (opt->objects) {
+        write_overlay(out, opt, frame, time, text);
+    }
+
+    begin_record(out, SESSION_PUSH_FRAME, sizeof(windows), time, 0);
+    out_write(out, &windows, sizeof(windows));
+    end_record(out);
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-w width] [-h height] [-f fps] [-n frames] [-s slices] [-g gop] [-N]\n"
+                    "       [-a x,y,w,h] [-o objects] [-R] output\n", name);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    synth_options opt = { 1920, 1080, 60, 600, 1, 0, 0, { 0, 0, 0, 0 }, 4, 0, NULL };
+    session_header header;
+    session_open open;
+    session_footer footer;
+    session_out out;
+    H264_synth synth;
+    unsigned char *buf, *codec_data;
+    uint32_t *text;
+    unsigned int frame, idrs = 0;
+    int size, len, codec_data_len, opt_char;
+
+    while ((opt_char = getopt(argc, argv, "w:h:f:n:s:g:Na:o:R")) != -1) {
+        switch (opt_char) {
+        case 'w':
+            opt.width = atoi(optarg);
+            break;
+        case 'h':
+            opt.height = atoi(optarg);
+            break;
+        case 'f':
+            opt.fps = atoi(optarg);
+            break;
+        case 'n':
+            opt.frames = atoi(optarg);
+            break;
+        case 's':
+            opt.slices = atoi(optarg);
+            break;
+        case 'g':
+            opt.gop = atoi(optarg);
+            break;
+        case 'N':
+            opt.non_ref = 1;
+            break;
+        case 'a':
+            if (sscanf(optarg, "%d,%d,%d,%d", &opt.active[0], &opt.active[1], &opt.active[2],
+                       &opt.active[3]) != 4) {
+                usage(argv[0]);
+            }
+            break;
+        case 'o':
+            opt.objects = atoi(optarg);
+            break;
+        case 'R':
+            opt.raw = 1;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if (optind != argc - 1 || opt.width < 16 || opt.height < 16 || opt.fps == 0) {
+        usage(argv[0]);
+    }
+    opt.output = argv[optind];
+
+    if (!opt.active[2] || !opt.active[3]) {
+        opt.active[0] = opt.active[1] = 0;
+        opt.active[2] = opt.width;
+        opt.active[3] = opt.height;
+    }
+
+    if (h264_synth_init(&synth, opt.width, opt.height, 1) != 0) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    synth.slices = opt.slices;
+    synth.gop = opt.gop;
+    synth.non_ref = opt.non_ref;
+    synth.fps = opt.fps;
+    h264_synth_set_active(&synth, opt.active[0], opt.active[1], opt.active[2], opt.active[3]);
+
+    size = h264_synth_max_size(&synth);
+    buf = malloc(size);
+    codec_data = malloc(256);
+    text = make_text();
+    if (!buf || !codec_data || !text) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    memset(&out, 0, sizeof(out));
+    out.file = fopen(opt.output, "wb");
+    if (!out.file) {
+        perror(opt.output);
+        return 1;
+    }
+
+    if (!opt.raw) {
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, SESSION_MAGIC, sizeof(header.magic));
+        header.version = SESSION_VERSION;
+        header.header_size = sizeof(session_header);
+        out_write(&out, &header, sizeof(header));
+
+        codec_data_len = h264_synth_parameter_sets(&synth, codec_data, 256);
+        memset(&open, 0, sizeof(open));
+        open.width = opt.width;
+        open.height = opt.height;
+        open.options = H264_OPTION_LOSSLESS | H264_OPTION_PREFER_TEXT_RECTS | H264_OPTION_SMALL_FRAME_SUPPORT;
+        open.codec_data_len = codec_data_len;
+        begin_record(&out, SESSION_OPEN_CONTEXT, sizeof(open) + codec_data_len, 0, 0);
+        out_write(&out, &open, sizeof(open));
+        out_write(&out, codec_data, codec_data_len);
+        end_record(&out);
+    }
+
+    for (frame = 0; frame < opt.frames; frame++) {
+        len = h264_synth_frame(&synth, buf, size);
+        if (len < 0) {
+            fprintf(stderr, "Frame %u is too big\n", frame);
+            return 1;
+        }
+
+        idrs += synth.idr;
+        if (opt.raw) {
+            out_write(&out, buf, len);
+        } else {
+            write_frame(&out, &opt, &synth, frame, buf, len, text);
+        }
+    }
+
+    if (!opt.raw) {
+        begin_record(&out, SESSION_CLOSE_CONTEXT, 0, (uint64_t)opt.frames * NS_PER_SEC / opt.fps, 0);
+
+        footer.index_offset = out.offset;
+        begin_record(&out, SESSION_INDEX, out.index_count * sizeof(session_index_entry), 0, 0);
+        out_write(&out, out.index, out.index_count * sizeof(session_index_entry));
+        end_record(&out);
+
+        memcpy(footer.magic, SESSION_FOOTER_MAGIC, sizeof(footer.magic));
+        out_write(&out, &footer, sizeof(footer));
+    }
+
+    if (fclose(out.file) != 0) {
+        perror(opt.output);
+        return 1;
+    }
+
+    printf("%u frames, %u IDRs, %llu bytes\n", opt.frames, idrs, (unsigned long long)out.offset);
+
+    free(out.index);
+    free(text);
+    free(codec_data);
+    free(buf);
+    h264_synth_free(&synth);
+
+    return 0;
+}
@@ -0,0 +1,354 @@
+/***************************************************************************
+*
+*   trace.c
+*
+*   Binary event tracing (see trace.h), and DEBUG_TRACE() on top of it.
+*
+****************************************************************************/
+
+#include <stdarg.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/prctl.h>
+
+#include "video_gl.h"
+#include "trace.h"
+
+/* Events kept per thread, a power of 2. */
+#define TRACE_RING_EVENTS   4096
+
+/* Rings allocated before those of threads that have gone are taken over. */
+#define TRACE_MAX_RINGS     16
+
+/* Slots left out at the oldest end of a dump, which the thread may be
+ * overwriting as it is written.
+ */
+#define TRACE_DUMP_MARGIN   64
+
+#define TRACE_MESSAGE_MAX   256
+
+/* A thread's ring. Only its thread writes it; "head" counts the slots
+ * written and is advanced once they are complete. Rings outlive their
+ * threads, to be taken over by later ones.
+ */
+typedef struct _trace_ring {
+    struct _trace_ring *next;
+    volatile int        in_use;
+    unsigned int        tid;
+    char                name[16];
+    volatile unsigned int head;
+    trace_event         events[TRACE_RING_EVENTS];
+} trace_ring;
+
+static const trace_dump_id ids[TRACE_IDS] = {
+    { TRACE_INSTANT, TRACE_LEVEL_MESSAGE, "message", "length" },
+    { TRACE_INSTANT, TRACE_LEVEL_MESSAGE, "text", "" },
+    { TRACE_INSTANT, TRACE_LEVEL_FRAME, "start_frame", "encoded_size,num_rects" },
+    { TRACE_BEGIN, TRACE_LEVEL_FRAME, "decode_frame", "len,last" },
+    { TRACE_END, TRACE_LEVEL_FRAME, "decode_frame", "" },
+    { TRACE_BEGIN, TRACE_LEVEL_FRAME, "end_frame", "submitted" },
+    { TRACE_END, TRACE_LEVEL_FRAME, "end_frame", "" },
+    { TRACE_INSTANT, TRACE_LEVEL_NAL, "nal", "type,ref_idc,dropped" },
+    { TRACE_INSTANT, TRACE_LEVEL_FRAME, "shed", "queue_depth,shed_frames" },
+    { TRACE_INSTANT, TRACE_LEVEL_FRAME, "stream_error", "errors" },
+    { TRACE_COUNTER, TRACE_LEVEL_FRAME, "queue_depth", "frames" },
+    { TRACE_INSTANT, TRACE_LEVEL_FRAME, "compose", "num_rects,text" },
+    { TRACE_BEGIN, TRACE_LEVEL_FRAME, "push_frame", "num_windows,wait" },
+    { TRACE_END, TRACE_LEVEL_FRAME, "push_frame", "" },
+    { TRACE_INSTANT, TRACE_LEVEL_NAL, "buffer_submit", "bytes,flags,in_flight" },
+    { TRACE_INSTANT, TRACE_LEVEL_NAL, "buffer_done", "in_flight" },
+    { TRACE_INSTANT, TRACE_LEVEL_FRAME, "frame_decoded", "frame,index" },
+    { TRACE_BEGIN, TRACE_LEVEL_FRAME, "present", "frame" },
+    { TRACE_END, TRACE_LEVEL_FRAME, "present", "" },
+    { TRACE_INSTANT, TRACE_LEVEL_FRAME, "pushed", "" },
+};
+
+int trace_level = TRACE_LEVEL_FRAME;
+
+static trace_ring *volatile rings;
+static volatile int num_rings;
+static __thread trace_ring *ring;
+static pthread_key_t ring_key;
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+
+static int initialised;
+static int trace_stdout = 1;
+static int dump_at_end;
+static char dump_path[256];
+
+/***************************************************************************
+*   Rings.
+****************************************************************************/
+
+/* Called as a thread exits, so a later thread can take its ring over. */
+static void release_ring(void *arg)
+{
+    trace_ring *r = arg;
+
+    __sync_synchronize();
+    r->in_use = 0;
+}
+
+static void create_ring_key(void)
+{
+    pthread_key_create(&ring_key, release_ring);
+}
+
+/* The calling thread's ring: a new one added to the list, or once there
+ * are TRACE_MAX_RINGS, a free one taken over. Returns NULL if out of
+ * memory.
+ */
+static trace_ring *get_ring(void)
+{
+    trace_ring *r = NULL;
+
+    if (ring) {
+        return ring;
+    }
+
+    if (num_rings >= TRACE_MAX_RINGS) {
+        for (r = rings; r; r = r->next) {
+            if (!r->in_use && __sync_bool_compare_and_swap(&r->in_use, 0, 1)) {
+                break;
+            }
+        }
+    }
+
+    if (!r) {
+        r = calloc(1, sizeof(trace_ring));
+        if (!r) {
+            return NULL;
+        }
+        r->in_use = 1;
+        do {
+            r->next = rings;
+        } while (!__sync_bool_compare_and_swap(&rings, r->next, r));
+        __sync_fetch_and_add(&num_rings, 1);
+    }
+
+    /* The events of a thread that has gone can't be told from this one's. */
+    r->head = 0;
+    r->tid = syscall(SYS_gettid);
+    memset(r->name, 0, sizeof(r->name));
+    prctl(PR_GET_NAME, r->name, 0, 0, 0);
+
+    pthread_once(&ring_key_once, create_ring_key);
+    pthread_setspecific(ring_key, r);
+    ring = r;
+
+    return r;
+}
+
+static unsigned long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void trace_event_record(trace_id id, unsigned int a, unsigned int b, unsigned int c)
+{
+    trace_ring *r;
+    trace_event *event;
+
+    if (trace_level < ids[id].level || !(r = get_ring())) {
+        return;
+    }
+
+    event = &r->events[r->head & (TRACE_RING_EVENTS - 1)];
+    event->time = now_ns();
+    event->id = id;
+    event->size = 0;
+    event->args[0] = a;
+    event->args[1] = b;
+    event->args[2] = c;
+
+    __sync_synchronize();
+    r->head++;
+}
+
+void trace_message(const char *text, int len)
+{
+    trace_ring *r;
+    trace_event *event;
+    unsigned int head;
+    int i, chunk;
+
+    if (trace_level < TRACE_LEVEL_MESSAGE || !(r = get_ring())) {
+        return;
+    }
+
+    head = r->head;
+    event = &r->events[head++ & (TRACE_RING_EVENTS - 1)];
+    event->time = now_ns();
+    event->id = TRACE_MESSAGE;
+    event->size = 0;
+    event->args[0] = len;
+
+    for (i = 0; i < len; i += chunk) {
+        chunk = min(len - i, (int)sizeof(event->args));
+        event = &r->events[head++ & (TRACE_RING_EVENTS - 1)];
+        event->time = 0;
+        event->id = TRACE_TEXT;
+        event->size = chunk;
+        memcpy(event->args, text + i, chunk);
+    }
+
+    __sync_synchronize();
+    r->head = head;
+}
+
+void DEBUG_TRACE(const char *format, ...)
+{
+    char buf[TRACE_MESSAGE_MAX];
+    va_list args;
+    int len;
+
+    if (trace_level < TRACE_LEVEL_MESSAGE) {
+        return;
+    }
+
+    va_start(args, format);
+    len = vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+
+    if (len < 0) {
+        return;
+    }
+    len = min(len, (int)sizeof(buf) - 1);
+
+    trace_message(buf, len);
+    if (trace_stdout) {
+        fwrite(buf, 1, len, stdout);
+    }
+}
+
+/***************************************************************************
+*   Dumps.
+****************************************************************************/
+
+static int write_all(int fd, const void *data, size_t size)
+{
+    const char *p = data;
+    ssize_t n;
+
+    while (size > 0) {
+        n = write(fd, p, size);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        p += n;
+        size -= n;
+    }
+
+    return 0;
+}
+
+/* The events of "r" still in it, in at most two runs where the ring wraps. */
+static int dump_ring(int fd, trace_ring *r)
+{
+    trace_dump_thread thread;
+    unsigned int head = r->head, first, start, count;
+
+    __sync_synchronize();
+
+    first = head > TRACE_RING_EVENTS - TRACE_DUMP_MARGIN ? head - (TRACE_RING_EVENTS - TRACE_DUMP_MARGIN) : 0;
+
+    memset(&thread, 0, sizeof(thread));
+    thread.tid = r->tid;
+    thread.num_events = head - first;
+    memcpy(thread.name, r->name, sizeof(thread.name));
+    if (write_all(fd, &thread, sizeof(thread)) != 0) {
+        return -1;
+    }
+
+    start = first & (TRACE_RING_EVENTS - 1);
+    count = min(thread.num_events, TRACE_RING_EVENTS - start);
+    if (write_all(fd, &r->events[start], count * sizeof(trace_event)) != 0 ||
+        write_all(fd, r->events, (thread.num_events - count) * sizeof(trace_event)) != 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+int trace_dump(void)
+{
+    trace_dump_header header;
+    trace_ring *r;
+    int fd, ret = 0, saved_errno = errno;
+
+    fd = open(dump_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        errno = saved_errno;
+        return -1;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TRACE_DUMP_MAGIC, sizeof(TRACE_DUMP_MAGIC));
+    header.pid = getpid();
+    header.num_ids = TRACE_IDS;
+
+    if (write_all(fd, &header, sizeof(header)) != 0 || write_all(fd, ids, sizeof(ids)) != 0) {
+        ret = -1;
+    }
+    for (r = rings; r && ret == 0; r = r->next) {
+        ret = dump_ring(fd, r);
+    }
+
+    close(fd);
+    errno = saved_errno;
+
+    return ret;
+}
+
+static void dump_signal(int sig)
+{
+    trace_dump();
+}
+
+void trace_init(void)
+{
+    struct sigaction action;
+    char *level = getenv("CTX_H264_TRACE");
+    char *path = getenv("CTX_H264_TRACE_FILE");
+    char *to_stdout = getenv("CTX_H264_TRACE_STDOUT");
+
+    if (initialised) {
+        return;
+    }
+    initialised = 1;
+
+    if (level) {
+        trace_level = atoi(level);
+    }
+    trace_stdout = !to_stdout || atoi(to_stdout) != 0;
+
+    dump_at_end = path != NULL;
+    if (path) {
+        snprintf(dump_path, sizeof(dump_path), "%s", path);
+    } else {
+        snprintf(dump_path, sizeof(dump_path), "/tmp/ctxh264.%d.trace", (int)getpid());
+    }
+
+    /* Receiver's own handler, if it has one, comes first. */
+    if (trace_level > TRACE_LEVEL_OFF && sigaction(SIGUSR2, NULL, &action) == 0 && action.sa_handler == SIG_DFL) {
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = dump_signal;
+        action.sa_flags = SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGUSR2, &action, NULL);
+    }
+}
+
+void trace_end(void)
+{
+    if (dump_at_end && trace_level > TRACE_LEVEL_OFF && trace_dump() != 0) {
+        printf("Couldn't write the trace to %s\n", dump_path);
+    }
+}
@@ -0,0 +1,130 @@
+/***************************************************************************
+*
+*   trace.h
+*
+*   Binary event tracing. Each thread writes fixed size events (an ID, a
+*   timestamp and up to three integers) to a ring of its own, without
+*   locks or formatting, so tracing can stay on during playback. The rings
+*   are dumped to a file on SIGUSR2 and at v3_end(), and trace_json.bin
+*   converts a dump to Chrome/Perfetto trace JSON.
+*
+*   CTX_H264_TRACE sets the level (TRACE_LEVEL_*, TRACE_LEVEL_FRAME by
+*   default), CTX_H264_TRACE_FILE where the dump goes (/tmp/ctxh264.<pid>.trace
+*   by default; only signals dump if it isn't set), and
+*   CTX_H264_TRACE_STDOUT=0 stops DEBUG_TRACE() messages being printed as
+*   well as recorded.
+*
+****************************************************************************/
+
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#define TRACE_LEVEL_OFF         0
+#define TRACE_LEVEL_MESSAGE     1       /* DEBUG_TRACE() messages. */
+#define TRACE_LEVEL_FRAME       2       /* Events once per frame or call. */
+#define TRACE_LEVEL_NAL         3       /* Events per NAL and per buffer. */
+
+#define TRACE_ARGS              3
+
+/* How trace_json.bin shows an event. */
+#define TRACE_INSTANT           0
+#define TRACE_BEGIN             1       /* Until the next TRACE_END of the thread. */
+#define TRACE_END               2
+#define TRACE_COUNTER           3       /* Its arguments are values plotted over time. */
+
+/* Event IDs; names, levels and argument names are in trace.c. Append
+ * only, older dumps keep their meaning.
+ */
+typedef enum _trace_id {
+    TRACE_MESSAGE = 0,          /* A DEBUG_TRACE() message, its text in the TRACE_TEXT events after it. */
+    TRACE_TEXT,
+    TRACE_START_FRAME,
+    TRACE_DECODE_BEGIN,
+    TRACE_DECODE_END,
+    TRACE_END_FRAME_BEGIN,
+    TRACE_END_FRAME_END,
+    TRACE_NAL,
+    TRACE_SHED,
+    TRACE_STREAM_ERROR,
+    TRACE_QUEUE_DEPTH,
+    TRACE_COMPOSE,
+    TRACE_PUSH_BEGIN,
+    TRACE_PUSH_END,
+    TRACE_BUFFER_SUBMIT,
+    TRACE_BUFFER_DONE,
+    TRACE_FRAME_DECODED,
+    TRACE_PRESENT_BEGIN,
+    TRACE_PRESENT_END,
+    TRACE_PUSHED,
+    TRACE_IDS
+} trace_id;
+
+/* One slot of a ring, as dumped. */
+typedef struct _trace_event {
+    unsigned long long  time;           /* CLOCK_MONOTONIC, in ns. */
+    unsigned short      id;
+    unsigned short      size;           /* TRACE_TEXT: bytes of text in "args". */
+    unsigned int        args[TRACE_ARGS];
+} trace_event;
+
+/* The dump: a header, each ID's description, then each thread's events,
+ * oldest first, to the end of the file.
+ */
+#define TRACE_DUMP_MAGIC        "CTXTRC1"
+
+typedef struct _trace_dump_header {
+    char                magic[8];
+    unsigned int        pid;
+    unsigned int        num_ids;
+} trace_dump_header;
+
+typedef struct _trace_dump_id {
+    unsigned char       phase;          /* TRACE_INSTANT etc. */
+    unsigned char       level;
+    char                name[30];
+    char                args[32];       /* Comma separated names of the arguments used. */
+} trace_dump_id;
+
+typedef struct _trace_dump_thread {
+    unsigned int        tid;
+    unsigned int        num_events;
+    char                name[16];
+} trace_dump_thread;
+
+extern int trace_level;
+
+/* Records an event, if the level is at least the event's. */
+#define TRACE(id, a, b, c) \
+    do { \
+        if (trace_level >= TRACE_LEVEL_FRAME) { \
+            trace_event_record((id), (a), (b), (c)); \
+        } \
+    } while (0)
+
+void trace_event_record(trace_id id, unsigned int a, unsigned int b, unsigned int c);
+
+/* Records the text of a message. */
+void trace_message(const char *text, int len);
+
+/*  Function: trace_init()
+ *
+ *  Reads the settings and installs the SIGUSR2 handler, unless something
+ *  else handles SIGUSR2; only the first call does anything. Events are
+ *  recorded from the start regardless.
+ */
+void trace_init(void);
+
+/*  Function: trace_dump()
+ *
+ *  Writes every ring to the dump file, replacing it. Safe in a signal
+ *  handler; events written meanwhile may be missing from the dump.
+ *
+ *  Returns:
+ *       0, or -1 if the file can't be written.
+ */
+int trace_dump(void);
+
+/* Dumps at the end of the session if CTX_H264_TRACE_FILE is set. */
+void trace_end(void);
+
+#endif /* _TRACE_H_ */
@@ -0,0 +1,180 @@
+/***************************************************************************
+*
+*   trace_json.c
+*
+*   Converts a trace dump (see trace.h) to the Chrome trace event format,
+*   which chrome://tracing and ui.perfetto.dev open:
+*
+*       make trace_json.bin
+*       ./trace_json.bin /tmp/ctxh264.<pid>.trace > trace.json
+*
+****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+
+#define MAX_IDS     256
+
+static trace_dump_id ids[MAX_IDS];
+static unsigned int num_ids;
+static unsigned int pid;
+static int first = 1;
+
+static void begin_event(void)
+{
+    printf("%s\n    ", first ? "" : ",");
+    first = 0;
+}
+
+static void print_string(const char *s, int len)
+{
+    int i;
+
+    putchar('"');
+    for (i = 0; i < len && s[i]; i++) {
+        if (s[i] == '"' || s[i] == '\\') {
+            printf("\\%c", s[i]);
+        } else if ((unsigned char)s[i] < 0x20) {
+            printf("\\u%04x", (unsigned char)s[i]);
+        } else {
+            putchar(s[i]);
+        }
+    }
+    putchar('"');
+}
+
+/* The arguments an ID names, as JSON members. */
+static void print_args(const trace_dump_id *id, const trace_event *event)
+{
+    char names[sizeof(id->args) + 1], *name, *save = NULL;
+    int i = 0;
+
+    memcpy(names, id->args, sizeof(id->args));
+    names[sizeof(id->args)] = '\0';
+
+    printf(", \"args\": {");
+    for (name = strtok_r(names, ",", &save); name && i < TRACE_ARGS; name = strtok_r(NULL, ",", &save), i++) {
+        printf("%s\"%s\": %u", i ? ", " : "", name, event->args[i]);
+    }
+    printf("}");
+}
+
+static void print_event(const trace_dump_thread *thread, const trace_event *event)
+{
+    static const char phases[] = { 'i', 'B', 'E', 'C' };
+    const trace_dump_id *id = &ids[event->id];
+
+    begin_event();
+    printf("{ \"name\": ");
+    print_string(id->name, sizeof(id->name));
+    printf(", \"ph\": \"%c\", \"ts\": %.3f, \"pid\": %u, \"tid\": %u", phases[id->phase & 3],
+           event->time / 1000.0, pid, thread->tid);
+    if (id->phase == TRACE_INSTANT) {
+        printf(", \"s\": \"t\"");
+    }
+    if (id->phase != TRACE_END) {
+        print_args(id, event);
+    }
+    printf(" }");
+}
+
+/* A message and the text after it, as an instant event. */
+static void print_message(const trace_dump_thread *thread, const trace_event *event, const char *text, int len)
+{
+    begin_event();
+    printf("{ \"name\": \"message\", \"ph\": \"i\", \"s\": \"t\", \"ts\": %.3f, \"pid\": %u, \"tid\": %u, "
+           "\"args\": { \"text\": ", event->time / 1000.0, pid, thread->tid);
+    /* Without the newline DEBUG_TRACE() messages end with. */
+    print_string(text, len > 0 && text[len - 1] == '\n' ? len - 1 : len);
+    printf(" } }");
+}
+
+static int convert_thread(FILE *in, const trace_dump_thread *thread)
+{
+    trace_event event, message;
+    char text[1024];
+    unsigned int i;
+    int len = 0, want = -1;
+
+    begin_event();
+    printf("{ \"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %u, \"tid\": %u, \"args\": { \"name\": ", pid,
+           thread->tid);
+    print_string(thread->name, sizeof(thread->name));
+    printf(" } }");
+
+    for (i = 0; i < thread->num_events; i++) {
+        if (fread(&event, sizeof(event), 1, in) != 1) {
+            return -1;
+        }
+
+        if (event.id == TRACE_TEXT) {
+            /* Text without its message was overwritten at the start. */
+            if (want >= 0 && len + event.size <= (int)sizeof(text) && event.size <= sizeof(event.args)) {
+                memcpy(text + len, event.args, event.size);
+                len += event.size;
+                if (len >= want) {
+                    print_message(thread, &message, text, want);
+                    want = -1;
+                }
+            }
+            continue;
+        }
+
+        want = -1;
+        if (event.id == TRACE_MESSAGE) {
+            message = event;
+            want = event.args[0];
+            len = 0;
+            if (want == 0 || want > (int)sizeof(text)) {
+                want = -1;
+            }
+        } else if (event.id < num_ids) {
+            print_event(thread, &event);
+        }
+    }
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    trace_dump_header header;
+    trace_dump_thread thread;
+    FILE *in;
+
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s dump > trace.json\n", argv[0]);
+        return 1;
+    }
+
+    in = fopen(argv[1], "rb");
+    if (!in) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    if (fread(&header, sizeof(header), 1, in) != 1 || memcmp(header.magic, TRACE_DUMP_MAGIC,
+                                                                sizeof(TRACE_DUMP_MAGIC)) != 0 ||
+        header.num_ids > MAX_IDS || fread(ids, sizeof(trace_dump_id), header.num_ids, in) != header.num_ids) {
+        fprintf(stderr, "%s: not a trace dump\n", argv[1]);
+        return 1;
+    }
+    num_ids = header.num_ids;
+    pid = header.pid;
+
+    printf("{ \"displayTimeUnit\": \"ns\", \"traceEvents\": [");
+    while (fread(&thread, sizeof(thread), 1, in) == 1) {
+        if (convert_thread(in, &thread) != 0) {
+            fprintf(stderr, "%s: truncated\n", argv[1]);
+            break;
+        }
+    }
+    printf("\n] }\n");
+
+    fclose(in);
+
+    return 0;
+}
@@ -0,0 +1,55 @@
+/***************************************************************************
+*
+*   usdt.h
+*
+*   Static probes for perf, bpftrace and SystemTap, under the "ctxh264"
+*   provider. With HAVE_SDT=1, which needs <sys/sdt.h> (systemtap-sdt-dev),
+*   each probe is a nop in the code with a note describing it in
+*   .note.stapsdt, and costs nothing until a tracer attaches to it.
+*   Without it they compile to nothing.
+*
+*       readelf -n ctxh264.so
+*       bpftrace -l 'usdt:/path/to/ctxh264.so:ctxh264:*'
+*
+*   Probes and their arguments, "timestamp" being the latency.h one of
+*   the frame:
+*
+*       frame_start         encoded_size, num_rects, timestamp
+*       frame_end           submitted, timestamp
+*       nal                 type, ref_idc, dropped
+*       stream_error        errors
+*       shed                queue_depth, shed_frames
+*       buffer_acquire      buffer, stalled
+*       buffer_submit       bytes, flags, timestamp
+*       buffer_done         in_flight
+*       frame_decoded       timestamp
+*       port_settings       width, height
+*       overlay_compose     objects, bytes, lossless (1 for compose_with_rects())
+*       overlay_upload      width, height
+*       present_begin       num_windows, wait
+*       present_end         result
+*       latency             point, timestamp, us since the point before
+*
+****************************************************************************/
+
+#ifndef _USDT_H_
+#define _USDT_H_
+
+#ifdef HAVE_SDT
+
+#include <sys/sdt.h>
+
+#define USDT1(name, a)              DTRACE_PROBE1(ctxh264, name, a)
+#define USDT2(name, a, b)           DTRACE_PROBE2(ctxh264, name, a, b)
+#define USDT3(name, a, b, c)        DTRACE_PROBE3(ctxh264, name, a, b, c)
+
+#else
+
+/* The arguments aren't evaluated, only kept from being unused. */
+#define USDT1(name, a)              do { (void)sizeof(a); } while (0)
+#define USDT2(name, a, b)           do { (void)sizeof(a); (void)sizeof(b); } while (0)
+#define USDT3(name, a, b, c)        do { (void)sizeof(a); (void)sizeof(b); (void)sizeof(c); } while (0)
+
+#endif
+
+#endif /* _USDT_H_ */
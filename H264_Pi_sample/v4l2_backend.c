@@ -0,0 +1,1876 @@
+/***************************************************************************
+*
+*   v4l2_backend.c
+*
+*   V4L2 stateless backend: a memory-to-memory H.264 decoder driven through
+*   the request API, as exposed by current kernels (and by the visl
+*   virtual decoder, for testing without hardware).
+*
+*   Stateless decoders are told everything a stateful one would work out
+*   from the bitstream, so the backend parses parameter sets and slice
+*   headers itself and keeps the reference picture state of the stream:
+*   picture order counts and the marking of reference frames.
+*
+****************************************************************************/
+
+#include "video_gl.h"
+
+#ifdef HAVE_V4L2
+
+#include <dirent.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/sysmacros.h>
+#include <linux/videodev2.h>
+#include <linux/media.h>
+
+#include "presenter.h"
+
+/* Output (bitstream) buffers, each paired with a request. This is also the
+ * number of frames that can be in flight in the decoder.
+ */
+#define V4L2_REQUESTS           4
+
+/* Capture buffers beyond the DPB: for each frame in flight, the one it is
+ * decoded to and one it refers to that later frames no longer do, then the
+ * frame on screen and the latest decoded one waiting for present().
+ */
+#define V4L2_EXTRA_CAPTURE      (2 * V4L2_REQUESTS + 2)
+#define V4L2_MAX_CAPTURE        (V4L2_H264_NUM_DPB_ENTRIES + V4L2_EXTRA_CAPTURE)
+
+/* Parameter sets and slice headers are unescaped before parsing. */
+#define V4L2_PARSE_MAX          4096
+
+#define V4L2_DEVICE_ENV         "CTX_H264_V4L2_DEVICE"
+
+typedef struct _v4l2_output {
+    void           *start;
+    size_t          length;
+} v4l2_output;
+
+typedef enum _capture_state {
+    CAPTURE_QUEUED = 0,         /* With the driver. */
+    CAPTURE_DECODED,            /* Dequeued, holds a picture. */
+} capture_state;
+
+/* Capture buffers are handed to the presenter as frames, both as DMABUFs
+ * and mapped. One still held when the queues are released keeps its
+ * DMABUFs and mappings, and is freed once the presenter lets it go.
+ */
+typedef struct _v4l2_frame {
+    H264_frame          frame;
+    void               *maps[H264_FRAME_MAX_PLANES];    /* Of each buffer plane. */
+    size_t              lengths[H264_FRAME_MAX_PLANES];
+} v4l2_frame;
+
+typedef struct _v4l2_capture {
+    capture_state       state;
+    unsigned long long  timestamp;
+    int                 dmabuf[VIDEO_MAX_PLANES];
+    H264_frame         *frame;
+    int                 held;           /* By the presenter. */
+} v4l2_capture;
+
+/* A reference frame, identified by the timestamp of the output buffer it
+ * was decoded from. Drivers copy that timestamp to the capture buffer.
+ */
+typedef struct _v4l2_ref {
+    unsigned long long  timestamp;
+    int                 long_term;
+    unsigned int        frame_num;
+    unsigned int        long_term_frame_idx;
+    int                 top_poc;
+    int                 bottom_poc;
+} v4l2_ref;
+
+/* The references a request was queued with stay held until it completes,
+ * even if later frames have stopped referring to them.
+ */
+typedef struct _v4l2_request {
+    int                 fd;
+    int                 queued;
+    unsigned long long  timestamp;
+    unsigned int        color;      /* H264_COLOR_* of the picture, from its SPS. */
+    unsigned long long  refs[V4L2_H264_NUM_DPB_ENTRIES];
+    int                 num_refs;
+} v4l2_request;
+
+typedef struct _V4L2H264_decoder {
+    int                 video_fd;
+    int                 media_fd;
+
+    /* Queue configuration, set from the first SPS and again whenever the
+     * picture size or number of references grows.
+     */
+    int                 configured;
+    unsigned int        coded_width;
+    unsigned int        coded_height;
+    unsigned int        max_refs;
+    unsigned int        capture_fourcc;
+    unsigned int        capture_planes;
+
+    v4l2_output         output[V4L2_REQUESTS];
+    unsigned int        output_size;
+    v4l2_capture        capture[V4L2_MAX_CAPTURE];
+    unsigned int        num_capture;
+
+    /* Requests are used round robin, and complete in the same order. */
+    v4l2_request        request[V4L2_REQUESTS];
+    int                 next_request;
+    int                 in_flight;
+    unsigned long long  last_timestamp;     /* Of the last request queued. */
+
+    /* The frame being received, written straight into the output buffer
+     * of the next request.
+     */
+    unsigned long long  frame_stamp;        /* Its latency timestamp. */
+    unsigned int        fill;
+    int                 nal_type;
+    int                 have_slice;
+    H264_slice_header   slice;
+
+    /* The start of each NAL is also kept aside for parsing. */
+    unsigned char       nal_buf[V4L2_PARSE_MAX];
+    int                 nal_len;
+    unsigned char       parse_buf[V4L2_PARSE_MAX];
+
+    H264_sps            sps[H264_MAX_SPS];
+    H264_pps            pps[H264_MAX_PPS];
+
+    /* Reference picture state (8.2.1 and 8.2.5). */
+    v4l2_ref            refs[V4L2_H264_NUM_DPB_ENTRIES];
+    int                 num_refs;
+    int                 max_long_term_frame_idx;   /* -1 for none. */
+    int                 prev_poc_msb;
+    int                 prev_poc_lsb;
+    unsigned int        prev_frame_num;
+    int                 prev_frame_num_offset;
+
+    /* Presentation. Frames are shown in decoding order, which is output
+     * order for the streams Receiver gets: they carry no B frames.
+     */
+    const H264_presenter *presenter;
+    void               *presenter_ctx;
+    unsigned int        width;          /* Of the context. */
+    unsigned int        height;
+    int                 ready;          /* Latest decoded, -1 if none. */
+    bool               *pushed;         /* Passed on once the pushed frame is decoded. */
+    unsigned long long  pushed_timestamp;
+    H264_dirty          damage;         /* Since a present() that left nothing to decode. */
+
+    int                 error;          /* Decoding failed since the last frame. */
+    H264_stats         *stats;
+} V4L2H264_decoder;
+
+/* Frame ids, unique across contexts and reconfigurations. */
+static unsigned int frame_ids;
+
+static int xioctl(int fd, unsigned long request, void *arg)
+{
+    int ret;
+
+    do {
+        ret = ioctl(fd, request, arg);
+    } while (ret < 0 && errno == EINTR);
+
+    return ret;
+}
+
+/***************************************************************************
+*   Device discovery.
+****************************************************************************/
+
+/* Whether "fd" is a multiplanar memory-to-memory device taking H.264
+ * slices, in frame based mode with start codes.
+ */
+static int is_stateless_h264(int fd)
+{
+    struct v4l2_capability cap;
+    struct v4l2_fmtdesc fmt;
+    struct v4l2_querymenu menu;
+    unsigned int caps;
+    int found = 0;
+
+    memset(&cap, 0, sizeof(cap));
+    if (xioctl(fd, VIDIOC_QUERYCAP, &cap) < 0) {
+        return 0;
+    }
+
+    caps = cap.capabilities & V4L2_CAP_DEVICE_CAPS ? cap.device_caps : cap.capabilities;
+    if (!(caps & V4L2_CAP_VIDEO_M2M_MPLANE) || !(caps & V4L2_CAP_STREAMING)) {
+        return 0;
+    }
+
+    memset(&fmt, 0, sizeof(fmt));
+    fmt.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+    while (!found && xioctl(fd, VIDIOC_ENUM_FMT, &fmt) == 0) {
+        found = fmt.pixelformat == V4L2_PIX_FMT_H264_SLICE;
+        fmt.index++;
+    }
+    if (!found) {
+        return 0;
+    }
+
+    memset(&menu, 0, sizeof(menu));
+    menu.id = V4L2_CID_STATELESS_H264_DECODE_MODE;
+    menu.index = V4L2_STATELESS_H264_DECODE_MODE_FRAME_BASED;
+    if (xioctl(fd, VIDIOC_QUERYMENU, &menu) < 0) {
+        DEBUG_TRACE("%s: no frame based decoding\n", cap.card);
+        return 0;
+    }
+
+    menu.id = V4L2_CID_STATELESS_H264_START_CODE;
+    menu.index = V4L2_STATELESS_H264_START_CODE_ANNEX_B;
+    if (xioctl(fd, VIDIOC_QUERYMENU, &menu) < 0) {
+        DEBUG_TRACE("%s: no Annex-B start codes\n", cap.card);
+        return 0;
+    }
+
+    return 1;
+}
+
+/* Whether the media device "fd" has the video node "dev". */
+static int media_has_devnode(int fd, dev_t dev)
+{
+    struct media_v2_topology topology;
+    struct media_v2_interface *interfaces;
+    unsigned int i;
+    int found = 0;
+
+    memset(&topology, 0, sizeof(topology));
+    if (xioctl(fd, MEDIA_IOC_G_TOPOLOGY, &topology) < 0 || topology.num_interfaces == 0) {
+        return 0;
+    }
+
+    interfaces = calloc(topology.num_interfaces, sizeof(struct media_v2_interface));
+    if (!interfaces) {
+        return 0;
+    }
+
+    topology.ptr_interfaces = (uintptr_t)interfaces;
+    if (xioctl(fd, MEDIA_IOC_G_TOPOLOGY, &topology) == 0) {
+        for (i = 0; i < topology.num_interfaces && !found; i++) {
+            found = interfaces[i].intf_type == MEDIA_INTF_T_V4L_VIDEO &&
+                    makedev(interfaces[i].devnode.major, interfaces[i].devnode.minor) == dev;
+        }
+    }
+
+    free(interfaces);
+
+    return found;
+}
+
+/* The media device requests for "video_fd" are allocated from. */
+static int open_media_device(int video_fd)
+{
+    struct stat st;
+    struct dirent *entry;
+    DIR *dir;
+    char path[300];
+    int fd = -1;
+
+    if (fstat(video_fd, &st) < 0 || !(dir = opendir("/dev"))) {
+        return -1;
+    }
+
+    while (fd < 0 && (entry = readdir(dir))) {
+        if (strncmp(entry->d_name, "media", 5) != 0) {
+            continue;
+        }
+
+        snprintf(path, sizeof(path), "/dev/%s", entry->d_name);
+        fd = open(path, O_RDWR | O_NONBLOCK);
+        if (fd >= 0 && !media_has_devnode(fd, st.st_rdev)) {
+            close(fd);
+            fd = -1;
+        }
+    }
+
+    closedir(dir);
+
+    return fd;
+}
+
+/* Opens the decoder named by CTX_H264_V4L2_DEVICE, or the first suitable
+ * one, and its media device.
+ */
+static int open_device(int *video_fd, int *media_fd)
+{
+    const char *env = getenv(V4L2_DEVICE_ENV);
+    struct dirent *entry;
+    DIR *dir;
+    char path[300];
+
+    *video_fd = -1;
+    *media_fd = -1;
+
+    if (env && *env) {
+        *video_fd = open(env, O_RDWR | O_NONBLOCK);
+        if (*video_fd >= 0 && !is_stateless_h264(*video_fd)) {
+            DEBUG_TRACE("%s is not a stateless H.264 decoder\n", env);
+            close(*video_fd);
+            *video_fd = -1;
+        }
+    } else if ((dir = opendir("/dev"))) {
+        while (*video_fd < 0 && (entry = readdir(dir))) {
+            if (strncmp(entry->d_name, "video", 5) != 0) {
+                continue;
+            }
+
+            snprintf(path, sizeof(path), "/dev/%s", entry->d_name);
+            *video_fd = open(path, O_RDWR | O_NONBLOCK);
+            if (*video_fd >= 0 && !is_stateless_h264(*video_fd)) {
+                close(*video_fd);
+                *video_fd = -1;
+            }
+        }
+        closedir(dir);
+    }
+
+    if (*video_fd < 0) {
+        return -1;
+    }
+
+    *media_fd = open_media_device(*video_fd);
+    if (*media_fd < 0) {
+        DEBUG_TRACE("No media device for the decoder, requests unavailable\n");
+        close(*video_fd);
+        *video_fd = -1;
+        return -1;
+    }
+
+    return 0;
+}
+
+/***************************************************************************
+*   Queues.
+****************************************************************************/
+
+static int set_menu_control(int fd, unsigned int id, int value)
+{
+    struct v4l2_ext_control control;
+    struct v4l2_ext_controls controls;
+
+    memset(&control, 0, sizeof(control));
+    memset(&controls, 0, sizeof(controls));
+    control.id = id;
+    control.value = value;
+    controls.which = V4L2_CTRL_WHICH_CUR_VAL;
+    controls.count = 1;
+    controls.controls = &control;
+
+    return xioctl(fd, VIDIOC_S_EXT_CTRLS, &controls);
+}
+
+static int request_buffers(V4L2H264_decoder *decoder, unsigned int type, unsigned int count)
+{
+    struct v4l2_requestbuffers reqbufs;
+
+    memset(&reqbufs, 0, sizeof(reqbufs));
+    reqbufs.count = count;
+    reqbufs.type = type;
+    reqbufs.memory = V4L2_MEMORY_MMAP;
+
+    if (xioctl(decoder->video_fd, VIDIOC_REQBUFS, &reqbufs) < 0) {
+        DEBUG_TRACE("VIDIOC_REQBUFS(%u) failed, errno=%d\n", count, errno);
+        return -1;
+    }
+
+    return reqbufs.count;
+}
+
+static int queue_capture(V4L2H264_decoder *decoder, int index)
+{
+    struct v4l2_plane planes[VIDEO_MAX_PLANES];
+    struct v4l2_buffer buf;
+
+    memset(&buf, 0, sizeof(buf));
+    memset(planes, 0, sizeof(planes));
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    buf.index = index;
+    buf.length = decoder->capture_planes;
+    buf.m.planes = planes;
+
+    if (xioctl(decoder->video_fd, VIDIOC_QBUF, &buf) < 0) {
+        DEBUG_TRACE("Capture VIDIOC_QBUF failed, errno=%d\n", errno);
+        return -1;
+    }
+
+    decoder->capture[index].state = CAPTURE_QUEUED;
+
+    return 0;
+}
+
+static void free_frame(H264_frame *frame)
+{
+    v4l2_frame *mapped = (v4l2_frame *)frame;
+    int p;
+
+    for (p = 0; p < H264_FRAME_MAX_PLANES; p++) {
+        if (mapped->maps[p]) {
+            munmap(mapped->maps[p], mapped->lengths[p]);
+        }
+    }
+
+    free(frame);
+}
+
+/* Frees a frame released after its capture buffer went away. */
+static void free_orphan(H264_frame *frame)
+{
+    int p;
+
+    for (p = 0; p < frame->num_planes; p++) {
+        if (frame->dmabuf[p] >= 0 && (p == 0 || frame->dmabuf[p] != frame->dmabuf[p - 1])) {
+            close(frame->dmabuf[p]);
+        }
+    }
+
+    free_frame(frame);
+}
+
+static void release_queues(V4L2H264_decoder *decoder)
+{
+    v4l2_capture *capture;
+    int type;
+    unsigned int i, p;
+
+    type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+    xioctl(decoder->video_fd, VIDIOC_STREAMOFF, &type);
+    type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    xioctl(decoder->video_fd, VIDIOC_STREAMOFF, &type);
+
+    for (i = 0; i < V4L2_REQUESTS; i++) {
+        if (decoder->output[i].start) {
+            munmap(decoder->output[i].start, decoder->output[i].length);
+            decoder->output[i].start = NULL;
+        }
+    }
+
+    for (i = 0; i < decoder->num_capture; i++) {
+        capture = &decoder->capture[i];
+
+        if (capture->held) {
+            capture->frame->index = -1;
+            capture->held = 0;
+        } else {
+            for (p = 0; p < decoder->capture_planes; p++) {
+                if (capture->dmabuf[p] >= 0) {
+                    close(capture->dmabuf[p]);
+                }
+            }
+            if (capture->frame) {
+                free_frame(capture->frame);
+            }
+        }
+        capture->frame = NULL;
+        for (p = 0; p < VIDEO_MAX_PLANES; p++) {
+            capture->dmabuf[p] = -1;
+        }
+    }
+    decoder->num_capture = 0;
+    decoder->ready = -1;
+
+    if (decoder->configured) {
+        request_buffers(decoder, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, 0);
+        request_buffers(decoder, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, 0);
+        decoder->configured = 0;
+    }
+}
+
+static int is_referenced(const V4L2H264_decoder *decoder, unsigned long long timestamp)
+{
+    const v4l2_request *request;
+    int i, j;
+
+    for (i = 0; i < decoder->num_refs; i++) {
+        if (decoder->refs[i].timestamp == timestamp) {
+            return 1;
+        }
+    }
+
+    for (i = 0; i < V4L2_REQUESTS; i++) {
+        request = &decoder->request[i];
+        for (j = 0; request->queued && j < request->num_refs; j++) {
+            if (request->refs[j] == timestamp) {
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/* Gives decoded pictures no longer needed back to the driver. */
+static void recycle_capture(V4L2H264_decoder *decoder)
+{
+    unsigned int i;
+
+    for (i = 0; i < decoder->num_capture; i++) {
+        if (decoder->capture[i].state == CAPTURE_DECODED && (int)i != decoder->ready &&
+            !decoder->capture[i].held && !is_referenced(decoder, decoder->capture[i].timestamp)) {
+            queue_capture(decoder, i);
+        }
+    }
+}
+
+/* Called by the presenter once it no longer shows the frame. */
+static void release_frame(H264_frame *frame)
+{
+    V4L2H264_decoder *decoder = frame->owner;
+
+    if (frame->index < 0) {
+        free_orphan(frame);
+        return;
+    }
+
+    decoder->capture[frame->index].held = 0;
+    recycle_capture(decoder);
+}
+
+/*  Describes capture buffer "index", in format "fmt", as a frame, and maps
+ *  it for presenters that read frames. NV12 in one buffer has its chroma
+ *  plane after the luma.
+ */
+static int init_frame(V4L2H264_decoder *decoder, int index, const struct v4l2_format *fmt)
+{
+    const struct v4l2_pix_format_mplane *pix = &fmt->fmt.pix_mp;
+    v4l2_frame *mapped = calloc(1, sizeof(v4l2_frame));
+    H264_frame *frame = &mapped->frame;
+    struct v4l2_plane planes[VIDEO_MAX_PLANES];
+    struct v4l2_buffer buf;
+    unsigned int p;
+
+    if (!mapped) {
+        return -1;
+    }
+    decoder->capture[index].frame = frame;
+
+    memset(&buf, 0, sizeof(buf));
+    memset(planes, 0, sizeof(planes));
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    buf.index = index;
+    buf.length = VIDEO_MAX_PLANES;
+    buf.m.planes = planes;
+    if (xioctl(decoder->video_fd, VIDIOC_QUERYBUF, &buf) < 0) {
+        return -1;
+    }
+
+    frame->id = ++frame_ids;
+    frame->fourcc = pix->pixelformat;
+    frame->width = min(decoder->width, pix->width);
+    frame->height = min(decoder->height, pix->height);
+    frame->num_planes = min(pix->num_planes, H264_FRAME_MAX_PLANES);
+    for (p = 0; p < (unsigned int)frame->num_planes; p++) {
+        mapped->maps[p] = mmap(NULL, planes[p].length, PROT_READ, MAP_SHARED, decoder->video_fd,
+                               planes[p].m.mem_offset);
+        if (mapped->maps[p] == MAP_FAILED) {
+            DEBUG_TRACE("Failed to map capture buffer %d, errno=%d\n", index, errno);
+            mapped->maps[p] = NULL;
+            return -1;
+        }
+        mapped->lengths[p] = planes[p].length;
+
+        frame->dmabuf[p] = decoder->capture[index].dmabuf[p];
+        frame->pitches[p] = pix->plane_fmt[p].bytesperline;
+        frame->data[p] = mapped->maps[p];
+    }
+
+    if (pix->pixelformat == V4L2_PIX_FMT_NV12 && pix->num_planes == 1) {
+        frame->num_planes = 2;
+        frame->dmabuf[1] = frame->dmabuf[0];
+        frame->pitches[1] = frame->pitches[0];
+        frame->offsets[1] = frame->pitches[0] * pix->height;
+        frame->data[1] = frame->data[0] + frame->offsets[1];
+    }
+
+    frame->latency = &decoder->stats->latency;
+    frame->release = release_frame;
+    frame->owner = decoder;
+    frame->index = index;
+
+    return 0;
+}
+
+/*  Sets up both queues for "sps": formats, output buffers mapped for the
+ *  bitstream to be written in place, and enough capture buffers for the
+ *  DPB, the requests in flight and presentation, exported as DMABUF.
+ */
+static int configure(V4L2H264_decoder *decoder, const H264_sps *sps)
+{
+    struct v4l2_format fmt;
+    struct v4l2_plane planes[VIDEO_MAX_PLANES];
+    struct v4l2_buffer buf;
+    struct v4l2_exportbuffer expbuf;
+    unsigned int width = (sps->pic_width_in_mbs_minus1 + 1) * 16;
+    unsigned int height = (sps->pic_height_in_map_units_minus1 + 1) * 16 * (2 - sps->frame_mbs_only);
+    unsigned int i, p;
+    int count, type;
+
+    USDT2(port_settings, width, height);
+    release_queues(decoder);
+    decoder->configured = 1;
+
+    if (set_menu_control(decoder->video_fd, V4L2_CID_STATELESS_H264_DECODE_MODE,
+                         V4L2_STATELESS_H264_DECODE_MODE_FRAME_BASED) < 0 ||
+        set_menu_control(decoder->video_fd, V4L2_CID_STATELESS_H264_START_CODE,
+                         V4L2_STATELESS_H264_START_CODE_ANNEX_B) < 0) {
+        DEBUG_TRACE("Failed to select frame based decoding\n");
+        return -1;
+    }
+
+    /* Compressed frames are well under half the size of a 4:2:0 picture. */
+    memset(&fmt, 0, sizeof(fmt));
+    fmt.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+    fmt.fmt.pix_mp.pixelformat = V4L2_PIX_FMT_H264_SLICE;
+    fmt.fmt.pix_mp.width = width;
+    fmt.fmt.pix_mp.height = height;
+    fmt.fmt.pix_mp.num_planes = 1;
+    fmt.fmt.pix_mp.plane_fmt[0].sizeimage = width * height * 3 / 4;
+    if (xioctl(decoder->video_fd, VIDIOC_S_FMT, &fmt) < 0) {
+        DEBUG_TRACE("Failed to set the output format to %ux%u\n", width, height);
+        return -1;
+    }
+    decoder->output_size = fmt.fmt.pix_mp.plane_fmt[0].sizeimage;
+
+    /* The driver picks the capture format matching the output; ask for
+     * NV12, which is what display planes and GL take directly.
+     */
+    memset(&fmt, 0, sizeof(fmt));
+    fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    if (xioctl(decoder->video_fd, VIDIOC_G_FMT, &fmt) < 0) {
+        return -1;
+    }
+    fmt.fmt.pix_mp.pixelformat = V4L2_PIX_FMT_NV12;
+    if (xioctl(decoder->video_fd, VIDIOC_S_FMT, &fmt) < 0) {
+        DEBUG_TRACE("Failed to set the capture format\n");
+        return -1;
+    }
+    decoder->capture_fourcc = fmt.fmt.pix_mp.pixelformat;
+    decoder->capture_planes = fmt.fmt.pix_mp.num_planes;
+
+    count = request_buffers(decoder, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, V4L2_REQUESTS);
+    if (count < V4L2_REQUESTS) {
+        return -1;
+    }
+
+    for (i = 0; i < V4L2_REQUESTS; i++) {
+        memset(&buf, 0, sizeof(buf));
+        memset(planes, 0, sizeof(planes));
+        buf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+        buf.memory = V4L2_MEMORY_MMAP;
+        buf.index = i;
+        buf.length = 1;
+        buf.m.planes = planes;
+        if (xioctl(decoder->video_fd, VIDIOC_QUERYBUF, &buf) < 0) {
+            return -1;
+        }
+
+        decoder->output[i].length = planes[0].length;
+        decoder->output[i].start = mmap(NULL, planes[0].length, PROT_READ | PROT_WRITE, MAP_SHARED,
+                                        decoder->video_fd, planes[0].m.mem_offset);
+        if (decoder->output[i].start == MAP_FAILED) {
+            decoder->output[i].start = NULL;
+            return -1;
+        }
+    }
+
+    count = request_buffers(decoder, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE,
+                            max(sps->max_num_ref_frames, 1) + V4L2_EXTRA_CAPTURE);
+    if (count <= 0) {
+        return -1;
+    }
+    decoder->num_capture = min(count, V4L2_MAX_CAPTURE);
+
+    for (i = 0; i < decoder->num_capture; i++) {
+        for (p = 0; p < VIDEO_MAX_PLANES; p++) {
+            decoder->capture[i].dmabuf[p] = -1;
+        }
+
+        for (p = 0; p < decoder->capture_planes; p++) {
+            memset(&expbuf, 0, sizeof(expbuf));
+            expbuf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+            expbuf.index = i;
+            expbuf.plane = p;
+            expbuf.flags = O_RDONLY | O_CLOEXEC;
+            if (xioctl(decoder->video_fd, VIDIOC_EXPBUF, &expbuf) < 0) {
+                DEBUG_TRACE("VIDIOC_EXPBUF failed, errno=%d\n", errno);
+                return -1;
+            }
+            decoder->capture[i].dmabuf[p] = expbuf.fd;
+        }
+
+        if (init_frame(decoder, i, &fmt) != 0 || queue_capture(decoder, i) != 0) {
+            return -1;
+        }
+    }
+
+    type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+    if (xioctl(decoder->video_fd, VIDIOC_STREAMON, &type) < 0) {
+        return -1;
+    }
+    type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    if (xioctl(decoder->video_fd, VIDIOC_STREAMON, &type) < 0) {
+        return -1;
+    }
+
+    decoder->coded_width = width;
+    decoder->coded_height = height;
+    decoder->max_refs = max(sps->max_num_ref_frames, 1);
+
+    DEBUG_TRACE("V4L2 decoder configured for %ux%u, %u capture buffers, %u byte bitstream buffers\n",
+                width, height, decoder->num_capture, decoder->output_size);
+
+    return 0;
+}
+
+static int needs_configure(const V4L2H264_decoder *decoder, const H264_sps *sps)
+{
+    return !decoder->configured ||
+           (sps->pic_width_in_mbs_minus1 + 1) * 16 != decoder->coded_width ||
+           (sps->pic_height_in_map_units_minus1 + 1) * 16 * (2 - sps->frame_mbs_only) != decoder->coded_height ||
+           max(sps->max_num_ref_frames, 1) > decoder->max_refs;
+}
+
+/***************************************************************************
+*   Requests and capture buffers.
+****************************************************************************/
+
+static int reset_request(V4L2H264_decoder *decoder, v4l2_request *request)
+{
+    request->queued = 0;
+    request->num_refs = 0;
+
+    if (request->fd >= 0 && xioctl(request->fd, MEDIA_REQUEST_IOC_REINIT, NULL) == 0) {
+        return 0;
+    }
+
+    /* Still busy, e.g. cancelled by a flush: replace it. */
+    if (request->fd >= 0) {
+        close(request->fd);
+        request->fd = -1;
+    }
+
+    if (xioctl(decoder->media_fd, MEDIA_IOC_REQUEST_ALLOC, &request->fd) < 0) {
+        DEBUG_TRACE("MEDIA_IOC_REQUEST_ALLOC failed, errno=%d\n", errno);
+        request->fd = -1;
+        return -1;
+    }
+
+    return 0;
+}
+
+static int dequeue(V4L2H264_decoder *decoder, unsigned int type, struct v4l2_buffer *buf,
+                   struct v4l2_plane planes[VIDEO_MAX_PLANES])
+{
+    memset(buf, 0, sizeof(struct v4l2_buffer));
+    memset(planes, 0, VIDEO_MAX_PLANES * sizeof(struct v4l2_plane));
+    buf->type = type;
+    buf->memory = V4L2_MEMORY_MMAP;
+    buf->length = VIDEO_MAX_PLANES;
+    buf->m.planes = planes;
+
+    return xioctl(decoder->video_fd, VIDIOC_DQBUF, buf);
+}
+
+/*  Collects the oldest request in flight once it completes, waiting up to
+ *  "timeout_ms" for it. The picture it decoded becomes the one ready for
+ *  present().
+ *
+ *  Returns:
+ *       1:     a request completed.
+ *
+ *       0:     none did in time, or none is in flight.
+ *
+ *       -1:    the decoder failed or is hung.
+ */
+static int reap_request(V4L2H264_decoder *decoder, int timeout_ms)
+{
+    v4l2_request *request;
+    struct pollfd pfd;
+    struct v4l2_buffer buf;
+    struct v4l2_plane planes[VIDEO_MAX_PLANES];
+    unsigned long long timestamp;
+    int ret;
+
+    if (decoder->in_flight == 0) {
+        return 0;
+    }
+
+    request = &decoder->request[(decoder->next_request + V4L2_REQUESTS - decoder->in_flight) % V4L2_REQUESTS];
+
+    pfd.fd = request->fd;
+    pfd.events = POLLPRI;
+    pfd.revents = 0;
+
+    do {
+        ret = poll(&pfd, 1, timeout_ms);
+    } while (ret < 0 && errno == EINTR);
+
+    if (ret == 0) {
+        if (timeout_ms > 0) {
+            DEBUG_TRACE("Request not done after %dms, decoder hung\n", timeout_ms);
+            decoder->stats->resets++;
+            return -1;
+        }
+        return 0;
+    }
+    if (ret < 0 || (pfd.revents & POLLERR)) {
+        return -1;
+    }
+
+    decoder->in_flight--;
+    USDT1(buffer_done, decoder->in_flight);
+    ret = 1;
+
+    if (dequeue(decoder, V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, &buf, planes) < 0) {
+        DEBUG_TRACE("Output VIDIOC_DQBUF failed, errno=%d\n", errno);
+        ret = -1;
+    } else {
+        latency_stamp(&decoder->stats->latency, request->timestamp / 1000, LATENCY_CONSUMED);
+    }
+
+    if (dequeue(decoder, V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, &buf, planes) < 0) {
+        DEBUG_TRACE("Capture VIDIOC_DQBUF failed, errno=%d\n", errno);
+        ret = -1;
+    } else if (buf.index < decoder->num_capture) {
+        timestamp = v4l2_timeval_to_ns(&buf.timestamp);
+
+        decoder->capture[buf.index].state = CAPTURE_DECODED;
+        decoder->capture[buf.index].timestamp = timestamp;
+
+        if (buf.flags & V4L2_BUF_FLAG_ERROR || timestamp != request->timestamp) {
+            DEBUG_TRACE("Decoding failed, flags=0x%x\n", buf.flags);
+            ret = -1;
+        } else {
+            decoder->capture[buf.index].frame->color = request->color;
+            decoder->capture[buf.index].frame->timestamp = timestamp / 1000;
+            latency_stamp(&decoder->stats->latency, timestamp / 1000, LATENCY_DECODED);
+            if (decoder->stats->checksums) {
+                checksum_picture(decoder->stats->checksums, decoder->capture[buf.index].frame);
+            }
+            decoder->ready = buf.index;
+            TRACE(TRACE_FRAME_DECODED, decoder->capture[buf.index].frame->id, buf.index, 0);
+            USDT1(frame_decoded, timestamp / 1000);
+        }
+    }
+
+    if (reset_request(decoder, request) != 0) {
+        ret = -1;
+    }
+
+    recycle_capture(decoder);
+
+    return ret;
+}
+
+/* Collects every request that has completed, without waiting. */
+static int reap_completed(V4L2H264_decoder *decoder)
+{
+    int ret;
+
+    while ((ret = reap_request(decoder, 0)) > 0) {
+    }
+
+    if (ret < 0) {
+        decoder->error = 1;
+    }
+
+    return ret;
+}
+
+/***************************************************************************
+*   Reference pictures.
+****************************************************************************/
+
+/* FrameNumWrap of a short term reference (8.2.4.1). */
+static int frame_num_wrap(const V4L2H264_decoder *decoder, const v4l2_ref *ref, const H264_sps *sps)
+{
+    if (ref->frame_num > decoder->slice.frame_num) {
+        return ref->frame_num - (1 << (sps->log2_max_frame_num_minus4 + 4));
+    }
+
+    return ref->frame_num;
+}
+
+static void remove_ref(V4L2H264_decoder *decoder, int i)
+{
+    decoder->num_refs--;
+    memmove(&decoder->refs[i], &decoder->refs[i + 1], (decoder->num_refs - i) * sizeof(v4l2_ref));
+}
+
+/* Picture order count of the current frame (8.2.1). */
+static void compute_poc(V4L2H264_decoder *decoder, const H264_sps *sps, const H264_pps *pps,
+                        int *frame_num_offset, int *poc_msb, int *top, int *bottom)
+{
+    const H264_slice_header *slice = &decoder->slice;
+    int idr = slice->nal_unit_type == H264_NAL_SLICE_IDR;
+    int max_frame_num = 1 << (sps->log2_max_frame_num_minus4 + 4);
+    int i;
+
+    *frame_num_offset = 0;
+    *poc_msb = 0;
+
+    if (!idr) {
+        *frame_num_offset = decoder->prev_frame_num_offset;
+        if (decoder->prev_frame_num > slice->frame_num) {
+            *frame_num_offset += max_frame_num;
+        }
+    }
+
+    if (sps->pic_order_cnt_type == 0) {
+        int max_lsb = 1 << (sps->log2_max_poc_lsb_minus4 + 4);
+        int prev_msb = idr ? 0 : decoder->prev_poc_msb;
+        int prev_lsb = idr ? 0 : decoder->prev_poc_lsb;
+        int lsb = slice->pic_order_cnt_lsb;
+
+        if (lsb < prev_lsb && prev_lsb - lsb >= max_lsb / 2) {
+            *poc_msb = prev_msb + max_lsb;
+        } else if (lsb > prev_lsb && lsb - prev_lsb > max_lsb / 2) {
+            *poc_msb = prev_msb - max_lsb;
+        } else {
+            *poc_msb = prev_msb;
+        }
+
+        *top = *poc_msb + lsb;
+        *bottom = *top + slice->delta_pic_order_cnt_bottom;
+    } else if (sps->pic_order_cnt_type == 1) {
+        int abs_frame_num = 0, expected = 0;
+
+        if (sps->num_ref_frames_in_poc_cycle) {
+            abs_frame_num = *frame_num_offset + slice->frame_num;
+        }
+        if (slice->nal_ref_idc == 0 && abs_frame_num > 0) {
+            abs_frame_num--;
+        }
+
+        if (abs_frame_num > 0) {
+            int cycle = (abs_frame_num - 1) / sps->num_ref_frames_in_poc_cycle;
+            int in_cycle = (abs_frame_num - 1) % sps->num_ref_frames_in_poc_cycle;
+            int delta = 0;
+
+            for (i = 0; i < sps->num_ref_frames_in_poc_cycle; i++) {
+                delta += sps->offset_for_ref_frame[i];
+            }
+
+            expected = cycle * delta;
+            for (i = 0; i <= in_cycle; i++) {
+                expected += sps->offset_for_ref_frame[i];
+            }
+        }
+
+        if (slice->nal_ref_idc == 0) {
+            expected += sps->offset_for_non_ref_pic;
+        }
+
+        *top = expected + slice->delta_pic_order_cnt[0];
+        *bottom = *top + sps->offset_for_top_to_bottom_field + slice->delta_pic_order_cnt[1];
+    } else {
+        int poc = idr ? 0 : 2 * (*frame_num_offset + slice->frame_num) - (slice->nal_ref_idc == 0);
+
+        *top = poc;
+        *bottom = poc;
+    }
+}
+
+/*  Marks the current frame (8.2.5), once it has been submitted. It refers
+ *  to the references as they were before, so the DPB given to the driver
+ *  is built first.
+ */
+static void mark_reference(V4L2H264_decoder *decoder, const H264_sps *sps, unsigned long long timestamp,
+                           int poc_msb, int top, int bottom)
+{
+    const H264_slice_header *slice = &decoder->slice;
+    int curr_pic_num = slice->frame_num;
+    int mmco5 = 0, long_term = -1;
+    v4l2_ref *ref;
+    int i, j;
+
+    if (slice->nal_unit_type == H264_NAL_SLICE_IDR) {
+        decoder->num_refs = 0;
+        if (slice->long_term_reference) {
+            long_term = 0;
+            decoder->max_long_term_frame_idx = 0;
+        } else {
+            decoder->max_long_term_frame_idx = -1;
+        }
+    } else if (slice->adaptive_ref_pic_marking) {
+        for (j = 0; j < slice->num_mmco; j++) {
+            const H264_mmco *mmco = &slice->mmco[j];
+            int pic_num_x = curr_pic_num - (int)(mmco->difference_of_pic_nums_minus1 + 1);
+
+            switch (mmco->op) {
+            case 1:
+            case 3:
+                for (i = 0; i < decoder->num_refs; i++) {
+                    ref = &decoder->refs[i];
+                    if (!ref->long_term && frame_num_wrap(decoder, ref, sps) == pic_num_x) {
+                        break;
+                    }
+                }
+                if (i == decoder->num_refs) {
+                    break;
+                }
+                if (mmco->op == 1) {
+                    remove_ref(decoder, i);
+                    break;
+                }
+                /* A long term frame with the same index is replaced. */
+                for (j = 0; j < decoder->num_refs; j++) {
+                    ref = &decoder->refs[j];
+                    if (ref->long_term && ref->long_term_frame_idx == mmco->long_term_frame_idx) {
+                        remove_ref(decoder, j);
+                        if (j < i) {
+                            i--;
+                        }
+                        break;
+                    }
+                }
+                decoder->refs[i].long_term = 1;
+                decoder->refs[i].long_term_frame_idx = mmco->long_term_frame_idx;
+                break;
+
+            case 2:
+                for (i = 0; i < decoder->num_refs; i++) {
+                    ref = &decoder->refs[i];
+                    if (ref->long_term && ref->long_term_frame_idx == mmco->long_term_pic_num) {
+                        remove_ref(decoder, i);
+                        break;
+                    }
+                }
+                break;
+
+            case 4:
+                decoder->max_long_term_frame_idx = (int)mmco->max_long_term_frame_idx_plus1 - 1;
+                for (i = decoder->num_refs - 1; i >= 0; i--) {
+                    ref = &decoder->refs[i];
+                    if (ref->long_term && (int)ref->long_term_frame_idx > decoder->max_long_term_frame_idx) {
+                        remove_ref(decoder, i);
+                    }
+                }
+                break;
+
+            case 5:
+                decoder->num_refs = 0;
+                decoder->max_long_term_frame_idx = -1;
+                mmco5 = 1;
+                break;
+
+            case 6:
+                for (i = 0; i < decoder->num_refs; i++) {
+                    ref = &decoder->refs[i];
+                    if (ref->long_term && ref->long_term_frame_idx == mmco->long_term_frame_idx) {
+                        remove_ref(decoder, i);
+                        break;
+                    }
+                }
+                long_term = mmco->long_term_frame_idx;
+                break;
+            }
+        }
+    } else if (decoder->num_refs >= max(sps->max_num_ref_frames, 1)) {
+        /* Sliding window: the oldest short term reference goes. */
+        int oldest = -1;
+
+        for (i = 0; i < decoder->num_refs; i++) {
+            ref = &decoder->refs[i];
+            if (!ref->long_term &&
+                (oldest < 0 || frame_num_wrap(decoder, ref, sps) < frame_num_wrap(decoder, &decoder->refs[oldest], sps))) {
+                oldest = i;
+            }
+        }
+        if (oldest >= 0) {
+            remove_ref(decoder, oldest);
+        }
+    }
+
+    if (mmco5) {
+        /* The frame now counts as frame_num 0 with its POC rebased to 0. */
+        int temp = min(top, bottom);
+
+        top -= temp;
+        bottom -= temp;
+    }
+
+    /* Picture order count and frame_num state for the next frame. */
+    decoder->prev_frame_num = mmco5 ? 0 : slice->frame_num;
+    if (mmco5) {
+        decoder->prev_frame_num_offset = 0;
+    }
+    if (slice->nal_ref_idc) {
+        decoder->prev_poc_msb = mmco5 ? 0 : poc_msb;
+        decoder->prev_poc_lsb = mmco5 ? top : slice->pic_order_cnt_lsb;
+    }
+
+    if (!slice->nal_ref_idc) {
+        return;
+    }
+
+    if (decoder->num_refs == V4L2_H264_NUM_DPB_ENTRIES) {
+        /* Only a broken stream gets here. */
+        remove_ref(decoder, 0);
+    }
+
+    ref = &decoder->refs[decoder->num_refs++];
+    ref->timestamp = timestamp;
+    ref->long_term = long_term >= 0;
+    ref->long_term_frame_idx = long_term >= 0 ? long_term : 0;
+    ref->frame_num = mmco5 ? 0 : slice->frame_num;
+    ref->top_poc = top;
+    ref->bottom_poc = bottom;
+}
+
+/***************************************************************************
+*   Controls.
+****************************************************************************/
+
+/* Unspecified matrix coefficients are taken as BT.601, as most decoders do. */
+static unsigned int sps_color(const H264_sps *sps)
+{
+    return (sps->matrix_coefficients == H264_MATRIX_BT709 ? H264_COLOR_BT709 : 0) |
+           (sps->video_full_range ? H264_COLOR_FULL_RANGE : 0);
+}
+
+static void fill_sps(struct v4l2_ctrl_h264_sps *ctrl, const H264_sps *sps)
+{
+    memset(ctrl, 0, sizeof(struct v4l2_ctrl_h264_sps));
+
+    ctrl->profile_idc = sps->profile_idc;
+    ctrl->constraint_set_flags = sps->constraint_flags;
+    ctrl->level_idc = sps->level_idc;
+    ctrl->seq_parameter_set_id = sps->id;
+    ctrl->chroma_format_idc = sps->chroma_format_idc;
+    ctrl->bit_depth_luma_minus8 = sps->bit_depth_luma_minus8;
+    ctrl->bit_depth_chroma_minus8 = sps->bit_depth_chroma_minus8;
+    ctrl->log2_max_frame_num_minus4 = sps->log2_max_frame_num_minus4;
+    ctrl->pic_order_cnt_type = sps->pic_order_cnt_type;
+    ctrl->log2_max_pic_order_cnt_lsb_minus4 = sps->log2_max_poc_lsb_minus4;
+    ctrl->max_num_ref_frames = sps->max_num_ref_frames;
+    ctrl->num_ref_frames_in_pic_order_cnt_cycle = sps->num_ref_frames_in_poc_cycle;
+    memcpy(ctrl->offset_for_ref_frame, sps->offset_for_ref_frame, sizeof(ctrl->offset_for_ref_frame));
+    ctrl->offset_for_non_ref_pic = sps->offset_for_non_ref_pic;
+    ctrl->offset_for_top_to_bottom_field = sps->offset_for_top_to_bottom_field;
+    ctrl->pic_width_in_mbs_minus1 = sps->pic_width_in_mbs_minus1;
+    ctrl->pic_height_in_map_units_minus1 = sps->pic_height_in_map_units_minus1;
+
+    if (sps->separate_colour_plane) {
+        ctrl->flags |= V4L2_H264_SPS_FLAG_SEPARATE_COLOUR_PLANE;
+    }
+    if (sps->qpprime_y_zero_transform_bypass) {
+        ctrl->flags |= V4L2_H264_SPS_FLAG_QPPRIME_Y_ZERO_TRANSFORM_BYPASS;
+    }
+    if (sps->delta_pic_order_always_zero) {
+        ctrl->flags |= V4L2_H264_SPS_FLAG_DELTA_PIC_ORDER_ALWAYS_ZERO;
+    }
+    if (sps->gaps_in_frame_num_allowed) {
+        ctrl->flags |= V4L2_H264_SPS_FLAG_GAPS_IN_FRAME_NUM_VALUE_ALLOWED;
+    }
+    if (sps->frame_mbs_only) {
+        ctrl->flags |= V4L2_H264_SPS_FLAG_FRAME_MBS_ONLY;
+    }
+    if (sps->mb_adaptive_frame_field) {
+        ctrl->flags |= V4L2_H264_SPS_FLAG_MB_ADAPTIVE_FRAME_FIELD;
+    }
+    if (sps->direct_8x8_inference) {
+        ctrl->flags |= V4L2_H264_SPS_FLAG_DIRECT_8X8_INFERENCE;
+    }
+}
+
+static void fill_pps(struct v4l2_ctrl_h264_pps *ctrl, const H264_pps *pps, const H264_sps *sps)
+{
+    memset(ctrl, 0, sizeof(struct v4l2_ctrl_h264_pps));
+
+    ctrl->pic_parameter_set_id = pps->id;
+    ctrl->seq_parameter_set_id = pps->sps_id;
+    ctrl->num_ref_idx_l0_default_active_minus1 = pps->num_ref_idx_l0_default_active_minus1;
+    ctrl->num_ref_idx_l1_default_active_minus1 = pps->num_ref_idx_l1_default_active_minus1;
+    ctrl->weighted_bipred_idc = pps->weighted_bipred_idc;
+    ctrl->pic_init_qp_minus26 = pps->pic_init_qp_minus26;
+    ctrl->pic_init_qs_minus26 = pps->pic_init_qs_minus26;
+    ctrl->chroma_qp_index_offset = pps->chroma_qp_index_offset;
+    ctrl->second_chroma_qp_index_offset = pps->second_chroma_qp_index_offset;
+
+    if (pps->entropy_coding_mode) {
+        ctrl->flags |= V4L2_H264_PPS_FLAG_ENTROPY_CODING_MODE;
+    }
+    if (pps->bottom_field_pic_order_in_frame_present) {
+        ctrl->flags |= V4L2_H264_PPS_FLAG_BOTTOM_FIELD_PIC_ORDER_IN_FRAME_PRESENT;
+    }
+    if (pps->weighted_pred) {
+        ctrl->flags |= V4L2_H264_PPS_FLAG_WEIGHTED_PRED;
+    }
+    if (pps->deblocking_filter_control_present) {
+        ctrl->flags |= V4L2_H264_PPS_FLAG_DEBLOCKING_FILTER_CONTROL_PRESENT;
+    }
+    if (pps->constrained_intra_pred) {
+        ctrl->flags |= V4L2_H264_PPS_FLAG_CONSTRAINED_INTRA_PRED;
+    }
+    if (pps->redundant_pic_cnt_present) {
+        ctrl->flags |= V4L2_H264_PPS_FLAG_REDUNDANT_PIC_CNT_PRESENT;
+    }
+    if (pps->transform_8x8_mode) {
+        ctrl->flags |= V4L2_H264_PPS_FLAG_TRANSFORM_8X8_MODE;
+    }
+    if (pps->scaling_matrix_present || sps->scaling_matrix_present) {
+        ctrl->flags |= V4L2_H264_PPS_FLAG_SCALING_MATRIX_PRESENT;
+    }
+}
+
+/* The driver wants the lists in raster order. */
+static void fill_scaling_matrix(struct v4l2_ctrl_h264_scaling_matrix *ctrl, const H264_pps *pps)
+{
+    int i, j;
+
+    for (i = 0; i < 6; i++) {
+        for (j = 0; j < 16; j++) {
+            ctrl->scaling_list_4x4[i][h264_zigzag_4x4[j]] = pps->scaling.list_4x4[i][j];
+        }
+        for (j = 0; j < 64; j++) {
+            ctrl->scaling_list_8x8[i][h264_zigzag_8x8[j]] = pps->scaling.list_8x8[i][j];
+        }
+    }
+}
+
+static void fill_decode_params(V4L2H264_decoder *decoder, struct v4l2_ctrl_h264_decode_params *ctrl,
+                               const H264_sps *sps, int top, int bottom)
+{
+    const H264_slice_header *slice = &decoder->slice;
+    int i;
+
+    memset(ctrl, 0, sizeof(struct v4l2_ctrl_h264_decode_params));
+
+    /* An IDR refers to nothing; the old references go once it is marked. */
+    for (i = 0; i < decoder->num_refs && slice->nal_unit_type != H264_NAL_SLICE_IDR; i++) {
+        const v4l2_ref *ref = &decoder->refs[i];
+        struct v4l2_h264_dpb_entry *entry = &ctrl->dpb[i];
+
+        entry->reference_ts = ref->timestamp;
+        entry->frame_num = ref->frame_num;
+        entry->pic_num = ref->long_term ? (int)ref->long_term_frame_idx : frame_num_wrap(decoder, ref, sps);
+        entry->fields = V4L2_H264_FRAME_REF;
+        entry->top_field_order_cnt = ref->top_poc;
+        entry->bottom_field_order_cnt = ref->bottom_poc;
+        entry->flags = V4L2_H264_DPB_ENTRY_FLAG_VALID | V4L2_H264_DPB_ENTRY_FLAG_ACTIVE;
+        if (ref->long_term) {
+            entry->flags |= V4L2_H264_DPB_ENTRY_FLAG_LONG_TERM;
+        }
+    }
+
+    ctrl->nal_ref_idc = slice->nal_ref_idc;
+    ctrl->frame_num = slice->frame_num;
+    ctrl->top_field_order_cnt = top;
+    ctrl->bottom_field_order_cnt = bottom;
+    ctrl->idr_pic_id = slice->idr_pic_id;
+    ctrl->pic_order_cnt_lsb = slice->pic_order_cnt_lsb;
+    ctrl->delta_pic_order_cnt_bottom = slice->delta_pic_order_cnt_bottom;
+    ctrl->delta_pic_order_cnt0 = slice->delta_pic_order_cnt[0];
+    ctrl->delta_pic_order_cnt1 = slice->delta_pic_order_cnt[1];
+    ctrl->dec_ref_pic_marking_bit_size = slice->dec_ref_pic_marking_bit_size;
+    ctrl->pic_order_cnt_bit_size = slice->pic_order_cnt_bit_size;
+
+    if (slice->nal_unit_type == H264_NAL_SLICE_IDR) {
+        ctrl->flags |= V4L2_H264_DECODE_PARAM_FLAG_IDR_PIC;
+    }
+    if (slice->slice_type == H264_SLICE_P || slice->slice_type == H264_SLICE_SP) {
+        ctrl->flags |= V4L2_H264_DECODE_PARAM_FLAG_PFRAME;
+    } else if (slice->slice_type == H264_SLICE_B) {
+        ctrl->flags |= V4L2_H264_DECODE_PARAM_FLAG_BFRAME;
+    }
+}
+
+/*  Queues the frame in the output buffer of the next request, with the
+ *  controls describing it.
+ */
+static int queue_frame(V4L2H264_decoder *decoder, v4l2_request *request, int index)
+{
+    const H264_pps *pps = &decoder->pps[decoder->slice.pps_id];
+    const H264_sps *sps = &decoder->sps[pps->sps_id];
+    struct v4l2_ctrl_h264_sps sps_ctrl;
+    struct v4l2_ctrl_h264_pps pps_ctrl;
+    struct v4l2_ctrl_h264_scaling_matrix scaling_ctrl;
+    struct v4l2_ctrl_h264_decode_params params_ctrl;
+    struct v4l2_ext_control controls[4];
+    struct v4l2_ext_controls ext;
+    struct v4l2_plane plane;
+    struct v4l2_buffer buf;
+    unsigned long long us;
+    int frame_num_offset, poc_msb, top, bottom;
+
+    compute_poc(decoder, sps, pps, &frame_num_offset, &poc_msb, &top, &bottom);
+
+    fill_sps(&sps_ctrl, sps);
+    fill_pps(&pps_ctrl, pps, sps);
+    fill_scaling_matrix(&scaling_ctrl, pps);
+    fill_decode_params(decoder, &params_ctrl, sps, top, bottom);
+
+    memset(controls, 0, sizeof(controls));
+    controls[0].id = V4L2_CID_STATELESS_H264_SPS;
+    controls[0].ptr = &sps_ctrl;
+    controls[0].size = sizeof(sps_ctrl);
+    controls[1].id = V4L2_CID_STATELESS_H264_PPS;
+    controls[1].ptr = &pps_ctrl;
+    controls[1].size = sizeof(pps_ctrl);
+    controls[2].id = V4L2_CID_STATELESS_H264_SCALING_MATRIX;
+    controls[2].ptr = &scaling_ctrl;
+    controls[2].size = sizeof(scaling_ctrl);
+    controls[3].id = V4L2_CID_STATELESS_H264_DECODE_PARAMS;
+    controls[3].ptr = &params_ctrl;
+    controls[3].size = sizeof(params_ctrl);
+
+    memset(&ext, 0, sizeof(ext));
+    ext.which = V4L2_CTRL_WHICH_REQUEST_VAL;
+    ext.request_fd = request->fd;
+    ext.count = 4;
+    ext.controls = controls;
+
+    if (xioctl(decoder->video_fd, VIDIOC_S_EXT_CTRLS, &ext) < 0) {
+        DEBUG_TRACE("VIDIOC_S_EXT_CTRLS failed, errno=%d, control %u\n", errno, ext.error_idx);
+        return -1;
+    }
+
+    /* Timestamps identify frames. They are the frames' latency timestamps,
+     * which drivers copy to the pictures decoded.
+     */
+    us = max(decoder->frame_stamp, decoder->last_timestamp / 1000 + 1);
+
+    memset(&buf, 0, sizeof(buf));
+    memset(&plane, 0, sizeof(plane));
+    plane.bytesused = decoder->fill;
+    buf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    buf.index = index;
+    buf.length = 1;
+    buf.m.planes = &plane;
+    buf.timestamp.tv_sec = us / 1000000;
+    buf.timestamp.tv_usec = us % 1000000;
+    buf.flags = V4L2_BUF_FLAG_REQUEST_FD;
+    buf.request_fd = request->fd;
+
+    latency_stamp(&decoder->stats->latency, us, LATENCY_FIRST_SUBMIT);
+    if (xioctl(decoder->video_fd, VIDIOC_QBUF, &buf) < 0) {
+        DEBUG_TRACE("Output VIDIOC_QBUF failed, errno=%d\n", errno);
+        return -1;
+    }
+
+    if (xioctl(request->fd, MEDIA_REQUEST_IOC_QUEUE, NULL) < 0) {
+        DEBUG_TRACE("MEDIA_REQUEST_IOC_QUEUE failed, errno=%d\n", errno);
+        return -1;
+    }
+    latency_stamp(&decoder->stats->latency, us, LATENCY_LAST_SUBMIT);
+
+    request->queued = 1;
+    request->timestamp = us * 1000;
+    decoder->last_timestamp = request->timestamp;
+    request->color = sps_color(sps);
+    TRACE(TRACE_BUFFER_SUBMIT, decoder->fill, 0, decoder->in_flight + 1);
+    USDT3(buffer_submit, decoder->fill, 0, us);
+    for (request->num_refs = 0; request->num_refs < V4L2_H264_NUM_DPB_ENTRIES; request->num_refs++) {
+        if (!(params_ctrl.dpb[request->num_refs].flags & V4L2_H264_DPB_ENTRY_FLAG_VALID)) {
+            break;
+        }
+        request->refs[request->num_refs] = params_ctrl.dpb[request->num_refs].reference_ts;
+    }
+
+    decoder->prev_frame_num_offset = frame_num_offset;
+    mark_reference(decoder, sps, request->timestamp, poc_msb, top, bottom);
+
+    return 0;
+}
+
+/***************************************************************************
+*   Bitstream.
+****************************************************************************/
+
+/* Makes the output buffer of the next request free for a new frame. */
+static int reserve_output(V4L2H264_decoder *decoder)
+{
+    int stalled = decoder->request[decoder->next_request].queued;
+
+    if (stalled) {
+        decoder->stats->input_stalls++;
+    }
+
+    while (decoder->request[decoder->next_request].queued) {
+        if (reap_request(decoder, TIMEOUT_MS) < 0) {
+            decoder->error = 1;
+            return -1;
+        }
+    }
+    USDT2(buffer_acquire, decoder->next_request, stalled);
+
+    return 0;
+}
+
+static int append_output(V4L2H264_decoder *decoder, const void *data, int len)
+{
+    v4l2_output *output = &decoder->output[decoder->next_request];
+
+    if (decoder->fill + len > output->length) {
+        DEBUG_TRACE("Frame larger than the %u byte bitstream buffer\n", (unsigned int)output->length);
+        return -1;
+    }
+
+    memcpy((unsigned char *)output->start + decoder->fill, data, len);
+    decoder->fill += len;
+
+    return 0;
+}
+
+/* Waits for every request in flight. */
+static int drain(V4L2H264_decoder *decoder)
+{
+    while (decoder->in_flight > 0) {
+        if (reap_request(decoder, TIMEOUT_MS) < 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* Parses a complete parameter set or the first slice of a frame, from the
+ * start of the NAL kept aside.
+ */
+static int end_nal(V4L2H264_decoder *decoder)
+{
+    H264_bits bits;
+    const H264_sps *sps;
+    int size, id;
+
+    if (decoder->nal_len == 0) {
+        return 0;
+    }
+
+    if (decoder->nal_type == H264_NAL_SLICE || decoder->nal_type == H264_NAL_SLICE_IDR) {
+        if (decoder->have_slice) {
+            /* Only the first slice header is needed for the frame. */
+            return 0;
+        }
+
+        size = h264_unescape(decoder->nal_buf, decoder->nal_len, decoder->parse_buf, V4L2_PARSE_MAX);
+        h264_bits_init(&bits, decoder->parse_buf, size);
+        if (h264_parse_slice_header(&bits, decoder->sps, decoder->pps, &decoder->slice) != 0) {
+            DEBUG_TRACE("Bad slice header\n");
+            return -1;
+        }
+
+        sps = &decoder->sps[decoder->pps[decoder->slice.pps_id].sps_id];
+        if (needs_configure(decoder, sps)) {
+            DEBUG_TRACE("Slice refers to an SPS the decoder isn't set up for\n");
+            return -1;
+        }
+
+        decoder->have_slice = 1;
+        return 0;
+    }
+
+    size = h264_unescape(decoder->nal_buf + 1, decoder->nal_len - 1, decoder->parse_buf, V4L2_PARSE_MAX);
+    h264_bits_init(&bits, decoder->parse_buf, size);
+
+    if (decoder->nal_type == H264_NAL_PPS) {
+        if (h264_parse_pps(&bits, decoder->sps, decoder->pps) < 0) {
+            DEBUG_TRACE("Bad or unsupported PPS\n");
+            return -1;
+        }
+        return 0;
+    }
+
+    id = h264_parse_sps(&bits, decoder->sps);
+    if (id < 0) {
+        DEBUG_TRACE("Bad or unsupported SPS\n");
+        return -1;
+    }
+
+    /* Parameter sets come ahead of the slices, so the queues can be set up
+     * again for a new size before anything of the frame is in them.
+     */
+    sps = &decoder->sps[id];
+    if (needs_configure(decoder, sps)) {
+        if (decoder->have_slice || drain(decoder) != 0 || configure(decoder, sps) != 0) {
+            DEBUG_TRACE("Failed to set up the decoder for the new SPS\n");
+            release_queues(decoder);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/***************************************************************************
+*   Backend interface.
+****************************************************************************/
+
+static int v4l2_probe(struct H264_decoder *caps)
+{
+    struct v4l2_frmsizeenum size;
+    int video_fd, media_fd;
+
+    if (open_device(&video_fd, &media_fd) != 0) {
+        return 0;
+    }
+
+    caps->width = 1920;
+    caps->height = 1080;
+
+    memset(&size, 0, sizeof(size));
+    size.pixel_format = V4L2_PIX_FMT_H264_SLICE;
+    if (xioctl(video_fd, VIDIOC_ENUM_FRAMESIZES, &size) == 0) {
+        if (size.type == V4L2_FRMSIZE_TYPE_DISCRETE) {
+            caps->width = min(caps->width, size.discrete.width);
+            caps->height = min(caps->height, size.discrete.height);
+        } else {
+            caps->width = min(caps->width, size.stepwise.max_width);
+            caps->height = min(caps->height, size.stepwise.max_height);
+        }
+    }
+
+    /* Nothing says how fast the decoder is; assume it keeps up with the
+     * frame rates Receiver asks for.
+     */
+    caps->max_fps = 30;
+    caps->chroma_formats = H264_CHROMA_FORMAT_420;
+    caps->options = 0;
+
+    DEBUG_TRACE("V4L2 stateless decoder, advertising %ux%u@%d\n", caps->width, caps->height, caps->max_fps);
+
+    close(media_fd);
+    close(video_fd);
+
+    return 1;
+}
+
+static void v4l2_close(void *ctx)
+{
+    V4L2H264_decoder *decoder = ctx;
+    int i;
+
+    if (!decoder) {
+        return;
+    }
+
+    /* Frames come back to the queues before they go. */
+    if (decoder->presenter_ctx) {
+        decoder->presenter->close(decoder->presenter_ctx);
+    }
+
+    if (decoder->video_fd >= 0) {
+        release_queues(decoder);
+    }
+
+    for (i = 0; i < V4L2_REQUESTS; i++) {
+        if (decoder->request[i].fd >= 0) {
+            close(decoder->request[i].fd);
+        }
+    }
+
+    if (decoder->media_fd >= 0) {
+        close(decoder->media_fd);
+    }
+    if (decoder->video_fd >= 0) {
+        close(decoder->video_fd);
+    }
+
+    free(decoder);
+}
+
+/* Queues are set up once the first SPS gives the coded size. */
+static void *v4l2_open(int width, int height, unsigned int options, H264_stats *stats)
+{
+    V4L2H264_decoder *decoder = calloc(1, sizeof(V4L2H264_decoder));
+    int i;
+
+    if (!decoder) {
+        return NULL;
+    }
+
+    decoder->stats = stats;
+    decoder->width = width;
+    decoder->height = height;
+    decoder->ready = -1;
+    decoder->max_long_term_frame_idx = -1;
+    for (i = 0; i < V4L2_REQUESTS; i++) {
+        decoder->request[i].fd = -1;
+    }
+
+    if (open_device(&decoder->video_fd, &decoder->media_fd) != 0) {
+        DEBUG_TRACE("No V4L2 stateless H.264 decoder\n");
+        free(decoder);
+        return NULL;
+    }
+
+    for (i = 0; i < V4L2_REQUESTS; i++) {
+        if (reset_request(decoder, &decoder->request[i]) != 0) {
+            v4l2_close(decoder);
+            return NULL;
+        }
+    }
+
+    decoder->presenter_ctx = presenter_open(width, height, PRESENTER_FRAMES_DMABUF | PRESENTER_FRAMES_MAPPED,
+                                            &decoder->presenter);
+    if (!decoder->presenter_ctx) {
+        v4l2_close(decoder);
+        return NULL;
+    }
+
+    DEBUG_TRACE("Opened V4L2 decoder for %dx%d\n", width, height);
+
+    return decoder;
+}
+
+static int v4l2_start_frame(void *ctx, SIGNED_RECT dirty_rects[], unsigned int num_rects)
+{
+    V4L2H264_decoder *decoder = ctx;
+
+    decoder->frame_stamp = decoder->stats->latency.current;
+    decoder->fill = 0;
+    decoder->have_slice = 0;
+    presenter_add_damage(&decoder->damage, dirty_rects, num_rects, decoder->width, decoder->height);
+
+    reap_completed(decoder);
+
+    if (decoder->error) {
+        decoder->error = 0;
+        return -1;
+    }
+
+    return 0;
+}
+
+/* NALs are written to the output buffer with their start code as they
+ * arrive, so the bitstream is copied once, from Receiver's buffer to memory
+ * the decoder reads. Only slices are kept, the decoder is given everything
+ * else through controls.
+ */
+static int v4l2_submit(void *ctx, const unsigned char *data, int len, unsigned int flags)
+{
+    V4L2H264_decoder *decoder = ctx;
+    int slice, keep;
+
+    if (flags & BACKEND_NAL_START) {
+        decoder->nal_type = len > 0 ? h264_nal_type(data[0]) : 0;
+        decoder->nal_len = 0;
+
+        slice = decoder->nal_type == H264_NAL_SLICE || decoder->nal_type == H264_NAL_SLICE_IDR;
+        if (slice && !decoder->configured) {
+            DEBUG_TRACE("Slice before any SPS\n");
+            return -1;
+        }
+        if (slice && decoder->fill == 0 && reserve_output(decoder) != 0) {
+            return -1;
+        }
+        if (slice && append_output(decoder, h264_start_code + 1, H264_START_CODE_LEN - 1) != 0) {
+            return -1;
+        }
+    }
+
+    slice = decoder->nal_type == H264_NAL_SLICE || decoder->nal_type == H264_NAL_SLICE_IDR;
+
+    if (slice && append_output(decoder, data, len) != 0) {
+        return -1;
+    }
+
+    /* Keep what the parser needs: a slice header is short, and the largest
+     * parameter set fits comfortably.
+     */
+    if (decoder->nal_type == H264_NAL_SPS || decoder->nal_type == H264_NAL_PPS || (slice && !decoder->have_slice)) {
+        keep = min(len, V4L2_PARSE_MAX - decoder->nal_len);
+        memcpy(decoder->nal_buf + decoder->nal_len, data, keep);
+        decoder->nal_len += keep;
+    }
+
+    if (flags & BACKEND_NAL_END) {
+        int ret = end_nal(decoder);
+
+        decoder->nal_type = 0;
+        decoder->nal_len = 0;
+        return ret;
+    }
+
+    return 0;
+}
+
+static int v4l2_end_frame(void *ctx, int submitted)
+{
+    V4L2H264_decoder *decoder = ctx;
+    v4l2_request *request = &decoder->request[decoder->next_request];
+    int ret = 0;
+
+    if (submitted && decoder->nal_type != 0) {
+        /* A NAL still open ends with the frame. */
+        ret = end_nal(decoder);
+        decoder->nal_type = 0;
+        decoder->nal_len = 0;
+    }
+
+    if (ret == 0 && decoder->have_slice) {
+        if (queue_frame(decoder, request, decoder->next_request) == 0) {
+            decoder->next_request = (decoder->next_request + 1) % V4L2_REQUESTS;
+            decoder->in_flight++;
+        } else {
+            reset_request(decoder, request);
+            ret = -1;
+        }
+    }
+
+    decoder->fill = 0;
+    decoder->have_slice = 0;
+
+    if (reap_completed(decoder) < 0) {
+        ret = -1;
+    }
+
+    return ret;
+}
+
+static int v4l2_queue_depth(void *ctx)
+{
+    V4L2H264_decoder *decoder = ctx;
+
+    reap_completed(decoder);
+
+    return decoder->in_flight;
+}
+
+/*  Cancels everything queued. Stopping the queues hands every buffer back;
+ *  frames the presenter holds stay with it, the others go straight back to
+ *  the driver. References go too, as decoding resumes with the next IDR.
+ */
+static void v4l2_flush(void *ctx)
+{
+    V4L2H264_decoder *decoder = ctx;
+    unsigned int i;
+    int type;
+
+    decoder->fill = 0;
+    decoder->have_slice = 0;
+    decoder->nal_type = 0;
+    decoder->nal_len = 0;
+    decoder->num_refs = 0;
+    decoder->pushed = NULL;
+    decoder->error = 0;
+
+    if (!decoder->configured) {
+        return;
+    }
+
+    type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+    xioctl(decoder->video_fd, VIDIOC_STREAMOFF, &type);
+    type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    xioctl(decoder->video_fd, VIDIOC_STREAMOFF, &type);
+
+    for (i = 0; i < V4L2_REQUESTS; i++) {
+        reset_request(decoder, &decoder->request[i]);
+    }
+    decoder->in_flight = 0;
+    decoder->next_request = 0;
+    decoder->ready = -1;
+
+    type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    if (xioctl(decoder->video_fd, VIDIOC_STREAMON, &type) < 0) {
+        decoder->error = 1;
+        return;
+    }
+
+    for (i = 0; i < decoder->num_capture; i++) {
+        if (decoder->capture[i].held) {
+            decoder->capture[i].state = CAPTURE_DECODED;
+        } else if (queue_capture(decoder, i) != 0) {
+            decoder->error = 1;
+        }
+    }
+
+    type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+    if (xioctl(decoder->video_fd, VIDIOC_STREAMON, &type) < 0) {
+        decoder->error = 1;
+    }
+}
+
+static int v4l2_compose_with_fb(void *ctx, struct image_buf *fb, SIGNED_RECT interesting_rects[],
+                                unsigned int num_rects)
+{
+    V4L2H264_decoder *decoder = ctx;
+
+    return decoder->presenter->compose_with_fb(decoder->presenter_ctx, fb, interesting_rects, num_rects);
+}
+
+static int v4l2_compose_with_rects(void *ctx, struct image_buf objects[], unsigned int num_objects, bool last)
+{
+    V4L2H264_decoder *decoder = ctx;
+
+    return decoder->presenter->compose_with_rects(decoder->presenter_ctx, objects, num_objects, last);
+}
+
+/*  Hands the latest decoded frame to the presenter. Without "wait", the
+ *  frame pushed may not be decoded yet; the presenter then shows the last
+ *  one that is, and "pushed" goes with the first frame from the push or
+ *  later to be presented. Damage is kept until a frame is presented with
+ *  none left in flight.
+ */
+static int v4l2_present(void *ctx, struct window_info windows[], unsigned int num_windows, bool wait, bool *pushed)
+{
+    V4L2H264_decoder *decoder = ctx;
+    v4l2_capture *capture = NULL;
+    bool *frame_pushed = NULL;
+    int ret = 0;
+
+    if (wait) {
+        ret = drain(decoder);
+    } else if (reap_completed(decoder) < 0) {
+        ret = -1;
+    }
+
+    if (pushed) {
+        *pushed = 0;
+        decoder->pushed = pushed;
+        decoder->pushed_timestamp = decoder->last_timestamp;
+    }
+
+    if (decoder->ready >= 0) {
+        capture = &decoder->capture[decoder->ready];
+        capture->held = 1;
+        decoder->ready = -1;
+
+        if (decoder->pushed && capture->timestamp >= decoder->pushed_timestamp) {
+            frame_pushed = decoder->pushed;
+            decoder->pushed = NULL;
+        }
+    }
+
+    TRACE(TRACE_PRESENT_BEGIN, capture ? capture->frame->id : 0, 0, 0);
+    if (decoder->presenter->present(decoder->presenter_ctx, capture ? capture->frame : NULL, &decoder->damage,
+                                    windows, num_windows, wait, frame_pushed) != 0) {
+        if (capture) {
+            capture->held = 0;
+        }
+        ret = -1;
+    } else if (decoder->in_flight == 0) {
+        decoder->damage.num_rects = 0;
+    }
+
+    TRACE(TRACE_PRESENT_END, 0, 0, 0);
+
+    recycle_capture(decoder);
+
+    return ret;
+}
+
+const H264_backend v4l2_backend = {
+    "v4l2",
+    v4l2_probe,
+    v4l2_open,
+    v4l2_start_frame,
+    v4l2_submit,
+    v4l2_end_frame,
+    v4l2_queue_depth,
+    v4l2_flush,
+    v4l2_compose_with_fb,
+    v4l2_compose_with_rects,
+    v4l2_present,
+    v4l2_close,
+};
+
+#endif /* HAVE_V4L2 */
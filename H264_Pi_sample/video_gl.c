@@ -9,20 +9,19 @@
 *
 ****************************************************************************/
 
-#include <stdarg.h>
-#include "video_gl.h"
+#include <unistd.h>
 
-#define TRACING_ENABLED
+#include "video_gl.h"
 
 struct H264_decoder	H264_decoder = {
     VERSION_MAJOR,
     VERSION_MINOR,
     1,                 /* 1 context supported. */
-    1920,
+    1920,              /* Limits probed by v3_init(). */
     1080,
-    60,
+    30,
     0, 
-    H264_CHROMA_FORMAT_444,
+    H264_CHROMA_FORMAT_420,
     0,                 /* Preferred alpha value for lossless objects. */
     PIXEL_FORMAT_ARGB, /* Preferred pixel format for lossless objects. */
     &v3_init,
@@ -36,304 +35,302 @@ struct H264_decoder	H264_decoder = {
     &v3_end,
 };
 
-OMXH264_decoder *hw_decoder = NULL;
+/* Tried in order when CTX_H264_BACKEND doesn't name one. */
+static const H264_backend *backends[] = {
+    &omx_backend,
+#ifdef HAVE_V4L2
+    &v4l2_backend,
+#endif
+#ifdef HAVE_AVCODEC
+    &avcodec_backend,
+#endif
+};
+
+static const H264_backend *backend = NULL;
+static H264_stream *stream = NULL;
 
 /* All exported by the main process. */
 extern Display *GetICADisplay();
 extern BOOL TwiModeEnableFlag;  /* Seamless enabled? */
 
-pthread_cond_t fill_buffer_done_cond = PTHREAD_COND_INITIALIZER;
-pthread_mutex_t fill_buffer_done_mutex = PTHREAD_MUTEX_INITIALIZER;
-int fill_buffer_done_val = 0;
-
-void DEBUG_TRACE(const char *format, ...)
+static void close_stream()
 {
-#ifdef TRACING_ENABLED
-    char buf[1024];
-    va_list args;
-
-    va_start(args, format);
-    vsprintf(buf, format, args);
-    va_end(args);
-
-    printf("%s", buf);
-#endif
+    if (stream) {
+        /* Decode-only contexts checksum every frame they were given. */
+        if (stream->stats.checksums) {
+            drain_stream(stream);
+        }
+        stream->backend->close(stream->ctx);
+        if (stream->stats.checksums) {
+            checksum_close(&stream->checksums);
+        }
+        if (stream->stats.analysis) {
+            analyze_close(stream->stats.analysis);
+        }
+        metrics_close(&stream->metrics, &stream->stats);
+        hud_close(&stream->hud);
+        latency_log(&stream->stats.latency, 1);
+        latency_destroy(&stream->stats.latency);
+        free(stream);
+        stream = NULL;
+    }
 }
 
-int port_settings_changed(OMXH264_decoder *decoder, int again)
+static unsigned long get_time_ms()
 {
-    OMX_PARAM_PORTDEFINITIONTYPE portdef;
-
-    portdef.nSize = sizeof(OMX_PARAM_PORTDEFINITIONTYPE);
-    portdef.nVersion.nVersion = OMX_VERSION;
-    portdef.nPortIndex = decoder->image_decode->out_port;
-    OMX_GetParameter(decoder->image_decode->handle, OMX_IndexParamPortDefinition, &portdef);
+    struct timespec ts;
 
-    DEBUG_TRACE("Got port settings width=%d, height=%d, again=%d\n", decoder->width, decoder->height, again);
+    clock_gettime(CLOCK_MONOTONIC, &ts);
 
-    if (decoder->video_render) {
-        DEBUG_TRACE("video_render port settings changed\n");
-        /* We're using video_render rendering. */
+    return ts.tv_sec * 1000UL + ts.tv_nsec / 1000000;
+}
 
-        ilclient_change_component_state(decoder->video_render->component, OMX_StateIdle);
+/* Waits for the decoder to take everything queued. Returns -1 if it
+ * doesn't within TIMEOUT_MS, measured rather than counted in sleeps, as
+ * queue_depth() itself dequeues pictures for some backends.
+ */
+int drain_stream(H264_stream *stream)
+{
+    unsigned long start = get_time_ms();
 
-        if (ilclient_setup_tunnel(decoder->tunnel, 0, 0) != 0) {
-            DEBUG_TRACE("Failed to setup tunnel\n");
-            exit(1);
+    while (stream->backend->queue_depth(stream->ctx) > 0) {
+        if (get_time_ms() - start >= TIMEOUT_MS) {
+            return -1;
         }
-
-        ilclient_change_component_state(decoder->video_render->component, OMX_StateExecuting);
-
+        usleep(1000);
     }
 
-    hw_decoder->renderer_init = 1;
-
-    DEBUG_TRACE("Port settings changed done\n");
-
     return 0;
 }
 
-comp_details *init_component(OMXH264_decoder *decoder, char *name, unsigned int extra_flags, int type)
+/* Enters error recovery: the backend discards everything queued and input
+ * is dropped until the next IDR, so that no corrupted frames are shown.
+ */
+static void stream_error(H264_stream *stream, const char *reason)
 {
-    comp_details *comp = malloc(sizeof(comp_details));
+    stream->stats.errors++;
+    TRACE(TRACE_STREAM_ERROR, stream->stats.errors, 0, 0);
+    USDT1(stream_error, stream->stats.errors);
 
-    ilclient_create_component(decoder->client, &(comp->component), name, extra_flags);
+    if (stream->state == DECODER_STATE_WAIT_IDR) {
+        /* Already recovering. */
+        return;
+    }
 
-    comp->handle = ILC_GET_HANDLE(comp->component);
+    DEBUG_TRACE("Decoder error (%s), skipping to next IDR\n", reason);
 
-    if (strcmp(name, "video_render") == 0) {
-        /* TODO: fix. */
-        comp->in_port = 90;
-        comp->out_port = NULL;
-    } else {
-        OMX_PORT_PARAM_TYPE port;
-        port.nSize = sizeof(OMX_PORT_PARAM_TYPE);
-        port.nVersion.nVersion = OMX_VERSION;
+    stream->state = DECODER_STATE_WAIT_IDR;
+    stream->nal = NAL_STATE_DROP;
+    stream->nal_bytes = 0;
+    stream->backend->flush(stream->ctx);
+}
 
-        OMX_GetParameter(comp->handle, type, &port);
+/* Decides at the first slice of a frame whether the frame is shed. Frames
+ * nothing refers to are dropped while the decoder is behind, which bounds
+ * latency without affecting the frames that follow.
+ */
+static shed_state shed_decision(H264_stream *stream, unsigned char header)
+{
+    int depth;
 
-        comp->in_port = port.nStartPortNumber;
-        comp->out_port = port.nStartPortNumber + 1;
+    if (stream->shed != SHED_UNDECIDED) {
+        return stream->shed;
     }
 
-    DEBUG_TRACE("Component %s, in_port=%d, out_port=%d\n", name, comp->in_port, comp->out_port);
+    stream->shed = SHED_KEEP;
 
-    return comp;
-}
+    if (stream->shed_depth > 0 && h264_nal_ref_idc(header) == 0 && h264_nal_type(header) == H264_NAL_SLICE &&
+        (depth = stream->backend->queue_depth(stream->ctx)) > stream->shed_depth) {
+        stream->shed = SHED_DROP;
+        stream->stats.shed_frames++;
+        TRACE(TRACE_SHED, depth, stream->stats.shed_frames, 0);
+        USDT2(shed, depth, stream->stats.shed_frames);
+    }
 
-void fill_buffer_done(void* data, COMPONENT_T* comp)
-{
-    /* Signal complete event. */
-    pthread_mutex_lock(&fill_buffer_done_mutex);
-    fill_buffer_done_val = 1;
-    pthread_cond_signal(&fill_buffer_done_cond);
-    pthread_mutex_unlock(&fill_buffer_done_mutex);
+    return stream->shed;
 }
 
-BOOL setup_decoder()
+/* Passes NAL payload on, unless it is being dropped. Whether a NAL is
+ * dropped is decided when its header byte arrives: while waiting for an
+ * IDR only parameter sets and the IDR itself get through, and the slices
+ * of shed frames are dropped.
+ */
+static int pass_nal_data(H264_stream *stream, const unsigned char *data, int size)
 {
-    if (hw_decoder != NULL) {
-        return FALSE;
-    }
+    unsigned int flags = 0;
 
-    hw_decoder = malloc(sizeof(OMXH264_decoder));
-
-    if (!hw_decoder) {
-        DEBUG_TRACE("Couldn't allocate decoder structure.\n");
-        return FALSE;
+    if (size == 0) {
+        return 0;
     }
 
-    memset(hw_decoder->tunnel, 0, sizeof(hw_decoder->tunnel));
+    if (stream->nal == NAL_STATE_START) {
+        int type = h264_nal_type(data[0]);
 
-    OMX_Init();
-    
-    hw_decoder->client = ilclient_init();
+        stream->nal = NAL_STATE_PASS;
 
-    ilclient_set_fill_buffer_done_callback(hw_decoder->client, fill_buffer_done, hw_decoder);
+        if (stream->state == DECODER_STATE_WAIT_IDR) {
+            if (type == H264_NAL_SLICE_IDR) {
+                DEBUG_TRACE("Got IDR, decoder recovered\n");
+                stream->state = DECODER_STATE_RUNNING;
+            } else if (type != H264_NAL_SPS && type != H264_NAL_PPS) {
+                stream->nal = NAL_STATE_DROP;
+            }
+        }
+
+        if ((type == H264_NAL_SLICE || type == H264_NAL_SLICE_IDR) && stream->nal == NAL_STATE_PASS &&
+            shed_decision(stream, data[0]) == SHED_DROP) {
+            stream->nal = NAL_STATE_DROP;
+        }
 
-    hw_decoder->image_decode = init_component(hw_decoder, "video_decode", ILCLIENT_DISABLE_ALL_PORTS | ILCLIENT_ENABLE_INPUT_BUFFERS, OMX_IndexParamVideoInit);
-    if (!hw_decoder->image_decode) {
-        goto error;
+        flags = BACKEND_NAL_START;
+        TRACE(TRACE_NAL, type, h264_nal_ref_idc(data[0]), stream->nal == NAL_STATE_DROP);
+        USDT3(nal, type, h264_nal_ref_idc(data[0]), stream->nal == NAL_STATE_DROP);
     }
 
-    /* Initialize variables. */
-    hw_decoder->video_render = NULL;
-    hw_decoder->renderer_init = 0;
+    if (stream->nal == NAL_STATE_DROP) {
+        return 0;
+    }
 
-    comp_details **comp_out = &(hw_decoder->video_render);
+    stream->nal_bytes += size;
+    stream->frame_submitted = 1;
+    stream->stats.bytes += size;
 
-    *comp_out = init_component(hw_decoder, 
-                               "video_render", 
-                               ILCLIENT_DISABLE_ALL_PORTS | ILCLIENT_ENABLE_OUTPUT_BUFFERS, 
-                               OMX_IndexParamImageInit);
-    if (!(*comp_out)) {
-        goto error;
+    if (stream->backend->submit(stream->ctx, data, size, flags) != 0) {
+        stream_error(stream, "submission failed");
+        return -1;
     }
 
-    set_tunnel(hw_decoder->tunnel, hw_decoder->image_decode->component, hw_decoder->image_decode->out_port, (*comp_out)->component, (*comp_out)->in_port);
+    return 0;
+}
 
-    ilclient_change_component_state(hw_decoder->image_decode->component, OMX_StateIdle);
+/* Feeds a chunk of a frame to the backend. Returns 0 on success, or -1 if
+ * the decoder failed, in which case recovery from the next IDR is under way.
+ */
+int decode_frame(H264_stream *stream, unsigned char *data, int size, int last)
+{
+    static const unsigned char zeros[4] = { 0 };
+    int ret = 0, submitted;
 
-    /* Set port format. */
-    OMX_VIDEO_PARAM_PORTFORMATTYPE format = {0};
-    format.nSize = sizeof(format);
-    format.nVersion.nVersion = OMX_VERSION;
-    format.nPortIndex = hw_decoder->image_decode->in_port;
-    format.eCompressionFormat = OMX_VIDEO_CodingAVC;
-    OMX_SetParameter(hw_decoder->image_decode->handle, OMX_IndexParamVideoPortFormat, &format);
+    /* Pass every NAL on as soon as its end is seen, so that the decoder can
+     * start on the first slices of a frame while the rest is still being
+     * received.
+     */
+    while (size > 0) {
+        int held, payload, found;
+        int consumed = h264_scan_nal(&stream->scanner, data, size, &held, &payload, &found);
 
-    ilclient_enable_port_buffers(hw_decoder->image_decode->component, hw_decoder->image_decode->in_port, NULL, NULL, NULL);
+        if (stream->stats.analysis) {
+            analyze_data(stream->stats.analysis, zeros, held);
+            analyze_data(stream->stats.analysis, data, payload);
+        }
 
-    ilclient_change_component_state(hw_decoder->image_decode->component, OMX_StateExecuting);
+        if (pass_nal_data(stream, zeros, held) != 0 ||
+            pass_nal_data(stream, data, payload) != 0) {
+            ret = -1;
+        }
 
-    return TRUE;
+        if (found) {
+            if (stream->stats.analysis) {
+                analyze_nal_end(stream->stats.analysis, stream->nal == NAL_STATE_PASS);
+            }
 
-error:
-    DEBUG_TRACE("Error setting up decoder.\n");
-	ilclient_destroy(hw_decoder->client);
-    free(hw_decoder);
-    return FALSE;
-}
+            /* The start code ends the previous NAL, if any. */
+            if (stream->nal == NAL_STATE_PASS && stream->nal_bytes > 0 &&
+                stream->backend->submit(stream->ctx, NULL, 0, BACKEND_NAL_END) != 0) {
+                stream_error(stream, "submission failed");
+                ret = -1;
+            }
 
-static void close_decoder()
-{
-    if (hw_decoder) {
-        COMPONENT_T *components[3] = {0};
-        
-        components[0] = hw_decoder->image_decode->component;
-        
-        if (hw_decoder->video_render) {
-            components[1] = hw_decoder->video_render->component;
+            stream->nal = NAL_STATE_START;
+            stream->nal_bytes = 0;
         }
 
-        ilclient_disable_tunnel(hw_decoder->tunnel);
-        ilclient_teardown_tunnels(hw_decoder->tunnel);
- 
-        DEBUG_TRACE("Disabling port buffers\n");
-        ilclient_disable_port_buffers(components[0], hw_decoder->image_decode->in_port, NULL, NULL, NULL);
-        ilclient_disable_port_buffers(components[0], hw_decoder->image_decode->out_port, NULL, NULL, NULL);
+        data += consumed;
+        size -= consumed;
+    }
 
-        ilclient_state_transition(components, OMX_StateIdle);
+    if (!last) {
+        /* All Input consumed. More data to come */
+        return ret;
+    }
 
-        /* Destroy components. */
-        ilclient_cleanup_components(components);
-        
-        if (hw_decoder->client) {
-            ilclient_destroy(hw_decoder->client);
-        }
-    
-        OMX_Deinit();
+    /* Done. Any zeros still held back are trailing bytes of the last NAL. */
+    h264_scanner_reset(&stream->scanner);
 
-        free(hw_decoder);
-        hw_decoder = NULL;
+    submitted = stream->nal != NAL_STATE_DROP && stream->frame_submitted;
+    TRACE(TRACE_END_FRAME_BEGIN, submitted, 0, 0);
+    if (stream->backend->end_frame(stream->ctx, submitted) != 0) {
+        stream_error(stream, "end of frame");
+        ret = -1;
     }
-}
+    TRACE(TRACE_END_FRAME_END, 0, 0, 0);
+    USDT2(frame_end, submitted, stream->stats.latency.current);
 
-int decode_frame(OMXH264_decoder *decoder, unsigned char *data, int size, int last)
-{
-    static OMX_BUFFERHEADERTYPE *buf = 0;
-    static int p_s_c = 0;
-    int ret;
-
-grab_buffer:
-    if (buf == 0) {
-        buf = ilclient_get_input_buffer(decoder->image_decode->component, decoder->image_decode->in_port, 1);
-        if (!buf) {
-            DEBUG_TRACE("Couldn't get buffer\n");
-            return -1;
-        }
-        buf->nFilledLen = 0;
-        buf->nOffset = 0;
-        buf->nFlags = 0;
+    /* After the decoder has the frame, to keep the parsing off its path. */
+    if (stream->stats.analysis) {
+        analyze_nal_end(stream->stats.analysis, submitted);
+        analyze_frame_end(stream->stats.analysis, stream->stats.latency.current);
     }
 
-    int buf_left = buf->nAllocLen - buf->nFilledLen;
-    int size_to_fill = size > buf_left ? buf_left : size;
+    /* Still waiting for an IDR, so none of the frame's slices got through. */
+    if (stream->state == DECODER_STATE_WAIT_IDR) {
+        stream->stats.dropped_frames++;
+    }
 
-    memcpy(buf->pBuffer + buf->nFilledLen, data, size_to_fill);
-    buf->nFilledLen += size_to_fill;
+    /* The next frame starts with a clean slate. */
+    stream->nal = stream->state == DECODER_STATE_RUNNING ? NAL_STATE_PASS : NAL_STATE_DROP;
+    stream->nal_bytes = 0;
+    stream->frame_submitted = 0;
+    stream->shed = SHED_UNDECIDED;
 
-    size -= size_to_fill;
+    return ret;
+}
 
-    if (size > 0) {
-        /* More to come, but the buffer is full. */
-        ret = OMX_EmptyThisBuffer(decoder->image_decode->handle, buf);
-        if (ret != OMX_ErrorNone) {
-            DEBUG_TRACE("[0] Couldn't empty buffer, size=%d, ret=0x%x\n", size, ret);
-            return -1;
-        }
+/* ARGB bytes Receiver sends for "rect". */
+static unsigned long long rect_bytes(const SIGNED_RECT *rect)
+{
+    if (rect->right <= rect->left || rect->bottom <= rect->top) {
+        return 0;
+    }
 
-        /* Advance input pointer... */
-        data += size_to_fill;
+    return (unsigned long long)(rect->right - rect->left) * (rect->bottom - rect->top) * 4;
+}
 
-        /* ..and grab a new buffer. */
-        buf = 0;
-        goto grab_buffer;
-    }
+/* Picks the backend named by CTX_H264_BACKEND, or the first one that can
+ * run here, and advertises its limits.
+ */
+static const H264_backend *select_backend()
+{
+    char *name = getenv("CTX_H264_BACKEND");
+    unsigned int i;
 
-    if (!last) {
-        /* All Input consumed. More data to come */
-        return -1;
-    }
+    for (i = 0; i < ELEMENTS_IN_ARRAY(backends); i++) {
+        struct H264_decoder caps = H264_decoder;
 
-    /* Done. */
-    buf->nFlags |= OMX_BUFFERFLAG_ENDOFFRAME;
-    ret = OMX_EmptyThisBuffer(decoder->image_decode->handle, buf);
-    if (ret != OMX_ErrorNone) {
-        DEBUG_TRACE("[1] Couldn't empty buffer, size=%d, ret=0x%x\n", size, ret);
-        return -1;
-    }
-    /* Make sure we grab a buffer next time we come in. */
-    buf = 0;
- 
-    if (p_s_c == 0) {
-        /* Wait for p_s_c event. */
-        if (0 == ilclient_wait_for_event(decoder->image_decode->component, OMX_EventPortSettingsChanged, decoder->image_decode->out_port, 0, 0, 1,
-                                               ILCLIENT_EVENT_ERROR | ILCLIENT_PARAMETER_CHANGED, 100)) {
-            DEBUG_TRACE("Got port settings changed event.\n");
-            port_settings_changed(decoder, 0);
-
-            p_s_c = 1;
+        if (name && strcmp(name, backends[i]->name) != 0) {
+            continue;
         }
-    } else {
-        if (0 == ilclient_remove_event(decoder->image_decode->component, OMX_EventPortSettingsChanged, decoder->image_decode->out_port, 0, 0, 1)) {
-            /* Port settings changed again. */
-            DEBUG_TRACE("Got port settings changed event, again!\n");
-            port_settings_changed(decoder, 1);
+
+        if (backends[i]->probe(&caps)) {
+            calibrate(backends[i], &caps);
+            DEBUG_TRACE("Using %s backend: %ux%u@%d\n", backends[i]->name, caps.width, caps.height, caps.max_fps);
+            H264_decoder = caps;
+            return backends[i];
         }
-    }
 
-    // if (p_s_c == 1) {
-    //     ret = OMX_FillThisBuffer(decoder->video_render->handle, 
-    //                              decoder->outbuf);
-    
-    //     if (ret != OMX_ErrorNone) {
-    //         DEBUG_TRACE("Error filling buffer, return code %x\n", ret);
-    //     } else {
-    //         pthread_mutex_lock(&fill_buffer_done_mutex);
-    //         while (fill_buffer_done_val == 0) {
-    //             pthread_cond_wait(&fill_buffer_done_cond, &fill_buffer_done_mutex);
-    //         }
-    //         fill_buffer_done_val = 0;
-    //         pthread_mutex_unlock(&fill_buffer_done_mutex);
-
-    //         return 0;
-    //     }
-    // }
-    if (p_s_c == 1)
-    {
-        return 0;
+        DEBUG_TRACE("%s backend unavailable\n", backends[i]->name);
     }
-    
-
-    return -1;
 
+    return NULL;
 }
 
 /* This function would be called only once, to initialize the DLL. */
 bool v3_init()
 {
     char *bcm_init = getenv("CTX_BCM_INIT");
+
+    trace_init();
+
     if (!bcm_init) {
         DEBUG_TRACE("Loading BCM init\n");
         if (!dlopen("bcm_init.so", RTLD_NOW)) {
@@ -363,6 +360,16 @@ bool v3_init()
         return 0;
     }
 
+    /* Advertise what can actually be decoded, before the server picks a
+     * mode.
+     */
+    backend = select_backend();
+    if (!backend) {
+        return 0;
+    }
+
+    capture_init();
+
     /* Defer decoder initialization until it's actually required. Indicate that
      * we support H.264.
      */
@@ -372,67 +379,231 @@ bool v3_init()
 void v3_end ()
 {
     DEBUG_TRACE("V3_END, pthread=0x%x\n", pthread_self());
-    close_decoder();
+    close_stream();
+    trace_end();
+
+    if (capture_enabled) {
+        capture_end();
+    }
 }
 
 H264_context v3_open_context(int width, int height, void* codec_data, int len, unsigned int options)
 {
     DEBUG_TRACE("V3_OPEN, pthread=0x%x\n", pthread_self());
     static int id = 1;
+    H264_context cxt = H264_INVALID_CONTEXT;
 
     /* Close the existing context if it exists. */
-    close_decoder();
+    close_stream();
 
-    /* Set up decoder and create context. */
-    if (!setup_decoder()) {
-        /* Couldn't set up decoder. */
-        return H264_INVALID_CONTEXT;
+    if (!backend) {
+        /* Receiver didn't call init(). */
+        trace_init();
+        backend = select_backend();
+        capture_init();
     }
 
-    if (hw_decoder) {
-        /* Set width and height here. */
-        hw_decoder->width = width;
-        hw_decoder->height = height;
+    /* Set up decoder and create context. */
+    stream = backend ? calloc(1, sizeof(H264_stream)) : NULL;
+    if (stream) {
+        char *shed_depth = getenv("CTX_H264_SHED_DEPTH");
+
+        stream->backend = backend;
+        stream->nal = NAL_STATE_PASS;
+        stream->state = DECODER_STATE_RUNNING;
+        stream->shed_depth = shed_depth ? atoi(shed_depth) : SHED_QUEUE_DEPTH;
+        h264_scanner_reset(&stream->scanner);
+        latency_init(&stream->stats.latency);
+        stream->stats.decode_point = LATENCY_DECODED;
+
+        if (decode_only() && checksum_open(&stream->checksums, id, width, height) == 0) {
+            stream->stats.checksums = &stream->checksums;
+
+            /* Which frames are shed depends on timing, and every run
+             * must decode the same.
+             */
+            stream->shed_depth = 0;
+        }
 
-        return id++;
+        /* Without its checksums a decode-only context would render and
+         * shed like any other, so it isn't opened.
+         */
+        if (!decode_only() || stream->stats.checksums) {
+            stream->ctx = backend->open(width, height, options, &stream->stats);
+        } else {
+            DEBUG_TRACE("Couldn't set up checksums for a decode-only context\n");
+        }
+        if (stream->ctx) {
+            cxt = id++;
+            if (analyze_open(&stream->analysis, cxt, &stream->stats) == 0) {
+                stream->stats.analysis = &stream->analysis;
+            }
+            metrics_open(&stream->metrics, cxt, backend->name, width, height);
+            hud_open(&stream->hud, backend->name, width, height);
+        } else {
+            if (stream->stats.checksums) {
+                checksum_close(&stream->checksums);
+            }
+            latency_destroy(&stream->stats.latency);
+            free(stream);
+            stream = NULL;
+        }
+    }
+
+    /* Recorded after the call, for the context ID. */
+    if (capture_enabled) {
+        capture_open_context(cxt, width, height, codec_data, len, options);
     }
 
-	return H264_INVALID_CONTEXT;
+	return cxt;
 }
 
 void v3_close_context(H264_context Ctx)
 {
     DEBUG_TRACE("V3_CLOSE, pthread=0x%x\n", pthread_self());
-    close_decoder();
+    if (capture_enabled) {
+        capture_close_context(Ctx);
+    }
+
+    close_stream();
 }
 
 bool v3_start_frame(H264_context Ctx, unsigned int encoded_size, SIGNED_RECT dirty_rects[], unsigned int num_rects)
 {
+    unsigned long long timestamp;
+    int depth;
+
+    if (capture_enabled) {
+        capture_start_frame(Ctx, encoded_size, dirty_rects, num_rects);
+    }
+
+    if (!stream) {
+        return 0;
+    }
+
+    stream->stats.frames++;
+    timestamp = latency_start(&stream->stats.latency);
+    latency_log(&stream->stats.latency, 0);
+
+    depth = stream->backend->queue_depth(stream->ctx);
+    metrics_update(&stream->metrics, &stream->stats, depth, stream->state == DECODER_STATE_WAIT_IDR);
+    hud_update(&stream->hud, &stream->stats, depth);
+
+    TRACE(TRACE_START_FRAME, encoded_size, num_rects, 0);
+    USDT3(frame_start, encoded_size, num_rects, timestamp);
+    TRACE(TRACE_QUEUE_DEPTH, depth, 0, 0);
+
+    /* Report errors raised since the last frame. */
+    if (stream->backend->start_frame(stream->ctx, dirty_rects, num_rects) != 0) {
+        stream_error(stream, "decoder failed");
+        return 0;
+    }
+
 	return 1;
 }
 
 bool v3_decode_frame(H264_context Ctx, void* H264_data, int len, bool last)
 {
-    decode_frame(hw_decoder, H264_data, len, last);
+    int ret;
 
-	return 1;
+    if (capture_enabled) {
+        capture_decode_frame(Ctx, H264_data, len, last);
+    }
+
+    if (!stream) {
+        return 0;
+    }
+
+    TRACE(TRACE_DECODE_BEGIN, len, last, 0);
+    ret = decode_frame(stream, H264_data, len, last);
+    TRACE(TRACE_DECODE_END, 0, 0, 0);
+
+	return ret == 0;
 }
 
 bool v3_compose_with_fb(H264_context Ctx, struct image_buf *fb, SIGNED_RECT interesting_rects[], unsigned int num_rects)
 {
-	return 1;
+    unsigned long long bytes = 0;
+    unsigned int i;
+
+    if (capture_enabled) {
+        capture_compose_with_fb(Ctx, fb, interesting_rects, num_rects);
+    }
+
+    if (!stream) {
+        return 0;
+    }
+
+    TRACE(TRACE_COMPOSE, num_rects, 0, 0);
+
+    if (num_rects == 0) {
+        bytes = fb->width * fb->height * 4ULL;
+    }
+    for (i = 0; i < num_rects; i++) {
+        bytes += rect_bytes(&interesting_rects[i]);
+    }
+    stream->stats.overlay_bytes += bytes;
+    USDT3(overlay_compose, num_rects, bytes, 0);
+
+    if (stream->stats.checksums) {
+        overlay_compose_fb(&stream->checksums.overlay, fb, interesting_rects, num_rects);
+    }
+
+	return stream->backend->compose_with_fb(stream->ctx, fb, interesting_rects, num_rects) == 0;
 }
 
 bool v3_compose_with_rects(H264_context Ctx, struct image_buf rects[], unsigned int num_rects, bool last)
 {
-	return 1;
+    unsigned long long bytes = 0;
+    unsigned int i;
+
+    if (capture_enabled) {
+        capture_compose_with_rects(Ctx, rects, num_rects, last);
+    }
+
+    if (!stream) {
+        return 0;
+    }
+
+    TRACE(TRACE_COMPOSE, num_rects, 1, 0);
+
+    stream->stats.lossless_objects += num_rects;
+    for (i = 0; i < num_rects; i++) {
+        if (rects[i].lossless_op == IMAGE_OP_DRAW_LOSSLESS || rects[i].lossless_op == IMAGE_OP_SMALL_FRAME_BITMAP) {
+            bytes += rects[i].width * rects[i].height * 4ULL;
+        }
+    }
+    stream->stats.overlay_bytes += bytes;
+    USDT3(overlay_compose, num_rects, bytes, 1);
+
+    if (stream->stats.checksums) {
+        overlay_compose_rects(&stream->checksums.overlay, rects, num_rects);
+    }
+
+	return stream->backend->compose_with_rects(stream->ctx, rects, num_rects, last) == 0;
 }
 
 bool v3_push_frame(H264_context Ctx, struct window_info windows[], unsigned int num_windows, bool wait, bool *pushed)
 {
-    if (pushed) {
-        *pushed = 1;
+    int ret;
+
+    if (capture_enabled) {
+        capture_push_frame(Ctx, windows, num_windows, wait);
     }
 
-	return 1;
+    if (!stream) {
+        return 0;
+    }
+
+    TRACE(TRACE_PUSH_BEGIN, num_windows, wait, 0);
+    USDT2(present_begin, num_windows, wait);
+    ret = stream->backend->present(stream->ctx, windows, num_windows, wait, pushed);
+    TRACE(TRACE_PUSH_END, 0, 0, 0);
+    USDT1(present_end, ret);
+
+    if (stream->stats.checksums) {
+        checksum_push(&stream->checksums);
+    }
+
+	return ret == 0;
 }
@@ -9,6 +9,8 @@
 *
 ****************************************************************************/
 #include <stdio.h>
+#include <errno.h>
+#include <time.h>
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
@@ -25,13 +27,26 @@
 
 #include "bcm_host.h"
 #include "ilclient.h"
-#include "GLES/gl.h"
+#include "GLES2/gl2.h"
+#include "GLES2/gl2ext.h"
 #include "EGL/egl.h"
 #include "EGL/eglext.h"
 
 #define X11_SUPPORT
 #include "citrix.h"
 #include "H264_decode.h"
+#include "h264_parse.h"
+#include "probe.h"
+#include "capture.h"
+#include "backend.h"
+#include "calibrate.h"
+#include "trace.h"
+#include "usdt.h"
+#include "metrics.h"
+#include "hud.h"
+#include "presenter.h"
+#include "checksum.h"
+#include "analyze.h"
 
 typedef unsigned char BOOL;
 
@@ -39,6 +54,12 @@ typedef unsigned char BOOL;
 #define FALSE       0
 #define TIMEOUT_MS  2000
 
+/* Frames queued in the decoder above which non-reference frames are shed.
+ * Can be overridden with CTX_H264_SHED_DEPTH, 0 disables shedding.
+ */
+#define SHED_QUEUE_DEPTH    3
+#define MAX_QUEUED_FRAMES   64
+
 #define max(a,b) (((a) > (b)) ? (a) : (b)) 
 #define min(a,b) (((a) < (b)) ? (a) : (b))
 
@@ -49,6 +70,31 @@ typedef struct _comp_details {
     int             out_port;
 } comp_details;
 
+/* Decoder error recovery. After a failed submission or a decoder error
+ * event the input is flushed and everything up to the next IDR is dropped,
+ * rather than tearing down the context.
+ */
+typedef enum _decoder_state {
+    DECODER_STATE_RUNNING = 0,
+    DECODER_STATE_WAIT_IDR
+} decoder_state;
+
+/* Load shedding decision for the frame being received, taken at its first
+ * slice.
+ */
+typedef enum _shed_state {
+    SHED_UNDECIDED = 0,
+    SHED_KEEP,
+    SHED_DROP
+} shed_state;
+
+/* What happens to the NAL currently being received. */
+typedef enum _nal_state {
+    NAL_STATE_START = 0,    /* Start code seen, header byte not yet. */
+    NAL_STATE_PASS,         /* Being submitted. */
+    NAL_STATE_DROP          /* Being dropped. */
+} nal_state;
+
 typedef struct _OMXH264_decoder {
     ILCLIENT_T      *client;
     TUNNEL_T        tunnel[2];
@@ -57,11 +103,86 @@ typedef struct _OMXH264_decoder {
     comp_details    *video_render;
     int             renderer_init;
 
+    /* Decode-only contexts read the pictures back from video_decode's
+     * output port instead; set while its buffers are there.
+     */
+    volatile int    readback;
+    H264_frame      picture;        /* Describes each, filled in from the port. */
+
     int             width;
     int             height;
 
+    /* Input side of the decoder. NALs are submitted as soon as they are
+     * complete, so the buffer being filled persists across calls.
+     */
+    OMX_BUFFERHEADERTYPE *in_buf;
+    int                   port_settings_done;
+    int                   port_settings_pending;
+
+    volatile OMX_U32      error_event;  /* Set from the VideoCore callback thread. */
+
+    /* Watchdog. Input buffers come back on the VideoCore callback thread;
+     * if none return for TIMEOUT_MS while some are outstanding, the decoder
+     * is considered hung. A stalled renderer shows up the same way, as it
+     * back-pressures the decoder through the tunnel.
+     */
+    pthread_mutex_t       input_lock;
+    pthread_cond_t        input_cond;
+    int                   in_flight;
+    unsigned int          returned;     /* Input buffers come back so far. */
+    unsigned int          submitted;    /* Input buffers submitted so far. */
+    unsigned long         progress_ms;  /* Last time an input buffer came back. */
+
+    /* Decode queue depth, in frames. Input buffers come back in order, so
+     * a frame has left the queue once the buffer ending it has. The
+     * callback doesn't say which buffer came back, so the frame's latency
+     * timestamp is kept alongside.
+     */
+    unsigned int          frame_ends[MAX_QUEUED_FRAMES];
+    unsigned long long    frame_stamps[MAX_QUEUED_FRAMES];
+    int                   frame_ends_head;
+    int                   frame_ends_count;
+
+    /* Latency timestamp of the frame being received, and whether any of
+     * it has been submitted.
+     */
+    unsigned long long    frame_stamp;
+    int                   frame_started;
+
+    H264_stats           *stats;
+
 } OMXH264_decoder;
 
+/* A decoding context as seen by Receiver: the stream state kept by the
+ * v3_* front-end, over the backend context doing the work. The start code
+ * scanner persists across decode_frame() calls, as NALs are passed on as
+ * soon as they are complete.
+ */
+typedef struct _H264_stream {
+    const H264_backend   *backend;
+    void                 *ctx;
+
+    H264_nal_scanner      scanner;
+    nal_state             nal;
+    int                   nal_bytes;        /* Passed on for the current NAL. */
+    int                   frame_submitted;  /* Anything of this frame passed on. */
+
+    decoder_state         state;
+    shed_state            shed;
+    int                   shed_depth;
+
+    H264_stats            stats;
+    H264_metrics          metrics;
+    H264_hud              hud;
+    H264_checksums        checksums;        /* Of decode-only contexts. */
+    H264_analysis         analysis;
+} H264_stream;
+
+
+void DEBUG_TRACE(const char *format, ...);
+
+int decode_frame(H264_stream *stream, unsigned char *data, int size, int last);
+int drain_stream(H264_stream *stream);
 
 bool v3_init();
 H264_context v3_open_context(int width, int height, void *codec_data, int len, unsigned int options);
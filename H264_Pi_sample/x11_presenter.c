@@ -0,0 +1,518 @@
+/***************************************************************************
+*
+*   x11_presenter.c
+*
+*   X11 presenter, for desktops without DRM planes to spare. The context is
+*   composed in software (see convert.h) into an MIT-SHM image, a dirty
+*   rectangle at a time, and only those rectangles are put to Receiver's
+*   windows. The server's completion events say when each put is done.
+*
+****************************************************************************/
+
+#include "video_gl.h"
+
+#include <poll.h>
+#include <sys/socket.h>
+
+#include "presenter.h"
+#include "overlay.h"
+#include "convert.h"
+
+/* A put not done after this long is given up on. */
+#define X11_PUT_TIMEOUT_MS  1000
+
+/* Windows put to at once; seamless sessions rarely have more. */
+#define X11_MAX_WINDOWS     16
+
+extern Display *GetICADisplay();
+
+/* A window and the part of the context it shows. */
+typedef struct _x11_target {
+    Window              id;
+    int                 x;                      /* Context offset at the window's top left. */
+    int                 y;
+    int                 width;
+    int                 height;
+} x11_target;
+
+typedef struct _X11_presenter {
+    Display            *disp;                   /* Ours, not Receiver's, so its events are left alone. */
+    int                 completion;             /* ShmCompletion event type. */
+    XShmSegmentInfo     shm;
+    XImage             *image;                  /* The composed context, XRGB. */
+    GC                  gc;
+    Window              own_window;             /* Shown in when Receiver gives no window. */
+    int                 exposed;                /* "own_window" needs all of it put again. */
+    int                 width;
+    int                 height;
+
+    unsigned char      *layer;
+    H264_overlay        overlay;
+    H264_frame         *shown;                  /* Composed in the image. */
+    H264_dirty          redraw;                 /* Of the image, not yet composed. */
+
+    /* The put in flight. After open, the thread is the only user of the
+     * display; the image isn't written while "busy".
+     */
+    pthread_t           putter;
+    pthread_mutex_t     lock;
+    pthread_cond_t      cond;
+    int                 busy;
+    H264_dirty          put;
+    x11_target          targets[X11_MAX_WINDOWS];
+    unsigned int        num_targets;
+    x11_target          last_targets[X11_MAX_WINDOWS];  /* Of the last put, to spot new windows. */
+    unsigned int        num_last_targets;
+    H264_latency       *latency;                /* Of a frame the put shows first, if any. */
+    unsigned long long  timestamp;
+    bool               *pushed;
+    int                 failed;
+    int                 quit;
+} X11_presenter;
+
+/* Set by shm_error() while XShmAttach() is tried. */
+static int shm_attach_failed;
+
+static int shm_error(Display *disp, XErrorEvent *error)
+{
+    shm_attach_failed = 1;
+    return 0;
+}
+
+/* Shared memory only works with a server on this machine. */
+static int display_is_local(Display *disp)
+{
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+
+    return getsockname(ConnectionNumber(disp), (struct sockaddr *)&addr, &len) == 0 && addr.ss_family == AF_UNIX;
+}
+
+/***************************************************************************
+*   Puts.
+****************************************************************************/
+
+static int was_put(const X11_presenter *x11, const x11_target *target)
+{
+    unsigned int i;
+
+    for (i = 0; i < x11->num_last_targets; i++) {
+        if (!memcmp(&x11->last_targets[i], target, sizeof(x11_target))) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/*  Puts "rects" of the image to "target", each moved to the window and
+ *  clipped to it. Returns the number of puts, each of which sends a
+ *  completion event.
+ */
+static int put_target(X11_presenter *x11, const x11_target *target, const H264_dirty *rects)
+{
+    SIGNED_RECT clip;
+    unsigned int i;
+    int puts = 0;
+
+    for (i = 0; i < rects->num_rects; i++) {
+        clip.left = max(rects->rects[i].left, max(target->x, 0));
+        clip.top = max(rects->rects[i].top, max(target->y, 0));
+        clip.right = min(rects->rects[i].right, min(target->x + target->width, x11->width));
+        clip.bottom = min(rects->rects[i].bottom, min(target->y + target->height, x11->height));
+        if (clip.left >= clip.right || clip.top >= clip.bottom) {
+            continue;
+        }
+
+        XShmPutImage(x11->disp, target->id, x11->gc, x11->image, clip.left, clip.top, clip.left - target->x,
+                     clip.top - target->y, clip.right - clip.left, clip.bottom - clip.top, True);
+        puts++;
+    }
+
+    return puts;
+}
+
+/* Waits for "puts" completion events, noting exposures of our window. */
+static int wait_puts(X11_presenter *x11, int puts)
+{
+    struct pollfd pfd;
+    XEvent event;
+    int ret;
+
+    XFlush(x11->disp);
+
+    while (puts > 0) {
+        while (puts > 0 && XPending(x11->disp)) {
+            XNextEvent(x11->disp, &event);
+            if (event.type == x11->completion) {
+                puts--;
+            } else if (event.type == Expose && event.xexpose.window == x11->own_window) {
+                x11->exposed = 1;
+            }
+        }
+        if (puts == 0) {
+            break;
+        }
+
+        pfd.fd = ConnectionNumber(x11->disp);
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        do {
+            ret = poll(&pfd, 1, X11_PUT_TIMEOUT_MS);
+        } while (ret < 0 && errno == EINTR);
+
+        if (ret <= 0) {
+            DEBUG_TRACE("Put not done after %dms\n", X11_PUT_TIMEOUT_MS);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/*  Puts what changed to every window, and all of the context to windows
+ *  not put to before, or moved or resized since.
+ */
+static int put_image(X11_presenter *x11)
+{
+    H264_dirty all = { { { 0, 0, x11->width, x11->height } }, 1 };
+    x11_target *target;
+    unsigned int i;
+    int puts = 0;
+
+    if (x11->num_targets == 0) {
+        if (!x11->own_window) {
+            x11->own_window = XCreateSimpleWindow(x11->disp, DefaultRootWindow(x11->disp), 0, 0, x11->width,
+                                                  x11->height, 0, 0, 0);
+            XStoreName(x11->disp, x11->own_window, "H.264");
+            XSelectInput(x11->disp, x11->own_window, ExposureMask);
+            XMapWindow(x11->disp, x11->own_window);
+        }
+        target = &x11->targets[0];
+        target->id = x11->own_window;
+        target->x = 0;
+        target->y = 0;
+        target->width = x11->width;
+        target->height = x11->height;
+        x11->num_targets = 1;
+    }
+
+    for (i = 0; i < x11->num_targets; i++) {
+        target = &x11->targets[i];
+        if (!was_put(x11, target) || (target->id == x11->own_window && x11->exposed)) {
+            puts += put_target(x11, target, &all);
+        } else {
+            puts += put_target(x11, target, &x11->put);
+        }
+    }
+    x11->exposed = 0;
+
+    memcpy(x11->last_targets, x11->targets, x11->num_targets * sizeof(x11_target));
+    x11->num_last_targets = x11->num_targets;
+
+    return wait_puts(x11, puts);
+}
+
+/* Does each put posted by present(), and reports it done. */
+static void *putter(void *arg)
+{
+    X11_presenter *x11 = arg;
+    int ret;
+
+    pthread_mutex_lock(&x11->lock);
+
+    while (!x11->quit) {
+        if (!x11->busy) {
+            pthread_cond_wait(&x11->cond, &x11->lock);
+            continue;
+        }
+
+        pthread_mutex_unlock(&x11->lock);
+        ret = put_image(x11);
+        pthread_mutex_lock(&x11->lock);
+
+        if (ret != 0) {
+            x11->failed = 1;
+        } else {
+            latency_stamp(x11->latency, x11->timestamp, LATENCY_DISPLAYED);
+        }
+        x11->busy = 0;
+        if (x11->pushed) {
+            *x11->pushed = 1;
+            x11->pushed = NULL;
+            TRACE(TRACE_PUSHED, 0, 0, 0);
+        }
+        pthread_cond_broadcast(&x11->cond);
+    }
+
+    pthread_mutex_unlock(&x11->lock);
+
+    return NULL;
+}
+
+/* Waits for the put in flight, if any. Returns -1 if it failed. */
+static int finish_put(X11_presenter *x11)
+{
+    int ret;
+
+    pthread_mutex_lock(&x11->lock);
+    while (x11->busy) {
+        pthread_cond_wait(&x11->cond, &x11->lock);
+    }
+    ret = x11->failed ? -1 : 0;
+    x11->failed = 0;
+    pthread_mutex_unlock(&x11->lock);
+
+    return ret;
+}
+
+/***************************************************************************
+*   Presenter interface.
+****************************************************************************/
+
+static void x11_close(void *ctx)
+{
+    X11_presenter *x11 = ctx;
+
+    if (!x11) {
+        return;
+    }
+
+    if (x11->putter) {
+        finish_put(x11);
+
+        pthread_mutex_lock(&x11->lock);
+        x11->quit = 1;
+        pthread_cond_broadcast(&x11->cond);
+        pthread_mutex_unlock(&x11->lock);
+        pthread_join(x11->putter, NULL);
+    }
+
+    if (x11->shown) {
+        x11->shown->release(x11->shown);
+    }
+
+    if (x11->image) {
+        if (x11->shm.shmaddr) {
+            XShmDetach(x11->disp, &x11->shm);
+            shmdt(x11->shm.shmaddr);
+        }
+        x11->image->data = NULL;
+        XDestroyImage(x11->image);
+    }
+    if (x11->own_window) {
+        XDestroyWindow(x11->disp, x11->own_window);
+    }
+    if (x11->gc) {
+        XFreeGC(x11->disp, x11->gc);
+    }
+    if (x11->disp) {
+        XCloseDisplay(x11->disp);
+    }
+
+    pthread_cond_destroy(&x11->cond);
+    pthread_mutex_destroy(&x11->lock);
+    free(x11->layer);
+    free(x11);
+}
+
+/* An image of the context in a shared memory segment, removed once both
+ * sides have it attached so that it goes when we do.
+ */
+static int create_image(X11_presenter *x11)
+{
+    int screen = DefaultScreen(x11->disp);
+    XErrorHandler handler;
+
+    x11->image = XShmCreateImage(x11->disp, DefaultVisual(x11->disp, screen), DefaultDepth(x11->disp, screen),
+                                 ZPixmap, NULL, &x11->shm, x11->width, x11->height);
+    if (!x11->image) {
+        return -1;
+    }
+
+    /* The conversion writes 0x00RRGGBB words. */
+    if (x11->image->bits_per_pixel != 32 || x11->image->byte_order != LSBFirst ||
+        x11->image->red_mask != 0xff0000 || x11->image->green_mask != 0xff00 || x11->image->blue_mask != 0xff) {
+        DEBUG_TRACE("X11 visual not XRGB, %d bpp\n", x11->image->bits_per_pixel);
+        return -1;
+    }
+
+    x11->shm.shmid = shmget(IPC_PRIVATE, x11->image->bytes_per_line * x11->height, IPC_CREAT | 0600);
+    if (x11->shm.shmid < 0) {
+        return -1;
+    }
+    x11->shm.shmaddr = shmat(x11->shm.shmid, NULL, 0);
+    if (x11->shm.shmaddr == (char *)-1) {
+        x11->shm.shmaddr = NULL;
+        shmctl(x11->shm.shmid, IPC_RMID, NULL);
+        return -1;
+    }
+    x11->shm.readOnly = True;
+    x11->image->data = x11->shm.shmaddr;
+
+    shm_attach_failed = 0;
+    handler = XSetErrorHandler(shm_error);
+    XShmAttach(x11->disp, &x11->shm);
+    XSync(x11->disp, False);
+    XSetErrorHandler(handler);
+    shmctl(x11->shm.shmid, IPC_RMID, NULL);
+
+    if (shm_attach_failed) {
+        DEBUG_TRACE("XShmAttach failed\n");
+        shmdt(x11->shm.shmaddr);
+        x11->shm.shmaddr = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+static void *x11_open(int width, int height, unsigned int frames)
+{
+    Display *receiver = GetICADisplay();
+    X11_presenter *x11;
+
+    /* Frames are converted by the CPU. */
+    if (!(frames & PRESENTER_FRAMES_MAPPED) || !receiver) {
+        return NULL;
+    }
+
+    x11 = calloc(1, sizeof(X11_presenter));
+    if (!x11) {
+        return NULL;
+    }
+
+    x11->width = width;
+    x11->height = height;
+    pthread_mutex_init(&x11->lock, NULL);
+    pthread_cond_init(&x11->cond, NULL);
+
+    x11->disp = XOpenDisplay(DisplayString(receiver));
+    if (!x11->disp || !XShmQueryExtension(x11->disp) || !display_is_local(x11->disp)) {
+        DEBUG_TRACE("No local X server with MIT-SHM\n");
+        x11_close(x11);
+        return NULL;
+    }
+    x11->completion = XShmGetEventBase(x11->disp) + ShmCompletion;
+
+    x11->layer = calloc(width * height, 4);
+    if (!x11->layer || create_image(x11) != 0) {
+        x11_close(x11);
+        return NULL;
+    }
+    overlay_init(&x11->overlay, x11->layer, width * 4, width, height);
+    overlay_add_dirty(&x11->redraw, &(SIGNED_RECT){ 0, 0, width, height }, width, height);
+
+    x11->gc = XCreateGC(x11->disp, DefaultRootWindow(x11->disp), 0, NULL);
+
+    if (pthread_create(&x11->putter, NULL, putter, x11) != 0) {
+        x11->putter = 0;
+        x11_close(x11);
+        return NULL;
+    }
+
+    DEBUG_TRACE("X11 presenter on %s, %dx%d\n", DisplayString(x11->disp), width, height);
+
+    return x11;
+}
+
+/* The layer isn't read by another thread, so it's composed in place. */
+static int x11_compose_with_fb(void *ctx, struct image_buf *fb, SIGNED_RECT interesting_rects[],
+                               unsigned int num_rects)
+{
+    X11_presenter *x11 = ctx;
+
+    return overlay_compose_fb(&x11->overlay, fb, interesting_rects, num_rects);
+}
+
+static int x11_compose_with_rects(void *ctx, struct image_buf objects[], unsigned int num_objects, bool last)
+{
+    X11_presenter *x11 = ctx;
+
+    return overlay_compose_rects(&x11->overlay, objects, num_objects);
+}
+
+/*  Composes what changed into the image and hands the put to the thread,
+ *  which sets "pushed" once the server is done with it. Only one put can
+ *  be in flight, so a present() waits for the last one.
+ */
+static int x11_present(void *ctx, H264_frame *frame, const H264_dirty *damage, struct window_info windows[],
+                       unsigned int num_windows, bool wait, bool *pushed)
+{
+    X11_presenter *x11 = ctx;
+    unsigned int i, num_targets = 0;
+    int ret;
+
+    ret = finish_put(x11);
+
+    if (pushed) {
+        *pushed = 1;
+    }
+
+    for (i = 0; damage && i < damage->num_rects; i++) {
+        overlay_add_dirty(&x11->redraw, &damage->rects[i], x11->width, x11->height);
+    }
+    for (i = 0; i < x11->overlay.dirty.num_rects; i++) {
+        overlay_add_dirty(&x11->redraw, &x11->overlay.dirty.rects[i], x11->width, x11->height);
+    }
+
+    for (i = 0; i < x11->redraw.num_rects; i++) {
+        if (convert_compose((unsigned char *)x11->image->data, x11->image->bytes_per_line,
+                            frame ? frame : x11->shown, &x11->overlay, &x11->redraw.rects[i],
+                            CONVERT_BGRA) != 0) {
+            /* Left in "redraw", to be composed from the next frame. */
+            return -1;
+        }
+    }
+    overlay_clear_dirty(&x11->overlay);
+
+    if (frame) {
+        if (x11->shown) {
+            x11->shown->release(x11->shown);
+        }
+        x11->shown = frame;
+    }
+
+    for (i = 0; i < num_windows && num_targets < X11_MAX_WINDOWS; i++) {
+        x11_target *target = &x11->targets[num_targets];
+
+        target->id = windows[i].id;
+        target->x = windows[i].target_x;
+        target->y = windows[i].target_y;
+        target->width = windows[i].rect.right - windows[i].rect.left;
+        target->height = windows[i].rect.bottom - windows[i].rect.top;
+        if (target->width > 0 && target->height > 0) {
+            num_targets++;
+        }
+    }
+
+    pthread_mutex_lock(&x11->lock);
+    x11->put = x11->redraw;
+    x11->num_targets = num_targets;
+    x11->latency = frame ? frame->latency : NULL;
+    x11->timestamp = frame ? frame->timestamp : 0;
+    x11->busy = 1;
+    x11->pushed = pushed;
+    if (pushed) {
+        *pushed = 0;
+    }
+    pthread_cond_broadcast(&x11->cond);
+    pthread_mutex_unlock(&x11->lock);
+
+    x11->redraw.num_rects = 0;
+
+    if (wait) {
+        ret = min(ret, finish_put(x11));
+    }
+
+    return ret;
+}
+
+const H264_presenter x11_presenter = {
+    "x11",
+    x11_open,
+    x11_compose_with_fb,
+    x11_compose_with_rects,
+    x11_present,
+    x11_close,
+};
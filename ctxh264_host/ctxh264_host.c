@@ -0,0 +1,1197 @@
+/***************************************************************************
+*
+*   ctxh264_host.c
+*
+*   Receiver host emulator. Loads an H.264 decoder plugin the way Receiver
+*   does, replays a recorded session (see session.h) or a raw Annex-B
+*   stream through its H264_decoder table, and reports throughput,
+*   per-call latency and CPU time.
+*
+****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <dlfcn.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <X11/Xlib.h>
+
+#include "citrix.h"
+#include "H264_decode.h"
+#include "session.h"
+#include "analyze.h"
+
+#define MAX_CONTEXTS        8
+#define NS_PER_SEC          1000000000ULL
+
+typedef unsigned char BOOL;
+
+/* Exported to the plugin, as Receiver does. */
+BOOL TwiModeEnableFlag = FALSE;
+
+static Display *display = NULL;
+
+Display *GetICADisplay()
+{
+    return display;
+}
+
+typedef enum _host_call {
+    CALL_OPEN_CONTEXT,
+    CALL_START_FRAME,
+    CALL_DECODE_FRAME,
+    CALL_COMPOSE_WITH_FB,
+    CALL_COMPOSE_WITH_RECTS,
+    CALL_PUSH_FRAME,
+    CALL_CLOSE_CONTEXT,
+    CALL_FRAME,             /* start_frame() to the end of push_frame(). */
+    CALL_COUNT
+} host_call;
+
+static const char *call_names[CALL_COUNT] = {
+    "open_context",
+    "start_frame",
+    "decode_frame",
+    "compose_with_fb",
+    "compose_with_rects",
+    "push_frame",
+    "close_context",
+    "frame",
+};
+
+typedef struct _host_samples {
+    unsigned long long *ns;
+    unsigned int count;
+    unsigned int size;
+    unsigned int failed;
+} host_samples;
+
+typedef struct _host_session {
+    unsigned char *data;
+    size_t size;
+    BOOL mapped;
+    session_index_entry *index;     /* Frames that start with an IDR. */
+    unsigned int index_count;
+    BOOL own_index;
+    unsigned int frames;
+} host_session;
+
+typedef struct _host_context {
+    uint32_t recorded;              /* Context ID in the session. */
+    H264_context cxt;
+    struct image_buf fb;            /* Rebuilt frame buffer for compose_with_fb(). */
+    unsigned long long frame_start;
+    BOOL in_frame;
+    bool pushed;                    /* Set by the plugin after push_frame() returns, so kept here. */
+} host_context;
+
+typedef struct _host_options {
+    const char *plugin;
+    const char *input;
+    BOOL cadence;                   /* Keep the recorded timing. */
+    BOOL headless;
+    int loops;
+    unsigned int seek;
+    unsigned int max_frames;
+    int width, height;              /* Annex-B input only. */
+    int fps;
+    int chunk;
+    const char *checksums;          /* Decode-only, with checksums written here. */
+    BOOL analysis;                  /* Print the frames the plugin described instead of replaying. */
+} host_options;
+
+static struct H264_decoder *decoder;
+static host_samples samples[CALL_COUNT];
+static host_context contexts[MAX_CONTEXTS];
+static Window window = None;
+static unsigned int frames_done;
+static unsigned int loop_frames;
+
+static unsigned long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (unsigned long long)ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+static void append_sample(host_samples *s, unsigned long long ns)
+{
+    if (s->count == s->size) {
+        s->size = s->size ? s->size * 2 : 1024;
+        s->ns = realloc(s->ns, s->size * sizeof(*s->ns));
+        if (!s->ns) {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+    }
+
+    s->ns[s->count++] = ns;
+}
+
+static void add_sample(host_call call, unsigned long long ns, BOOL ok)
+{
+    append_sample(&samples[call], ns);
+    if (!ok) {
+        samples[call].failed++;
+    }
+}
+
+/***************************************************************************
+*   Session input.
+****************************************************************************/
+
+static const session_record *record_at(const host_session *session, uint64_t offset)
+{
+    const session_record *rec;
+
+    if (offset + sizeof(session_record) > session->size) {
+        return NULL;
+    }
+
+    rec = (const session_record *)(session->data + offset);
+    if (offset + sizeof(session_record) + rec->size > session->size) {
+        return NULL;
+    }
+
+    return rec;
+}
+
+static uint64_t next_record(const session_record *rec, uint64_t offset)
+{
+    return offset + sizeof(session_record) + SESSION_ALIGN(rec->size);
+}
+
+static BOOL has_idr(const unsigned char *data, uint32_t len)
+{
+    uint32_t i;
+
+    for (i = 0; i + 3 < len; i++) {
+        if (data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1 && (data[i + 3] & 0x1f) == 5) {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+/* Sessions that were not closed cleanly have no index, so rebuild it. */
+static int build_index(host_session *session)
+{
+    uint64_t offset = sizeof(session_header);
+    uint64_t open_offset = 0, frame_offset = 0, frame_time = 0;
+    const session_record *rec;
+    BOOL indexed = FALSE;
+    unsigned int size = 0;
+
+    session->own_index = TRUE;
+    session->frames = 0;
+    while ((rec = record_at(session, offset)) != NULL) {
+        const unsigned char *payload = (const unsigned char *)(rec + 1);
+
+        switch (rec->type) {
+        case SESSION_OPEN_CONTEXT:
+            open_offset = offset;
+            break;
+        case SESSION_START_FRAME:
+            frame_offset = offset;
+            frame_time = rec->time;
+            indexed = FALSE;
+            session->frames++;
+            break;
+        case SESSION_DECODE_FRAME:
+            if (!indexed && session->frames && has_idr(payload, rec->size)) {
+                if (session->index_count == size) {
+                    size = size ? size * 2 : 64;
+                    session->index = realloc(session->index, size * sizeof(session_index_entry));
+                    if (!session->index) {
+                        return -1;
+                    }
+                }
+                session->index[session->index_count].offset = frame_offset;
+                session->index[session->index_count].open_offset = open_offset;
+                session->index[session->index_count].time = frame_time;
+                session->index[session->index_count].frame = session->frames - 1;
+                session->index[session->index_count].reserved = 0;
+                session->index_count++;
+                indexed = TRUE;
+            }
+            break;
+        case SESSION_INDEX:
+            /* Nothing after the index is replayed. */
+            return 0;
+        }
+
+        offset = next_record(rec, offset);
+    }
+
+    return 0;
+}
+
+static void count_frames(host_session *session)
+{
+    uint64_t offset = sizeof(session_header);
+    const session_record *rec;
+
+    session->frames = 0;
+    while ((rec = record_at(session, offset)) != NULL && rec->type != SESSION_INDEX) {
+        if (rec->type == SESSION_START_FRAME) {
+            session->frames++;
+        }
+        offset = next_record(rec, offset);
+    }
+}
+
+static int read_index(host_session *session)
+{
+    const session_footer *footer;
+    const session_record *rec;
+
+    if (session->size < sizeof(session_header) + sizeof(session_footer)) {
+        return build_index(session);
+    }
+
+    footer = (const session_footer *)(session->data + session->size - sizeof(session_footer));
+    if (memcmp(footer->magic, SESSION_FOOTER_MAGIC, sizeof(footer->magic)) != 0 ||
+        (rec = record_at(session, footer->index_offset)) == NULL || rec->type != SESSION_INDEX) {
+        return build_index(session);
+    }
+
+    session->index = (session_index_entry *)(rec + 1);
+    session->index_count = rec->size / sizeof(session_index_entry);
+    count_frames(session);
+
+    return 0;
+}
+
+/***************************************************************************
+*   Raw Annex-B input, turned into a session in memory.
+****************************************************************************/
+
+typedef struct _host_writer {
+    unsigned char *data;
+    size_t size;
+    size_t used;
+} host_writer;
+
+static void *reserve(host_writer *w, size_t size)
+{
+    void *p;
+
+    if (w->used + size > w->size) {
+        while (w->used + size > w->size) {
+            w->size = w->size ? w->size * 2 : 65536;
+        }
+        w->data = realloc(w->data, w->size);
+        if (!w->data) {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+    }
+
+    p = w->data + w->used;
+    memset(p, 0, size);
+    w->used += size;
+
+    return p;
+}
+
+static void *write_record(host_writer *w, uint32_t type, uint32_t size, uint64_t time, uint32_t arg)
+{
+    session_record *rec = reserve(w, sizeof(session_record) + SESSION_ALIGN(size));
+
+    rec->type = type;
+    rec->size = size;
+    rec->time = time;
+    rec->context = 1;
+    rec->arg = arg;
+
+    return rec + 1;
+}
+
+/* Returns the offset of the next start code, or "len" if there is none. */
+static size_t find_start_code(const unsigned char *data, size_t len, size_t from)
+{
+    size_t i;
+
+    for (i = from; i + 2 < len; i++) {
+        if (data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1) {
+            return i;
+        }
+    }
+
+    return len;
+}
+
+static void write_access_unit(host_writer *w, const host_options *opt, const unsigned char *data, size_t len,
+                              unsigned int frame)
+{
+    uint64_t time = (uint64_t)frame * NS_PER_SEC / opt->fps;
+    session_start_frame *start;
+    size_t done, chunk;
+
+    start = write_record(w, SESSION_START_FRAME, sizeof(session_start_frame), time, 0);
+    start->encoded_size = len;
+    start->num_rects = 0;
+
+    for (done = 0; done < len; done += chunk) {
+        chunk = opt->chunk > 0 && len - done > (size_t)opt->chunk ? (size_t)opt->chunk : len - done;
+        memcpy(write_record(w, SESSION_DECODE_FRAME, chunk, time, done + chunk == len), data + done, chunk);
+    }
+
+    *(uint32_t *)write_record(w, SESSION_PUSH_FRAME, sizeof(uint32_t), time, 0) = 0;
+}
+
+/* Access units are split at the first SEI, SPS, PPS or AUD after a slice,
+ * or at a slice whose first_mb_in_slice is 0.
+ */
+static int convert_annexb(host_session *session, const host_options *opt, const unsigned char *data, size_t len)
+{
+    host_writer w = { NULL, 0, 0 };
+    session_header *header;
+    session_open *open;
+    size_t au_start, nal, next;
+    BOOL have_slice = FALSE;
+    unsigned int frame = 0;
+
+    header = reserve(&w, sizeof(session_header));
+    memcpy(header->magic, SESSION_MAGIC, sizeof(header->magic));
+    header->version = SESSION_VERSION;
+    header->header_size = sizeof(session_header);
+
+    open = write_record(&w, SESSION_OPEN_CONTEXT, sizeof(session_open), 0, 0);
+    open->width = opt->width;
+    open->height = opt->height;
+    open->options = 0;
+    open->codec_data_len = 0;
+
+    au_start = nal = find_start_code(data, len, 0);
+    while (nal < len) {
+        unsigned char type = nal + 3 < len ? data[nal + 3] & 0x1f : 0;
+        BOOL slice = type == 1 || type == 5;
+        BOOL first_mb = slice && nal + 4 < len && (data[nal + 4] & 0x80);
+
+        if (have_slice && ((type >= 6 && type <= 9) || first_mb)) {
+            /* Keep the leading zero of a 4-byte start code with its NAL. */
+            size_t end = nal > au_start && data[nal - 1] == 0 ? nal - 1 : nal;
+
+            write_access_unit(&w, opt, data + au_start, end - au_start, frame++);
+            au_start = end;
+            have_slice = FALSE;
+        }
+        have_slice |= slice;
+
+        next = find_start_code(data, len, nal + 3);
+        nal = next;
+    }
+
+    if (au_start < len) {
+        write_access_unit(&w, opt, data + au_start, len - au_start, frame++);
+    }
+
+    write_record(&w, SESSION_CLOSE_CONTEXT, 0, (uint64_t)frame * NS_PER_SEC / opt->fps, 0);
+
+    session->data = w.data;
+    session->size = w.used;
+    session->mapped = FALSE;
+
+    return build_index(session);
+}
+
+static int load_session(host_session *session, const host_options *opt)
+{
+    struct stat st;
+    unsigned char *data;
+    int fd;
+
+    memset(session, 0, sizeof(host_session));
+
+    fd = open(opt->input, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        fprintf(stderr, "Cannot open %s: %s\n", opt->input, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+
+    if (st.st_size < (off_t)sizeof(session_header)) {
+        fprintf(stderr, "%s is too short\n", opt->input);
+        close(fd);
+        return -1;
+    }
+
+    /* Private and writable, as decode_frame() takes non-const data. */
+    data = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "Cannot map %s: %s\n", opt->input, strerror(errno));
+        return -1;
+    }
+
+    if (memcmp(data, SESSION_MAGIC, sizeof(((session_header *)0)->magic)) == 0) {
+        session->data = data;
+        session->size = st.st_size;
+        session->mapped = TRUE;
+
+        if (((session_header *)data)->version != SESSION_VERSION) {
+            fprintf(stderr, "%s: unsupported session version %u\n", opt->input,
+                    ((session_header *)data)->version);
+            return -1;
+        }
+
+        return read_index(session);
+    }
+
+    if (find_start_code(data, st.st_size < 4 ? st.st_size : 4, 0) < 2) {
+        int ret = convert_annexb(session, opt, data, st.st_size);
+
+        munmap(data, st.st_size);
+        return ret;
+    }
+
+    fprintf(stderr, "%s is neither a session nor an Annex-B stream\n", opt->input);
+    munmap(data, st.st_size);
+
+    return -1;
+}
+
+static void free_session(host_session *session)
+{
+    if (session->own_index) {
+        free(session->index);
+    }
+
+    if (session->mapped) {
+        munmap(session->data, session->size);
+    } else {
+        free(session->data);
+    }
+}
+
+/***************************************************************************
+*   Replay.
+****************************************************************************/
+
+static host_context *find_context(uint32_t recorded)
+{
+    int i;
+
+    for (i = 0; i < MAX_CONTEXTS; i++) {
+        if (contexts[i].cxt != H264_INVALID_CONTEXT && contexts[i].recorded == recorded) {
+            return &contexts[i];
+        }
+    }
+
+    return NULL;
+}
+
+static void close_context(host_context *c)
+{
+    unsigned long long start = now_ns();
+
+    decoder->close_context(c->cxt);
+    add_sample(CALL_CLOSE_CONTEXT, now_ns() - start, TRUE);
+
+    free(c->fb.mem);
+    memset(c, 0, sizeof(host_context));
+}
+
+static void open_context(const session_record *rec)
+{
+    const session_open *open = (const session_open *)(rec + 1);
+    host_context *c = find_context(rec->context);
+    unsigned long long start;
+    H264_context cxt;
+    int i;
+
+    if (c) {
+        /* Receiver closes a context before opening it again. */
+        close_context(c);
+    }
+
+    for (i = 0; i < MAX_CONTEXTS && contexts[i].cxt != H264_INVALID_CONTEXT; i++) {
+    }
+    if (i == MAX_CONTEXTS) {
+        fprintf(stderr, "Too many contexts\n");
+        return;
+    }
+
+    start = now_ns();
+    cxt = decoder->open_context(open->width, open->height, open->codec_data_len ? (void *)(open + 1) : NULL,
+                                open->codec_data_len, open->options);
+    add_sample(CALL_OPEN_CONTEXT, now_ns() - start, cxt != H264_INVALID_CONTEXT);
+
+    if (cxt == H264_INVALID_CONTEXT) {
+        return;
+    }
+
+    c = &contexts[i];
+    c->recorded = rec->context;
+    c->cxt = cxt;
+
+    if (display && window == None) {
+        window = XCreateSimpleWindow(display, DefaultRootWindow(display), 0, 0, open->width, open->height, 0,
+                                     BlackPixel(display, DefaultScreen(display)),
+                                     BlackPixel(display, DefaultScreen(display)));
+        XMapWindow(display, window);
+        XFlush(display);
+    }
+}
+
+static void fill_image(struct image_buf *image, const session_image *recorded, void *bits)
+{
+    memset(image, 0, sizeof(struct image_buf));
+    image->cb_size = sizeof(struct image_buf);
+    image->bits = bits;
+    image->pixel_format = recorded->pixel_format;
+    image->lossless_op = recorded->lossless_op;
+    image->stride = recorded->stride;
+    image->width = recorded->width;
+    image->height = recorded->height;
+    image->dst_x = recorded->dst_x;
+    image->dst_y = recorded->dst_y;
+    image->src_x = recorded->src_x;
+    image->src_y = recorded->src_y;
+    image->col = recorded->col;
+}
+
+static BOOL has_pixels(const session_image *image)
+{
+    return image->lossless_op == IMAGE_OP_DRAW_LOSSLESS || image->lossless_op == IMAGE_OP_SMALL_FRAME_BITMAP;
+}
+
+/* Pixels a recorded rect carries: its rows as recorded, unclipped. */
+static uint64_t rect_pixels(const SIGNED_RECT *rect)
+{
+    if (rect->right <= rect->left || rect->bottom <= rect->top) {
+        return 0;
+    }
+
+    return (uint64_t)(rect->right - rect->left) * (rect->bottom - rect->top);
+}
+
+static BOOL compose_with_fb(host_context *c, const session_record *rec)
+{
+    const session_compose_fb *compose = (const session_compose_fb *)(rec + 1);
+    SIGNED_RECT *rects = (SIGNED_RECT *)(compose + 1);
+    const uint32_t *pixels = (const uint32_t *)(rects + compose->num_rects);
+    uint64_t needed = 0;
+    unsigned int i;
+    int y;
+
+    /* Records of sessions cut short by a crash may be anything. */
+    if (rec->size < sizeof(session_compose_fb) ||
+        compose->num_rects > (rec->size - sizeof(session_compose_fb)) / sizeof(SIGNED_RECT) ||
+        compose->fb.width == 0 || compose->fb.height == 0 ||
+        compose->fb.stride < 0 || (uint64_t)compose->fb.stride < (uint64_t)compose->fb.width * 4) {
+        return FALSE;
+    }
+
+    for (i = 0; i < compose->num_rects; i++) {
+        needed += rect_pixels(&rects[i]) * 4;
+    }
+    if (needed > rec->size - sizeof(session_compose_fb) - compose->num_rects * sizeof(SIGNED_RECT)) {
+        return FALSE;
+    }
+
+    if (!c->fb.mem || c->fb.stride != compose->fb.stride || c->fb.width != compose->fb.width ||
+        c->fb.height != compose->fb.height) {
+        free(c->fb.mem);
+        fill_image(&c->fb, &compose->fb, NULL);
+        c->fb.mem = calloc(1, (size_t)compose->fb.stride * compose->fb.height);
+        if (!c->fb.mem) {
+            return FALSE;
+        }
+        c->fb.bits = c->fb.mem;
+    }
+
+    /* Only the interesting rects were recorded, each clipped here to the
+     * frame buffer.
+     */
+    for (i = 0; i < compose->num_rects; i++) {
+        int left = rects[i].left < 0 ? 0 : rects[i].left;
+        int right = rects[i].right > (INT32)c->fb.width ? (INT32)c->fb.width : rects[i].right;
+        int width = rects[i].right - rects[i].left;
+
+        if (!rect_pixels(&rects[i])) {
+            continue;
+        }
+
+        for (y = rects[i].top; y < rects[i].bottom; y++) {
+            if (y >= 0 && y < (int)c->fb.height && right > left) {
+                memcpy((unsigned char *)c->fb.bits + (size_t)y * c->fb.stride + left * 4,
+                       pixels + (left - rects[i].left), (right - left) * 4);
+            }
+            pixels += width;
+        }
+    }
+
+    /* "arg" is set when the whole frame buffer was recorded for no rects. */
+    return decoder->compose_with_fb(c->cxt, &c->fb, rec->arg ? NULL : rects, rec->arg ? 0 : compose->num_rects);
+}
+
+static BOOL compose_with_rects(host_context *c, const session_record *rec)
+{
+    const unsigned char *p = (const unsigned char *)(rec + 1) + sizeof(uint32_t);
+    uint64_t left, pixels;
+    struct image_buf *objects;
+    uint32_t count, i;
+    BOOL ok;
+
+    /* As for compose_with_fb(), the record may be anything. */
+    if (rec->size < sizeof(uint32_t)) {
+        return FALSE;
+    }
+    count = *(const uint32_t *)(rec + 1);
+    left = rec->size - sizeof(uint32_t);
+    if (count > left / sizeof(session_image)) {
+        return FALSE;
+    }
+
+    objects = calloc(count ? count : 1, sizeof(struct image_buf));
+    if (!objects) {
+        return FALSE;
+    }
+
+    for (i = 0; i < count; i++) {
+        const session_image *image = (const session_image *)p;
+
+        if (left < sizeof(session_image)) {
+            free(objects);
+            return FALSE;
+        }
+        p += sizeof(session_image);
+        left -= sizeof(session_image);
+
+        fill_image(&objects[i], image, has_pixels(image) ? (void *)p : NULL);
+        if (has_pixels(image)) {
+            pixels = (uint64_t)image->width * image->height * 4;
+            if (pixels > left) {
+                free(objects);
+                return FALSE;
+            }
+            p += pixels;
+            left -= pixels;
+
+            /* The source rectangle was recorded packed. */
+            objects[i].stride = image->width * 4;
+            objects[i].src_x = 0;
+            objects[i].src_y = 0;
+        }
+    }
+
+    ok = decoder->compose_with_rects(c->cxt, objects, count, rec->arg);
+    free(objects);
+
+    return ok;
+}
+
+static BOOL push_frame(host_context *c, const session_record *rec)
+{
+    const session_window *recorded = (const session_window *)((const unsigned char *)(rec + 1) + sizeof(uint32_t));
+    struct window_info windows[16];
+    uint32_t count, i;
+
+    if (rec->size < sizeof(uint32_t)) {
+        return FALSE;
+    }
+    count = *(const uint32_t *)(rec + 1);
+    if (count > (rec->size - sizeof(uint32_t)) / sizeof(session_window)) {
+        return FALSE;
+    }
+
+    if (count > ELEMENTS_IN_ARRAY(windows)) {
+        count = ELEMENTS_IN_ARRAY(windows);
+    }
+
+    /* The recorded window IDs belong to another X server. */
+    for (i = 0; i < count; i++) {
+        windows[i].cb_size = sizeof(struct window_info);
+        windows[i].id = window;
+        windows[i].rect.left = recorded[i].left;
+        windows[i].rect.top = recorded[i].top;
+        windows[i].rect.right = recorded[i].right;
+        windows[i].rect.bottom = recorded[i].bottom;
+        windows[i].target_x = recorded[i].target_x;
+        windows[i].target_y = recorded[i].target_y;
+        windows[i].flags = recorded[i].flags;
+    }
+
+    c->pushed = 0;
+    return decoder->push_frame(c->cxt, count ? windows : NULL, count, rec->arg, &c->pushed);
+}
+
+static void sleep_until(unsigned long long when)
+{
+    struct timespec ts;
+
+    ts.tv_sec = when / NS_PER_SEC;
+    ts.tv_nsec = when % NS_PER_SEC;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+    }
+}
+
+/* Returns FALSE once enough frames have been replayed. */
+static BOOL replay_record(const session_record *rec, const host_options *opt)
+{
+    host_context *c;
+    unsigned long long start;
+    BOOL ok;
+
+    if (rec->type == SESSION_OPEN_CONTEXT) {
+        open_context(rec);
+        return TRUE;
+    }
+
+    c = find_context(rec->context);
+    if (!c) {
+        /* Context failed to open, or the record precedes the seek point. */
+        return TRUE;
+    }
+
+    start = now_ns();
+    switch (rec->type) {
+    case SESSION_START_FRAME:
+        if (opt->max_frames && loop_frames >= opt->max_frames) {
+            return FALSE;
+        }
+        c->frame_start = start;
+        c->in_frame = TRUE;
+        ok = decoder->start_frame(c->cxt, ((const session_start_frame *)(rec + 1))->encoded_size,
+                                  (SIGNED_RECT *)((const session_start_frame *)(rec + 1) + 1),
+                                  ((const session_start_frame *)(rec + 1))->num_rects);
+        add_sample(CALL_START_FRAME, now_ns() - start, ok);
+        break;
+    case SESSION_DECODE_FRAME:
+        ok = decoder->decode_frame(c->cxt, (void *)(rec + 1), rec->size, rec->arg);
+        add_sample(CALL_DECODE_FRAME, now_ns() - start, ok);
+        break;
+    case SESSION_COMPOSE_WITH_FB:
+        ok = compose_with_fb(c, rec);
+        add_sample(CALL_COMPOSE_WITH_FB, now_ns() - start, ok);
+        break;
+    case SESSION_COMPOSE_WITH_RECTS:
+        ok = compose_with_rects(c, rec);
+        add_sample(CALL_COMPOSE_WITH_RECTS, now_ns() - start, ok);
+        break;
+    case SESSION_PUSH_FRAME:
+        ok = push_frame(c, rec);
+        add_sample(CALL_PUSH_FRAME, now_ns() - start, ok);
+        if (c->in_frame) {
+            add_sample(CALL_FRAME, now_ns() - c->frame_start, ok);
+            c->in_frame = FALSE;
+            frames_done++;
+            loop_frames++;
+        }
+        break;
+    case SESSION_CLOSE_CONTEXT:
+        close_context(c);
+        break;
+    }
+
+    return TRUE;
+}
+
+static void replay(const host_session *session, const host_options *opt)
+{
+    uint64_t offset = sizeof(session_header);
+    unsigned long long base = 0, wall = 0;
+    const session_record *rec;
+    BOOL first = TRUE;
+
+    loop_frames = 0;
+    if (opt->seek) {
+        const session_index_entry *entry = NULL;
+        unsigned int i;
+
+        /* Start from the last IDR at or before the requested frame. */
+        for (i = 0; i < session->index_count && session->index[i].frame <= opt->seek; i++) {
+            entry = &session->index[i];
+        }
+
+        if (entry) {
+            if ((rec = record_at(session, entry->open_offset)) != NULL) {
+                replay_record(rec, opt);
+            }
+            offset = entry->offset;
+        }
+    }
+
+    while ((rec = record_at(session, offset)) != NULL && rec->type != SESSION_INDEX) {
+        if (opt->cadence) {
+            if (first) {
+                base = rec->time;
+                wall = now_ns();
+                first = FALSE;
+            } else if (rec->time > base) {
+                sleep_until(wall + (rec->time - base));
+            }
+        }
+
+        if (!replay_record(rec, opt)) {
+            break;
+        }
+
+        offset = next_record(rec, offset);
+    }
+}
+
+/***************************************************************************
+*   Report.
+****************************************************************************/
+
+static int compare_ns(const void *a, const void *b)
+{
+    unsigned long long x = *(const unsigned long long *)a, y = *(const unsigned long long *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static double percentile_us(const host_samples *s, double p)
+{
+    unsigned int i = (unsigned int)(p * (s->count - 1) + 0.5);
+
+    return s->ns[i] / 1000.0;
+}
+
+static double timeval_s(const struct timeval *tv)
+{
+    return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+static void report(const host_options *opt, const host_session *session, unsigned long long wall_ns,
+                   const struct rusage *before, const struct rusage *after)
+{
+    double wall = wall_ns / 1e9;
+    double user = timeval_s(&after->ru_utime) - timeval_s(&before->ru_utime);
+    double sys = timeval_s(&after->ru_stime) - timeval_s(&before->ru_stime);
+    int i;
+
+    printf("%s: %u frames (%u IDR), %d loop(s), %s\n", opt->input, session->frames, session->index_count,
+           opt->loops, opt->cadence ? "original cadence" : "as fast as possible");
+    printf("wall %.3f s, %u frames pushed, %.1f fps\n", wall, frames_done, wall > 0 ? frames_done / wall : 0);
+    printf("cpu %.3f s user, %.3f s sys, %.1f%% of one core\n", user, sys,
+           wall > 0 ? 100 * (user + sys) / wall : 0);
+    printf("\n%-20s %8s %6s %10s %10s %10s %10s\n", "call", "count", "failed", "p50 us", "p90 us", "p99 us",
+           "max us");
+
+    for (i = 0; i < CALL_COUNT; i++) {
+        host_samples *s = &samples[i];
+
+        if (!s->count) {
+            continue;
+        }
+
+        qsort(s->ns, s->count, sizeof(*s->ns), compare_ns);
+        printf("%-20s %8u %6u %10.1f %10.1f %10.1f %10.1f\n", call_names[i], s->count, s->failed,
+               percentile_us(s, 0.50), percentile_us(s, 0.90), percentile_us(s, 0.99),
+               s->ns[s->count - 1] / 1000.0);
+    }
+}
+
+/* Prints the digest and throughput of each context from the checksum file,
+ * written by the plugin as the contexts closed.
+ */
+static void report_checksums(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    char line[256];
+
+    if (!f) {
+        fprintf(stderr, "No checksums in %s, does the plugin support decode-only?\n", path);
+        return;
+    }
+
+    printf("\nchecksums in %s\n", path);
+    while (fgets(line, sizeof(line), f)) {
+        if (strncmp(line, "digest ", 7) == 0 || strncmp(line, "throughput ", 11) == 0) {
+            fputs(line, stdout);
+        }
+    }
+
+    fclose(f);
+}
+
+/***************************************************************************
+*   Frame analysis, from the SESSION_FRAME_INFO records of a capture (see
+*   analyze.h).
+****************************************************************************/
+
+static const char *class_names[ANALYZE_CLASSES] = {
+    "IDR", "I", "P", "B"
+};
+
+/* As analyze.c classes frames. */
+static int frame_class(const session_frame_info *info)
+{
+    if (info->slices == 0) {
+        return -1;
+    }
+    if (info->idr) {
+        return ANALYZE_IDR;
+    }
+    if (info->slice_types & (1 << H264_SLICE_B)) {
+        return ANALYZE_B;
+    }
+    if (info->slice_types & ((1 << H264_SLICE_P) | (1 << H264_SLICE_SP))) {
+        return ANALYZE_P;
+    }
+
+    return ANALYZE_I;
+}
+
+/* From the first submission to the picture out of the decoder, or the
+ * bitstream consumed; 0 if not seen.
+ */
+static unsigned int decode_us(const session_frame_info *info)
+{
+    const uint32_t *us = info->latency_us;
+    uint32_t end = us[LATENCY_DECODED] ? us[LATENCY_DECODED] : us[LATENCY_CONSUMED];
+
+    if (!end || !us[LATENCY_FIRST_SUBMIT] || end < us[LATENCY_FIRST_SUBMIT]) {
+        return 0;
+    }
+
+    return end > us[LATENCY_FIRST_SUBMIT] ? end - us[LATENCY_FIRST_SUBMIT] : 1;
+}
+
+static double stamp_ms(uint32_t us)
+{
+    return us / 1000.0;
+}
+
+/* Prints each frame described, then the figures of each class. Returns 0,
+ * or 1 if the session has no frames described.
+ */
+static int analyze_session(const host_session *session)
+{
+    host_samples decode[ANALYZE_CLASSES];
+    unsigned long long bytes[ANALYZE_CLASSES] = { 0 }, slices[ANALYZE_CLASSES] = { 0 };
+    unsigned int frames[ANALYZE_CLASSES] = { 0 }, max_bytes[ANALYZE_CLASSES] = { 0 };
+    unsigned int max_slices[ANALYZE_CLASSES] = { 0 }, described = 0;
+    uint64_t offset = sizeof(session_header);
+    const session_record *rec;
+    int c;
+
+    memset(decode, 0, sizeof(decode));
+
+    printf("%3s %7s %-3s %8s %4s %6s %9s %3s %3s %4s %-7s %9s %9s %9s %9s %9s\n", "ctx", "frame", "cls", "bytes",
+           "nals", "slices", "max slice", "ref", "qp", "refs", "flags", "submit", "consumed", "decoded",
+           "displayed", "decode");
+
+    while ((rec = record_at(session, offset)) != NULL && rec->type != SESSION_INDEX) {
+        const session_frame_info *info = (const session_frame_info *)(rec + 1);
+
+        offset = next_record(rec, offset);
+        if (rec->type != SESSION_FRAME_INFO || rec->size < sizeof(session_frame_info)) {
+            continue;
+        }
+
+        c = frame_class(info);
+        printf("%3u %7u %-3s %8u %4u %6u %9u %3u %3d %4u %c%c%c     %9.1f %9.1f %9.1f %9.1f %9.1f\n",
+               rec->context, info->frame, c >= 0 ? class_names[c] : "-", info->bytes, info->nals, info->slices,
+               info->max_slice_bytes, info->ref_idc, info->qp, info->refs,
+               info->flags & SESSION_FRAME_DROPPED ? 'D' : '-', info->flags & SESSION_FRAME_CABAC ? 'C' : '-',
+               info->flags & SESSION_FRAME_PARAMS ? 'S' : '-', stamp_ms(info->latency_us[LATENCY_FIRST_SUBMIT]),
+               stamp_ms(info->latency_us[LATENCY_CONSUMED]), stamp_ms(info->latency_us[LATENCY_DECODED]),
+               stamp_ms(info->latency_us[LATENCY_DISPLAYED]), stamp_ms(decode_us(info)));
+        described++;
+
+        if (c < 0) {
+            continue;
+        }
+        frames[c]++;
+        bytes[c] += info->bytes;
+        if (info->bytes > max_bytes[c]) {
+            max_bytes[c] = info->bytes;
+        }
+        slices[c] += info->slices;
+        if (info->slices > max_slices[c]) {
+            max_slices[c] = info->slices;
+        }
+        if (decode_us(info)) {
+            append_sample(&decode[c], decode_us(info) * 1000ULL);
+        }
+    }
+
+    if (!described) {
+        fprintf(stderr, "No frames described: capture with CTX_H264_ANALYZE other than 0\n");
+        return 1;
+    }
+
+    printf("\n%-5s %8s %10s %10s %8s %6s %10s %10s %10s\n", "class", "frames", "mean KB", "max KB", "slices",
+           "max", "p50 ms", "p99 ms", "max ms");
+    for (c = 0; c < ANALYZE_CLASSES; c++) {
+        host_samples *s = &decode[c];
+
+        if (!frames[c]) {
+            continue;
+        }
+
+        printf("%-5s %8u %10.1f %10.1f %8.1f %6u", class_names[c], frames[c], bytes[c] / 1024.0 / frames[c],
+               max_bytes[c] / 1024.0, (double)slices[c] / frames[c], max_slices[c]);
+        if (s->count) {
+            qsort(s->ns, s->count, sizeof(*s->ns), compare_ns);
+            printf(" %10.1f %10.1f %10.1f\n", percentile_us(s, 0.50) / 1000, percentile_us(s, 0.99) / 1000,
+                   s->ns[s->count - 1] / 1e6);
+        } else {
+            printf(" %10s %10s %10s\n", "-", "-", "-");
+        }
+        free(s->ns);
+    }
+
+    return 0;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "Usage: %s [options] <session | stream.264>\n"
+            "  -p plugin      decoder plugin to load (default ./ctxh264.so)\n"
+            "  -r             replay at the recorded cadence instead of as fast as possible\n"
+            "  -l loops       replay the session this many times (default 1)\n"
+            "  -s frame       start at the last IDR at or before this frame\n"
+            "  -n frames      stop after this many frames per loop\n"
+            "  -H             headless: no X display, init() is not called\n"
+            "  -t             report a seamless (TwiMode) session to the plugin\n"
+            "  -C file        decode only, showing nothing, and write checksums of each\n"
+            "                 picture and of the lossless layer to this file\n"
+            "  -A             print what each frame of a captured session was sent as and\n"
+            "                 how long it took to decode, by frame class, without replaying\n"
+            "Annex-B input only:\n"
+            "  -w width -h height   context size (default 1920x1080)\n"
+            "  -f fps               frame rate for -r (default 30)\n"
+            "  -c bytes             split frames into decode_frame() calls of this size\n",
+            name);
+}
+
+int main(int argc, char **argv)
+{
+    host_options opt = { "./ctxh264.so", NULL, FALSE, FALSE, 1, 0, 0, 1920, 1080, 30, 0, NULL, FALSE };
+    host_session session;
+    struct rusage before, after;
+    unsigned long long start;
+    void *plugin;
+    int c, i;
+
+    while ((c = getopt(argc, argv, "p:rl:s:n:HtC:Aw:h:f:c:")) != -1) {
+        switch (c) {
+        case 'p': opt.plugin = optarg; break;
+        case 'r': opt.cadence = TRUE; break;
+        case 'l': opt.loops = atoi(optarg); break;
+        case 's': opt.seek = atoi(optarg); break;
+        case 'n': opt.max_frames = atoi(optarg); break;
+        case 'H': opt.headless = TRUE; break;
+        case 't': TwiModeEnableFlag = TRUE; break;
+        case 'C': opt.checksums = optarg; break;
+        case 'A': opt.analysis = TRUE; break;
+        case 'w': opt.width = atoi(optarg); break;
+        case 'h': opt.height = atoi(optarg); break;
+        case 'f': opt.fps = atoi(optarg); break;
+        case 'c': opt.chunk = atoi(optarg); break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    if (optind != argc - 1 || opt.loops < 1 || opt.fps < 1) {
+        usage(argv[0]);
+        return 2;
+    }
+    opt.input = argv[optind];
+
+    if (load_session(&session, &opt) != 0) {
+        return 1;
+    }
+
+    if (opt.analysis) {
+        i = analyze_session(&session);
+        free_session(&session);
+        return i;
+    }
+
+    if (!opt.headless) {
+        display = XOpenDisplay(NULL);
+        if (!display) {
+            fprintf(stderr, "Cannot open X display, use -H to run without one\n");
+            return 1;
+        }
+    }
+
+    if (opt.checksums) {
+        /* The plugin appends to the file, one block per context. */
+        unlink(opt.checksums);
+        setenv("CTX_H264_DECODE_ONLY", "1", 1);
+        setenv("CTX_H264_CHECKSUM_FILE", opt.checksums, 1);
+    }
+
+    /* Receiver resolves the table with dlsym(), so must we. */
+    plugin = dlopen(opt.plugin, RTLD_NOW | RTLD_GLOBAL);
+    if (!plugin) {
+        fprintf(stderr, "Cannot load %s: %s\n", opt.plugin, dlerror());
+        return 1;
+    }
+
+    decoder = dlsym(plugin, "H264_decoder");
+    if (!decoder) {
+        fprintf(stderr, "%s has no H264_decoder: %s\n", opt.plugin, dlerror());
+        return 1;
+    }
+
+    if (decoder->ver_major != VERSION_MAJOR) {
+        fprintf(stderr, "%s implements interface %u.%u, expected %u.x\n", opt.plugin, decoder->ver_major,
+                decoder->ver_minor, VERSION_MAJOR);
+        return 1;
+    }
+
+    if (!opt.headless && !decoder->init()) {
+        fprintf(stderr, "%s: init() failed, Receiver would fall back to JPEG\n", opt.plugin);
+        return 1;
+    }
+
+    printf("%s: %ux%u@%d, options 0x%x, chroma 0x%x, %d context(s)\n", opt.plugin, decoder->width,
+           decoder->height, decoder->max_fps, decoder->options, decoder->chroma_formats, decoder->max_contexts);
+
+    getrusage(RUSAGE_SELF, &before);
+    start = now_ns();
+
+    for (i = 0; i < opt.loops; i++) {
+        int j;
+
+        replay(&session, &opt);
+
+        /* Sessions cut short by a crash have no close records. */
+        for (j = 0; j < MAX_CONTEXTS; j++) {
+            if (contexts[j].cxt != H264_INVALID_CONTEXT) {
+                close_context(&contexts[j]);
+            }
+        }
+    }
+
+    getrusage(RUSAGE_SELF, &after);
+    report(&opt, &session, now_ns() - start, &before, &after);
+    if (opt.checksums) {
+        report_checksums(opt.checksums);
+    }
+
+    decoder->end();
+    free_session(&session);
+
+    if (display) {
+        if (window != None) {
+            XDestroyWindow(display, window);
+        }
+        XCloseDisplay(display);
+    }
+
+    return 0;
+}
@@ -0,0 +1,313 @@
+/***************************************************************************
+*
+*   dispmanx.c
+*
+*   Stand-in dispmanx, bcm_host and gencmd services. Resources are plain
+*   host memory and updates are counted rather than displayed. The gencmd
+*   responses can be overridden with VC_STUB_* environment variables to
+*   emulate different boards.
+*
+****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <pthread.h>
+
+#include "bcm_host.h"
+
+#define MAX_RESOURCES   64
+#define MAX_ELEMENTS    64
+
+typedef struct _stub_resource {
+    int             used;
+    VC_IMAGE_TYPE_T type;
+    uint32_t        width;
+    uint32_t        height;
+    unsigned char  *pixels;
+} stub_resource;
+
+typedef struct _stub_element {
+    int                        used;
+    int32_t                    layer;
+    VC_RECT_T                  dest;
+    DISPMANX_RESOURCE_HANDLE_T resource;
+} stub_element;
+
+static pthread_mutex_t dispmanx_lock = PTHREAD_MUTEX_INITIALIZER;
+static stub_resource resources[MAX_RESOURCES];
+static stub_element elements[MAX_ELEMENTS];
+static uint32_t next_update = 1;
+
+static int bytes_per_pixel(VC_IMAGE_TYPE_T type)
+{
+    return type == VC_IMAGE_RGB565 ? 2 : 4;
+}
+
+void bcm_host_init(void)
+{
+}
+
+void bcm_host_deinit(void)
+{
+}
+
+int32_t graphics_get_display_size(const uint16_t display_number, uint32_t *width, uint32_t *height)
+{
+    char *size = getenv("VC_STUB_DISPLAY_SIZE");
+    unsigned int w = 1920, h = 1080;
+
+    if (size) {
+        sscanf(size, "%ux%u", &w, &h);
+    }
+
+    *width = w;
+    *height = h;
+
+    return 0;
+}
+
+int vc_dispmanx_rect_set(VC_RECT_T *rect, uint32_t x_offset, uint32_t y_offset, uint32_t width, uint32_t height)
+{
+    rect->x = x_offset;
+    rect->y = y_offset;
+    rect->width = width;
+    rect->height = height;
+
+    return 0;
+}
+
+DISPMANX_DISPLAY_HANDLE_T vc_dispmanx_display_open(uint32_t device)
+{
+    return device + 1;
+}
+
+int vc_dispmanx_display_close(DISPMANX_DISPLAY_HANDLE_T display)
+{
+    return 0;
+}
+
+DISPMANX_RESOURCE_HANDLE_T vc_dispmanx_resource_create(VC_IMAGE_TYPE_T type, uint32_t width, uint32_t height,
+                                                       uint32_t *native_image_handle)
+{
+    DISPMANX_RESOURCE_HANDLE_T handle = DISPMANX_NO_HANDLE;
+    int i;
+
+    pthread_mutex_lock(&dispmanx_lock);
+    for (i = 0; i < MAX_RESOURCES; i++) {
+        if (!resources[i].used) {
+            resources[i].used = 1;
+            resources[i].type = type;
+            resources[i].width = width;
+            resources[i].height = height;
+            resources[i].pixels = calloc(width * height, bytes_per_pixel(type));
+            handle = i + 1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&dispmanx_lock);
+
+    if (native_image_handle) {
+        *native_image_handle = handle;
+    }
+
+    return handle;
+}
+
+int vc_dispmanx_resource_write_data(DISPMANX_RESOURCE_HANDLE_T res, VC_IMAGE_TYPE_T src_type, int src_pitch,
+                                    void *src_address, const VC_RECT_T *rect)
+{
+    stub_resource *r;
+    int bpp, y;
+
+    if (res == DISPMANX_NO_HANDLE || res > MAX_RESOURCES || !resources[res - 1].used) {
+        return -1;
+    }
+
+    r = &resources[res - 1];
+    bpp = bytes_per_pixel(r->type);
+
+    if (rect->x < 0 || rect->y < 0 || rect->x + rect->width > (int32_t)r->width ||
+        rect->y + rect->height > (int32_t)r->height) {
+        return -1;
+    }
+
+    /* As on VideoCore, the source address points at the start of the
+     * whole image and only the rows covered by the rectangle are copied.
+     */
+    for (y = rect->y; y < rect->y + rect->height; y++) {
+        memcpy(r->pixels + (y * r->width + rect->x) * bpp,
+               (unsigned char *)src_address + y * src_pitch + rect->x * bpp,
+               rect->width * bpp);
+    }
+
+    return 0;
+}
+
+int vc_dispmanx_resource_delete(DISPMANX_RESOURCE_HANDLE_T res)
+{
+    if (res == DISPMANX_NO_HANDLE || res > MAX_RESOURCES) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&dispmanx_lock);
+    free(resources[res - 1].pixels);
+    memset(&resources[res - 1], 0, sizeof(stub_resource));
+    pthread_mutex_unlock(&dispmanx_lock);
+
+    return 0;
+}
+
+DISPMANX_UPDATE_HANDLE_T vc_dispmanx_update_start(int32_t priority)
+{
+    DISPMANX_UPDATE_HANDLE_T update;
+
+    pthread_mutex_lock(&dispmanx_lock);
+    update = next_update++;
+    pthread_mutex_unlock(&dispmanx_lock);
+
+    return update;
+}
+
+DISPMANX_ELEMENT_HANDLE_T vc_dispmanx_element_add(DISPMANX_UPDATE_HANDLE_T update, DISPMANX_DISPLAY_HANDLE_T display,
+                                                  int32_t layer, const VC_RECT_T *dest_rect,
+                                                  DISPMANX_RESOURCE_HANDLE_T src, const VC_RECT_T *src_rect,
+                                                  DISPMANX_PROTECTION_T protection, VC_DISPMANX_ALPHA_T *alpha,
+                                                  void *clamp, VC_IMAGE_TRANSFORM_T transform)
+{
+    DISPMANX_ELEMENT_HANDLE_T handle = DISPMANX_NO_HANDLE;
+    int i;
+
+    pthread_mutex_lock(&dispmanx_lock);
+    for (i = 0; i < MAX_ELEMENTS; i++) {
+        if (!elements[i].used) {
+            elements[i].used = 1;
+            elements[i].layer = layer;
+            elements[i].dest = *dest_rect;
+            elements[i].resource = src;
+            handle = i + 1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&dispmanx_lock);
+
+    return handle;
+}
+
+int vc_dispmanx_element_change_attributes(DISPMANX_UPDATE_HANDLE_T update, DISPMANX_ELEMENT_HANDLE_T element,
+                                          uint32_t change_flags, int32_t layer, uint8_t opacity,
+                                          const VC_RECT_T *dest_rect, const VC_RECT_T *src_rect,
+                                          DISPMANX_RESOURCE_HANDLE_T mask, VC_IMAGE_TRANSFORM_T transform)
+{
+    if (element == DISPMANX_NO_HANDLE || element > MAX_ELEMENTS) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&dispmanx_lock);
+    if (dest_rect) {
+        elements[element - 1].dest = *dest_rect;
+    }
+    pthread_mutex_unlock(&dispmanx_lock);
+
+    return 0;
+}
+
+int vc_dispmanx_element_change_source(DISPMANX_UPDATE_HANDLE_T update, DISPMANX_ELEMENT_HANDLE_T element,
+                                      DISPMANX_RESOURCE_HANDLE_T src)
+{
+    if (element == DISPMANX_NO_HANDLE || element > MAX_ELEMENTS) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&dispmanx_lock);
+    elements[element - 1].resource = src;
+    pthread_mutex_unlock(&dispmanx_lock);
+
+    return 0;
+}
+
+int vc_dispmanx_element_remove(DISPMANX_UPDATE_HANDLE_T update, DISPMANX_ELEMENT_HANDLE_T element)
+{
+    if (element == DISPMANX_NO_HANDLE || element > MAX_ELEMENTS) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&dispmanx_lock);
+    memset(&elements[element - 1], 0, sizeof(stub_element));
+    pthread_mutex_unlock(&dispmanx_lock);
+
+    return 0;
+}
+
+/* Updates take effect at once, so the callback is made straight away. */
+int vc_dispmanx_update_submit(DISPMANX_UPDATE_HANDLE_T update, DISPMANX_CALLBACK_FUNC_T cb_func, void *cb_arg)
+{
+    if (cb_func) {
+        cb_func(update, cb_arg);
+    }
+
+    return 0;
+}
+
+int vc_dispmanx_update_submit_sync(DISPMANX_UPDATE_HANDLE_T update)
+{
+    return 0;
+}
+
+/***************************************************************************
+*   gencmd.
+****************************************************************************/
+
+int vc_gencmd(char *response, int maxlen, const char *format, ...)
+{
+    char command[128];
+    char *value;
+    va_list args;
+
+    va_start(args, format);
+    vsnprintf(command, sizeof(command), format, args);
+    va_end(args);
+
+    if (strcmp(command, "get_mem gpu") == 0) {
+        value = getenv("VC_STUB_GPU_MEM");
+        snprintf(response, maxlen, "gpu=%sM", value ? value : "128");
+    } else if (strcmp(command, "get_mem arm") == 0) {
+        snprintf(response, maxlen, "arm=%sM", "384");
+    } else if (strcmp(command, "codec_enabled H264") == 0) {
+        value = getenv("VC_STUB_H264_ENABLED");
+        snprintf(response, maxlen, "H264=%s", (!value || atoi(value)) ? "enabled" : "disabled");
+    } else if (strncmp(command, "get_config ", 11) == 0) {
+        snprintf(response, maxlen, "%s=0", command + 11);
+    } else {
+        snprintf(response, maxlen, "error=1 error_msg=\"Command not registered\"");
+        return -1;
+    }
+
+    return 0;
+}
+
+int vc_gencmd_number_property(char *text, char *property, int *number)
+{
+    char *p = strstr(text, property);
+
+    if (!p || p[strlen(property)] != '=') {
+        return 0;
+    }
+
+    return sscanf(p + strlen(property) + 1, "%d", number) == 1;
+}
+
+int vc_gencmd_string_property(char *text, const char *property, char **value, int *length)
+{
+    char *p = strstr(text, property);
+
+    if (!p || p[strlen(property)] != '=') {
+        return 0;
+    }
+
+    *value = p + strlen(property) + 1;
+    *length = strcspn(*value, " \n");
+
+    return 1;
+}
@@ -0,0 +1,69 @@
+/***************************************************************************
+*
+*   OMX_Broadcom.h
+*
+*   Stand-in for the Broadcom OpenMAX IL headers.
+*
+****************************************************************************/
+#ifndef OMX_Broadcom_h
+#define OMX_Broadcom_h
+
+#include "OMX_Component.h"
+
+typedef enum OMX_DISPLAYTRANSFORMTYPE {
+    OMX_DISPLAY_ROT0 = 0,
+    OMX_DISPLAY_DUMMY = 0x7FFFFFFF
+} OMX_DISPLAYTRANSFORMTYPE;
+
+typedef struct OMX_DISPLAYRECTTYPE {
+    OMX_S16 x_offset;
+    OMX_S16 y_offset;
+    OMX_S16 width;
+    OMX_S16 height;
+} OMX_DISPLAYRECTTYPE;
+
+typedef enum OMX_DISPLAYMODETYPE {
+    OMX_DISPLAY_MODE_FILL = 0,
+    OMX_DISPLAY_MODE_LETTERBOX = 1,
+    OMX_DISPLAY_MODE_DUMMY = 0x7FFFFFFF
+} OMX_DISPLAYMODETYPE;
+
+typedef enum OMX_DISPLAYSETTYPE {
+    OMX_DISPLAY_SET_NONE = 0,
+    OMX_DISPLAY_SET_NUM = 1,
+    OMX_DISPLAY_SET_FULLSCREEN = 2,
+    OMX_DISPLAY_SET_TRANSFORM = 4,
+    OMX_DISPLAY_SET_DEST_RECT = 8,
+    OMX_DISPLAY_SET_SRC_RECT = 0x10,
+    OMX_DISPLAY_SET_MODE = 0x20,
+    OMX_DISPLAY_SET_PIXEL = 0x40,
+    OMX_DISPLAY_SET_NOASPECT = 0x80,
+    OMX_DISPLAY_SET_LAYER = 0x100,
+    OMX_DISPLAY_SET_COPYPROTECT = 0x200,
+    OMX_DISPLAY_SET_ALPHA = 0x400,
+    OMX_DISPLAY_SET_DUMMY = 0x7FFFFFFF
+} OMX_DISPLAYSETTYPE;
+
+/* OMX_IndexConfigDisplayRegion, of video_render's input port. */
+typedef struct OMX_CONFIG_DISPLAYREGIONTYPE {
+    OMX_U32 nSize;
+    OMX_VERSIONTYPE nVersion;
+    OMX_U32 nPortIndex;
+    OMX_DISPLAYSETTYPE set;
+    OMX_U32 num;
+    OMX_BOOL fullscreen;
+    OMX_DISPLAYTRANSFORMTYPE transform;
+    OMX_DISPLAYRECTTYPE dest_rect;
+    OMX_DISPLAYRECTTYPE src_rect;
+    OMX_BOOL noaspect;
+    OMX_DISPLAYMODETYPE mode;
+    OMX_U32 pixel_x;
+    OMX_U32 pixel_y;
+    OMX_S32 layer;
+    OMX_BOOL copyprotect_required;
+    OMX_U32 alpha;
+    OMX_U32 wfc_context_width;
+    OMX_U32 wfc_context_height;
+} OMX_CONFIG_DISPLAYREGIONTYPE;
+
+#endif /* OMX_Broadcom_h */
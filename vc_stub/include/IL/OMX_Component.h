@@ -0,0 +1,13 @@
+/***************************************************************************
+*
+*   OMX_Component.h
+*
+*   Stand-in for the Broadcom OpenMAX IL headers.
+*
+****************************************************************************/
+#ifndef OMX_Component_h
+#define OMX_Component_h
+
+#include "OMX_Core.h"
+
+#endif /* OMX_Component_h */
@@ -0,0 +1,151 @@
+/***************************************************************************
+*
+*   OMX_Core.h
+*
+*   Stand-in for the Broadcom OpenMAX IL headers. The core entry points are
+*   real functions here rather than macros through the component handle.
+*
+****************************************************************************/
+#ifndef OMX_Core_h
+#define OMX_Core_h
+
+#include "OMX_Types.h"
+#include "OMX_Index.h"
+#include "OMX_Video.h"
+
+typedef enum OMX_COMMANDTYPE {
+    OMX_CommandStateSet,
+    OMX_CommandFlush,
+    OMX_CommandPortDisable,
+    OMX_CommandPortEnable,
+    OMX_CommandMarkBuffer,
+    OMX_CommandMax = 0x7FFFFFFF
+} OMX_COMMANDTYPE;
+
+typedef enum OMX_STATETYPE {
+    OMX_StateInvalid,
+    OMX_StateLoaded,
+    OMX_StateIdle,
+    OMX_StateExecuting,
+    OMX_StatePause,
+    OMX_StateWaitForResources,
+    OMX_StateMax = 0x7FFFFFFF
+} OMX_STATETYPE;
+
+typedef enum OMX_ERRORTYPE {
+    OMX_ErrorNone = 0,
+    OMX_ErrorInsufficientResources = (OMX_S32) 0x80001000,
+    OMX_ErrorUndefined = (OMX_S32) 0x80001001,
+    OMX_ErrorInvalidComponentName = (OMX_S32) 0x80001002,
+    OMX_ErrorComponentNotFound = (OMX_S32) 0x80001003,
+    OMX_ErrorInvalidComponent = (OMX_S32) 0x80001004,
+    OMX_ErrorBadParameter = (OMX_S32) 0x80001005,
+    OMX_ErrorNotImplemented = (OMX_S32) 0x80001006,
+    OMX_ErrorUnderflow = (OMX_S32) 0x80001007,
+    OMX_ErrorOverflow = (OMX_S32) 0x80001008,
+    OMX_ErrorHardware = (OMX_S32) 0x80001009,
+    OMX_ErrorInvalidState = (OMX_S32) 0x8000100A,
+    OMX_ErrorStreamCorrupt = (OMX_S32) 0x8000100B,
+    OMX_ErrorPortsNotCompatible = (OMX_S32) 0x8000100C,
+    OMX_ErrorResourcesLost = (OMX_S32) 0x8000100D,
+    OMX_ErrorNoMore = (OMX_S32) 0x8000100E,
+    OMX_ErrorVersionMismatch = (OMX_S32) 0x8000100F,
+    OMX_ErrorNotReady = (OMX_S32) 0x80001010,
+    OMX_ErrorTimeout = (OMX_S32) 0x80001011,
+    OMX_ErrorSameState = (OMX_S32) 0x80001012,
+    OMX_ErrorIncorrectStateOperation = (OMX_S32) 0x80001018,
+    OMX_ErrorMax = 0x7FFFFFFF
+} OMX_ERRORTYPE;
+
+typedef enum OMX_EVENTTYPE {
+    OMX_EventCmdComplete,
+    OMX_EventError,
+    OMX_EventMark,
+    OMX_EventPortSettingsChanged,
+    OMX_EventBufferFlag,
+    OMX_EventResourcesAcquired,
+    OMX_EventComponentResumed,
+    OMX_EventDynamicResourcesAvailable,
+    OMX_EventPortFormatDetected,
+    OMX_EventMax = 0x7FFFFFFF
+} OMX_EVENTTYPE;
+
+#define OMX_BUFFERFLAG_EOS              0x00000001
+#define OMX_BUFFERFLAG_STARTTIME        0x00000002
+#define OMX_BUFFERFLAG_DECODEONLY       0x00000004
+#define OMX_BUFFERFLAG_DATACORRUPT      0x00000008
+#define OMX_BUFFERFLAG_ENDOFFRAME       0x00000010
+#define OMX_BUFFERFLAG_SYNCFRAME        0x00000020
+#define OMX_BUFFERFLAG_EXTRADATA        0x00000040
+#define OMX_BUFFERFLAG_CODECCONFIG      0x00000080
+#define OMX_BUFFERFLAG_TIME_UNKNOWN     0x00000100
+#define OMX_BUFFERFLAG_CAPTURE_PREVIEW  0x00000200
+#define OMX_BUFFERFLAG_ENDOFNAL         0x00000400
+#define OMX_BUFFERFLAG_FRAGMENTLIST     0x00000800
+#define OMX_BUFFERFLAG_DISCONTINUITY    0x00001000
+
+typedef struct OMX_BUFFERHEADERTYPE {
+    OMX_U32 nSize;
+    OMX_VERSIONTYPE nVersion;
+    OMX_U8 *pBuffer;
+    OMX_U32 nAllocLen;
+    OMX_U32 nFilledLen;
+    OMX_U32 nOffset;
+    OMX_PTR pAppPrivate;
+    OMX_PTR pPlatformPrivate;
+    OMX_PTR pInputPortPrivate;
+    OMX_PTR pOutputPortPrivate;
+    OMX_HANDLETYPE hMarkTargetComponent;
+    OMX_PTR pMarkData;
+    OMX_U32 nTickCount;
+    OMX_TICKS nTimeStamp;
+    OMX_U32 nFlags;
+    OMX_U32 nOutputPortIndex;
+    OMX_U32 nInputPortIndex;
+} OMX_BUFFERHEADERTYPE;
+
+typedef enum OMX_PORTDOMAINTYPE {
+    OMX_PortDomainAudio,
+    OMX_PortDomainVideo,
+    OMX_PortDomainImage,
+    OMX_PortDomainOther,
+    OMX_PortDomainMax = 0x7FFFFFFF
+} OMX_PORTDOMAINTYPE;
+
+typedef struct OMX_PARAM_PORTDEFINITIONTYPE {
+    OMX_U32 nSize;
+    OMX_VERSIONTYPE nVersion;
+    OMX_U32 nPortIndex;
+    OMX_DIRTYPE eDir;
+    OMX_U32 nBufferCountActual;
+    OMX_U32 nBufferCountMin;
+    OMX_U32 nBufferSize;
+    OMX_BOOL bEnabled;
+    OMX_BOOL bPopulated;
+    OMX_PORTDOMAINTYPE eDomain;
+    union {
+        OMX_VIDEO_PORTDEFINITIONTYPE video;
+    } format;
+    OMX_BOOL bBuffersContiguous;
+    OMX_U32 nBufferAlignment;
+} OMX_PARAM_PORTDEFINITIONTYPE;
+
+typedef struct OMX_PORT_PARAM_TYPE {
+    OMX_U32 nSize;
+    OMX_VERSIONTYPE nVersion;
+    OMX_U32 nPorts;
+    OMX_U32 nStartPortNumber;
+} OMX_PORT_PARAM_TYPE;
+
+OMX_ERRORTYPE OMX_Init(void);
+OMX_ERRORTYPE OMX_Deinit(void);
+
+OMX_ERRORTYPE OMX_GetParameter(OMX_HANDLETYPE hComponent, OMX_INDEXTYPE nParamIndex, OMX_PTR pComponentParameterStructure);
+OMX_ERRORTYPE OMX_SetParameter(OMX_HANDLETYPE hComponent, OMX_INDEXTYPE nParamIndex, OMX_PTR pComponentParameterStructure);
+OMX_ERRORTYPE OMX_GetConfig(OMX_HANDLETYPE hComponent, OMX_INDEXTYPE nConfigIndex, OMX_PTR pComponentConfigStructure);
+OMX_ERRORTYPE OMX_SetConfig(OMX_HANDLETYPE hComponent, OMX_INDEXTYPE nConfigIndex, OMX_PTR pComponentConfigStructure);
+OMX_ERRORTYPE OMX_SendCommand(OMX_HANDLETYPE hComponent, OMX_COMMANDTYPE Cmd, OMX_U32 nParam1, OMX_PTR pCmdData);
+OMX_ERRORTYPE OMX_EmptyThisBuffer(OMX_HANDLETYPE hComponent, OMX_BUFFERHEADERTYPE *pBuffer);
+OMX_ERRORTYPE OMX_FillThisBuffer(OMX_HANDLETYPE hComponent, OMX_BUFFERHEADERTYPE *pBuffer);
+
+#endif /* OMX_Core_h */
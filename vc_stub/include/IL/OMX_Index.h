@@ -0,0 +1,30 @@
+/***************************************************************************
+*
+*   OMX_Index.h
+*
+*   Stand-in for the Broadcom OpenMAX IL headers.
+*
+****************************************************************************/
+#ifndef OMX_Index_h
+#define OMX_Index_h
+
+typedef enum OMX_INDEXTYPE {
+    OMX_IndexComponentStartUnused = 0x01000000,
+    OMX_IndexParamPriorityMgmt,
+    OMX_IndexParamAudioInit,
+    OMX_IndexParamImageInit,
+    OMX_IndexParamVideoInit,
+    OMX_IndexParamOtherInit,
+
+    OMX_IndexPortStartUnused = 0x02000000,
+    OMX_IndexParamPortDefinition,
+
+    OMX_IndexVideoStartUnused = 0x06000000,
+    OMX_IndexParamVideoPortFormat,
+
+    OMX_IndexVendorStartUnused = 0x7F000000,
+    OMX_IndexConfigDisplayRegion,
+    OMX_IndexMax = 0x7FFFFFFF
+} OMX_INDEXTYPE;
+
+#endif /* OMX_Index_h */
@@ -0,0 +1,67 @@
+/***************************************************************************
+*
+*   OMX_Types.h
+*
+*   Stand-in for the Broadcom OpenMAX IL headers. Only the subset used by
+*   the H.264 plugin is declared.
+*
+****************************************************************************/
+#ifndef OMX_Types_h
+#define OMX_Types_h
+
+typedef unsigned char   OMX_U8;
+typedef signed char     OMX_S8;
+typedef unsigned short  OMX_U16;
+typedef signed short    OMX_S16;
+typedef unsigned int    OMX_U32;
+typedef signed int      OMX_S32;
+typedef unsigned long long OMX_U64;
+typedef signed long long   OMX_S64;
+
+typedef enum OMX_BOOL {
+    OMX_FALSE = 0,
+    OMX_TRUE = !OMX_FALSE,
+    OMX_BOOL_MAX = 0x7FFFFFFF
+} OMX_BOOL;
+
+typedef void           *OMX_PTR;
+typedef char           *OMX_STRING;
+typedef unsigned char  *OMX_BYTE;
+typedef void           *OMX_HANDLETYPE;
+typedef OMX_U32         OMX_NATIVE_WINDOWTYPE;
+typedef void           *OMX_NATIVE_DEVICETYPE;
+
+#ifdef OMX_SKIP64BIT
+typedef struct OMX_TICKS {
+    OMX_U32 nLowPart;
+    OMX_U32 nHighPart;
+} OMX_TICKS;
+#else
+typedef OMX_S64 OMX_TICKS;
+#endif
+
+#define OMX_VERSION_MAJOR    1
+#define OMX_VERSION_MINOR    1
+#define OMX_VERSION_REVISION 2
+#define OMX_VERSION_STEP     0
+
+#define OMX_VERSION ((OMX_VERSION_STEP << 24) | (OMX_VERSION_REVISION << 16) | \
+                     (OMX_VERSION_MINOR << 8) | OMX_VERSION_MAJOR)
+
+typedef union OMX_VERSIONTYPE {
+    struct {
+        OMX_U8 nVersionMajor;
+        OMX_U8 nVersionMinor;
+        OMX_U8 nRevision;
+        OMX_U8 nStep;
+    } s;
+    OMX_U32 nVersion;
+} OMX_VERSIONTYPE;
+
+typedef enum OMX_DIRTYPE {
+    OMX_DirInput,
+    OMX_DirOutput,
+    OMX_DirMax = 0x7FFFFFFF
+} OMX_DIRTYPE;
+
+#endif /* OMX_Types_h */
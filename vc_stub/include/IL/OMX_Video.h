@@ -0,0 +1,59 @@
+/***************************************************************************
+*
+*   OMX_Video.h
+*
+*   Stand-in for the Broadcom OpenMAX IL headers.
+*
+****************************************************************************/
+#ifndef OMX_Video_h
+#define OMX_Video_h
+
+#include "OMX_Types.h"
+
+typedef enum OMX_VIDEO_CODINGTYPE {
+    OMX_VIDEO_CodingUnused,
+    OMX_VIDEO_CodingAutoDetect,
+    OMX_VIDEO_CodingMPEG2,
+    OMX_VIDEO_CodingH263,
+    OMX_VIDEO_CodingMPEG4,
+    OMX_VIDEO_CodingWMV,
+    OMX_VIDEO_CodingRV,
+    OMX_VIDEO_CodingAVC,
+    OMX_VIDEO_CodingMJPEG,
+    OMX_VIDEO_CodingMax = 0x7FFFFFFF
+} OMX_VIDEO_CODINGTYPE;
+
+typedef enum OMX_COLOR_FORMATTYPE {
+    OMX_COLOR_FormatUnused,
+    OMX_COLOR_Format32bitARGB8888 = 16,
+    OMX_COLOR_FormatYUV420PackedPlanar = 20,
+    OMX_COLOR_Format32bitABGR8888 = 0x7F000001,
+    OMX_COLOR_FormatMax = 0x7FFFFFFF
+} OMX_COLOR_FORMATTYPE;
+
+typedef struct OMX_VIDEO_PORTDEFINITIONTYPE {
+    OMX_STRING cMIMEType;
+    OMX_NATIVE_DEVICETYPE pNativeRender;
+    OMX_U32 nFrameWidth;
+    OMX_U32 nFrameHeight;
+    OMX_S32 nStride;
+    OMX_U32 nSliceHeight;
+    OMX_U32 nBitrate;
+    OMX_U32 xFramerate;
+    OMX_BOOL bFlagErrorConcealment;
+    OMX_VIDEO_CODINGTYPE eCompressionFormat;
+    OMX_COLOR_FORMATTYPE eColorFormat;
+    OMX_NATIVE_WINDOWTYPE pNativeWindow;
+} OMX_VIDEO_PORTDEFINITIONTYPE;
+
+typedef struct OMX_VIDEO_PARAM_PORTFORMATTYPE {
+    OMX_U32 nSize;
+    OMX_VERSIONTYPE nVersion;
+    OMX_U32 nPortIndex;
+    OMX_U32 nIndex;
+    OMX_VIDEO_CODINGTYPE eCompressionFormat;
+    OMX_COLOR_FORMATTYPE eColorFormat;
+    OMX_U32 xFramerate;
+} OMX_VIDEO_PARAM_PORTFORMATTYPE;
+
+#endif /* OMX_Video_h */
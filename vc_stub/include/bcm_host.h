@@ -0,0 +1,21 @@
+/***************************************************************************
+*
+*   bcm_host.h
+*
+*   Stand-in for the Broadcom host support header.
+*
+****************************************************************************/
+#ifndef BCM_HOST_H
+#define BCM_HOST_H
+
+#include <stdint.h>
+
+#include "interface/vmcs_host/vc_dispmanx.h"
+#include "interface/vmcs_host/vc_gencmd.h"
+
+void bcm_host_init(void);
+void bcm_host_deinit(void);
+
+int32_t graphics_get_display_size(const uint16_t display_number, uint32_t *width, uint32_t *height);
+
+#endif /* BCM_HOST_H */
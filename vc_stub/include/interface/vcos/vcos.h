@@ -0,0 +1,18 @@
+/***************************************************************************
+*
+*   vcos.h
+*
+*   Stand-in for the VideoCore OS abstraction layer header.
+*
+****************************************************************************/
+#ifndef VCOS_H
+#define VCOS_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <dlfcn.h>
+
+typedef uint32_t VCOS_UNSIGNED;
+
+#endif /* VCOS_H */
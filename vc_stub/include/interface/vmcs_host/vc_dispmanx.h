@@ -0,0 +1,93 @@
+/***************************************************************************
+*
+*   vc_dispmanx.h
+*
+*   Stand-in for the VideoCore dispmanx host interface.
+*
+****************************************************************************/
+#ifndef _VC_DISPMANX_H_
+#define _VC_DISPMANX_H_
+
+#include <stdint.h>
+
+typedef uint32_t DISPMANX_DISPLAY_HANDLE_T;
+typedef uint32_t DISPMANX_UPDATE_HANDLE_T;
+typedef uint32_t DISPMANX_ELEMENT_HANDLE_T;
+typedef uint32_t DISPMANX_RESOURCE_HANDLE_T;
+typedef uint32_t DISPMANX_PROTECTION_T;
+
+#define DISPMANX_NO_HANDLE        0
+#define DISPMANX_PROTECTION_NONE  0
+
+typedef enum {
+    VC_IMAGE_MIN = 0,
+    VC_IMAGE_RGB565 = 1,
+    VC_IMAGE_YUV420 = 7,
+    VC_IMAGE_RGBA32 = 15,
+    VC_IMAGE_ARGB8888 = 43,
+    VC_IMAGE_XRGB8888 = 44,
+    VC_IMAGE_MAX
+} VC_IMAGE_TYPE_T;
+
+typedef enum {
+    VC_IMAGE_ROT0 = 0
+} VC_IMAGE_TRANSFORM_T;
+
+typedef enum {
+    DISPMANX_FLAGS_ALPHA_FROM_SOURCE = 0,
+    DISPMANX_FLAGS_ALPHA_FIXED_ALL_PIXELS = 1,
+    DISPMANX_FLAGS_ALPHA_FIXED_NON_ZERO = 2,
+    DISPMANX_FLAGS_ALPHA_FIXED_EXCEED_0X07 = 3,
+    DISPMANX_FLAGS_ALPHA_PREMULT = 1 << 16,
+    DISPMANX_FLAGS_ALPHA_MIX = 1 << 17
+} DISPMANX_FLAGS_ALPHA_T;
+
+typedef struct {
+    DISPMANX_FLAGS_ALPHA_T flags;
+    uint32_t opacity;
+    DISPMANX_RESOURCE_HANDLE_T mask;
+} VC_DISPMANX_ALPHA_T;
+
+typedef void (*DISPMANX_CALLBACK_FUNC_T)(DISPMANX_UPDATE_HANDLE_T update, void *arg);
+
+typedef struct tag_VC_RECT_T {
+    int32_t x;
+    int32_t y;
+    int32_t width;
+    int32_t height;
+} VC_RECT_T;
+
+typedef struct {
+    DISPMANX_ELEMENT_HANDLE_T element;
+    int width;
+    int height;
+} EGL_DISPMANX_WINDOW_T;
+
+int vc_dispmanx_rect_set(VC_RECT_T *rect, uint32_t x_offset, uint32_t y_offset, uint32_t width, uint32_t height);
+
+DISPMANX_DISPLAY_HANDLE_T vc_dispmanx_display_open(uint32_t device);
+int vc_dispmanx_display_close(DISPMANX_DISPLAY_HANDLE_T display);
+
+DISPMANX_RESOURCE_HANDLE_T vc_dispmanx_resource_create(VC_IMAGE_TYPE_T type, uint32_t width, uint32_t height,
+                                                       uint32_t *native_image_handle);
+int vc_dispmanx_resource_write_data(DISPMANX_RESOURCE_HANDLE_T res, VC_IMAGE_TYPE_T src_type, int src_pitch,
+                                    void *src_address, const VC_RECT_T *rect);
+int vc_dispmanx_resource_delete(DISPMANX_RESOURCE_HANDLE_T res);
+
+DISPMANX_UPDATE_HANDLE_T vc_dispmanx_update_start(int32_t priority);
+DISPMANX_ELEMENT_HANDLE_T vc_dispmanx_element_add(DISPMANX_UPDATE_HANDLE_T update, DISPMANX_DISPLAY_HANDLE_T display,
+                                                  int32_t layer, const VC_RECT_T *dest_rect,
+                                                  DISPMANX_RESOURCE_HANDLE_T src, const VC_RECT_T *src_rect,
+                                                  DISPMANX_PROTECTION_T protection, VC_DISPMANX_ALPHA_T *alpha,
+                                                  void *clamp, VC_IMAGE_TRANSFORM_T transform);
+int vc_dispmanx_element_change_attributes(DISPMANX_UPDATE_HANDLE_T update, DISPMANX_ELEMENT_HANDLE_T element,
+                                          uint32_t change_flags, int32_t layer, uint8_t opacity,
+                                          const VC_RECT_T *dest_rect, const VC_RECT_T *src_rect,
+                                          DISPMANX_RESOURCE_HANDLE_T mask, VC_IMAGE_TRANSFORM_T transform);
+int vc_dispmanx_element_change_source(DISPMANX_UPDATE_HANDLE_T update, DISPMANX_ELEMENT_HANDLE_T element,
+                                      DISPMANX_RESOURCE_HANDLE_T src);
+int vc_dispmanx_element_remove(DISPMANX_UPDATE_HANDLE_T update, DISPMANX_ELEMENT_HANDLE_T element);
+int vc_dispmanx_update_submit(DISPMANX_UPDATE_HANDLE_T update, DISPMANX_CALLBACK_FUNC_T cb_func, void *cb_arg);
+int vc_dispmanx_update_submit_sync(DISPMANX_UPDATE_HANDLE_T update);
+
+#endif /* _VC_DISPMANX_H_ */
@@ -0,0 +1,15 @@
+/***************************************************************************
+*
+*   vc_gencmd.h
+*
+*   Stand-in for the VideoCore general command service.
+*
+****************************************************************************/
+#ifndef VC_GENCMD_H
+#define VC_GENCMD_H
+
+int vc_gencmd(char *response, int maxlen, const char *format, ...);
+int vc_gencmd_number_property(char *text, char *property, int *number);
+int vc_gencmd_string_property(char *text, const char *property, char **value, int *length);
+
+#endif /* VC_GENCMD_H */
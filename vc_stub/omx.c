@@ -0,0 +1,1073 @@
+/***************************************************************************
+*
+*   omx.c
+*
+*   Stand-in OpenMAX IL core and ilclient implementation. Components are
+*   simulated on the host: video_decode parses the SPS of the incoming
+*   stream to report port settings, "decodes" each frame after a configurable
+*   latency and hands it to whatever it is tunnelled to. Buffer counts,
+*   latencies and failures are controlled through VC_STUB_* environment
+*   variables so the plugin's buffering and recovery paths can be exercised
+*   deterministically off-device.
+*
+****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "ilclient.h"
+
+#define MAX_PORTS       2
+#define MAX_BUFFERS     64
+#define MAX_QUEUE       (MAX_BUFFERS * 2)
+
+typedef struct _stub_event {
+    OMX_EVENTTYPE       event;
+    OMX_U32             data1;
+    OMX_U32             data2;
+    struct _stub_event *next;
+} stub_event;
+
+typedef struct _stub_port {
+    OMX_PARAM_PORTDEFINITIONTYPE def;
+
+    OMX_BUFFERHEADERTYPE *buffers[MAX_BUFFERS];
+    int                   num_buffers;
+
+    /* Buffers currently owned by the client. */
+    OMX_BUFFERHEADERTYPE *avail[MAX_BUFFERS];
+    int                   num_avail;
+} stub_port;
+
+struct _ILCLIENT_T {
+    ILCLIENT_BUFFER_CALLBACK_T  empty_buffer_done;
+    void                       *empty_buffer_done_data;
+    ILCLIENT_BUFFER_CALLBACK_T  fill_buffer_done;
+    void                       *fill_buffer_done_data;
+    ILCLIENT_CALLBACK_T         error;
+    void                       *error_data;
+    ILCLIENT_CALLBACK_T         port_settings;
+    void                       *port_settings_data;
+    ILCLIENT_CALLBACK_T         eos;
+    void                       *eos_data;
+};
+
+struct _COMPONENT_T {
+    char            name[32];
+    ILCLIENT_T     *client;
+    OMX_STATETYPE   state;
+    int             is_decoder;
+
+    stub_port       ports[MAX_PORTS];
+    int             num_ports;
+
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    stub_event     *events;
+
+    /* Input buffers submitted with OMX_EmptyThisBuffer, and output buffers
+     * submitted with OMX_FillThisBuffer, waiting for the worker.
+     */
+    OMX_BUFFERHEADERTYPE *in_queue[MAX_QUEUE];
+    int                   in_head, in_count;
+    OMX_BUFFERHEADERTYPE *out_queue[MAX_QUEUE];
+    int                   out_head, out_count;
+
+    pthread_t       worker;
+    int             terminate;
+    int             hung;
+
+    COMPONENT_T    *sink;
+    int             output_buffers; /* Created to give its output to the client. */
+
+    int             settings_sent;
+    unsigned int    frame_hash;
+    unsigned long   buffers_consumed;
+    unsigned long   frames_decoded;
+};
+
+/* Configuration, read once from the environment. */
+static struct {
+    int loaded;
+    int input_buffers;
+    int input_buffer_size;
+    int decode_us;
+    int error_every;
+    int etb_fail_every;
+    int hang_after;
+    int tunnel_fail;
+} config;
+
+static int hang_fired = 0;
+static unsigned long etb_count = 0;
+
+static int env_int(const char *name, int def)
+{
+    char *value = getenv(name);
+
+    return value ? atoi(value) : def;
+}
+
+static void load_config()
+{
+    if (config.loaded) {
+        return;
+    }
+
+    config.input_buffers = env_int("VC_STUB_INPUT_BUFFERS", 20);
+    config.input_buffer_size = env_int("VC_STUB_INPUT_BUFFER_SIZE", 81920);
+    config.decode_us = env_int("VC_STUB_DECODE_US", 0);
+    config.error_every = env_int("VC_STUB_ERROR_EVERY", 0);
+    config.etb_fail_every = env_int("VC_STUB_ETB_FAIL_EVERY", 0);
+    config.hang_after = env_int("VC_STUB_HANG_AFTER", 0);
+    config.tunnel_fail = env_int("VC_STUB_TUNNEL_FAIL", 0);
+
+    if (config.input_buffers > MAX_BUFFERS) {
+        config.input_buffers = MAX_BUFFERS;
+    }
+
+    config.loaded = 1;
+}
+
+static void deadline_in(struct timespec *ts, int ms)
+{
+    clock_gettime(CLOCK_REALTIME, ts);
+    ts->tv_sec += ms / 1000;
+    ts->tv_nsec += (ms % 1000) * 1000000L;
+    if (ts->tv_nsec >= 1000000000L) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000L;
+    }
+}
+
+static stub_port *find_port(COMPONENT_T *comp, OMX_U32 index)
+{
+    int i;
+
+    for (i = 0; i < comp->num_ports; i++) {
+        if (comp->ports[i].def.nPortIndex == index) {
+            return &comp->ports[i];
+        }
+    }
+
+    return NULL;
+}
+
+static void post_event(COMPONENT_T *comp, OMX_EVENTTYPE event, OMX_U32 data1, OMX_U32 data2)
+{
+    stub_event *ev = calloc(1, sizeof(stub_event));
+    stub_event **tail;
+
+    ev->event = event;
+    ev->data1 = data1;
+    ev->data2 = data2;
+
+    pthread_mutex_lock(&comp->lock);
+    for (tail = &comp->events; *tail; tail = &(*tail)->next);
+    *tail = ev;
+    pthread_cond_broadcast(&comp->cond);
+    pthread_mutex_unlock(&comp->lock);
+}
+
+/* Must be called with the component lock held. */
+static int take_event(COMPONENT_T *comp, OMX_EVENTTYPE event, OMX_U32 data1, int ignore1, OMX_U32 data2, int ignore2)
+{
+    stub_event **ev;
+
+    for (ev = &comp->events; *ev; ev = &(*ev)->next) {
+        if ((*ev)->event == event &&
+            (ignore1 || (*ev)->data1 == data1) &&
+            (ignore2 || (*ev)->data2 == data2)) {
+            stub_event *found = *ev;
+
+            *ev = found->next;
+            free(found);
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+/***************************************************************************
+*   Bitstream inspection.
+****************************************************************************/
+
+typedef struct _bit_reader {
+    const unsigned char *data;
+    int                  len;
+    int                  pos;
+} bit_reader;
+
+static unsigned int read_bits(bit_reader *br, int n)
+{
+    unsigned int v = 0;
+
+    while (n--) {
+        int bit = 0;
+
+        if ((br->pos >> 3) < br->len) {
+            bit = (br->data[br->pos >> 3] >> (7 - (br->pos & 7))) & 1;
+        }
+        v = (v << 1) | bit;
+        br->pos++;
+    }
+
+    return v;
+}
+
+static unsigned int read_ue(bit_reader *br)
+{
+    int zeros = 0;
+
+    while (read_bits(br, 1) == 0 && zeros < 32) {
+        zeros++;
+    }
+
+    return ((1u << zeros) - 1) + read_bits(br, zeros);
+}
+
+static int read_se(bit_reader *br)
+{
+    unsigned int v = read_ue(br);
+
+    return (v & 1) ? (int)((v + 1) / 2) : -(int)(v / 2);
+}
+
+static void skip_scaling_list(bit_reader *br, int size)
+{
+    int last = 8, next = 8, j;
+
+    for (j = 0; j < size; j++) {
+        if (next != 0) {
+            next = (last + read_se(br) + 256) % 256;
+        }
+        last = next ? next : last;
+    }
+}
+
+/* Extract the coded size from an SPS NAL payload (after the header byte). */
+static void parse_sps(const unsigned char *nal, int len, int *width, int *height)
+{
+    unsigned char rbsp[256];
+    int n = 0, zeros = 0, i;
+    bit_reader br;
+
+    /* Strip emulation prevention bytes. */
+    for (i = 0; i < len && n < (int)sizeof(rbsp); i++) {
+        if (zeros >= 2 && nal[i] == 3) {
+            zeros = 0;
+            continue;
+        }
+        zeros = nal[i] == 0 ? zeros + 1 : 0;
+        rbsp[n++] = nal[i];
+    }
+
+    br.data = rbsp;
+    br.len = n;
+    br.pos = 0;
+
+    int profile_idc = read_bits(&br, 8);
+    read_bits(&br, 16);         /* Constraint flags, level_idc. */
+    read_ue(&br);               /* seq_parameter_set_id */
+
+    int chroma_format_idc = 1;
+    if (profile_idc == 100 || profile_idc == 110 || profile_idc == 122 || profile_idc == 244 ||
+        profile_idc == 44 || profile_idc == 83 || profile_idc == 86 || profile_idc == 118 || profile_idc == 128) {
+        chroma_format_idc = read_ue(&br);
+        if (chroma_format_idc == 3) {
+            read_bits(&br, 1);
+        }
+        read_ue(&br);
+        read_ue(&br);
+        read_bits(&br, 1);
+        if (read_bits(&br, 1)) {
+            for (i = 0; i < (chroma_format_idc != 3 ? 8 : 12); i++) {
+                if (read_bits(&br, 1)) {
+                    skip_scaling_list(&br, i < 6 ? 16 : 64);
+                }
+            }
+        }
+    }
+
+    read_ue(&br);               /* log2_max_frame_num_minus4 */
+    int poc_type = read_ue(&br);
+    if (poc_type == 0) {
+        read_ue(&br);
+    } else if (poc_type == 1) {
+        read_bits(&br, 1);
+        read_se(&br);
+        read_se(&br);
+        int cycle = read_ue(&br);
+        for (i = 0; i < cycle; i++) {
+            read_se(&br);
+        }
+    }
+    read_ue(&br);               /* max_num_ref_frames */
+    read_bits(&br, 1);
+
+    int mbs_w = read_ue(&br) + 1;
+    int map_h = read_ue(&br) + 1;
+    int frame_mbs_only = read_bits(&br, 1);
+    if (!frame_mbs_only) {
+        read_bits(&br, 1);
+    }
+    read_bits(&br, 1);
+
+    int crop_l = 0, crop_r = 0, crop_t = 0, crop_b = 0;
+    if (read_bits(&br, 1)) {
+        crop_l = read_ue(&br);
+        crop_r = read_ue(&br);
+        crop_t = read_ue(&br);
+        crop_b = read_ue(&br);
+    }
+
+    int crop_x = chroma_format_idc == 3 ? 1 : 2;
+    int crop_y = (chroma_format_idc == 1 ? 2 : 1) * (2 - frame_mbs_only);
+
+    *width = mbs_w * 16 - (crop_l + crop_r) * crop_x;
+    *height = (2 - frame_mbs_only) * map_h * 16 - (crop_t + crop_b) * crop_y;
+}
+
+/* Looks for an SPS in an Annex-B buffer. */
+static int find_sps(const unsigned char *data, int len, int *width, int *height)
+{
+    int i;
+
+    for (i = 0; i + 3 < len; i++) {
+        if (data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1 && (data[i + 3] & 0x1f) == 7) {
+            parse_sps(data + i + 4, len - i - 4, width, height);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/***************************************************************************
+*   Component worker.
+****************************************************************************/
+
+static void return_input_buffer(COMPONENT_T *comp, OMX_BUFFERHEADERTYPE *buf)
+{
+    stub_port *port = &comp->ports[0];
+
+    pthread_mutex_lock(&comp->lock);
+    buf->nFilledLen = 0;
+    port->avail[port->num_avail++] = buf;
+    pthread_cond_broadcast(&comp->cond);
+    pthread_mutex_unlock(&comp->lock);
+
+    if (comp->client->empty_buffer_done) {
+        comp->client->empty_buffer_done(comp->client->empty_buffer_done_data, comp);
+    }
+}
+
+static void output_frame(COMPONENT_T *comp, OMX_TICKS timestamp)
+{
+    stub_port *out = &comp->ports[1];
+    OMX_BUFFERHEADERTYPE *buf = NULL;
+
+    if (comp->sink) {
+        /* Tunnelled: the sink "displays" the frame. */
+        COMPONENT_T *sink = comp->sink;
+
+        pthread_mutex_lock(&sink->lock);
+        sink->frames_decoded++;
+        pthread_mutex_unlock(&sink->lock);
+        return;
+    }
+
+    pthread_mutex_lock(&comp->lock);
+    /* As the firmware does, a client reading output back gets every
+     * picture: decoding stalls until there is a buffer for it.
+     */
+    while (comp->output_buffers && !comp->out_count && !comp->terminate) {
+        pthread_cond_wait(&comp->cond, &comp->lock);
+    }
+    if (comp->out_count) {
+        buf = comp->out_queue[comp->out_head];
+        comp->out_head = (comp->out_head + 1) % MAX_QUEUE;
+        comp->out_count--;
+    }
+    pthread_mutex_unlock(&comp->lock);
+
+    if (!buf) {
+        /* No output buffer available, the frame is dropped. */
+        return;
+    }
+
+    /* Synthesise a picture that depends only on the coded data. */
+    unsigned int size = out->def.nBufferSize < buf->nAllocLen ? out->def.nBufferSize : buf->nAllocLen;
+    unsigned int h = comp->frame_hash, i;
+    for (i = 0; i + 4 <= size; i += 4) {
+        h = h * 1103515245u + 12345u;
+        memcpy(buf->pBuffer + i, &h, 4);
+    }
+    buf->nFilledLen = size;
+    buf->nFlags = OMX_BUFFERFLAG_ENDOFFRAME;
+    buf->nTimeStamp = timestamp;
+
+    pthread_mutex_lock(&comp->lock);
+    out->avail[out->num_avail++] = buf;
+    pthread_cond_broadcast(&comp->cond);
+    pthread_mutex_unlock(&comp->lock);
+
+    if (comp->client->fill_buffer_done) {
+        comp->client->fill_buffer_done(comp->client->fill_buffer_done_data, comp);
+    }
+}
+
+static void decode_buffer(COMPONENT_T *comp, OMX_BUFFERHEADERTYPE *buf)
+{
+    int width, height, i;
+
+    if (!comp->settings_sent && find_sps(buf->pBuffer + buf->nOffset, buf->nFilledLen, &width, &height)) {
+        stub_port *out = &comp->ports[1];
+
+        out->def.format.video.nFrameWidth = width;
+        out->def.format.video.nFrameHeight = height;
+        out->def.format.video.nStride = (width + 31) & ~31;
+        out->def.format.video.nSliceHeight = (height + 15) & ~15;
+        out->def.nBufferSize = out->def.format.video.nStride * out->def.format.video.nSliceHeight * 3 / 2;
+        comp->settings_sent = 1;
+
+        post_event(comp, OMX_EventPortSettingsChanged, out->def.nPortIndex, 0);
+        if (comp->client->port_settings) {
+            comp->client->port_settings(comp->client->port_settings_data, comp, out->def.nPortIndex);
+        }
+    }
+
+    for (i = 0; i < (int)buf->nFilledLen; i++) {
+        comp->frame_hash = comp->frame_hash * 31 + buf->pBuffer[buf->nOffset + i];
+    }
+
+    if (buf->nFlags & OMX_BUFFERFLAG_ENDOFFRAME) {
+        OMX_TICKS timestamp = buf->nTimeStamp;
+
+        if (config.decode_us) {
+            usleep(config.decode_us);
+        }
+
+        comp->frames_decoded++;
+
+        if (config.error_every && (comp->frames_decoded % config.error_every) == 0) {
+            post_event(comp, OMX_EventError, (OMX_U32)OMX_ErrorStreamCorrupt, 0);
+            if (comp->client->error) {
+                comp->client->error(comp->client->error_data, comp, (OMX_U32)OMX_ErrorStreamCorrupt);
+            }
+        } else if (comp->settings_sent) {
+            output_frame(comp, timestamp);
+        }
+
+        comp->frame_hash = 0;
+    }
+}
+
+static void *component_worker(void *arg)
+{
+    COMPONENT_T *comp = (COMPONENT_T *)arg;
+
+    pthread_mutex_lock(&comp->lock);
+    for (;;) {
+        while (!comp->terminate && (comp->in_count == 0 || comp->hung)) {
+            pthread_cond_wait(&comp->cond, &comp->lock);
+        }
+
+        if (comp->terminate) {
+            break;
+        }
+
+        OMX_BUFFERHEADERTYPE *buf = comp->in_queue[comp->in_head];
+
+        if (config.hang_after && !hang_fired && comp->buffers_consumed >= (unsigned long)config.hang_after) {
+            /* Simulate a firmware hang: stop consuming input until flushed. */
+            hang_fired = 1;
+            comp->hung = 1;
+            continue;
+        }
+
+        comp->in_head = (comp->in_head + 1) % MAX_QUEUE;
+        comp->in_count--;
+        comp->buffers_consumed++;
+        pthread_mutex_unlock(&comp->lock);
+
+        decode_buffer(comp, buf);
+        return_input_buffer(comp, buf);
+
+        pthread_mutex_lock(&comp->lock);
+    }
+    pthread_mutex_unlock(&comp->lock);
+
+    return NULL;
+}
+
+/* Returns every queued buffer to the client. */
+static void flush_component(COMPONENT_T *comp)
+{
+    OMX_BUFFERHEADERTYPE *flushed[MAX_QUEUE];
+    int n = 0;
+
+    pthread_mutex_lock(&comp->lock);
+    while (comp->in_count) {
+        flushed[n++] = comp->in_queue[comp->in_head];
+        comp->in_head = (comp->in_head + 1) % MAX_QUEUE;
+        comp->in_count--;
+    }
+    while (comp->out_count && comp->num_ports > 1) {
+        stub_port *out = &comp->ports[1];
+
+        out->avail[out->num_avail++] = comp->out_queue[comp->out_head];
+        comp->out_head = (comp->out_head + 1) % MAX_QUEUE;
+        comp->out_count--;
+    }
+    comp->hung = 0;
+    comp->frame_hash = 0;
+    pthread_mutex_unlock(&comp->lock);
+
+    while (n--) {
+        return_input_buffer(comp, flushed[n]);
+    }
+}
+
+/***************************************************************************
+*   OMX core.
+****************************************************************************/
+
+OMX_ERRORTYPE OMX_Init(void)
+{
+    load_config();
+    return OMX_ErrorNone;
+}
+
+OMX_ERRORTYPE OMX_Deinit(void)
+{
+    return OMX_ErrorNone;
+}
+
+OMX_ERRORTYPE OMX_GetParameter(OMX_HANDLETYPE hComponent, OMX_INDEXTYPE nParamIndex, OMX_PTR param)
+{
+    COMPONENT_T *comp = (COMPONENT_T *)hComponent;
+
+    switch (nParamIndex) {
+    case OMX_IndexParamVideoInit:
+    case OMX_IndexParamImageInit:
+    case OMX_IndexParamOtherInit: {
+        OMX_PORT_PARAM_TYPE *p = (OMX_PORT_PARAM_TYPE *)param;
+
+        p->nPorts = comp->num_ports;
+        p->nStartPortNumber = comp->ports[0].def.nPortIndex;
+        return OMX_ErrorNone;
+    }
+    case OMX_IndexParamPortDefinition: {
+        OMX_PARAM_PORTDEFINITIONTYPE *p = (OMX_PARAM_PORTDEFINITIONTYPE *)param;
+        stub_port *port = find_port(comp, p->nPortIndex);
+
+        if (!port) {
+            return OMX_ErrorBadParameter;
+        }
+        pthread_mutex_lock(&comp->lock);
+        *p = port->def;
+        pthread_mutex_unlock(&comp->lock);
+        return OMX_ErrorNone;
+    }
+    case OMX_IndexParamVideoPortFormat: {
+        OMX_VIDEO_PARAM_PORTFORMATTYPE *p = (OMX_VIDEO_PARAM_PORTFORMATTYPE *)param;
+        stub_port *port = find_port(comp, p->nPortIndex);
+
+        if (!port) {
+            return OMX_ErrorBadParameter;
+        }
+        p->eCompressionFormat = port->def.format.video.eCompressionFormat;
+        p->eColorFormat = port->def.format.video.eColorFormat;
+        return OMX_ErrorNone;
+    }
+    default:
+        return OMX_ErrorNotImplemented;
+    }
+}
+
+OMX_ERRORTYPE OMX_SetParameter(OMX_HANDLETYPE hComponent, OMX_INDEXTYPE nParamIndex, OMX_PTR param)
+{
+    COMPONENT_T *comp = (COMPONENT_T *)hComponent;
+
+    switch (nParamIndex) {
+    case OMX_IndexParamPortDefinition: {
+        OMX_PARAM_PORTDEFINITIONTYPE *p = (OMX_PARAM_PORTDEFINITIONTYPE *)param;
+        stub_port *port = find_port(comp, p->nPortIndex);
+
+        if (!port || port->num_buffers) {
+            return port ? OMX_ErrorIncorrectStateOperation : OMX_ErrorBadParameter;
+        }
+        if (p->nBufferCountActual < port->def.nBufferCountMin || p->nBufferCountActual > MAX_BUFFERS) {
+            return OMX_ErrorBadParameter;
+        }
+        pthread_mutex_lock(&comp->lock);
+        port->def.nBufferCountActual = p->nBufferCountActual;
+        if (p->nBufferSize > port->def.nBufferSize) {
+            port->def.nBufferSize = p->nBufferSize;
+        }
+        pthread_mutex_unlock(&comp->lock);
+        return OMX_ErrorNone;
+    }
+    case OMX_IndexParamVideoPortFormat: {
+        OMX_VIDEO_PARAM_PORTFORMATTYPE *p = (OMX_VIDEO_PARAM_PORTFORMATTYPE *)param;
+        stub_port *port = find_port(comp, p->nPortIndex);
+
+        if (!port) {
+            return OMX_ErrorBadParameter;
+        }
+        port->def.format.video.eCompressionFormat = p->eCompressionFormat;
+        return OMX_ErrorNone;
+    }
+    default:
+        return OMX_ErrorNotImplemented;
+    }
+}
+
+OMX_ERRORTYPE OMX_GetConfig(OMX_HANDLETYPE hComponent, OMX_INDEXTYPE nConfigIndex, OMX_PTR config)
+{
+    return OMX_ErrorNotImplemented;
+}
+
+OMX_ERRORTYPE OMX_SetConfig(OMX_HANDLETYPE hComponent, OMX_INDEXTYPE nConfigIndex, OMX_PTR config)
+{
+    return OMX_ErrorNone;
+}
+
+OMX_ERRORTYPE OMX_SendCommand(OMX_HANDLETYPE hComponent, OMX_COMMANDTYPE Cmd, OMX_U32 nParam1, OMX_PTR pCmdData)
+{
+    COMPONENT_T *comp = (COMPONENT_T *)hComponent;
+
+    switch (Cmd) {
+    case OMX_CommandStateSet:
+        comp->state = (OMX_STATETYPE)nParam1;
+        break;
+    case OMX_CommandFlush:
+        flush_component(comp);
+        break;
+    default:
+        break;
+    }
+
+    post_event(comp, OMX_EventCmdComplete, Cmd, nParam1);
+
+    return OMX_ErrorNone;
+}
+
+OMX_ERRORTYPE OMX_EmptyThisBuffer(OMX_HANDLETYPE hComponent, OMX_BUFFERHEADERTYPE *pBuffer)
+{
+    COMPONENT_T *comp = (COMPONENT_T *)hComponent;
+
+    if (config.etb_fail_every && (++etb_count % config.etb_fail_every) == 0) {
+        return OMX_ErrorHardware;
+    }
+
+    if (comp->state != OMX_StateExecuting || pBuffer->nFilledLen > pBuffer->nAllocLen) {
+        return OMX_ErrorIncorrectStateOperation;
+    }
+
+    pthread_mutex_lock(&comp->lock);
+    comp->in_queue[(comp->in_head + comp->in_count) % MAX_QUEUE] = pBuffer;
+    comp->in_count++;
+    pthread_cond_broadcast(&comp->cond);
+    pthread_mutex_unlock(&comp->lock);
+
+    return OMX_ErrorNone;
+}
+
+OMX_ERRORTYPE OMX_FillThisBuffer(OMX_HANDLETYPE hComponent, OMX_BUFFERHEADERTYPE *pBuffer)
+{
+    COMPONENT_T *comp = (COMPONENT_T *)hComponent;
+
+    if (comp->num_ports < 2) {
+        return OMX_ErrorBadParameter;
+    }
+
+    pthread_mutex_lock(&comp->lock);
+    comp->out_queue[(comp->out_head + comp->out_count) % MAX_QUEUE] = pBuffer;
+    comp->out_count++;
+    pthread_cond_broadcast(&comp->cond);
+    pthread_mutex_unlock(&comp->lock);
+
+    return OMX_ErrorNone;
+}
+
+/***************************************************************************
+*   ilclient.
+****************************************************************************/
+
+ILCLIENT_T *ilclient_init(void)
+{
+    load_config();
+    return calloc(1, sizeof(ILCLIENT_T));
+}
+
+void ilclient_destroy(ILCLIENT_T *handle)
+{
+    free(handle);
+}
+
+void ilclient_set_port_settings_callback(ILCLIENT_T *handle, ILCLIENT_CALLBACK_T func, void *userdata)
+{
+    handle->port_settings = func;
+    handle->port_settings_data = userdata;
+}
+
+void ilclient_set_eos_callback(ILCLIENT_T *handle, ILCLIENT_CALLBACK_T func, void *userdata)
+{
+    handle->eos = func;
+    handle->eos_data = userdata;
+}
+
+void ilclient_set_error_callback(ILCLIENT_T *handle, ILCLIENT_CALLBACK_T func, void *userdata)
+{
+    handle->error = func;
+    handle->error_data = userdata;
+}
+
+void ilclient_set_empty_buffer_done_callback(ILCLIENT_T *handle, ILCLIENT_BUFFER_CALLBACK_T func, void *userdata)
+{
+    handle->empty_buffer_done = func;
+    handle->empty_buffer_done_data = userdata;
+}
+
+void ilclient_set_fill_buffer_done_callback(ILCLIENT_T *handle, ILCLIENT_BUFFER_CALLBACK_T func, void *userdata)
+{
+    handle->fill_buffer_done = func;
+    handle->fill_buffer_done_data = userdata;
+}
+
+static void init_port(stub_port *port, OMX_U32 index, OMX_DIRTYPE dir)
+{
+    memset(port, 0, sizeof(*port));
+    port->def.nSize = sizeof(port->def);
+    port->def.nVersion.nVersion = OMX_VERSION;
+    port->def.nPortIndex = index;
+    port->def.eDir = dir;
+    port->def.eDomain = OMX_PortDomainVideo;
+    port->def.nBufferCountMin = 1;
+    port->def.nBufferCountActual = 1;
+    port->def.bEnabled = OMX_TRUE;
+}
+
+int ilclient_create_component(ILCLIENT_T *handle, COMPONENT_T **comp, char *name, ILCLIENT_CREATE_FLAGS_T flags)
+{
+    COMPONENT_T *c = calloc(1, sizeof(COMPONENT_T));
+
+    if (!c) {
+        return -1;
+    }
+
+    snprintf(c->name, sizeof(c->name), "%s", name);
+    c->client = handle;
+    c->state = OMX_StateLoaded;
+    pthread_mutex_init(&c->lock, NULL);
+    pthread_cond_init(&c->cond, NULL);
+
+    if (strcmp(name, "video_decode") == 0) {
+        c->is_decoder = 1;
+        c->output_buffers = (flags & ILCLIENT_ENABLE_OUTPUT_BUFFERS) != 0;
+        c->num_ports = 2;
+        init_port(&c->ports[0], 130, OMX_DirInput);
+        init_port(&c->ports[1], 131, OMX_DirOutput);
+        c->ports[0].def.nBufferCountMin = 2;
+        c->ports[0].def.nBufferCountActual = config.input_buffers;
+        c->ports[0].def.nBufferSize = config.input_buffer_size;
+        c->ports[0].def.format.video.eCompressionFormat = OMX_VIDEO_CodingAVC;
+        c->ports[1].def.format.video.eColorFormat = OMX_COLOR_FormatYUV420PackedPlanar;
+    } else if (strcmp(name, "video_render") == 0) {
+        c->num_ports = 1;
+        init_port(&c->ports[0], 90, OMX_DirInput);
+    } else if (strcmp(name, "null_sink") == 0) {
+        c->num_ports = 1;
+        init_port(&c->ports[0], 240, OMX_DirInput);
+    } else {
+        fprintf(stderr, "vc_stub: unsupported component %s\n", name);
+        free(c);
+        *comp = NULL;
+        return -1;
+    }
+
+    if (c->is_decoder) {
+        pthread_create(&c->worker, NULL, component_worker, c);
+    }
+
+    *comp = c;
+
+    return 0;
+}
+
+void ilclient_cleanup_components(COMPONENT_T *list[])
+{
+    int i;
+
+    for (i = 0; list[i]; i++) {
+        COMPONENT_T *c = list[i];
+        stub_event *ev;
+
+        if (c->is_decoder) {
+            pthread_mutex_lock(&c->lock);
+            c->terminate = 1;
+            pthread_cond_broadcast(&c->cond);
+            pthread_mutex_unlock(&c->lock);
+            pthread_join(c->worker, NULL);
+        }
+
+        while ((ev = c->events)) {
+            c->events = ev->next;
+            free(ev);
+        }
+
+        int p;
+        for (p = 0; p < c->num_ports; p++) {
+            ilclient_disable_port_buffers(c, c->ports[p].def.nPortIndex, NULL, NULL, NULL);
+        }
+
+        pthread_mutex_destroy(&c->lock);
+        pthread_cond_destroy(&c->cond);
+        free(c);
+    }
+}
+
+int ilclient_change_component_state(COMPONENT_T *comp, OMX_STATETYPE state)
+{
+    if (!comp) {
+        return -1;
+    }
+
+    comp->state = state;
+
+    return 0;
+}
+
+void ilclient_state_transition(COMPONENT_T *list[], OMX_STATETYPE state)
+{
+    int i;
+
+    for (i = 0; list[i]; i++) {
+        ilclient_change_component_state(list[i], state);
+    }
+}
+
+void ilclient_disable_port(COMPONENT_T *comp, int portIndex)
+{
+    stub_port *port = find_port(comp, portIndex);
+
+    if (port) {
+        port->def.bEnabled = OMX_FALSE;
+    }
+}
+
+void ilclient_enable_port(COMPONENT_T *comp, int portIndex)
+{
+    stub_port *port = find_port(comp, portIndex);
+
+    if (port) {
+        port->def.bEnabled = OMX_TRUE;
+    }
+}
+
+int ilclient_enable_port_buffers(COMPONENT_T *comp, int portIndex, ILCLIENT_MALLOC_T ilclient_malloc,
+                                 ILCLIENT_FREE_T ilclient_free, void *userdata)
+{
+    stub_port *port = find_port(comp, portIndex);
+    int i;
+
+    if (!port || port->num_buffers) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&comp->lock);
+    for (i = 0; i < (int)port->def.nBufferCountActual; i++) {
+        OMX_BUFFERHEADERTYPE *buf = calloc(1, sizeof(OMX_BUFFERHEADERTYPE));
+
+        buf->nSize = sizeof(OMX_BUFFERHEADERTYPE);
+        buf->nVersion.nVersion = OMX_VERSION;
+        buf->nAllocLen = port->def.nBufferSize;
+        buf->pBuffer = malloc(buf->nAllocLen ? buf->nAllocLen : 1);
+        if (port->def.eDir == OMX_DirInput) {
+            buf->nInputPortIndex = portIndex;
+        } else {
+            buf->nOutputPortIndex = portIndex;
+        }
+
+        port->buffers[port->num_buffers++] = buf;
+        port->avail[port->num_avail++] = buf;
+    }
+    port->def.bPopulated = OMX_TRUE;
+    pthread_mutex_unlock(&comp->lock);
+
+    return 0;
+}
+
+void ilclient_disable_port_buffers(COMPONENT_T *comp, int portIndex, OMX_BUFFERHEADERTYPE *bufferList,
+                                   ILCLIENT_FREE_T ilclient_free, void *userdata)
+{
+    stub_port *port;
+    int i;
+
+    if (!comp || !(port = find_port(comp, portIndex))) {
+        return;
+    }
+
+    if (port->def.eDir == OMX_DirInput) {
+        flush_component(comp);
+    }
+
+    pthread_mutex_lock(&comp->lock);
+    if (port->def.eDir == OMX_DirOutput) {
+        comp->out_count = 0;
+    }
+    for (i = 0; i < port->num_buffers; i++) {
+        free(port->buffers[i]->pBuffer);
+        free(port->buffers[i]);
+    }
+    port->num_buffers = 0;
+    port->num_avail = 0;
+    port->def.bPopulated = OMX_FALSE;
+    pthread_mutex_unlock(&comp->lock);
+}
+
+int ilclient_setup_tunnel(TUNNEL_T *tunnel, unsigned int portStream, int timeout)
+{
+    if (!tunnel->source || !tunnel->sink) {
+        return -1;
+    }
+
+    if (timeout && ilclient_wait_for_event(tunnel->source, OMX_EventPortSettingsChanged, tunnel->source_port,
+                                           0, 0, 1, 0, timeout) != 0) {
+        return -1;
+    }
+
+    if (config.tunnel_fail) {
+        return -2;
+    }
+
+    tunnel->source->sink = tunnel->sink;
+
+    return 0;
+}
+
+void ilclient_disable_tunnel(TUNNEL_T *tunnel)
+{
+}
+
+int ilclient_enable_tunnel(TUNNEL_T *tunnel)
+{
+    return 0;
+}
+
+void ilclient_flush_tunnels(TUNNEL_T *tunnel, int max)
+{
+    int i;
+
+    for (i = 0; (max == 0 || i < max) && tunnel[i].source; i++) {
+        flush_component(tunnel[i].source);
+    }
+}
+
+void ilclient_teardown_tunnels(TUNNEL_T *tunnels)
+{
+    int i;
+
+    for (i = 0; tunnels[i].source; i++) {
+        tunnels[i].source->sink = NULL;
+        memset(&tunnels[i], 0, sizeof(TUNNEL_T));
+    }
+}
+
+OMX_HANDLETYPE ilclient_get_handle(COMPONENT_T *comp)
+{
+    return (OMX_HANDLETYPE)comp;
+}
+
+int ilclient_remove_event(COMPONENT_T *comp, OMX_EVENTTYPE event, OMX_U32 nData1, int ignore1,
+                          OMX_U32 nData2, int ignore2)
+{
+    int ret;
+
+    pthread_mutex_lock(&comp->lock);
+    ret = take_event(comp, event, nData1, ignore1, nData2, ignore2);
+    pthread_mutex_unlock(&comp->lock);
+
+    return ret;
+}
+
+int ilclient_wait_for_event(COMPONENT_T *comp, OMX_EVENTTYPE event, OMX_U32 nData1, int ignore1,
+                            OMX_U32 nData2, int ignore2, int event_flag, int suspend)
+{
+    struct timespec deadline;
+    int ret = -1;
+
+    if (suspend > 0) {
+        deadline_in(&deadline, suspend);
+    }
+
+    pthread_mutex_lock(&comp->lock);
+    for (;;) {
+        if (take_event(comp, event, nData1, ignore1, nData2, ignore2) == 0) {
+            ret = 0;
+            break;
+        }
+
+        if ((event_flag & ILCLIENT_EVENT_ERROR) && take_event(comp, OMX_EventError, 0, 1, 0, 1) == 0) {
+            ret = -2;
+            break;
+        }
+
+        if (suspend == 0) {
+            break;
+        }
+
+        if (suspend < 0) {
+            pthread_cond_wait(&comp->cond, &comp->lock);
+        } else if (pthread_cond_timedwait(&comp->cond, &comp->lock, &deadline) == ETIMEDOUT) {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&comp->lock);
+
+    return ret;
+}
+
+int ilclient_wait_for_command_complete(COMPONENT_T *comp, OMX_COMMANDTYPE command, OMX_U32 nData2)
+{
+    return ilclient_wait_for_event(comp, OMX_EventCmdComplete, command, 0, nData2, 0, ILCLIENT_EVENT_ERROR, -1);
+}
+
+static OMX_BUFFERHEADERTYPE *get_buffer(COMPONENT_T *comp, int portIndex, int block)
+{
+    stub_port *port = find_port(comp, portIndex);
+    OMX_BUFFERHEADERTYPE *buf = NULL;
+
+    if (!port) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&comp->lock);
+    while (port->num_avail == 0 && block && port->num_buffers) {
+        pthread_cond_wait(&comp->cond, &comp->lock);
+    }
+    if (port->num_avail) {
+        buf = port->avail[--port->num_avail];
+    }
+    pthread_mutex_unlock(&comp->lock);
+
+    return buf;
+}
+
+OMX_BUFFERHEADERTYPE *ilclient_get_input_buffer(COMPONENT_T *comp, int portIndex, int block)
+{
+    return get_buffer(comp, portIndex, block);
+}
+
+OMX_BUFFERHEADERTYPE *ilclient_get_output_buffer(COMPONENT_T *comp, int portIndex, int block)
+{
+    return get_buffer(comp, portIndex, block);
+}